@@ -1,29 +1,130 @@
 /*********************************************************************
- ** Program Filename: keygen.c 
+ ** Program Filename: keygen.c
  ** Author: Peter Nguyen
  ** Date: 3/14/16
  ** CS 344-400, Program 4
- ** Description: Outputs a key file of specified length
+ ** Description: Outputs a key file of specified length. With -s it
+ ** instead outputs a new seed file, and with -e the symbols of one
+ ** segment of a seed (otp_seed.h). Seed-derived keys are NOT one-time
+ ** pads: they are only as strong as ChaCha20 and the seed's secrecy.
+ ** With -d it runs as a pad service: a pool of pre-generated pad
+ ** segments (otp_padpool.h) is kept full by refill threads and each
+ ** -g on the local socket is issued a ready segment's path at once,
+ ** or by a thread of its own once one is ready.
  *********************************************************************/
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <signal.h>
 #include <time.h>
+#include <unistd.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "otp_seed.h"
+#include "otp_padpool.h"
 
 const int ASCII_A = 65;
 const int ASCII_Z = 90;
+const size_t EXPAND_CHUNK = 1 << 20;  // symbols written per expansion
+
+// Pad service defaults (see usage for the matching options)
+const int POOL_SEGMENTS = 8;        // segments kept ready
+const long POOL_SYMBOLS = 1L << 20; // symbols per segment
+const int POOL_WORKERS = 2;         // refill threads
+const int POOL_TAKE_MS = 30000;     // longest -g waits out a refill stall
+const int POOL_CLIENT_MS = 1000;    // for a client to send its command
+const int POOL_TAKERS = 64;         // -g requests being served at once
+
+// A -g request, served by a thread of its own
+struct poolRequest
+{
+  struct padPool* pool;
+  int clientfd;
+};
+
+int poolTakers = 0;  // takeThreads running, counted atomically
+
+// Function prototypes
+void error(const char *msg);
+void writeSeed();
+void expandSeed(char* seedPath, uint64_t segment, uint64_t offset,
+                long keyLength);
+void runPool(char* socketPath, char* poolDir, int segments, long symbols,
+             int workers);
+int askPool(char* socketPath, char command);
+int startTake(struct padPool* pool, int clientfd);
+void* takeThread(void* argument);
 
 int main(int argc, char* argv[])
 {
   int keyLength;
   int randChar;
+  int option,
+      makeSeed = 0,
+      segments = POOL_SEGMENTS,
+      workers = POOL_WORKERS;
+  long symbols = POOL_SYMBOLS;
+  char command = 0;
+  char *seedPath = NULL,
+       *socketPath = NULL,  // -d serves on it, -g and -q ask it
+       *poolDir = "pool";
+  uint64_t segment = 0,
+           offset = 0;
+
+  // Parse seed and pad service options
+  while ((option = getopt(argc, argv, "se:n:o:d:D:p:l:w:g:q:")) != -1)
+  {
+    switch (option)
+    {
+      case 's': makeSeed = 1; break;
+      case 'e': seedPath = optarg; break;
+      case 'n': segment = strtoull(optarg, NULL, 10); break;
+      case 'o': offset = strtoull(optarg, NULL, 10); break;
+      case 'd': socketPath = optarg; command = 'd'; break;
+      case 'g': socketPath = optarg; command = 'g'; break;
+      case 'q': socketPath = optarg; command = 'q'; break;
+      case 'D': poolDir = optarg; break;
+      case 'p': segments = atoi(optarg); break;
+      case 'l': symbols = atol(optarg); break;
+      case 'w': workers = atoi(optarg); break;
+      default:
+        fprintf(stderr, "usage: %s length\n"
+                "       %s -s > seedFile\n"
+                "       %s -e seedFile [-n segment] [-o offset] length\n"
+                "       %s -d socket [-D poolDir] [-p segments] "
+                "[-l length] [-w workers]\n"
+                "       %s -g socket | -q socket\n",
+                argv[0], argv[0], argv[0], argv[0], argv[0]);
+        exit(1);
+    }
+  }
+  if (makeSeed)
+  {
+    writeSeed();
+    return 0;
+  }
+  if (command == 'd')
+    runPool(socketPath, poolDir, segments, symbols, workers);
+  if (command != 0)
+    return askPool(socketPath, command);
 
   // Get key length from argv, else print error message
-  if (argc < 2)
+  if (argc - optind < 1)
+  {
     printf("error: key length must be specified\n");
+    exit(1);
+  }
   else
   {
-    keyLength = atoi(argv[1]);
+    keyLength = atoi(argv[optind]);
+  }
+
+  if (seedPath != NULL)
+  {
+    expandSeed(seedPath, segment, offset, keyLength);
+    return 0;
   }
 
   // Generate random char from 'A' to 'Z' + 1 (65 to 91)
@@ -38,7 +139,288 @@ int main(int argc, char* argv[])
       printf("%c", randChar);
   }
   printf("\n");
- 
+
   return 0;
 }
 
+/*********************************************************************
+ ** writeSeed
+ ** Description: Prints a new seed file: SEED_FILE_TAG and 32 random
+ ** bytes from the kernel in hex. Warns that its keys are not
+ ** one-time pads.
+ ** Parameters: none
+ *********************************************************************/
+void writeSeed()
+{
+  uint8_t key[SEED_KEY_BYTES];
+  int index;
+
+  if (getrandom(key, sizeof(key), 0) != sizeof(key))
+    error("ERROR reading random bytes");
+  fprintf(stderr, "warning: keys derived from a seed are a stream "
+          "cipher, not a one-time pad\n");
+  printf("%s", SEED_FILE_TAG);
+  for (index = 0; index < SEED_KEY_BYTES; index++)
+    printf("%02x", key[index]);
+  printf("\n");
+  memset(key, 0, sizeof(key));
+}
+
+/*********************************************************************
+ ** expandSeed
+ ** Description: Prints keyLength symbols of segment of the seed at
+ ** seedPath, from symbol offset on, and a newline: the same key a
+ ** daemon derives for a descriptor, usable as an ordinary key file.
+ ** Parameters: char* seedPath, uint64_t segment, uint64_t offset,
+ ** long keyLength
+ *********************************************************************/
+void expandSeed(char* seedPath, uint64_t segment, uint64_t offset,
+                long keyLength)
+{
+  struct seedKey seed;
+  uint8_t* buffer = malloc(EXPAND_CHUNK);
+  size_t count;
+
+  if (buffer == NULL)
+    error("ERROR allocating key buffer");
+  if (seedLoad(&seed, seedPath) < 0)
+    error("ERROR loading seed file");
+  while (keyLength > 0)
+  {
+    count = (size_t) keyLength < EXPAND_CHUNK ? (size_t) keyLength
+                                              : EXPAND_CHUNK;
+    if (seedExpand(&seed, segment, offset, buffer, count) < 0)
+      error("ERROR expanding seed segment");
+    fwrite(buffer, 1, count, stdout);
+    offset += count;
+    keyLength -= count;
+  }
+  printf("\n");
+  free(buffer);
+}
+
+/*********************************************************************
+ ** runPool
+ ** Description: Runs the pad service: keeps segments segments of
+ ** symbols symbols ready in poolDir with workers refill threads and
+ ** answers one command per connection on the unix socket at
+ ** socketPath. 'g' is handed to startTake, so a take waiting out a
+ ** refill stall never holds up the clients behind it; 'q' is told
+ ** the pool's counters at once. Does not return.
+ ** Parameters: char* socketPath, char* poolDir, int segments,
+ ** long symbols, int workers
+ *********************************************************************/
+void runPool(char* socketPath, char* poolDir, int segments, long symbols,
+             int workers)
+{
+  struct padPool pool;
+  struct sockaddr_un addr;
+  struct stat info;
+  pthread_t thread;
+  char reply[POOL_PATH_MAX + 64],
+       command;
+  char* fullDir;
+  int listenfd,
+      clientfd,
+      index;
+
+  if (segments < 1 || symbols < 1 || workers < 1)
+  {
+    fprintf(stderr, "ERROR, pool sizes must be positive\n");
+    exit(1);
+  }
+
+  // Pads and the socket that hands them out are the owner's alone
+  umask(077);
+  if (mkdir(poolDir, 0700) < 0 && errno != EEXIST)
+    error("ERROR creating pool directory");
+  fullDir = realpath(poolDir, NULL);  // issued paths work from anywhere
+  if (fullDir == NULL || poolOpen(&pool, fullDir, segments, symbols) < 0)
+  {
+    if (errno == EBUSY)
+    {
+      fprintf(stderr, "ERROR, %s is in use by another pad service\n",
+              poolDir);
+      exit(1);
+    }
+    error("ERROR opening pad pool");
+  }
+  for (index = 0; index < workers; index++)
+  {
+    errno = pthread_create(&thread, NULL, poolRefill, &pool);
+    if (errno != 0)
+      error("ERROR starting refill thread");
+  }
+  signal(SIGPIPE, SIG_IGN);
+
+  listenfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (listenfd < 0 || strlen(socketPath) >= sizeof(addr.sun_path))
+    error("ERROR opening pool socket");
+  strcpy(addr.sun_path, socketPath);
+  // Replace the socket of an earlier run, but never any other file
+  if (lstat(socketPath, &info) == 0 && S_ISSOCK(info.st_mode))
+    unlink(socketPath);
+  if (bind(listenfd, (struct sockaddr*) &addr, sizeof(addr)) < 0 ||
+      listen(listenfd, SOMAXCONN) < 0)
+    error("ERROR binding pool socket");
+  fprintf(stderr, "serving %d segments of %ld symbols from %s\n", segments,
+          symbols, fullDir);
+
+  while (1)
+  {
+    clientfd = accept(listenfd, NULL, NULL);
+    if (clientfd < 0)
+    {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      error("ERROR on accept");
+    }
+    if (netWait(clientfd, POLLIN, netDeadline(POOL_CLIENT_MS)) < 0 ||
+        read(clientfd, &command, 1) != 1)
+    {
+      close(clientfd);
+      continue;
+    }
+
+    if (command == 'g')
+    {
+      if (startTake(&pool, clientfd) == 0)
+        continue;  // the thread replies and closes clientfd
+      snprintf(reply, sizeof(reply), "ERROR %s\n", strerror(errno));
+    }
+    else if (command == 'q')
+      poolStats(&pool, reply, sizeof(reply));
+    else
+      snprintf(reply, sizeof(reply), "ERROR unknown command\n");
+    writeFull(clientfd, reply, strlen(reply), netDeadline(POOL_CLIENT_MS));
+    close(clientfd);
+  }
+}
+
+/*********************************************************************
+ ** startTake
+ ** Description: Starts a thread that issues a ready segment to the
+ ** client on clientfd and closes it, unless POOL_TAKERS are already
+ ** running. Returns 0, or -1 with errno set (EBUSY if there were too
+ ** many); clientfd is then still the caller's.
+ ** Parameters: struct padPool* pool, int clientfd
+ *********************************************************************/
+int startTake(struct padPool* pool, int clientfd)
+{
+  struct poolRequest* request;
+  pthread_attr_t attributes;
+  pthread_t thread;
+  int status;
+
+  if (__atomic_add_fetch(&poolTakers, 1, __ATOMIC_RELAXED) > POOL_TAKERS)
+  {
+    __atomic_sub_fetch(&poolTakers, 1, __ATOMIC_RELAXED);
+    errno = EBUSY;
+    return -1;
+  }
+  request = malloc(sizeof(struct poolRequest));
+  if (request == NULL)
+  {
+    __atomic_sub_fetch(&poolTakers, 1, __ATOMIC_RELAXED);
+    return -1;
+  }
+  request->pool = pool;
+  request->clientfd = clientfd;
+
+  pthread_attr_init(&attributes);
+  pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+  status = pthread_create(&thread, &attributes, takeThread, request);
+  pthread_attr_destroy(&attributes);
+  if (status != 0)
+  {
+    free(request);
+    __atomic_sub_fetch(&poolTakers, 1, __ATOMIC_RELAXED);
+    errno = status;
+    return -1;
+  }
+  return 0;
+}
+
+/*********************************************************************
+ ** takeThread
+ ** Description: Body of a take thread: issues the oldest ready
+ ** segment, waiting up to POOL_TAKE_MS through a refill stall, and
+ ** tells the client its path and length. A client that hangs up
+ ** before reading its reply loses the segment, which is never issued
+ ** again.
+ ** Parameters: void* argument, the struct poolRequest
+ *********************************************************************/
+void* takeThread(void* argument)
+{
+  struct poolRequest* request = argument;
+  char path[POOL_PATH_MAX],
+       reply[POOL_PATH_MAX + 64];
+
+  if (poolTake(request->pool, POOL_TAKE_MS, path) < 0)
+    snprintf(reply, sizeof(reply), "ERROR %s\n", strerror(errno));
+  else
+    snprintf(reply, sizeof(reply), "%s %ld\n", path,
+             request->pool->segmentSymbols);
+  writeFull(request->clientfd, reply, strlen(reply),
+            netDeadline(POOL_CLIENT_MS));
+  close(request->clientfd);
+  free(request);
+  __atomic_sub_fetch(&poolTakers, 1, __ATOMIC_RELAXED);
+  return NULL;
+}
+
+/*********************************************************************
+ ** askPool
+ ** Description: Sends command ('g' or 'q') to the pad service at
+ ** socketPath and prints its reply: the issued segment's path and
+ ** length, or the pool's counters. Returns 0, or 1 if the service
+ ** reported an error or could not be reached.
+ ** Parameters: char* socketPath, char command
+ *********************************************************************/
+int askPool(char* socketPath, char command)
+{
+  struct sockaddr_un addr;
+  char reply[POOL_PATH_MAX + 64];
+  ssize_t got;
+  size_t length = 0;
+  int sockfd;
+
+  sockfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (sockfd < 0 || strlen(socketPath) >= sizeof(addr.sun_path))
+    error("ERROR opening pool socket");
+  strcpy(addr.sun_path, socketPath);
+  if (connect(sockfd, (struct sockaddr*) &addr, sizeof(addr)) < 0)
+    error("ERROR connecting to pad service");
+  if (write(sockfd, &command, 1) != 1)
+    error("ERROR writing to pad service");
+
+  // The reply is one line, then the service hangs up
+  while (length < sizeof(reply) - 1 &&
+         (got = read(sockfd, reply + length, sizeof(reply) - 1 - length)) > 0)
+    length += got;
+  reply[length] = '\0';
+  close(sockfd);
+
+  if (length == 0 || strncmp(reply, "ERROR", 5) == 0)
+  {
+    fprintf(stderr, "%s", length > 0 ? reply : "ERROR no reply\n");
+    return 1;
+  }
+  printf("%s", reply);
+  return 0;
+}
+
+/*********************************************************************
+ ** error
+ ** Description: Displays an error message
+ ** Parameters: const char *msg
+ *********************************************************************/
+void error(const char *msg)
+{
+  perror(msg);
+  exit(1);
+}
@@ -0,0 +1,154 @@
+/*********************************************************************
+ ** Program Filename: otp_arena.h
+ ** Author: Peter Nguyen
+ ** Date: 10/19/26
+ ** CS 344-400, Program 4
+ ** Description: Per-request arena for the daemons. Request buffers
+ ** are carved out of one block sized by the lengths the client
+ ** declares, and the arena is reset rather than freed between
+ ** requests. When a request does not fit, a spill block is added;
+ ** the next reset folds everything into a single block large enough
+ ** for that request, so a server in steady state stops touching the
+ ** heap. The allocation counter makes that visible.
+ *********************************************************************/
+
+#ifndef OTP_ARENA_H
+#define OTP_ARENA_H
+
+#include <stdlib.h>
+#include <string.h>
+
+static const size_t ARENA_ALIGN = 64;  // keep buffers cache-line aligned
+
+// Extra block used when the main block is full, kept in a list
+struct arenaSpill
+{
+  struct arenaSpill* next;
+  size_t size;
+};
+
+struct arena
+{
+  char* base;               // main block
+  size_t capacity,
+         used,
+         spilled;           // bytes handed out from spill blocks
+  struct arenaSpill* spills;
+  unsigned long allocations,  // calls into malloc since arenaInit
+                resets;
+};
+
+/*********************************************************************
+ ** arenaInit
+ ** Description: Prepares an arena with room for capacity bytes. A
+ ** capacity of 0 defers the first allocation to the first request.
+ ** Returns 0, or -1 if out of memory.
+ ** Parameters: struct arena* arena, size_t capacity
+ *********************************************************************/
+static inline int arenaInit(struct arena* arena, size_t capacity)
+{
+  memset(arena, 0, sizeof(*arena));
+  if (capacity == 0)
+    return 0;
+
+  if (posix_memalign((void**) &arena->base, ARENA_ALIGN, capacity) != 0)
+    return -1;
+  arena->capacity = capacity;
+  arena->allocations++;
+  return 0;
+}
+
+/*********************************************************************
+ ** arenaAlloc
+ ** Description: Returns size bytes from the arena, or NULL if out of
+ ** memory. The memory is not zeroed.
+ ** Parameters: struct arena* arena, size_t size
+ *********************************************************************/
+static inline void* arenaAlloc(struct arena* arena, size_t size)
+{
+  struct arenaSpill* spill;
+  void* block;
+
+  size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+  if (arena->used + size <= arena->capacity)
+  {
+    block = arena->base + arena->used;
+    arena->used += size;
+    return block;
+  }
+
+  // Does not fit: take a spill block, merged into base on reset
+  if (posix_memalign(&block, ARENA_ALIGN, ARENA_ALIGN + size) != 0)
+    return NULL;
+  spill = block;
+  spill->next = arena->spills;
+  spill->size = size;
+  arena->spills = spill;
+  arena->spilled += size;
+  arena->allocations++;
+  return (char*) block + ARENA_ALIGN;
+}
+
+/*********************************************************************
+ ** arenaReset
+ ** Description: Releases everything handed out since the last reset.
+ ** If the last request spilled, the main block is replaced by one
+ ** that holds the whole request, so the next one of that size needs
+ ** no allocation. Returns 0, or -1 if the larger block could not be
+ ** allocated (the arena then stays usable at its old size).
+ ** Parameters: struct arena* arena
+ *********************************************************************/
+static inline int arenaReset(struct arena* arena)
+{
+  struct arenaSpill* spill;
+  size_t wanted = arena->used + arena->spilled;
+  char* grown;
+  int status = 0;
+
+  while (arena->spills != NULL)
+  {
+    spill = arena->spills;
+    arena->spills = spill->next;
+    free(spill);
+  }
+
+  if (wanted > arena->capacity)
+  {
+    if (posix_memalign((void**) &grown, ARENA_ALIGN, wanted) == 0)
+    {
+      free(arena->base);
+      arena->base = grown;
+      arena->capacity = wanted;
+      arena->allocations++;
+    }
+    else
+      status = -1;
+  }
+
+  arena->used = 0;
+  arena->spilled = 0;
+  arena->resets++;
+  return status;
+}
+
+/*********************************************************************
+ ** arenaFree
+ ** Description: Returns all of the arena's memory to the heap
+ ** Parameters: struct arena* arena
+ *********************************************************************/
+static inline void arenaFree(struct arena* arena)
+{
+  struct arenaSpill* spill;
+
+  while (arena->spills != NULL)
+  {
+    spill = arena->spills;
+    arena->spills = spill->next;
+    free(spill);
+  }
+  free(arena->base);
+  memset(arena, 0, sizeof(*arena));
+}
+
+#endif
@@ -0,0 +1,854 @@
+/*********************************************************************
+ ** Program Filename: otp_cipher.h
+ ** Author: Peter Nguyen
+ ** Date: 10/19/26
+ ** CS 344-400, Program 4
+ ** Description: Cipher engines for the 27-symbol one-time pad. Every
+ ** engine maps n bytes of 'A'-'Z'/space text and key to n bytes of
+ ** output, (in + key) mod 27 to encrypt and (in - key) mod 27 to
+ ** decrypt, with space standing for 26. Engines are registered in
+ ** cipherEngines, the fastest one the CPU supports is chosen at
+ ** startup (or one is forced by name), and cipherSelfTest checks
+ ** every engine against the scalar reference first. Each engine also
+ ** has a validator that finds the first byte outside the alphabet,
+ ** the bytes every engine must agree on; symbolsFindInvalid runs the
+ ** fastest one. A newline is outside it: callers whose data ends in
+ ** one leave that byte out of the check.
+ *********************************************************************/
+
+#ifndef OTP_CIPHER_H
+#define OTP_CIPHER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define OTP_CIPHER_X86 1
+#endif
+
+typedef void (*cipherFn)(const uint8_t* in, const uint8_t* key,
+                         uint8_t* out, size_t n);
+typedef size_t (*cipherScanFn)(const uint8_t* in, size_t n);
+
+struct cipherEngine
+{
+  const char* name;
+  int (*supported)(void);
+  cipherFn encrypt;
+  cipherFn decrypt;
+  cipherScanFn findInvalid;
+  int failed;           // set when the self-test disagrees with scalar
+};
+
+/******** Scalar reference ********/
+
+/*********************************************************************
+ ** symbolValue
+ ** Description: Converts 'A'-'Z' to 0-25 and space to 26
+ ** Parameters: uint8_t c
+ *********************************************************************/
+static inline int symbolValue(uint8_t c)
+{
+  return c == ' ' ? 26 : c - 'A';
+}
+
+/*********************************************************************
+ ** symbolChar
+ ** Description: Converts 0-25 to 'A'-'Z' and 26 to space
+ ** Parameters: int value
+ *********************************************************************/
+static inline uint8_t symbolChar(int value)
+{
+  return value == 26 ? ' ' : 'A' + value;
+}
+
+/*********************************************************************
+ ** scalarEncrypt
+ ** Description: Encrypts n bytes one symbol at a time; the reference
+ ** every other engine is checked against
+ ** Parameters: const uint8_t* in, const uint8_t* key, uint8_t* out,
+ ** size_t n
+ *********************************************************************/
+static inline void scalarEncrypt(const uint8_t* in, const uint8_t* key,
+                                 uint8_t* out, size_t n)
+{
+  size_t index;
+
+  for (index = 0; index < n; index++)
+    out[index] = symbolChar((symbolValue(in[index]) +
+                             symbolValue(key[index])) % 27);
+}
+
+/*********************************************************************
+ ** scalarDecrypt
+ ** Description: Decrypts n bytes one symbol at a time; the reference
+ ** every other engine is checked against
+ ** Parameters: const uint8_t* in, const uint8_t* key, uint8_t* out,
+ ** size_t n
+ *********************************************************************/
+static inline void scalarDecrypt(const uint8_t* in, const uint8_t* key,
+                                 uint8_t* out, size_t n)
+{
+  size_t index;
+
+  for (index = 0; index < n; index++)
+    out[index] = symbolChar((symbolValue(in[index]) -
+                             symbolValue(key[index]) + 27) % 27);
+}
+
+/*********************************************************************
+ ** symbolValid
+ ** Description: Returns 1 for 'A'-'Z' and space, 0 for any other
+ ** byte (newline included: the engines disagree on it)
+ ** Parameters: uint8_t c
+ *********************************************************************/
+static inline int symbolValid(uint8_t c)
+{
+  return (uint8_t) (c - 'A') < 26 || c == ' ';
+}
+
+/*********************************************************************
+ ** scalarFindInvalid
+ ** Description: Returns the offset of the first of n bytes that is
+ ** not valid (see symbolValid), or n if all are; the reference every
+ ** other validator is checked against
+ ** Parameters: const uint8_t* in, size_t n
+ *********************************************************************/
+static inline size_t scalarFindInvalid(const uint8_t* in, size_t n)
+{
+  size_t index;
+
+  for (index = 0; index < n && symbolValid(in[index]); index++)
+    ;
+  return index;
+}
+
+static inline int alwaysSupported(void)
+{
+  return 1;
+}
+
+/******** Table lookup ********/
+
+// symbolTable maps a byte to its value; sumTable maps a value sum
+// (decrypt: difference + 27) of 0-53 back to a character; validTable
+// is 1 for valid bytes
+static uint8_t symbolTable[256];
+static uint8_t sumTable[54];
+static uint8_t validTable[256];
+
+/*********************************************************************
+ ** tableInit
+ ** Description: Fills the lookup tables once
+ ** Parameters: none
+ *********************************************************************/
+static inline void tableInit(void)
+{
+  int index,
+      value;
+
+  if (sumTable[0] != 0)
+    return;
+  // Bytes outside the alphabet count as 'A': callers that skip
+  // symbolsFindInvalid would otherwise index past sumTable
+  for (index = 0; index < 256; index++)
+  {
+    value = symbolValue(index);
+    symbolTable[index] = value >= 0 && value <= 26 ? value : 0;
+    validTable[index] = symbolValid(index);
+  }
+  for (index = 0; index < 54; index++)
+    sumTable[index] = symbolChar(index % 27);
+}
+
+/*********************************************************************
+ ** tableEncrypt
+ ** Description: Encrypts n bytes with a byte-to-value table and a
+ ** sum-to-character table, no branches
+ ** Parameters: const uint8_t* in, const uint8_t* key, uint8_t* out,
+ ** size_t n
+ *********************************************************************/
+static inline void tableEncrypt(const uint8_t* in, const uint8_t* key,
+                                uint8_t* out, size_t n)
+{
+  size_t index;
+
+  tableInit();
+  for (index = 0; index < n; index++)
+    out[index] = sumTable[symbolTable[in[index]] + symbolTable[key[index]]];
+}
+
+/*********************************************************************
+ ** tableDecrypt
+ ** Description: Decrypts n bytes with a byte-to-value table and a
+ ** sum-to-character table, no branches
+ ** Parameters: const uint8_t* in, const uint8_t* key, uint8_t* out,
+ ** size_t n
+ *********************************************************************/
+static inline void tableDecrypt(const uint8_t* in, const uint8_t* key,
+                                uint8_t* out, size_t n)
+{
+  size_t index;
+
+  tableInit();
+  for (index = 0; index < n; index++)
+    out[index] = sumTable[symbolTable[in[index]] + 27 -
+                          symbolTable[key[index]]];
+}
+
+/*********************************************************************
+ ** tableFindInvalid
+ ** Description: Finds the first invalid byte with a lookup table
+ ** Parameters: const uint8_t* in, size_t n
+ *********************************************************************/
+static inline size_t tableFindInvalid(const uint8_t* in, size_t n)
+{
+  size_t index;
+
+  tableInit();
+  for (index = 0; index < n && validTable[in[index]]; index++)
+    ;
+  return index;
+}
+
+/******** Packed: 8 symbols per 64-bit word (SWAR) ********/
+
+#define PACKED_ONES 0x0101010101010101ULL
+#define PACKED_HIGH 0x8080808080808080ULL
+#define PACKED_LOW7 0x7F7F7F7F7F7F7F7FULL
+
+/*********************************************************************
+ ** packedEqual
+ ** Description: Returns 0xFF in every byte of word that equals c and
+ ** 0x00 elsewhere. All bytes must be below 0x80.
+ ** Parameters: uint64_t word, uint8_t c
+ *********************************************************************/
+static inline uint64_t packedEqual(uint64_t word, uint8_t c)
+{
+  uint64_t diff = word ^ (PACKED_ONES * c),
+           nonZero = (((diff & PACKED_LOW7) + PACKED_LOW7) | diff) &
+                     PACKED_HIGH;
+
+  return ((nonZero ^ PACKED_HIGH) >> 7) * 0xFF;
+}
+
+/*********************************************************************
+ ** packedValues
+ ** Description: Converts 8 characters to 8 symbol values at once
+ ** Parameters: uint64_t word
+ *********************************************************************/
+static inline uint64_t packedValues(uint64_t word)
+{
+  uint64_t space = packedEqual(word, ' ');
+
+  // Letters are at least 'A', so no byte borrows from its neighbour
+  return ((word & ~space) - (PACKED_ONES * 'A' & ~space)) |
+         (PACKED_ONES * 26 & space);
+}
+
+/*********************************************************************
+ ** packedFinish
+ ** Description: Reduces 8 sums of 0-53 mod 27 and converts them back
+ ** to characters
+ ** Parameters: uint64_t sum
+ *********************************************************************/
+static inline uint64_t packedFinish(uint64_t sum)
+{
+  uint64_t wrap = (((sum + PACKED_ONES * (128 - 27)) & PACKED_HIGH) >> 7) *
+                  0xFF,
+           space;
+
+  sum -= PACKED_ONES * 27 & wrap;
+  space = packedEqual(sum, 26);
+  return ((sum + PACKED_ONES * 'A') & ~space) | (PACKED_ONES * ' ' & space);
+}
+
+/*********************************************************************
+ ** packedFindInvalid
+ ** Description: Checks 8 bytes per 64-bit word: with no high bit set,
+ ** adding 128 - 'A' (and 128 - 'Z' - 1) sets a byte's high bit
+ ** exactly when it is at least 'A' (past 'Z'), without carries. The
+ ** word holding the first invalid byte is searched with scalar.
+ ** Parameters: const uint8_t* in, size_t n
+ *********************************************************************/
+static inline size_t packedFindInvalid(const uint8_t* in, size_t n)
+{
+  uint64_t word,
+           valid;
+  size_t index;
+
+  for (index = 0; index + 8 <= n; index += 8)
+  {
+    memcpy(&word, in + index, 8);
+    if (word & PACKED_HIGH)
+      break;
+    valid = ((word + PACKED_ONES * (128 - 'A')) &
+             ~(word + PACKED_ONES * (128 - 'Z' - 1))) |
+            packedEqual(word, ' ');
+    if ((valid & PACKED_HIGH) != PACKED_HIGH)
+      break;
+  }
+  return index + scalarFindInvalid(in + index, n - index);
+}
+
+/*********************************************************************
+ ** packedEncrypt
+ ** Description: Encrypts n bytes eight symbols per 64-bit word with
+ ** SWAR arithmetic, then the tail with scalar
+ ** Parameters: const uint8_t* in, const uint8_t* key, uint8_t* out,
+ ** size_t n
+ *********************************************************************/
+static inline void packedEncrypt(const uint8_t* in, const uint8_t* key,
+                                 uint8_t* out, size_t n)
+{
+  uint64_t text,
+           pad;
+  size_t index;
+
+  for (index = 0; index + 8 <= n; index += 8)
+  {
+    memcpy(&text, in + index, 8);
+    memcpy(&pad, key + index, 8);
+    text = packedFinish(packedValues(text) + packedValues(pad));
+    memcpy(out + index, &text, 8);
+  }
+  scalarEncrypt(in + index, key + index, out + index, n - index);
+}
+
+/*********************************************************************
+ ** packedDecrypt
+ ** Description: Decrypts n bytes eight symbols per 64-bit word with
+ ** SWAR arithmetic, then the tail with scalar
+ ** Parameters: const uint8_t* in, const uint8_t* key, uint8_t* out,
+ ** size_t n
+ *********************************************************************/
+static inline void packedDecrypt(const uint8_t* in, const uint8_t* key,
+                                 uint8_t* out, size_t n)
+{
+  uint64_t text,
+           pad;
+  size_t index;
+
+  for (index = 0; index + 8 <= n; index += 8)
+  {
+    memcpy(&text, in + index, 8);
+    memcpy(&pad, key + index, 8);
+    text = packedFinish(packedValues(text) + PACKED_ONES * 27 -
+                        packedValues(pad));
+    memcpy(out + index, &text, 8);
+  }
+  scalarDecrypt(in + index, key + index, out + index, n - index);
+}
+
+#ifdef OTP_CIPHER_X86
+
+/******** SSE2: 16 symbols per step ********/
+
+__attribute__((target("sse2")))
+static inline __m128i sse2Values(__m128i chars)
+{
+  __m128i space = _mm_cmpeq_epi8(chars, _mm_set1_epi8(' '));
+
+  return _mm_or_si128(_mm_and_si128(space, _mm_set1_epi8(26)),
+                      _mm_andnot_si128(space,
+                                       _mm_sub_epi8(chars,
+                                                    _mm_set1_epi8('A'))));
+}
+
+__attribute__((target("sse2")))
+static inline __m128i sse2Finish(__m128i sum)
+{
+  __m128i wrap = _mm_cmpgt_epi8(sum, _mm_set1_epi8(26)),
+          space;
+
+  sum = _mm_sub_epi8(sum, _mm_and_si128(wrap, _mm_set1_epi8(27)));
+  space = _mm_cmpeq_epi8(sum, _mm_set1_epi8(26));
+  return _mm_or_si128(_mm_and_si128(space, _mm_set1_epi8(' ')),
+                      _mm_andnot_si128(space,
+                                       _mm_add_epi8(sum,
+                                                    _mm_set1_epi8('A'))));
+}
+
+/*********************************************************************
+ ** sse2Encrypt
+ ** Description: Encrypts n bytes 16 symbols per step, then the tail
+ ** with scalar
+ ** Parameters: const uint8_t* in, const uint8_t* key, uint8_t* out,
+ ** size_t n
+ *********************************************************************/
+__attribute__((target("sse2")))
+static inline void sse2Encrypt(const uint8_t* in, const uint8_t* key,
+                               uint8_t* out, size_t n)
+{
+  __m128i text,
+          pad;
+  size_t index;
+
+  for (index = 0; index + 16 <= n; index += 16)
+  {
+    text = _mm_loadu_si128((const __m128i*) (in + index));
+    pad = _mm_loadu_si128((const __m128i*) (key + index));
+    text = sse2Finish(_mm_add_epi8(sse2Values(text), sse2Values(pad)));
+    _mm_storeu_si128((__m128i*) (out + index), text);
+  }
+  scalarEncrypt(in + index, key + index, out + index, n - index);
+}
+
+/*********************************************************************
+ ** sse2Decrypt
+ ** Description: Decrypts n bytes 16 symbols per step, then the tail
+ ** with scalar
+ ** Parameters: const uint8_t* in, const uint8_t* key, uint8_t* out,
+ ** size_t n
+ *********************************************************************/
+__attribute__((target("sse2")))
+static inline void sse2Decrypt(const uint8_t* in, const uint8_t* key,
+                               uint8_t* out, size_t n)
+{
+  __m128i text,
+          pad;
+  size_t index;
+
+  for (index = 0; index + 16 <= n; index += 16)
+  {
+    text = _mm_loadu_si128((const __m128i*) (in + index));
+    pad = _mm_loadu_si128((const __m128i*) (key + index));
+    text = _mm_add_epi8(sse2Values(text), _mm_set1_epi8(27));
+    text = sse2Finish(_mm_sub_epi8(text, sse2Values(pad)));
+    _mm_storeu_si128((__m128i*) (out + index), text);
+  }
+  scalarDecrypt(in + index, key + index, out + index, n - index);
+}
+
+__attribute__((target("sse2")))
+static inline int sse2Valid(__m128i chars)
+{
+  __m128i letter = _mm_sub_epi8(chars, _mm_set1_epi8('A')),
+          valid;
+
+  // Unsigned letter <= 25 holds exactly for 'A'-'Z'
+  valid = _mm_cmpeq_epi8(_mm_min_epu8(letter, _mm_set1_epi8(25)), letter);
+  valid = _mm_or_si128(valid, _mm_cmpeq_epi8(chars, _mm_set1_epi8(' ')));
+  return _mm_movemask_epi8(valid);
+}
+
+/*********************************************************************
+ ** sse2FindInvalid
+ ** Description: Checks 32 bytes per step, two 16-byte range checks
+ ** with one branch, then the tail with scalar
+ ** Parameters: const uint8_t* in, size_t n
+ *********************************************************************/
+__attribute__((target("sse2")))
+static inline size_t sse2FindInvalid(const uint8_t* in, size_t n)
+{
+  uint32_t valid;
+  size_t index;
+
+  for (index = 0; index + 32 <= n; index += 32)
+  {
+    valid = sse2Valid(_mm_loadu_si128((const __m128i*) (in + index))) |
+            (uint32_t) sse2Valid(_mm_loadu_si128((const __m128i*)
+                                                 (in + index + 16))) << 16;
+    if (valid != 0xFFFFFFFFu)
+      return index + __builtin_ctz(~valid);
+  }
+  return index + scalarFindInvalid(in + index, n - index);
+}
+
+static inline int sse2Supported(void)
+{
+  return __builtin_cpu_supports("sse2");
+}
+
+/******** AVX2: 32 symbols per step ********/
+
+__attribute__((target("avx2")))
+static inline __m256i avx2Values(__m256i chars)
+{
+  __m256i space = _mm256_cmpeq_epi8(chars, _mm256_set1_epi8(' '));
+
+  return _mm256_blendv_epi8(_mm256_sub_epi8(chars, _mm256_set1_epi8('A')),
+                            _mm256_set1_epi8(26), space);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i avx2Finish(__m256i sum)
+{
+  __m256i wrap = _mm256_cmpgt_epi8(sum, _mm256_set1_epi8(26));
+
+  sum = _mm256_sub_epi8(sum, _mm256_and_si256(wrap, _mm256_set1_epi8(27)));
+  return _mm256_blendv_epi8(_mm256_add_epi8(sum, _mm256_set1_epi8('A')),
+                            _mm256_set1_epi8(' '),
+                            _mm256_cmpeq_epi8(sum, _mm256_set1_epi8(26)));
+}
+
+/*********************************************************************
+ ** avx2Encrypt
+ ** Description: Encrypts n bytes 32 symbols per step, then the tail
+ ** with sse2
+ ** Parameters: const uint8_t* in, const uint8_t* key, uint8_t* out,
+ ** size_t n
+ *********************************************************************/
+__attribute__((target("avx2")))
+static inline void avx2Encrypt(const uint8_t* in, const uint8_t* key,
+                               uint8_t* out, size_t n)
+{
+  __m256i text,
+          pad;
+  size_t index;
+
+  for (index = 0; index + 32 <= n; index += 32)
+  {
+    text = _mm256_loadu_si256((const __m256i*) (in + index));
+    pad = _mm256_loadu_si256((const __m256i*) (key + index));
+    text = avx2Finish(_mm256_add_epi8(avx2Values(text), avx2Values(pad)));
+    _mm256_storeu_si256((__m256i*) (out + index), text);
+  }
+  sse2Encrypt(in + index, key + index, out + index, n - index);
+}
+
+/*********************************************************************
+ ** avx2Decrypt
+ ** Description: Decrypts n bytes 32 symbols per step, then the tail
+ ** with sse2
+ ** Parameters: const uint8_t* in, const uint8_t* key, uint8_t* out,
+ ** size_t n
+ *********************************************************************/
+__attribute__((target("avx2")))
+static inline void avx2Decrypt(const uint8_t* in, const uint8_t* key,
+                               uint8_t* out, size_t n)
+{
+  __m256i text,
+          pad;
+  size_t index;
+
+  for (index = 0; index + 32 <= n; index += 32)
+  {
+    text = _mm256_loadu_si256((const __m256i*) (in + index));
+    pad = _mm256_loadu_si256((const __m256i*) (key + index));
+    text = _mm256_add_epi8(avx2Values(text), _mm256_set1_epi8(27));
+    text = avx2Finish(_mm256_sub_epi8(text, avx2Values(pad)));
+    _mm256_storeu_si256((__m256i*) (out + index), text);
+  }
+  sse2Decrypt(in + index, key + index, out + index, n - index);
+}
+
+__attribute__((target("avx2")))
+static inline uint32_t avx2Valid(__m256i chars)
+{
+  __m256i letter = _mm256_sub_epi8(chars, _mm256_set1_epi8('A')),
+          valid;
+
+  valid = _mm256_cmpeq_epi8(_mm256_min_epu8(letter, _mm256_set1_epi8(25)),
+                            letter);
+  valid = _mm256_or_si256(valid, _mm256_cmpeq_epi8(chars,
+                                                   _mm256_set1_epi8(' ')));
+  return _mm256_movemask_epi8(valid);
+}
+
+/*********************************************************************
+ ** avx2FindInvalid
+ ** Description: Checks 64 bytes per step, two 32-byte range checks
+ ** with one branch, then the tail with sse2
+ ** Parameters: const uint8_t* in, size_t n
+ *********************************************************************/
+__attribute__((target("avx2")))
+static inline size_t avx2FindInvalid(const uint8_t* in, size_t n)
+{
+  uint64_t valid;
+  size_t index;
+
+  for (index = 0; index + 64 <= n; index += 64)
+  {
+    valid = avx2Valid(_mm256_loadu_si256((const __m256i*) (in + index))) |
+            (uint64_t) avx2Valid(_mm256_loadu_si256((const __m256i*)
+                                                    (in + index + 32))) << 32;
+    if (valid != ~0ULL)
+      return index + __builtin_ctzll(~valid);
+  }
+  return index + sse2FindInvalid(in + index, n - index);
+}
+
+static inline int avx2Supported(void)
+{
+  return __builtin_cpu_supports("avx2");
+}
+
+/******** AVX-512: 64 symbols per step, masked tail ********/
+
+__attribute__((target("avx512f,avx512bw")))
+static inline __m512i avx512Values(__m512i chars)
+{
+  __mmask64 space = _mm512_cmpeq_epi8_mask(chars, _mm512_set1_epi8(' '));
+
+  return _mm512_mask_blend_epi8(space,
+                                _mm512_sub_epi8(chars,
+                                                _mm512_set1_epi8('A')),
+                                _mm512_set1_epi8(26));
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static inline __m512i avx512Finish(__m512i sum)
+{
+  __mmask64 wrap = _mm512_cmpgt_epi8_mask(sum, _mm512_set1_epi8(26));
+
+  sum = _mm512_mask_sub_epi8(sum, wrap, sum, _mm512_set1_epi8(27));
+  return _mm512_mask_blend_epi8(_mm512_cmpeq_epi8_mask(sum,
+                                                       _mm512_set1_epi8(26)),
+                                _mm512_add_epi8(sum, _mm512_set1_epi8('A')),
+                                _mm512_set1_epi8(' '));
+}
+
+/*********************************************************************
+ ** avx512Encrypt
+ ** Description: Encrypts n bytes 64 symbols per step, with a masked
+ ** final step
+ ** Parameters: const uint8_t* in, const uint8_t* key, uint8_t* out,
+ ** size_t n
+ *********************************************************************/
+__attribute__((target("avx512f,avx512bw")))
+static inline void avx512Encrypt(const uint8_t* in, const uint8_t* key,
+                                 uint8_t* out, size_t n)
+{
+  __m512i text,
+          pad;
+  __mmask64 lanes = ~0ULL;
+  size_t index;
+
+  for (index = 0; index < n; index += 64)
+  {
+    // The last step only touches the bytes that are left
+    if (n - index < 64)
+      lanes = (1ULL << (n - index)) - 1;
+    text = _mm512_maskz_loadu_epi8(lanes, in + index);
+    pad = _mm512_maskz_loadu_epi8(lanes, key + index);
+    text = avx512Finish(_mm512_add_epi8(avx512Values(text),
+                                        avx512Values(pad)));
+    _mm512_mask_storeu_epi8(out + index, lanes, text);
+  }
+}
+
+/*********************************************************************
+ ** avx512Decrypt
+ ** Description: Decrypts n bytes 64 symbols per step, with a masked
+ ** final step
+ ** Parameters: const uint8_t* in, const uint8_t* key, uint8_t* out,
+ ** size_t n
+ *********************************************************************/
+__attribute__((target("avx512f,avx512bw")))
+static inline void avx512Decrypt(const uint8_t* in, const uint8_t* key,
+                                 uint8_t* out, size_t n)
+{
+  __m512i text,
+          pad;
+  __mmask64 lanes = ~0ULL;
+  size_t index;
+
+  for (index = 0; index < n; index += 64)
+  {
+    if (n - index < 64)
+      lanes = (1ULL << (n - index)) - 1;
+    text = _mm512_maskz_loadu_epi8(lanes, in + index);
+    pad = _mm512_maskz_loadu_epi8(lanes, key + index);
+    text = _mm512_add_epi8(avx512Values(text), _mm512_set1_epi8(27));
+    text = avx512Finish(_mm512_sub_epi8(text, avx512Values(pad)));
+    _mm512_mask_storeu_epi8(out + index, lanes, text);
+  }
+}
+
+/*********************************************************************
+ ** avx512FindInvalid
+ ** Description: Checks 64 bytes per step into a mask register, with a
+ ** masked final step
+ ** Parameters: const uint8_t* in, size_t n
+ *********************************************************************/
+__attribute__((target("avx512f,avx512bw")))
+static inline size_t avx512FindInvalid(const uint8_t* in, size_t n)
+{
+  __m512i chars;
+  __mmask64 lanes = ~0ULL,
+            valid;
+  size_t index;
+
+  for (index = 0; index < n; index += 64)
+  {
+    if (n - index < 64)
+      lanes = (1ULL << (n - index)) - 1;
+    chars = _mm512_maskz_loadu_epi8(lanes, in + index);
+    valid = _mm512_cmple_epu8_mask(_mm512_sub_epi8(chars,
+                                                   _mm512_set1_epi8('A')),
+                                   _mm512_set1_epi8(25)) |
+            _mm512_cmpeq_epi8_mask(chars, _mm512_set1_epi8(' '));
+    if (lanes & ~valid)
+      return index + __builtin_ctzll(lanes & ~valid);
+  }
+  return n;
+}
+
+static inline int avx512Supported(void)
+{
+  return __builtin_cpu_supports("avx512f") &&
+         __builtin_cpu_supports("avx512bw");
+}
+
+#endif
+
+/******** Registry and dispatch ********/
+
+// Listed from slowest to fastest; cipherSelect prefers the last usable
+static struct cipherEngine cipherEngines[] =
+{
+  { "scalar", alwaysSupported, scalarEncrypt, scalarDecrypt,
+    scalarFindInvalid, 0 },
+  { "table", alwaysSupported, tableEncrypt, tableDecrypt,
+    tableFindInvalid, 0 },
+  { "packed", alwaysSupported, packedEncrypt, packedDecrypt,
+    packedFindInvalid, 0 },
+#ifdef OTP_CIPHER_X86
+  { "sse2", sse2Supported, sse2Encrypt, sse2Decrypt, sse2FindInvalid, 0 },
+  { "avx2", avx2Supported, avx2Encrypt, avx2Decrypt, avx2FindInvalid, 0 },
+  { "avx512", avx512Supported, avx512Encrypt, avx512Decrypt,
+    avx512FindInvalid, 0 },
+#endif
+};
+static const int CIPHER_ENGINE_COUNT =
+  sizeof(cipherEngines) / sizeof(cipherEngines[0]);
+
+/*********************************************************************
+ ** cipherRandomSymbols
+ ** Description: Fills buffer with random 'A'-'Z'/space characters
+ ** from a private xorshift generator, leaving rand() untouched.
+ ** Parameters: uint8_t* buffer, size_t n, uint64_t* state
+ *********************************************************************/
+static inline void cipherRandomSymbols(uint8_t* buffer, size_t n,
+                                       uint64_t* state)
+{
+  size_t index;
+
+  for (index = 0; index < n; index++)
+  {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    buffer[index] = symbolChar(*state % 27);
+  }
+}
+
+/*********************************************************************
+ ** cipherSelfTest
+ ** Description: Runs every supported engine over random vectors of
+ ** many lengths and alignments and compares both directions with the
+ ** scalar reference, and its validator on the same vectors with a
+ ** random byte (often outside the alphabet) planted at a random spot,
+ ** and with a newline inside them, which it must stop at.
+ ** Engines that disagree are marked failed and are never selected.
+ ** Returns the number of failed engines.
+ ** Parameters: none
+ *********************************************************************/
+static inline int cipherSelfTest(void)
+{
+  enum { TEST_MAX = 515 };
+  uint8_t text[TEST_MAX + 1],
+          key[TEST_MAX + 1],
+          expected[TEST_MAX + 1],
+          actual[TEST_MAX + 1];
+  uint64_t state = 0x9E3779B97F4A7C15ULL;
+  size_t n,
+         offset,
+         newline;
+  int engine,
+      failures = 0;
+
+  for (engine = 1; engine < CIPHER_ENGINE_COUNT; engine++)
+  {
+    if (!cipherEngines[engine].supported())
+      continue;
+    for (n = 0; n < TEST_MAX && !cipherEngines[engine].failed; n++)
+    {
+      offset = n % 2;  // exercise unaligned starts as well
+      cipherRandomSymbols(text, n + offset, &state);
+      cipherRandomSymbols(key, n + offset, &state);
+
+      scalarEncrypt(text + offset, key + offset, expected, n);
+      cipherEngines[engine].encrypt(text + offset, key + offset, actual, n);
+      if (memcmp(expected, actual, n) != 0)
+        cipherEngines[engine].failed = 1;
+
+      scalarDecrypt(text + offset, key + offset, expected, n);
+      cipherEngines[engine].decrypt(text + offset, key + offset, actual, n);
+      if (memcmp(expected, actual, n) != 0)
+        cipherEngines[engine].failed = 1;
+
+      if (cipherEngines[engine].findInvalid(text + offset, n) != n)
+        cipherEngines[engine].failed = 1;
+      if (n > 0)
+      {
+        text[offset + state % n] = state >> 32;
+        if (cipherEngines[engine].findInvalid(text + offset, n) !=
+            scalarFindInvalid(text + offset, n))
+          cipherEngines[engine].failed = 1;
+      }
+
+      // Engines encipher a newline differently, so no validator may
+      // pass one that is not the final byte its caller leaves out
+      if (n > 1)
+      {
+        newline = state % (n - 1);
+        memcpy(text + offset, key + offset, n);
+        text[offset + newline] = '\n';
+        if (cipherEngines[engine].findInvalid(text + offset, n) != newline)
+          cipherEngines[engine].failed = 1;
+      }
+    }
+    if (cipherEngines[engine].failed)
+    {
+      fprintf(stderr, "cipher engine %s failed its self-test\n",
+              cipherEngines[engine].name);
+      failures++;
+    }
+  }
+  return failures;
+}
+
+/*********************************************************************
+ ** cipherSelect
+ ** Description: Returns the engine called name, or the fastest
+ ** usable engine if name is NULL. Returns NULL if the named engine
+ ** is unknown, unsupported by this CPU, or failed its self-test.
+ ** Parameters: const char* name
+ *********************************************************************/
+static inline struct cipherEngine* cipherSelect(const char* name)
+{
+  int engine;
+
+  for (engine = CIPHER_ENGINE_COUNT - 1; engine >= 0; engine--)
+  {
+    if (name != NULL && strcmp(name, cipherEngines[engine].name) != 0)
+      continue;
+    if (cipherEngines[engine].supported() && !cipherEngines[engine].failed)
+      return &cipherEngines[engine];
+    if (name != NULL)
+      return NULL;
+  }
+  return NULL;
+}
+
+/*********************************************************************
+ ** symbolsFindInvalid
+ ** Description: Returns the offset of the first of n bytes that is
+ ** not 'A'-'Z' or space, or n if all are, using the fastest
+ ** usable engine's validator
+ ** Parameters: const uint8_t* in, size_t n
+ *********************************************************************/
+static inline size_t symbolsFindInvalid(const uint8_t* in, size_t n)
+{
+  static struct cipherEngine* engine = NULL;
+
+  if (engine == NULL)
+    engine = cipherSelect(NULL);
+  return engine->findInvalid(in, n);
+}
+
+#endif
@@ -0,0 +1,357 @@
+/*********************************************************************
+ ** Program Filename: otp_compress.h
+ ** Author: Peter Nguyen
+ ** Date: 10/19/26
+ ** CS 344-400, Program 4
+ ** Description: LZ77-style compression that stays inside the 27
+ ** symbol alphabet (A-Z and space), so compressed text is still a
+ ** valid message for the daemons and uses one pad byte per symbol.
+ ** 'Z' is the escape symbol:
+ **   Z, space          a literal Z
+ **   Z, L, D1, D2      copy LZ_MIN_MATCH + value(L) symbols from
+ **                     value(D1) * 27 + value(D2) + 1 symbols back
+ ** where value() maps A-Z to 0-25 and space to 26 (L is never a
+ ** space). Matches are found with a hash chain over a 729-symbol
+ ** window. Both directions are streaming: input is fed in chunks of
+ ** up to LZ_CHUNK symbols and the window carries across chunks.
+ *********************************************************************/
+
+#ifndef OTP_COMPRESS_H
+#define OTP_COMPRESS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LZ_ESCAPE 'Z'
+#define LZ_WINDOW 729       // 27 * 27 distances
+#define LZ_MIN_MATCH 5      // a match token is 4 symbols
+#define LZ_MAX_MATCH 30     // 26 length codes
+#define LZ_CHUNK 4096
+#define LZ_HASH_SIZE 4096
+#define LZ_MAX_CHAIN 32     // candidates tried per position
+
+// Largest output of one lzEncodeChunk / lzDecodeChunk call
+#define LZ_ENCODE_BOUND(n) (2 * (n))
+#define LZ_DECODE_BOUND(n) (((n) / 4 + 1) * LZ_MAX_MATCH + (n))
+
+struct lzEncoder
+{
+  uint8_t buffer[LZ_WINDOW + LZ_CHUNK];  // window, then the new chunk
+  int head[LZ_HASH_SIZE],                // newest position per hash
+      prev[LZ_WINDOW + LZ_CHUNK],        // older position, same hash
+      length;                            // symbols in buffer
+};
+
+struct lzDecoder
+{
+  uint8_t window[LZ_WINDOW];  // last symbols written, as a ring
+  unsigned long total;        // symbols written so far
+  int state,                  // symbols of the current token seen
+      matchLen,
+      distHigh;
+};
+
+/*********************************************************************
+ ** lzValue
+ ** Description: Maps a symbol to 0-26, or returns -1 if it is not in
+ ** the alphabet
+ ** Parameters: uint8_t c
+ *********************************************************************/
+static inline int lzValue(uint8_t c)
+{
+  if (c >= 'A' && c <= 'Z')
+    return c - 'A';
+  return c == ' ' ? 26 : -1;
+}
+
+/*********************************************************************
+ ** lzSymbol
+ ** Description: Maps a value from 0-26 back to its symbol
+ ** Parameters: int value
+ *********************************************************************/
+static inline uint8_t lzSymbol(int value)
+{
+  return value == 26 ? ' ' : 'A' + value;
+}
+
+/*********************************************************************
+ ** lzHash
+ ** Description: Hashes the three symbols starting at buffer[pos]
+ ** Parameters: const uint8_t* buffer, int pos
+ *********************************************************************/
+static inline int lzHash(const uint8_t* buffer, int pos)
+{
+  uint32_t key = buffer[pos] | buffer[pos + 1] << 8 | buffer[pos + 2] << 16;
+
+  return (key * 2654435761u) >> 20 & (LZ_HASH_SIZE - 1);
+}
+
+/*********************************************************************
+ ** lzEncoderInit
+ ** Description: Prepares an encoder for a new stream
+ ** Parameters: struct lzEncoder* enc
+ *********************************************************************/
+static inline void lzEncoderInit(struct lzEncoder* enc)
+{
+  memset(enc->head, 0xff, sizeof(enc->head));  // every entry -1
+  enc->length = 0;
+}
+
+/*********************************************************************
+ ** lzInsert
+ ** Description: Adds position pos to the hash chains, if three
+ ** symbols are available there
+ ** Parameters: struct lzEncoder* enc, int pos
+ *********************************************************************/
+static inline void lzInsert(struct lzEncoder* enc, int pos)
+{
+  int hash;
+
+  if (pos + 3 > enc->length)
+    return;
+  hash = lzHash(enc->buffer, pos);
+  enc->prev[pos] = enc->head[hash];
+  enc->head[hash] = pos;
+}
+
+/*********************************************************************
+ ** lzEncodeChunk
+ ** Description: Compresses n (at most LZ_CHUNK) symbols from in into
+ ** out, which must hold LZ_ENCODE_BOUND(n) symbols. Matches may refer
+ ** back into earlier chunks but do not run past the end of this one.
+ ** Returns the number of symbols written.
+ ** Parameters: struct lzEncoder* enc, const uint8_t* in, size_t n,
+ ** uint8_t* out
+ *********************************************************************/
+static inline size_t lzEncodeChunk(struct lzEncoder* enc, const uint8_t* in,
+                                   size_t n, uint8_t* out)
+{
+  int pos,
+      candidate,
+      steps,
+      matchLen,
+      bestLen,
+      bestDist,
+      limit,
+      shift,
+      index;
+  size_t written = 0;
+
+  memcpy(enc->buffer + enc->length, in, n);
+  pos = enc->length;
+  enc->length += n;
+
+  while (pos < enc->length)
+  {
+    // Walk the chain for the longest match inside the window
+    bestLen = 0;
+    bestDist = 0;
+    limit = enc->length - pos;
+    if (limit > LZ_MAX_MATCH)
+      limit = LZ_MAX_MATCH;
+    if (limit >= LZ_MIN_MATCH)
+    {
+      candidate = enc->head[lzHash(enc->buffer, pos)];
+      for (steps = 0; candidate >= 0 && pos - candidate <= LZ_WINDOW &&
+           steps < LZ_MAX_CHAIN; steps++)
+      {
+        matchLen = 0;
+        while (matchLen < limit &&
+               enc->buffer[candidate + matchLen] ==
+               enc->buffer[pos + matchLen])
+          matchLen++;
+        if (matchLen > bestLen)
+        {
+          bestLen = matchLen;
+          bestDist = pos - candidate;
+          if (bestLen == limit)
+            break;
+        }
+        candidate = enc->prev[candidate];
+      }
+    }
+
+    if (bestLen >= LZ_MIN_MATCH)
+    {
+      out[written++] = LZ_ESCAPE;
+      out[written++] = lzSymbol(bestLen - LZ_MIN_MATCH);
+      out[written++] = lzSymbol((bestDist - 1) / 27);
+      out[written++] = lzSymbol((bestDist - 1) % 27);
+      for (index = 0; index < bestLen; index++)
+        lzInsert(enc, pos + index);
+      pos += bestLen;
+    }
+    else
+    {
+      out[written++] = enc->buffer[pos];
+      if (enc->buffer[pos] == LZ_ESCAPE)
+        out[written++] = ' ';
+      lzInsert(enc, pos);
+      pos++;
+    }
+  }
+
+  // Keep only the window, rebasing every stored position
+  if (enc->length > LZ_WINDOW)
+  {
+    shift = enc->length - LZ_WINDOW;
+    memmove(enc->buffer, enc->buffer + shift, LZ_WINDOW);
+    for (index = 0; index < LZ_HASH_SIZE; index++)
+      enc->head[index] = enc->head[index] >= shift
+                         ? enc->head[index] - shift : -1;
+    for (index = 0; index < LZ_WINDOW; index++)
+      enc->prev[index] = enc->prev[index + shift] >= shift
+                         ? enc->prev[index + shift] - shift : -1;
+    enc->length = LZ_WINDOW;
+  }
+  return written;
+}
+
+/*********************************************************************
+ ** lzDecoderInit
+ ** Description: Prepares a decoder for a new stream
+ ** Parameters: struct lzDecoder* dec
+ *********************************************************************/
+static inline void lzDecoderInit(struct lzDecoder* dec)
+{
+  memset(dec, 0, sizeof(*dec));
+}
+
+/*********************************************************************
+ ** lzPut
+ ** Description: Writes one decoded symbol and remembers it
+ ** Parameters: struct lzDecoder* dec, uint8_t c, uint8_t* out,
+ ** size_t* written
+ *********************************************************************/
+static inline void lzPut(struct lzDecoder* dec, uint8_t c, uint8_t* out,
+                         size_t* written)
+{
+  out[(*written)++] = c;
+  dec->window[dec->total++ % LZ_WINDOW] = c;
+}
+
+/*********************************************************************
+ ** lzDecodeChunk
+ ** Description: Decompresses n symbols from in into out, which must
+ ** hold LZ_DECODE_BOUND(n) symbols. Tokens may be split across
+ ** chunks. Returns the number of symbols written, or -1 if the input
+ ** is not a valid stream.
+ ** Parameters: struct lzDecoder* dec, const uint8_t* in, size_t n,
+ ** uint8_t* out
+ *********************************************************************/
+static inline long lzDecodeChunk(struct lzDecoder* dec, const uint8_t* in,
+                                 size_t n, uint8_t* out)
+{
+  size_t index,
+         written = 0;
+  unsigned long from;
+  int value,
+      dist,
+      count;
+
+  for (index = 0; index < n; index++)
+  {
+    value = lzValue(in[index]);
+    if (value < 0)
+      return -1;
+
+    switch (dec->state)
+    {
+      case 0:  // between tokens
+        if (in[index] == LZ_ESCAPE)
+          dec->state = 1;
+        else
+          lzPut(dec, in[index], out, &written);
+        break;
+
+      case 1:  // after the escape: literal Z or a length
+        if (value == 26)
+        {
+          lzPut(dec, LZ_ESCAPE, out, &written);
+          dec->state = 0;
+        }
+        else
+        {
+          dec->matchLen = LZ_MIN_MATCH + value;
+          dec->state = 2;
+        }
+        break;
+
+      case 2:  // high distance digit
+        dec->distHigh = value;
+        dec->state = 3;
+        break;
+
+      case 3:  // low distance digit: copy the match
+        dist = dec->distHigh * 27 + value + 1;
+        if ((unsigned long) dist > dec->total)
+          return -1;
+        from = dec->total - dist;
+        for (count = 0; count < dec->matchLen; count++)
+          lzPut(dec, dec->window[(from + count) % LZ_WINDOW], out, &written);
+        dec->state = 0;
+        break;
+    }
+  }
+  return written;
+}
+
+/*********************************************************************
+ ** lzCompress
+ ** Description: Compresses a whole message of n symbols into out,
+ ** which must hold LZ_ENCODE_BOUND(n). Returns the compressed length,
+ ** or -1 if out of memory.
+ ** Parameters: const char* in, size_t n, char* out
+ *********************************************************************/
+static inline long lzCompress(const char* in, size_t n, char* out)
+{
+  struct lzEncoder* enc = malloc(sizeof(struct lzEncoder));
+  size_t done = 0,
+         written = 0,
+         chunk;
+
+  if (enc == NULL)
+    return -1;
+  lzEncoderInit(enc);
+  while (done < n)
+  {
+    chunk = n - done < LZ_CHUNK ? n - done : LZ_CHUNK;
+    written += lzEncodeChunk(enc, (const uint8_t*) in + done, chunk,
+                             (uint8_t*) out + written);
+    done += chunk;
+  }
+  free(enc);
+  return written;
+}
+
+/*********************************************************************
+ ** lzDecompress
+ ** Description: Decompresses a whole message of n symbols into a
+ ** newly allocated, NUL-terminated buffer and stores its length in
+ ** outLen. The buffer has room for one more symbol, such as a
+ ** newline. Returns NULL if the input is invalid or out of memory.
+ ** Parameters: const char* in, size_t n, size_t* outLen
+ *********************************************************************/
+static inline char* lzDecompress(const char* in, size_t n, size_t* outLen)
+{
+  struct lzDecoder dec;
+  char* out = malloc(LZ_DECODE_BOUND(n) + 2);
+  long written;
+
+  if (out == NULL)
+    return NULL;
+  lzDecoderInit(&dec);
+  written = lzDecodeChunk(&dec, (const uint8_t*) in, n, (uint8_t*) out);
+  if (written < 0 || dec.state != 0)
+  {
+    free(out);
+    return NULL;
+  }
+  out[written] = '\0';
+  *outLen = written;
+  return out;
+}
+
+#endif
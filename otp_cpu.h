@@ -0,0 +1,241 @@
+/*********************************************************************
+ ** Program Filename: otp_cpu.h
+ ** Author: Peter Nguyen
+ ** Date: 10/19/26
+ ** CS 344-400, Program 4
+ ** Description: CPU placement helpers for the prefork daemons and
+ ** the benchmark. Parses CPU lists, pins a process to one CPU, finds
+ ** the NUMA node of a CPU, and builds a SO_REUSEPORT listener group
+ ** in which the kernel hands each connection to the listener of a
+ ** worker pinned to the CPU that received it. Memory is kept local
+ ** by first touch: a pinned process allocates and touches its own
+ ** buffers, so no NUMA library is needed.
+ *********************************************************************/
+
+#ifndef OTP_CPU_H
+#define OTP_CPU_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <dirent.h>
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/filter.h>
+
+#ifndef SO_INCOMING_CPU
+#define SO_INCOMING_CPU 49
+#endif
+#ifndef SO_ATTACH_REUSEPORT_CBPF
+#define SO_ATTACH_REUSEPORT_CBPF 51
+#endif
+
+#define STEER_MAX_CODE 4096  // the kernel's limit on BPF instructions
+
+/*********************************************************************
+ ** parseCpuList
+ ** Description: Parses a list such as "0,2,4-7" into cpus. A NULL
+ ** list means every CPU this process may run on, in order. Returns
+ ** the number of CPUs stored (at most max), or -1 if the list is
+ ** malformed.
+ ** Parameters: const char* list, int* cpus, int max
+ *********************************************************************/
+static inline int parseCpuList(const char* list, int* cpus, int max)
+{
+  cpu_set_t allowed;
+  char* end;
+  long first,
+       last;
+  int count = 0,
+      cpu;
+
+  if (list == NULL)
+  {
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0)
+      return -1;
+    for (cpu = 0; cpu < CPU_SETSIZE && count < max; cpu++)
+      if (CPU_ISSET(cpu, &allowed))
+        cpus[count++] = cpu;
+    return count;
+  }
+
+  while (*list != '\0' && count < max)
+  {
+    first = strtol(list, &end, 10);
+    if (end == list || first < 0)
+      return -1;
+    last = first;
+    if (*end == '-')
+    {
+      list = end + 1;
+      last = strtol(list, &end, 10);
+      if (end == list || last < first)
+        return -1;
+    }
+    for (; first <= last && count < max; first++)
+      cpus[count++] = first;
+    if (*end == ',')
+      end++;
+    else if (*end != '\0')
+      return -1;
+    list = end;
+  }
+  return count;
+}
+
+/*********************************************************************
+ ** pinToCpu
+ ** Description: Restricts the calling process to one CPU. Returns 0,
+ ** or -1 with errno set.
+ ** Parameters: int cpu
+ *********************************************************************/
+static inline int pinToCpu(int cpu)
+{
+  cpu_set_t set;
+
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return sched_setaffinity(0, sizeof(set), &set);
+}
+
+/*********************************************************************
+ ** cpuNode
+ ** Description: Returns the NUMA node a CPU belongs to, from sysfs,
+ ** or 0 when the machine does not report one.
+ ** Parameters: int cpu
+ *********************************************************************/
+static inline int cpuNode(int cpu)
+{
+  char path[64];
+  struct dirent* entry;
+  DIR* dir;
+  int node = 0;
+
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+  dir = opendir(path);
+  if (dir == NULL)
+    return 0;
+  while ((entry = readdir(dir)) != NULL)
+    if (sscanf(entry->d_name, "node%d", &node) == 1)
+      break;
+  closedir(dir);
+  return node;
+}
+
+/*********************************************************************
+ ** reuseportListener
+ ** Description: Opens one member of a SO_REUSEPORT listener group on
+ ** port and marks it as belonging to cpu. Members must be opened in
+ ** worker order: steering uses the order they joined the group.
+ ** Returns the socket, or -1 with errno set.
+ ** Parameters: int port, int backlog, int cpu
+ *********************************************************************/
+static inline int reuseportListener(int port, int backlog, int cpu)
+{
+  struct sockaddr_in addr;
+  int sockfd,
+      on = 1;
+
+  sockfd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (sockfd < 0)
+    return -1;
+  setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0)
+    goto fail;
+  // Hint for kernels that match on the receiving CPU without BPF
+  setsockopt(sockfd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu));
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = INADDR_ANY;
+  if (bind(sockfd, (struct sockaddr*) &addr, sizeof(addr)) < 0 ||
+      listen(sockfd, backlog) < 0)
+    goto fail;
+  return sockfd;
+
+fail:
+  close(sockfd);
+  return -1;
+}
+
+/*********************************************************************
+ ** steerByCpu
+ ** Description: Attaches a classic BPF program to a listener group
+ ** whose member i is pinned to cpus[i], for workers members. The
+ ** program looks the receiving CPU up in cpus and picks its member,
+ ** or one of them at random where several share the CPU, so every
+ ** connection is accepted on the core whose softirq received it. A
+ ** CPU that is not in cpus gets member (CPU % workers). Members that
+ ** share a CPU must be adjacent. Returns 0, or -1 with errno set
+ ** (EINVAL if they are not; the kernel then falls back to hashing
+ ** connections across members).
+ ** Parameters: int sockfd, const int* cpus, int workers
+ *********************************************************************/
+static inline int steerByCpu(int sockfd, const int* cpus, int workers)
+{
+  struct sock_filter code[STEER_MAX_CODE];
+  struct sock_fprog program;
+  int count = 0,
+      first,
+      run,
+      other;
+
+  code[count++] = (struct sock_filter)
+    { BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU };
+  for (first = 0; first < workers; first += run)
+  {
+    for (run = 1; first + run < workers && cpus[first + run] == cpus[first];
+         run++)
+      ;
+    for (other = first + run; other < workers; other++)
+      if (cpus[other] == cpus[first])
+      {
+        errno = EINVAL;
+        return -1;
+      }
+    if (count + 7 > STEER_MAX_CODE)
+    {
+      errno = E2BIG;
+      return -1;
+    }
+
+    // A is still the CPU whenever a test fails and skips its returns
+    if (run == 1)
+    {
+      code[count++] = (struct sock_filter)
+        { BPF_JMP | BPF_JEQ | BPF_K, 0, 1, (unsigned) cpus[first] };
+      code[count++] = (struct sock_filter)
+        { BPF_RET | BPF_K, 0, 0, (unsigned) first };
+    }
+    else
+    {
+      code[count++] = (struct sock_filter)
+        { BPF_JMP | BPF_JEQ | BPF_K, 0, 4, (unsigned) cpus[first] };
+      code[count++] = (struct sock_filter)
+        { BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_RANDOM };
+      code[count++] = (struct sock_filter)
+        { BPF_ALU | BPF_MOD | BPF_K, 0, 0, (unsigned) run };
+      code[count++] = (struct sock_filter)
+        { BPF_ALU | BPF_ADD | BPF_K, 0, 0, (unsigned) first };
+      code[count++] = (struct sock_filter) { BPF_RET | BPF_A, 0, 0, 0 };
+    }
+  }
+  code[count++] = (struct sock_filter)
+    { BPF_ALU | BPF_MOD | BPF_K, 0, 0, (unsigned) workers };
+  code[count++] = (struct sock_filter) { BPF_RET | BPF_A, 0, 0, 0 };
+
+  program.len = count;
+  program.filter = code;
+  return setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program,
+                    sizeof(program));
+}
+
+#endif
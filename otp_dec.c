@@ -4,284 +4,945 @@
  ** Date: 3/14/16
  ** CS 344-400, Program 4
  ** Description: Sends ciphertext and key to otp_dec_d and receives
- ** back the decrypted text.
+ ** back the decrypted text. With -b, processes a whole directory
+ ** or manifest of files against slices of one pad. The result goes
+ ** to stdout, or with -o to a file (otp_output.h).
  *********************************************************************/
 
+#define _GNU_SOURCE  // splice and fallocate in otp_output.h
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <dirent.h>
+#include <libgen.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include <netinet/in.h>
 #include <netdb.h>
 #include <arpa/inet.h>
+#include <time.h>
+#include "otp_net.h"
+#include "otp_pad.h"
+#include "otp_compress.h"
+#include "otp_frame.h"
+#include "otp_trace.h"
+#include "otp_cipher.h"
+#include "otp_stream.h"
+#include "otp_seed.h"
+#include "otp_transport.h"
+#include "otp_output.h"
 
 const int BUFF_SIZE = 70000;
+const int BUSY_ID = 3;            // daemon has no free slot, try again
+const int BACKOFF_BASE_MS = 20;
+const int BACKOFF_CAP_MS = 2000;
+
+// Connection manager defaults (see usage for the matching options)
+const int DEFAULT_CONNECT_MS = 2000;
+const int DEFAULT_RETRIES = 8;
+const int DEFAULT_SEND_MS = 10000;
+const int DEFAULT_RECV_MS = 10000;
+const int DEFAULT_IN_FLIGHT = 4;  // batch requests sent concurrently
+const int PAD_CHUNK_SIZE = 1 << 20;  // pad read-ahead per buffer
+
+// Where and how to reach the daemon
+struct clientConfig
+{
+  struct sockaddr_in addr;
+  struct netPolicy policy;
+  int sendMs,
+      recvMs,
+      compress,  // -z: text goes through otp_compress.h
+      framed,    // -F: authenticated frames (otp_frame.h)
+      transport;  // -L: socket profile (otp_transport.h)
+  char *portArg,
+       *outPath;             // -o: result file instead of stdout
+  struct outputSink output;  // where the result goes
+  struct otpStream* stream;  // -S: pipelined frames (otp_stream.h)
+  struct seedDescriptor* seed;  // -G: key named by a seed segment
+};
 
 // Function prototypes
 void error(const char *msg);
-void writeSock(int sockfd, char* buffer);
-void readSock(int sockfd, char* buffer, int size);
-int validChars(char* buffer);
+void readSock(int sockfd, char* buffer, int size, long deadline);
+int validChars(char* buffer, const char* path);
+void openOutput(struct clientConfig* config, off_t sizeHint);
+char* expandText(char* packed);
+int runStream(struct clientConfig* config, char* txtFile, char* keyFile,
+              long padOffset);
+void describeSeed(char* seedFile, uint64_t segment, long padOffset,
+                  struct seedDescriptor* descriptor);
+void sendRequest(struct clientConfig* config, char* txtBuffer,
+                 char* keyBuffer, char* outBuffer);
+void exchangeFramed(struct clientConfig* config, int sockfd,
+                    char* txtBuffer, char* keyBuffer, char* outBuffer);
+int runBatch(struct clientConfig* config, char* inputPath, char* keyFile,
+             char* outDir, int inFlight, long padOffset);
+int listInputs(char* inputPath, char*** paths);
+int compareNames(const void* a, const void* b);
+int writeAtomic(char* outDir, char* path, char* data);
 
 int main(int argc, char *argv[])
 {
-  int sockfd,
-      portno,
-      n,
-      receivedNum = 0, // int representing the data size sent
-      returnStatus,    // value returned from read or write
-      dataSizeNum,
-      convertedNum,
-      connectStatus;
-  struct sockaddr_in serv_addr;
+  int option,
+      inFlight = DEFAULT_IN_FLIGHT,
+      streamed = 0,
+      textLen;
+  long padOffset = 0;
+  long long segment = -1;  // -G: seed segment instead of a pad
+  ssize_t keyLen,
+          keyNeed;
+  struct seedDescriptor descriptor;
+  struct padReader pad;
+  char *txtFile,
+       *keyFile,
+       *outDir = NULL,
+       *tracePath = NULL;
   struct hostent *server;        // Defines a host computer
+  struct clientConfig config;
   char txtBuffer[BUFF_SIZE],
-       keyBuffer[BUFF_SIZE],
+       keyBuffer[FRAME_KEY_LENGTH(BUFF_SIZE)],
        plainBuffer[BUFF_SIZE];
+  char* outText;
   FILE* filePtr;
 
+  config.policy.connectMs = DEFAULT_CONNECT_MS;
+  config.policy.retries = DEFAULT_RETRIES;
+  config.policy.baseMs = BACKOFF_BASE_MS;
+  config.policy.capMs = BACKOFF_CAP_MS;
+  config.sendMs = DEFAULT_SEND_MS;
+  config.recvMs = DEFAULT_RECV_MS;
+  config.compress = 0;
+  config.framed = 0;
+  config.stream = NULL;
+  config.seed = NULL;
+  config.transport = TRANSPORT_PLAIN;
+  config.outPath = NULL;
+
+  // Parse connection manager and batch options
+  while ((option = getopt(argc, argv, "c:r:s:w:b:j:O:T:G:L:o:zFS")) != -1)
+  {
+    switch (option)
+    {
+      case 'c': config.policy.connectMs = atoi(optarg); break;
+      case 'r': config.policy.retries = atoi(optarg); break;
+      case 's': config.sendMs = atoi(optarg); break;
+      case 'w': config.recvMs = atoi(optarg); break;
+      case 'b': outDir = optarg; break;
+      case 'j': inFlight = atoi(optarg); break;
+      case 'O': padOffset = atol(optarg); break;
+      case 'z': config.compress = 1; break;
+      case 'F': config.framed = 1; break;
+      case 'S': streamed = 1; break;
+      case 'G': segment = atoll(optarg); break;
+      case 'L': config.transport = transportParse(optarg); break;
+      case 'T': tracePath = optarg; break;
+      case 'o': config.outPath = optarg; break;
+      default: argc = 0; break;  // force the usage message
+    }
+  }
+
   // Check for correct arguments
-  if (argc < 4)
+  if (argc - optind < 3 || config.policy.retries < 1 || inFlight < 1 ||
+      padOffset < 0 || config.transport < 0 ||
+      (config.outPath != NULL && outDir != NULL) ||
+      (streamed && (outDir != NULL || config.compress)) ||
+      (segment >= 0 && (outDir != NULL || streamed || config.framed)))
   {
-    fprintf(stderr,"usage: %s ciphertext key port\n", argv[0]);
+    fprintf(stderr,"usage: %s [-c connectMs] [-r retries] [-s sendMs] "
+            "[-w recvMs] [-O padOffset] [-T traceFile] [-z] "
+            "[-L plain|latency|bulk] [-o outFile] [-F | -S] ciphertext key "
+            "port\n"
+            "       %s -G segment [-O offset] [-T traceFile] [-z] "
+            "[-L profile] [-o outFile] ciphertext seedFile port\n"
+            "       %s -b outDir [-j inFlight] [-O padOffset] [-T traceFile] "
+            "[-z] [-L profile] [-F] dir|manifest pad port\n", argv[0], argv[0],
+            argv[0]);
     exit(0);
   }
+  txtFile = argv[optind];
+  keyFile = argv[optind + 1];
+  config.portArg = argv[optind + 2];
+
+  // Set host name
+  server = gethostbyname("localhost");
+  if (server == NULL)
+  {
+    fprintf(stderr,"ERROR, no such host\n");
+    exit(1);
+  }
+
+  // Set server address
+  bzero((char *) &config.addr, sizeof(config.addr));
+  config.addr.sin_family = AF_INET;
+  bcopy((char *)server->h_addr,
+        (char *)&config.addr.sin_addr.s_addr,
+        server->h_length);
+  config.addr.sin_port = htons(atoi(config.portArg));
+
+  srand(time(NULL) ^ getpid());
+
+  if (tracePath != NULL && traceOpen(tracePath) < 0)
+    error("ERROR opening trace file");
+
+  if (outDir != NULL)
+    return runBatch(&config, txtFile, keyFile, outDir, inFlight, padOffset);
+
+  // Large texts go through the pipelined exchange, never whole in memory
+  if (streamed)
+    return runStream(&config, txtFile, keyFile, padOffset);
 
   // Read the ciphertext file
-  filePtr = fopen(argv[1], "r");
+  filePtr = fopen(txtFile, "r");
   if (filePtr == NULL)
   {
     fprintf(stderr, "could not open ciphertext file\n");
     exit(1);
   }
-  bzero(txtBuffer, BUFF_SIZE);
+  txtBuffer[0] = '\0';  // fgets leaves it alone for an empty file
   fgets(txtBuffer, BUFF_SIZE, filePtr);
   fclose(filePtr);
 
-  // Read the key file
-  filePtr = fopen(argv[2], "r");
-  if (filePtr == NULL)
+  textLen = strcspn(txtBuffer, "\n");
+  keyNeed = config.framed ? FRAME_KEY_LENGTH(textLen) : textLen;
+  if (segment >= 0)
   {
-    fprintf(stderr, "could not open key file\n");
-    exit(1);
+    // The daemon derives the key from the segment; none is sent
+    describeSeed(keyFile, segment, padOffset, &descriptor);
+    config.seed = &descriptor;
+    keyBuffer[0] = '\0';
   }
-  bzero(keyBuffer, BUFF_SIZE);
-  fgets(keyBuffer, BUFF_SIZE, filePtr);
-  fclose(filePtr);
-
-  // Check for bad characters or if key file is too short
-  if (strlen(keyBuffer) < strlen(txtBuffer))
+  else
   {
-    fprintf(stderr, "ERROR: key %s is too short\n", argv[2]);
+    // Stream only the key bytes this message uses out of the pad
+    if (padOpen(&pad, keyFile, padOffset, BUFF_SIZE) < 0)
+    {
+      fprintf(stderr, "could not open key file\n");
+      exit(1);
+    }
+    keyLen = padRead(&pad, keyBuffer, keyNeed);
+    padClose(&pad);
+    if (keyLen < 0)
+      error("ERROR reading key file");
+    keyBuffer[keyLen] = '\n';
+    keyBuffer[keyLen + 1] = '\0';
+
+    // Check for bad characters or if key file is too short
+    if (keyLen < keyNeed)
+    {
+      fprintf(stderr, "ERROR: key %s is too short\n", keyFile);
+      exit(1);
+    }
+    if (!validChars(keyBuffer, keyFile))
+      exit(1);
+  }
+
+  if (!validChars(txtBuffer, txtFile))
     exit(1);
+
+  // A plain reply goes straight from the socket to the output
+  openOutput(&config, config.compress ? 0 : textLen + 1);
+  if (config.compress || config.framed)
+  {
+    sendRequest(&config, txtBuffer, keyBuffer, plainBuffer);
+    outText = config.compress ? expandText(plainBuffer) : plainBuffer;
+    if (outputWrite(&config.output, outText, strlen(outText)) < 0)
+      error("ERROR writing output");
   }
+  else
+    sendRequest(&config, txtBuffer, keyBuffer, NULL);
+  if (outputClose(&config.output) < 0)
+    error("ERROR writing output");
 
-  if (!validChars(txtBuffer))
+  return 0;
+}
+
+/*********************************************************************
+ ** expandText
+ ** Description: Decompresses the newline-terminated text returned by
+ ** otp_dec_d when otp_enc compressed it. Returns a new buffer with
+ ** the original text and its newline. Exits with an error if the
+ ** text is not a valid compressed stream (wrong key or no -z).
+ ** Parameters: char* packed
+ *********************************************************************/
+char* expandText(char* packed)
+{
+  size_t textLen;
+  char* text;
+
+  text = lzDecompress(packed, strcspn(packed, "\n"), &textLen);
+  if (text == NULL)
   {
-    fprintf(stderr, "ERROR: bad characters in %s\n", argv[1]);
+    fprintf(stderr, "ERROR: decrypted text is not compressed data\n");
     exit(1);
   }
-  if (!validChars(keyBuffer))
+  text[textLen] = '\n';
+  text[textLen + 1] = '\0';
+  return text;
+}
+
+/*********************************************************************
+ ** describeSeed
+ ** Description: Loads the seed file written by keygen -s and fills
+ ** descriptor with its ID, segment and the symbol offset padOffset
+ ** (see otp_seed.h)
+ ** Parameters: char* seedFile, uint64_t segment, long padOffset,
+ ** struct seedDescriptor* descriptor
+ *********************************************************************/
+void describeSeed(char* seedFile, uint64_t segment, long padOffset,
+                  struct seedDescriptor* descriptor)
+{
+  struct seedKey seed;
+
+  if (seedLoad(&seed, seedFile) < 0)
+    error("ERROR loading seed file");
+  if (segment == SEED_ID_SEGMENT)
   {
-    fprintf(stderr, "ERROR: bad characters in %s\n", argv[2]);
+    fprintf(stderr, "ERROR: segment %llu is reserved\n",
+            (unsigned long long) segment);
     exit(1);
   }
+  descriptor->id = seed.id;
+  descriptor->segment = segment;
+  descriptor->offset = padOffset;
+  memset(&seed, 0, sizeof(seed));
+}
 
-  /******** Connect to server ********/
+/*********************************************************************
+ ** runStream
+ ** Description: Decrypts txtFile with -S: checks that the pad holds
+ ** the FRAME_KEY_LENGTH symbols the whole text needs, then streams
+ ** the ciphertext through otp_dec_d frame by frame, writing
+ ** plaintext to the output as it arrives. Returns 0, or exits with
+ ** an error.
+ ** Parameters: struct clientConfig* config, char* txtFile,
+ ** char* keyFile, long padOffset
+ *********************************************************************/
+int runStream(struct clientConfig* config, char* txtFile, char* keyFile,
+              long padOffset)
+{
+  struct otpStream stream;
+  struct padReader pad;
 
-  // Set port number and host name
-  portno = atoi(argv[3]);
-  sockfd = socket(AF_INET, SOCK_STREAM, 0);
-  if (sockfd < 0)
-    error("ERROR opening socket");
-  server = gethostbyname("localhost");
-  if (server == NULL)
+  if (padOpen(&pad, keyFile, padOffset, PAD_CHUNK_SIZE) < 0)
   {
-    fprintf(stderr,"ERROR, no such host\n");
+    fprintf(stderr, "could not open key file\n");
+    exit(1);
+  }
+  if (streamOpen(&stream, txtFile, &pad, keyFile) < 0)
+  {
+    fprintf(stderr, "could not open ciphertext file\n");
+    exit(1);
+  }
+  if (pad.length - pad.position < FRAME_KEY_LENGTH(stream.textLen))
+  {
+    fprintf(stderr, "ERROR: key %s is too short\n", keyFile);
     exit(1);
   }
 
-  // Set server address
-  bzero((char *) &serv_addr, sizeof(serv_addr));
-  serv_addr.sin_family = AF_INET;
-  bcopy((char *)server->h_addr,
-        (char *)&serv_addr.sin_addr.s_addr,
-        server->h_length);
-  serv_addr.sin_port = htons(portno);
+  openOutput(config, stream.textLen + 1);
+  config->framed = 1;
+  config->stream = &stream;
+  sendRequest(config, NULL, NULL, NULL);
+  padClose(&pad);
+  if (outputClose(&config->output) < 0)
+    error("ERROR writing output");
+  return 0;
+}
 
-  // Connect to the server
-  if (connect(sockfd, (struct sockaddr *) &serv_addr, sizeof(serv_addr)) < 0)
-    error("ERROR connecting");
+/*********************************************************************
+ ** openOutput
+ ** Description: Points config's output at the -o file, created with
+ ** sizeHint bytes preallocated (0 if unknown), or at stdout. Exits
+ ** with an error if the file cannot be created.
+ ** Parameters: struct clientConfig* config, off_t sizeHint
+ *********************************************************************/
+void openOutput(struct clientConfig* config, off_t sizeHint)
+{
+  int status;
 
-  // Check if trying to connect to otp_enc_d; if so, reject
-  returnStatus = read(sockfd, &receivedNum, sizeof(receivedNum));
-  if (returnStatus > 0)
+  if (config->outPath != NULL)
+    status = outputCreate(&config->output, config->outPath, sizeHint);
+  else
+    status = outputOpen(&config->output, STDOUT_FILENO);
+  if (status < 0)
+    error("ERROR opening output");
+}
+
+/*********************************************************************
+ ** sendRequest
+ ** Description: Connects to otp_dec_d, follows the redirect to the
+ ** child's port, sends the ciphertext and key (or -G seed
+ ** descriptor) and reads the plaintext into outBuffer, or with no
+ ** outBuffer moves it straight to config's output. Exits with an
+ ** error if any phase fails. With -F the exchange goes through
+ ** exchangeFramed, and with -S through streamExchange, which writes
+ ** to config's output as well.
+ ** Parameters: struct clientConfig* config, char* txtBuffer,
+ ** char* keyBuffer, char* outBuffer
+ *********************************************************************/
+void sendRequest(struct clientConfig* config, char* txtBuffer,
+                 char* keyBuffer, char* outBuffer)
+{
+  int sockfd,
+      receivedNum = 0, // int representing the data size sent
+      textSize,
+      keySize,
+      count = 2,
+      attempt;
+  uint32_t flags = 0;
+  uint64_t start = traceNow(),
+           phase = start;
+  long deadline;
+  struct sockaddr_in serv_addr = config->addr;
+  struct transport serverLink;
+  struct iovec parts[4];
+
+  if (traceEnabled())
   {
+    traceNewRequest();
+    flags |= FRAME_FLAG_TRACE;
+  }
+  if (config->framed)
+    flags |= FRAME_FLAG_MAC;
+  if (config->seed != NULL)
+    flags |= FRAME_FLAG_SEED;
+
+  /******** Connect to server ********/
+
+  // Connect to the server, backing off while it reports busy
+  for (attempt = 0; ; attempt++)
+  {
+    sockfd = connectRetry(&serv_addr, &config->policy);
+    if (sockfd < 0)
+      error("ERROR connecting");
+
+    // Check if trying to connect to otp_enc_d; if so, reject
+    if (readFull(sockfd, &receivedNum, sizeof(receivedNum),
+                 netDeadline(config->recvMs)) < 0)
+      error("ERROR receiving identifier");
     receivedNum = ntohl(receivedNum);
     if (receivedNum == 1)
     {
-      fprintf(stderr, "ERROR: could not contact otp_enc_d on port %s\n",
-              argv[3]);
+      fprintf(stderr, "ERROR: could not contact otp_dec_d on port %s\n",
+              config->portArg);
+      exit(2);
+    }
+    if (receivedNum != BUSY_ID)
+      break;
+
+    close(sockfd);
+    if (attempt + 1 >= config->policy.retries)
+    {
+      fprintf(stderr, "ERROR: otp_dec_d on port %s is busy\n",
+              config->portArg);
       exit(2);
     }
+    netBackoff(attempt, config->policy.baseMs, config->policy.capMs);
   }
+  traceSpan(TRACE_CONNECT, phase, attempt + 1);
+  phase = traceNow();
 
   // Receive the new port number from server after initial connect
-  returnStatus = read(sockfd, &receivedNum, sizeof(receivedNum));
-  if (returnStatus > 0)
-    receivedNum = ntohl(receivedNum);
-  else
-    fprintf(stderr, "ERROR receiving port number: %d\n", returnStatus);
+  if (readFull(sockfd, &receivedNum, sizeof(receivedNum),
+               netDeadline(config->recvMs)) < 0)
+    error("ERROR receiving port number");
+  receivedNum = ntohl(receivedNum);
 
   // Restart socket on new port number
-
   close(sockfd);
-  // Set port number and host name
-  portno = receivedNum; // set to new port number
-  sockfd = socket(AF_INET, SOCK_STREAM, 0);
+  serv_addr.sin_port = htons(receivedNum);
+  sockfd = connectRetry(&serv_addr, &config->policy);
   if (sockfd < 0)
-    error("ERROR opening socket");
-  server = gethostbyname("localhost");
-  if (server == NULL)
+    error("ERROR connecting");
+  transportSetup(&serverLink, sockfd, config->transport);
+  traceSpan(TRACE_REDIRECT, phase, 0);
+
+  // Tracing and framing announce themselves in an extended header
+  if (flags != 0 && frameSendStart(sockfd, flags, traceRing.request,
+                                   netDeadline(config->sendMs)) < 0)
+    error("ERROR writing request header");
+  if (config->framed)
   {
-    fprintf(stderr,"ERROR, no such host\n");
-    exit(0);
+    if (config->stream == NULL)
+      exchangeFramed(config, sockfd, txtBuffer, keyBuffer, outBuffer);
+    else if (streamExchange(config->stream, sockfd, &config->output,
+                            "otp_dec_d", config->sendMs, config->recvMs) < 0)
+    {
+      fprintf(stderr, "ERROR: %s\n", config->stream->error);
+      exit(1);
+    }
+    close(sockfd);
+    traceSpan(TRACE_REQUEST, start, 0);
+    return;
   }
-  // Set server address
-  bzero((char *) &serv_addr, sizeof(serv_addr));
-  serv_addr.sin_family = AF_INET;
-  bcopy((char *)server->h_addr,
-        (char *)&serv_addr.sin_addr.s_addr,
-        server->h_length);
-  serv_addr.sin_port = htons(portno);
-  // Connect to the server
-  do
-  {
-  connectStatus =
-    connect(sockfd, (struct sockaddr *) &serv_addr, sizeof(serv_addr));
-  if (connectStatus < 0)
-    perror("ERROR connecting");
-  } while (connectStatus < 0);
 
   /******** Begin data exchange with server *********/
 
-  // Write the data size of ciphertext to the socket
-  dataSizeNum = strlen(txtBuffer);
-  convertedNum = htonl(dataSizeNum);
-  returnStatus = write(sockfd, &convertedNum, sizeof(convertedNum));
-  if (returnStatus < 0)
-    error("ERROR writing data size");
-  // Write ciphertext to the socket
-  writeSock(sockfd, txtBuffer);
-
-  // Write the data size of the key to the socket
-  dataSizeNum = strlen(keyBuffer);
-  convertedNum = htonl(dataSizeNum);
-  returnStatus = write(sockfd, &convertedNum, sizeof(convertedNum));
-  if (returnStatus < 0)
-    error("ERROR writing data size");
-  // Write key to the socket
-  writeSock(sockfd, keyBuffer);
+  // The whole request must be sent before the send deadline
+  phase = traceNow();
+  deadline = netDeadline(config->sendMs);
+
+  // Write the data sizes, ciphertext and key as one request
+  textSize = htonl(strlen(txtBuffer));
+  parts[0].iov_base = &textSize;
+  parts[0].iov_len = sizeof(textSize);
+  parts[1].iov_base = txtBuffer;
+  parts[1].iov_len = strlen(txtBuffer);
+  if (config->seed == NULL)
+  {
+    keySize = htonl(strlen(keyBuffer));
+    parts[2].iov_base = &keySize;
+    parts[2].iov_len = sizeof(keySize);
+    parts[3].iov_base = keyBuffer;
+    parts[3].iov_len = strlen(keyBuffer);
+    count = 4;
+  }
+  if (transportSend(&serverLink, parts, count, deadline) < 0)
+    error("ERROR writing to socket");
 
-  // Read the data size of plaintext
-  returnStatus = read(sockfd, &receivedNum, sizeof(receivedNum));
-  if (returnStatus > 0)
-    receivedNum = ntohl(receivedNum);
-  else
-    fprintf(stderr, "ERROR receiving data size: %d\n", returnStatus);
-  // Read plaintext from the socket
-  readSock(sockfd, plainBuffer, receivedNum);
+  // A seed descriptor names the key instead of carrying it
+  if (config->seed != NULL &&
+      seedSendDescriptor(sockfd, config->seed, deadline) < 0)
+    error("ERROR writing seed descriptor");
+
+  traceSpan(TRACE_SEND, phase, 0);
 
-  printf("%s", plainBuffer);
+  // The whole response must arrive before the receive deadline
+  phase = traceNow();
+  deadline = netDeadline(config->recvMs);
+
+  // Read the data size of plaintext
+  if (readFull(sockfd, &receivedNum, sizeof(receivedNum), deadline) < 0)
+    error("ERROR receiving data size");
+  receivedNum = ntohl(receivedNum);
+  // Read plaintext from the socket, or pass it straight to the output
+  if (outBuffer != NULL)
+    readSock(sockfd, outBuffer, receivedNum, deadline);
+  else if (receivedNum < 0 || receivedNum > BUFF_SIZE - 1)
+  {
+    fprintf(stderr, "ERROR: server sent bad data size %d\n", receivedNum);
+    exit(1);
+  }
+  else if (outputFromSocket(&config->output, sockfd, receivedNum,
+                            deadline) < 0)
+    error("ERROR forwarding reply");
+  traceSpan(TRACE_RECEIVE, phase, 0);
 
   close(sockfd);
-  return 0;
+  traceSpan(TRACE_REQUEST, start, 0);
 }
 
 /*********************************************************************
- ** writeSock
- ** Description: Writes data to the specified socket from the
- ** specified buffer in "chunks" of 1000 bytes.
- ** Parameters: int sockfd, char* buffer
+ ** exchangeFramed
+ ** Description: Runs after the extended header. Sends the ciphertext
+ ** in authenticated frames of up to FRAME_CHUNK symbols and reads
+ ** each plaintext frame back into outBuffer, newline terminated.
+ ** keyBuffer holds FRAME_KEY_LENGTH(text length) pad symbols: each
+ ** frame's cipher key followed by its two MAC keys. A frame whose
+ ** reply is missing, misnumbered or fails its tag stops the program
+ ** with an error.
+ ** Parameters: struct clientConfig* config, int sockfd,
+ ** char* txtBuffer, char* keyBuffer, char* outBuffer
  *********************************************************************/
-void writeSock(int sockfd, char* buffer)
+void exchangeFramed(struct clientConfig* config, int sockfd,
+                    char* txtBuffer, char* keyBuffer, char* outBuffer)
 {
-  int bytesWrit,
-      totalBytesWrit = 0,
-      index,
-      tempIndex;
-  char tempBuffer[BUFF_SIZE];
+  struct frameHeader frame,
+                     reply;
+  uint64_t tag,
+           phase;
+  uint8_t *text = (uint8_t*) txtBuffer,
+          *key = (uint8_t*) keyBuffer,
+          *out = (uint8_t*) outBuffer;
+  size_t textLen = strcspn(txtBuffer, "\n"),
+         done = 0;
+  long deadline;
+
+  // One frame at a time; the empty frame ends the request
+  frame.sequence = 0;
+  do
+  {
+    frame.length = textLen - done < FRAME_CHUNK ? textLen - done
+                                                : FRAME_CHUNK;
+    phase = traceNow();
+    deadline = netDeadline(config->sendMs);
+    if (frameSend(sockfd, &frame, text + done, frame.length, key,
+                  frame.length + FRAME_KEY_EXTRA,
+                  frameTag(&frame, text + done, key, key + frame.length),
+                  deadline) < 0)
+      error("ERROR writing frame");
+    traceSpan(TRACE_SEND, phase, frame.sequence);
+
+    // The daemon closes the connection rather than answer a bad frame
+    phase = traceNow();
+    deadline = netDeadline(config->recvMs);
+    if (frameRecvHeader(sockfd, &reply, deadline) < 0)
+    {
+      fprintf(stderr, "ERROR: otp_dec_d did not answer frame %u: %s\n",
+              frame.sequence, strerror(errno));
+      exit(1);
+    }
+    if (reply.sequence != frame.sequence || reply.length != frame.length)
+    {
+      fprintf(stderr, "ERROR: otp_dec_d answered frame %u with frame %u\n",
+              frame.sequence, reply.sequence);
+      exit(1);
+    }
+    if (readFull(sockfd, out + done, reply.length, deadline) < 0 ||
+        frameRecvTag(sockfd, &tag, deadline) < 0)
+      error("ERROR receiving frame");
+    traceSpan(TRACE_RECEIVE, phase, frame.sequence);
+    if (frameTag(&reply, text + done, out + done,
+                 key + frame.length + MAC_KEY_SYMBOLS) != tag)
+    {
+      fprintf(stderr, "ERROR: frame %u from otp_dec_d failed authentication\n",
+              frame.sequence);
+      exit(1);
+    }
 
-  bytesWrit = write(sockfd, buffer, strlen(buffer));
+    done += frame.length;
+    key += frame.length + FRAME_KEY_EXTRA;
+    frame.sequence++;
+  } while (frame.length > 0);
 
-  if (bytesWrit < 0)
-    error("ERROR writing to socket");
-  else if (bytesWrit < strlen(buffer))
+  outBuffer[textLen] = '\n';
+  outBuffer[textLen + 1] = '\0';
+}
+
+/*********************************************************************
+ ** runBatch
+ ** Description: Processes every file named by inputPath (a directory
+ ** or a manifest with one path per line). File i uses the pad slice
+ ** that starts where file i-1's slice ended, beginning at padOffset,
+ ** so the same order and offset reproduce the same slices in
+ ** otp_enc. Up to inFlight requests run at once, each in its own
+ ** child, and results are renamed into outDir only when complete.
+ ** Prints a run summary and returns 0 if every file succeeded.
+ ** Parameters: struct clientConfig* config, char* inputPath,
+ ** char* keyFile, char* outDir, int inFlight, long padOffset
+ *********************************************************************/
+int runBatch(struct clientConfig* config, char* inputPath, char* keyFile,
+             char* outDir, int inFlight, long padOffset)
+{
+  int fileCount,
+      next = 0,
+      running = 0,
+      succeeded = 0,
+      failed = 0,
+      childStatus,
+      groupSize,
+      index,
+      textLen;
+  long totalBytes = 0;
+  ssize_t keyLen,
+          keyNeed;
+  size_t keySlot = FRAME_KEY_LENGTH(BUFF_SIZE);  // room for MAC keys
+  double elapsed;
+  char** paths;
+  char* txtBuffer;
+  char* keyBuffer;
+  char* texts;       // one BUFF_SIZE text slot per request in the group
+  char* keys;        // and one keySlot for the pad slice it uses
+  int* groupFiles;   // index into paths of each request in the group
+  char outBuffer[BUFF_SIZE];
+  struct padReader pad;
+  struct timespec start,
+                  finish;
+  FILE* filePtr;
+  pid_t childPID;
+
+  fileCount = listInputs(inputPath, &paths);
+  if (padOpen(&pad, keyFile, padOffset, PAD_CHUNK_SIZE) < 0)
+  {
+    fprintf(stderr, "could not open key file\n");
+    exit(1);
+  }
+  texts = malloc((size_t) inFlight * BUFF_SIZE);
+  keys = malloc(inFlight * keySlot);
+  groupFiles = malloc(sizeof(int) * inFlight);
+  if (texts == NULL || keys == NULL || groupFiles == NULL)
+    error("ERROR allocating batch buffers");
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  while (next < fileCount || running > 0)
   {
-    // Continue to write until all data has been sent
-    while (totalBytesWrit != strlen(buffer))
+    // Read and slice a group of files for every free slot
+    groupSize = 0;
+    while (next < fileCount && running + groupSize < inFlight)
     {
-      totalBytesWrit += bytesWrit;
-      index = totalBytesWrit + 1;
-      tempIndex = 0;
-      do
-      // Copy remaining data to be written until temp buffer
+      txtBuffer = texts + (size_t) groupSize * BUFF_SIZE;
+      filePtr = fopen(paths[next], "r");
+      if (filePtr == NULL)
       {
-        tempBuffer[tempIndex] = buffer[index];
-        index++;
-        tempIndex++;
-      } while (buffer[index] != '\0');
+        fprintf(stderr, "could not open ciphertext file %s\n", paths[next]);
+        failed++;
+        next++;
+        continue;
+      }
+      bzero(txtBuffer, BUFF_SIZE);
+      fgets(txtBuffer, BUFF_SIZE - 1, filePtr);
+      fclose(filePtr);
+
+      // The daemon expects a trailing newline, which uses no key
+      textLen = strlen(txtBuffer);
+      if (textLen == 0 || txtBuffer[textLen - 1] != '\n')
+        txtBuffer[textLen++] = '\n';
+      textLen--;
+
+      if (!validChars(txtBuffer, paths[next]))
+      {
+        failed++;
+        next++;
+        continue;
+      }
+
+      // The next slice streams in while earlier requests are running
+      keyBuffer = keys + groupSize * keySlot;
+      keyNeed = config->framed ? FRAME_KEY_LENGTH(textLen) : textLen;
+      keyLen = padRead(&pad, keyBuffer, keyNeed);
+      if (keyLen < keyNeed)
+      {
+        if (keyLen < 0)
+          perror("ERROR reading key file");
+        else
+          fprintf(stderr, "ERROR: key %s is too short for %s\n",
+                  keyFile, paths[next]);
+        failed += fileCount - next;
+        next = fileCount;
+        break;
+      }
+      keyBuffer[keyNeed] = '\0';
+      if (!validChars(keyBuffer, keyFile))
+      {
+        failed += fileCount - next;
+        next = fileCount;
+        break;
+      }
+
+      groupFiles[groupSize] = next;
+      padOffset += keyNeed;
+      totalBytes += textLen;
+      groupSize++;
+      next++;
+    }
 
-      bytesWrit = write(sockfd, tempBuffer, strlen(tempBuffer));
+    for (index = 0; index < groupSize; index++)
+    {
+      childPID = fork();
+      if (childPID < 0)
+        error("fork failed");
+      if (childPID == 0)
+      {
+        sendRequest(config, texts + (size_t) index * BUFF_SIZE,
+                    keys + index * keySlot, outBuffer);
+        exit(writeAtomic(outDir, paths[groupFiles[index]],
+                         config->compress ? expandText(outBuffer)
+                                          : outBuffer) < 0);
+      }
+      running++;
     }
+
+    // All slots are busy (or no files are left): wait for one
+    if (running == 0)
+      continue;
+    if (wait(&childStatus) < 0)
+      break;
+    running--;
+    if (WIFEXITED(childStatus) && WEXITSTATUS(childStatus) == 0)
+      succeeded++;
+    else
+      failed++;
   }
+
+  clock_gettime(CLOCK_MONOTONIC, &finish);
+  elapsed = (finish.tv_sec - start.tv_sec) +
+            (finish.tv_nsec - start.tv_nsec) / 1e9;
+  if (elapsed <= 0)
+    elapsed = 1e-9;
+
+  fprintf(stderr, "batch: %d ok, %d failed, %ld bytes in %.3f s "
+          "(%.1f files/s, %.2f MB/s), next pad offset %ld, "
+          "%lu pad stalls\n",
+          succeeded, failed, totalBytes, elapsed, succeeded / elapsed,
+          totalBytes / elapsed / 1e6, padOffset, pad.waits);
+
+  padClose(&pad);
+  free(groupFiles);
+  free(keys);
+  free(texts);
+  return failed > 0;
 }
 
 /*********************************************************************
- ** readSock
- ** Description: Reads data from the specified socket to the specified
- ** buffer. Takes the total data size to be read as a parameter
- ** Parameters: int sockfd, char* buffer, int size
+ ** listInputs
+ ** Description: Fills paths with the batch input files. A directory
+ ** contributes its regular, non-hidden files in name order so that
+ ** pad slices are reproducible. Any other file is read as a manifest
+ ** of paths, one per line. Returns the number of paths.
+ ** Parameters: char* inputPath, char*** paths
  *********************************************************************/
-void readSock(int sockfd, char* buffer, int size)
+int listInputs(char* inputPath, char*** paths)
 {
-  char tempBuffer[BUFF_SIZE];
-  int bytesRead;
+  int count = 0,
+      capacity = 64;
+  char line[4096];
+  struct stat info;
+  struct dirent* entry;
+  DIR* dirPtr;
+  FILE* filePtr;
 
-  bzero(buffer, BUFF_SIZE);
-  do
+  *paths = malloc(sizeof(char*) * capacity);
+  if (*paths == NULL)
+    error("ERROR allocating file list");
+
+  if (stat(inputPath, &info) < 0)
+    error("ERROR reading batch input");
+
+  if (S_ISDIR(info.st_mode))
   {
-    bzero(tempBuffer, BUFF_SIZE);
-    // Continue reading into temp buffer until buffer length = size
-    bytesRead = read(sockfd, tempBuffer, size);
-    if (bytesRead < 0)
-      error("ERROR reading from socket");
+    dirPtr = opendir(inputPath);
+    if (dirPtr == NULL)
+      error("ERROR opening batch directory");
+    while ((entry = readdir(dirPtr)) != NULL)
+    {
+      if (entry->d_name[0] == '.')
+        continue;
+      snprintf(line, sizeof(line), "%s/%s", inputPath, entry->d_name);
+      if (stat(line, &info) < 0 || !S_ISREG(info.st_mode))
+        continue;
+      if (count == capacity)
+      {
+        capacity *= 2;
+        *paths = realloc(*paths, sizeof(char*) * capacity);
+        if (*paths == NULL)
+          error("ERROR allocating file list");
+      }
+      (*paths)[count++] = strdup(line);
+    }
+    closedir(dirPtr);
+    qsort(*paths, count, sizeof(char*), compareNames);
+  }
+  else
+  {
+    filePtr = fopen(inputPath, "r");
+    if (filePtr == NULL)
+      error("ERROR opening batch manifest");
+    while (fgets(line, sizeof(line), filePtr) != NULL)
+    {
+      line[strcspn(line, "\n")] = '\0';
+      if (line[0] == '\0')
+        continue;
+      if (count == capacity)
+      {
+        capacity *= 2;
+        *paths = realloc(*paths, sizeof(char*) * capacity);
+        if (*paths == NULL)
+          error("ERROR allocating file list");
+      }
+      (*paths)[count++] = strdup(line);
+    }
+    fclose(filePtr);
+  }
+
+  return count;
+}
+
+/*********************************************************************
+ ** compareNames
+ ** Description: qsort comparator for an array of strings
+ ** Parameters: const void* a, const void* b
+ *********************************************************************/
+int compareNames(const void* a, const void* b)
+{
+  return strcmp(*(char* const*) a, *(char* const*) b);
+}
 
-    strcat(buffer, tempBuffer);
+/*********************************************************************
+ ** writeAtomic
+ ** Description: Writes data to outDir/basename(path) through a
+ ** temporary file that is renamed into place, so readers never see
+ ** a partial result. Returns 0 on success, -1 on failure.
+ ** Parameters: char* outDir, char* path, char* data
+ *********************************************************************/
+int writeAtomic(char* outDir, char* path, char* data)
+{
+  char tmpPath[4096],
+       outPath[4096],
+       nameBuffer[4096];
+  char* name;
+  FILE* filePtr;
+
+  strncpy(nameBuffer, path, sizeof(nameBuffer) - 1);
+  nameBuffer[sizeof(nameBuffer) - 1] = '\0';
+  name = basename(nameBuffer);
+  snprintf(outPath, sizeof(outPath), "%s/%s", outDir, name);
+  snprintf(tmpPath, sizeof(tmpPath), "%s/.%s.%d.tmp", outDir, name,
+           (int) getpid());
+
+  filePtr = fopen(tmpPath, "w");
+  if (filePtr == NULL)
+  {
+    perror(tmpPath);
+    return -1;
+  }
+  if (fputs(data, filePtr) == EOF || fclose(filePtr) == EOF ||
+      rename(tmpPath, outPath) < 0)
+  {
+    perror(outPath);
+    unlink(tmpPath);
+    return -1;
+  }
+  return 0;
+}
+
+/*********************************************************************
+ ** readSock
+ ** Description: Reads data from the specified socket to the specified
+ ** buffer. Takes the total data size to be read as a parameter and
+ ** exits with an error if the server closes early, sends more than
+ ** the buffer holds, or misses the deadline.
+ ** Parameters: int sockfd, char* buffer, int size, long deadline
+ *********************************************************************/
+void readSock(int sockfd, char* buffer, int size, long deadline)
+{
+  if (size < 0 || size > BUFF_SIZE - 1)
+  {
+    fprintf(stderr, "ERROR: server sent bad data size %d\n", size);
+    exit(1);
   }
-  while (strlen(buffer) != size);
+  if (readFull(sockfd, buffer, size, deadline) < 0)
+    error("ERROR reading from socket");
+  buffer[size] = '\0';
 }
 
 /*********************************************************************
  ** validChars
  ** Description: Checks string buffer for valid input, i.e.
- ** 'A' through 'Z' or space. Returns true or false.
- ** Parameters: char* buffer
+ ** 'A' through 'Z' or space and at most a final newline, 32-64 bytes
+ ** at a time with the fastest cipher engine (otp_cipher.h). Reports
+ ** the first bad character and its offset in the file at path.
+ ** Returns true or false.
+ ** Parameters: char* buffer, const char* path
  *********************************************************************/
-int validChars(char* buffer)
+int validChars(char* buffer, const char* path)
 {
-  int index = 0;
+  size_t length = strlen(buffer),
+         index;
 
-  while (buffer[index] != '\0')
+  // The file's newline ends it; anywhere else it is a bad character
+  if (length > 0 && buffer[length - 1] == '\n')
+    length--;
+  index = symbolsFindInvalid((const uint8_t*) buffer, length);
+
+  if (index < length)
   {
-    if (buffer[index] < 'A' || buffer[index] > 'Z')
-    {
-     if (buffer[index] != ' ' && buffer[index] != '\n')
-       return 0;  // false: chars are bad
-    }
-    index++;
+    fprintf(stderr, "ERROR: bad character 0x%02x at offset %zu in %s\n",
+            (uint8_t) buffer[index], index, path);
+    return 0;     // false: chars are bad
   }
   return 1;       // true: chars are valid
 }
@@ -6,6 +6,8 @@
  ** Description: Daemon that performs one-time pad encryption
  *********************************************************************/
 
+#define _GNU_SOURCE  // CPU affinity in otp_cpu.h
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -15,176 +17,497 @@
 #include <netinet/in.h>
 #include <time.h>
 #include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include "otp_net.h"
+#include "otp_arena.h"
+#include "otp_cipher.h"
+#include "otp_cpu.h"
+#include "otp_event.h"
+#include "otp_frame.h"
+#include "otp_request.h"
+#include "otp_trace.h"
+#include "otp_transport.h"
 
-const int ASCII_SPACE = 32;
 const int BUFF_SIZE = 70000;
-const int MIN_PORT = 50000;
-const int MAX_PORT = 65535;
+const int BUSY_ID = 3;  // identifier sent instead of 1 when overloaded
+
+// Admission control defaults (see usage for the matching options)
+const int DEFAULT_BACKLOG = 128;
+const int DEFAULT_MAX_INFLIGHT = 32;
+const int DEFAULT_QUEUE_LEN = 64;
+const int DEFAULT_QUEUE_TIMEOUT = 2000;  // milliseconds
+const int DEFAULT_ARENA_SIZE = 16384;    // covers typical requests
+const int MAX_WORKERS = 1024;            // prefork mode (-p)
+const int RESPAWN_DELAY_MS = 100;        // after a worker crashes
+const int CLIENT_TIMEOUT = 10000;        // ms a client may stall a child
+const int WORKER_REDIRECT_MS = 1000;     // ms a worker waits on a redirect
+const int KEEPALIVE_IDLE = 30000;        // ms -k holds an idle connection
+#define MAX_WEIGHT_RULES 16               // -W address blocks
+
+// Environment variables that carry descriptors across a hot reload
+const char* LISTEN_FD_ENV = "OTP_LISTEN_FD";
+const char* READY_FD_ENV = "OTP_READY_FD";
+
+// Redirect listeners opened at startup for a -P port range
+struct portPool
+{
+  int count;
+  int* fds;       // listening sockets
+  int* ports;
+  pid_t* owners;  // child using each listener, 0 while it is free
+};
+
+// -E: a connection served by a coroutine in the event loop
+struct requestTask
+{
+  struct eventTask task;  // first, so the loop's pointer is this one
+  uint32_t word,          // size or header being read, network order
+           reply;         // size of the reply, network order
+  uint32_t words[6];      // request ID or seed descriptor being read
+  struct otpRequest request;  // text and key are malloc'd
+  struct arena keyArena;      // or the key, derived from the seed
+  struct iovec parts[2];
+};
+
+// -W: the share of each round given to clients from one address block
+struct weightRule
+{
+  uint32_t addr,  // network order, already masked
+           mask;
+  int weight;
+};
+
+// Client accepted by the parent but still waiting for a free slot
+struct pendingClient
+{
+  int sockfd;
+  long arrival;  // monotonic time of accept in milliseconds
+};
+
+int sigPipe[2];  // signal handlers wake the accept loop through this
+volatile sig_atomic_t reloadRequested = 0;  // set by SIGHUP
+int verbose = 0;
+struct arena requestArena;  // request buffers, reset after each request
+struct cipherEngine* cipher;  // engine chosen at startup
+struct portPool redirectPool;  // empty unless -P was given
+int redirectSlot = -1;         // pool listener this process redirects to
+struct seedKey* padSeed = NULL;  // -K: derives FRAME_FLAG_SEED keys
+int keepAlive = 0;  // -k: serve requests until the client hangs up
+int transportProfile = -1;  // -L, latency under -k and plain otherwise
+struct transport clientLink;  // the child's connection to its client
+struct eventLoop eventLoop;  // -E: listeners and connections
+int eventLimit = 0;          // -E: connections at once, 0 forks instead
+int eventActive = 0;         // -E: connections open now
+int eventPort;               // -E: the redirect port every client gets
+int eventMaxBytes;
+long eventQuantum = EVENT_QUANTUM;  // -E -Q: cipher bytes per round
+struct weightRule weightRules[MAX_WEIGHT_RULES];  // -E -W
+int weightRuleCount = 0;
+int preforkWorker = 0;  // -p: this process outlives the clients it serves
 
 // Function prototypes
 void error(const char *msg);
-void readSock(int sockfd, char* buffer, int size);
-void writeSock(int sockfd, char* buffer);
-char* encrypt(char* plaintext, char* key);
+char* encrypt(char* plaintext, char* key, int size);
+int serveClient(int clientfd, int maxBytes);
+int nextRequest(int sockfd);
+int redirectClient(int clientfd);
+int openPortPool(const char* range, int want);
+int takePort();
+void releasePort(pid_t owner);
+int handleRequest(int sockfd, int maxBytes);
+int handleFramed(int sockfd, int maxBytes);
+void finishRequest(int textLen);
+int requestError(struct otpRequest* request);
+int dispatchClient(int clientfd, int listenfd, int maxBytes);
+void rejectClient(int clientfd);
+void onChildExit(int signo);
+void onReload(int signo);
+pid_t startReload(char* argv[], int listenfd, int* readyfd);
+void signalReady();
+long nowMs();
+int runPrefork(int portno, int backlog, int workers, char* cpuList,
+               int maxBytes);
+void runWorker(int listenfd, int cpu, int maxBytes);
+int runEvents(int listenfd, int backlog, int maxBytes);
+int acceptClients(struct eventTask* task);
+int acceptRequests(struct eventTask* task);
+int serveEvent(struct eventTask* task);
+int eventError(struct requestTask* state, const char* format, ...);
+void encryptQuantum(struct eventTask* task, size_t offset, size_t count);
+int parseWeights(const char* list);
+int clientWeight(const struct sockaddr_in* addr);
+void finishEvent(struct eventTask* task);
+int handOff(struct requestTask* state);
 
 int main(int argc, char *argv[])
 {
   int sockfd,
       newsockfd,
       portno,
-      receivedNum = 0, // int representing the data size sent
-      returnStatus,    // value returned from read or write
-      dataSizeNum,
-      convertedNum,
-      randPort,
-      childExitStatus = 0;
+      option,
+      backlog = DEFAULT_BACKLOG,
+      maxInFlight = DEFAULT_MAX_INFLIGHT,
+      queueLen = DEFAULT_QUEUE_LEN,
+      queueTimeout = DEFAULT_QUEUE_TIMEOUT,
+      maxBytes = BUFF_SIZE - 1,
+      inFlight = 0,    // number of forked children still running
+      queueHead = 0,
+      queueCount = 0,
+      pollTimeout,
+      reuse = 1,
+      workers = 0,     // prefork workers, 0 forks per request
+      readyfd = -1,    // read end of a pending reload's ready pipe
+      draining = 0;    // replaced by a new image, finishing up
+  long now;
+  char drain[64];
+  char* engineName = NULL;  // NULL picks the fastest engine
+  char* cpuList = NULL;     // NULL uses every allowed CPU
+  char* tracePath = NULL;   // -T: record spans for otp_trace2json
+  char* portRange = NULL;   // -P: redirect ports, NULL lets the kernel pick
+  char* seedPath = NULL;    // -K: seed file for descriptor requests
+  char* inherited;
+  pid_t childPID,
+        reloadPID = -1;
   socklen_t clilen;    // size of client address
-  char txtBuffer[BUFF_SIZE],
-       keyBuffer[BUFF_SIZE];
-  char* ciphertext;
   struct sockaddr_in serv_addr,
          cli_addr;
-  pid_t childPID;
+  struct pendingClient* queue;
+  struct pollfd fds[3];
+  struct sigaction sa;
 
+  // Parse admission control options
+  while ((option = getopt(argc, argv,
+                           "b:c:q:t:m:e:p:a:P:T:K:L:E:Q:W:kv")) != -1)
+  {
+    switch (option)
+    {
+      case 'b': backlog = atoi(optarg); break;
+      case 'c': maxInFlight = atoi(optarg); break;
+      case 'q': queueLen = atoi(optarg); break;
+      case 't': queueTimeout = atoi(optarg); break;
+      case 'm': maxBytes = atoi(optarg); break;
+      case 'e': engineName = optarg; break;
+      case 'p': workers = atoi(optarg); break;
+      case 'a': cpuList = optarg; break;
+      case 'P': portRange = optarg; break;
+      case 'T': tracePath = optarg; break;
+      case 'K': seedPath = optarg; break;
+      case 'L':
+        transportProfile = transportParse(optarg);
+        if (transportProfile < 0)
+        {
+          fprintf(stderr, "ERROR, unknown transport profile %s\n",
+                  optarg);
+          exit(1);
+        }
+        break;
+      case 'E': eventLimit = atoi(optarg); break;
+      case 'Q': eventQuantum = atol(optarg); break;
+      case 'W':
+        if (parseWeights(optarg) < 0)
+        {
+          fprintf(stderr, "ERROR, bad client weights %s\n", optarg);
+          exit(1);
+        }
+        break;
+      case 'k': keepAlive = 1; break;
+      case 'v': verbose = 1; break;
+      default:
+        fprintf(stderr, "usage: %s [-b backlog] [-c maxInFlight] "
+                "[-q queueLen] [-t queueTimeoutMs] [-m maxBytes] [-e engine] "
+                "[-p workers [-a cpuList] | -E connections [-Q quantum] "
+                "[-W addr[/bits]=weight,...]] "
+                "[-P lowPort-highPort] [-T traceFile] [-K seedFile] "
+                "[-L plain|latency|bulk] [-k] [-v] port\n",
+                argv[0]);
+        exit(1);
+    }
+  }
 
   // Check if user provided a port
-  if (argc < 2)
+  if (optind >= argc)
   {
     fprintf(stderr,"ERROR, no port provided\n");
     exit(1);
   }
+  if (backlog < 1 || maxInFlight < 1 || queueLen < 0 || queueTimeout < 0)
+  {
+    fprintf(stderr, "ERROR, admission limits must be positive\n");
+    exit(1);
+  }
+  if (maxBytes < 1)
+    maxBytes = BUFF_SIZE - 1;
+  // Kept-alive connections leave TCP quickack, so a plain reply would
+  // wait on Nagle for the client's delayed ACK every request
+  if (transportProfile < 0)
+    transportProfile = keepAlive ? TRANSPORT_LATENCY : TRANSPORT_PLAIN;
+  if (workers < 0 || workers > MAX_WORKERS)
+  {
+    fprintf(stderr, "ERROR, workers must be between 0 and %d\n",
+            MAX_WORKERS);
+    exit(1);
+  }
+  if (eventLimit < 0 || (eventLimit > 0 && workers > 0))
+  {
+    fprintf(stderr, "ERROR, -E takes a positive limit and excludes -p\n");
+    exit(1);
+  }
+  if (eventQuantum < 1)
+  {
+    fprintf(stderr, "ERROR, -Q takes a positive number of bytes\n");
+    exit(1);
+  }
 
-  // Open the socket
-  sockfd = socket(AF_INET, SOCK_STREAM, 0);
-  if (sockfd < 0)
-    error("ERROR opening socket");
+  // Check every cipher engine against the scalar one, then pick one
+  cipherSelfTest();
+  cipher = cipherSelect(engineName);
+  if (cipher == NULL)
+  {
+    fprintf(stderr, "ERROR, cipher engine %s is not available\n",
+            engineName);
+    exit(1);
+  }
+  if (verbose)
+    fprintf(stderr, "using %s cipher engine\n", cipher->name);
 
-  // Set server address and port number
-  bzero((char *) &serv_addr, sizeof(serv_addr)); // reset to zero's
-  portno = atoi(argv[1]);
-  serv_addr.sin_family = AF_INET;
-  serv_addr.sin_port = htons(portno);
-  serv_addr.sin_addr.s_addr = INADDR_ANY;
+  if (tracePath != NULL && traceOpen(tracePath) < 0)
+    error("ERROR opening trace file");
 
-  // Bind socket to address and start listening
-  if (bind(sockfd, (struct sockaddr *) &serv_addr, sizeof(serv_addr)) < 0)
-    error("ERROR on initial binding");
-  listen(sockfd, 5);
+  // Seed-derived keys are not one-time pads; see otp_seed.h
+  if (seedPath != NULL)
+  {
+    padSeed = malloc(sizeof(struct seedKey));
+    if (padSeed == NULL || seedLoad(padSeed, seedPath) < 0)
+      error("ERROR loading seed file");
+    if (verbose)
+      fprintf(stderr, "serving keys of seed %016llx\n",
+              (unsigned long long) padSeed->id);
+  }
 
-  /******** Accept a client and get new socket file descriptor ********/
+  // Children inherit a warm arena, so small requests never call malloc
+  if (arenaInit(&requestArena, DEFAULT_ARENA_SIZE) < 0)
+    error("ERROR allocating request arena");
 
-  // Loop infinitely in the parent process to accept clients
-  // Loop ends in child when process completes successfully
-  while (childExitStatus == 0)
+  // A fixed port range gets one listener per concurrent child, opened
+  // once here instead of a bind per request
+  if (portRange != NULL)
   {
-    clilen = sizeof(cli_addr);
-    newsockfd = accept(sockfd, (struct sockaddr *) &cli_addr, &clilen);
-    if (newsockfd < 0)
-      error("ERROR on accept");
-    else
+    option = openPortPool(portRange, workers > 0 ? workers : maxInFlight);
+    if (option < 0)
     {
-      // Send valid identifier to otp_enc
-      dataSizeNum = 1;
-      convertedNum = htonl(dataSizeNum);
-      returnStatus = write(newsockfd, &convertedNum, sizeof(convertedNum));
+      fprintf(stderr, "ERROR, bad port range %s\n", portRange);
+      exit(1);
     }
+    if (option < (workers > 0 ? workers : 1))
+    {
+      fprintf(stderr, "ERROR, only %d free ports in %s\n", option,
+              portRange);
+      exit(1);
+    }
+    if (option < maxInFlight)
+    {
+      maxInFlight = option;
+      if (verbose)
+        fprintf(stderr, "only %d free ports in %s, serving %d at once\n",
+                option, portRange, maxInFlight);
+    }
+  }
+
+  // Prefork mode: pinned workers serve requests themselves
+  if (workers > 0)
+    return runPrefork(atoi(argv[optind]), backlog, workers, cpuList,
+                      maxBytes);
 
-    /******** Fork a new process ********/
+  queue = malloc(sizeof(struct pendingClient) * (queueLen + 1));
+  if (queue == NULL)
+    error("ERROR allocating client queue");
 
-    childPID = fork();
+  // Reap children from a signal handler that only pokes the self-pipe
+  if (pipe(sigPipe) < 0)
+    error("ERROR creating signal pipe");
+  fcntl(sigPipe[0], F_SETFL, O_NONBLOCK);
+  fcntl(sigPipe[1], F_SETFL, O_NONBLOCK);
+  fcntl(sigPipe[0], F_SETFD, FD_CLOEXEC);
+  fcntl(sigPipe[1], F_SETFD, FD_CLOEXEC);
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = onChildExit;
+  sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+  sigaction(SIGCHLD, &sa, NULL);
+  sa.sa_handler = onReload;
+  sa.sa_flags = SA_RESTART;
+  sigaction(SIGHUP, &sa, NULL);
 
-    switch (childPID)
+  // A reloading predecessor hands over its listening socket
+  inherited = getenv(LISTEN_FD_ENV);
+  if (inherited != NULL)
+  {
+    sockfd = atoi(inherited);
+    unsetenv(LISTEN_FD_ENV);
+    if (fcntl(sockfd, F_GETFD) < 0)
+      error("ERROR on inherited listening socket");
+    if (verbose)
+      fprintf(stderr, "%d: took over listening socket %d\n",
+              (int) getpid(), sockfd);
+  }
+  else
+  {
+    // Open the socket
+    sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (sockfd < 0)
+      error("ERROR opening socket");
+
+    // Let a restarted daemon rebind while old connections are in TIME_WAIT
+    setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    // Set server address and port number
+    bzero((char *) &serv_addr, sizeof(serv_addr)); // reset to zero's
+    portno = atoi(argv[optind]);
+    serv_addr.sin_family = AF_INET;
+    serv_addr.sin_port = htons(portno);
+    serv_addr.sin_addr.s_addr = INADDR_ANY;
+
+    // Bind socket to address and start listening
+    if (bind(sockfd, (struct sockaddr *) &serv_addr, sizeof(serv_addr)) < 0)
+      error("ERROR on initial binding");
+    listen(sockfd, backlog);
+  }
+  fcntl(sockfd, F_SETFL, O_NONBLOCK);
+  fcntl(sockfd, F_SETFD, FD_CLOEXEC);  // only a reload passes it on
+
+  // Tell the predecessor (if any) that it can stop accepting
+  signalReady();
+
+  // Event mode: this process serves every connection itself
+  if (eventLimit > 0)
+    return runEvents(sockfd, backlog, maxBytes);
+
+  /******** Accept clients, queue them, and fork up to maxInFlight ********/
+
+  fds[0].fd = sockfd;
+  fds[0].events = POLLIN;
+  fds[1].fd = sigPipe[0];
+  fds[1].events = POLLIN;
+  fds[2].fd = -1;  // ready pipe, only watched during a reload
+  fds[2].events = POLLIN;
+
+  while (1)
+  {
+    // Collect finished children to free their slots
+    while ((childPID = waitpid(-1, NULL, WNOHANG)) > 0)
+      if (childPID != reloadPID)  // the new image is not a request
+      {
+        inFlight--;
+        releasePort(childPID);
+      }
+
+    // Tell clients that waited too long that the server is busy
+    now = nowMs();
+    while (queueCount > 0 && now - queue[queueHead].arrival >= queueTimeout)
     {
-      case -1: // Fork failure
-        printf("fork failed\n");
-        fflush(stdout);
-        exit(1);
-        break;
+      rejectClient(queue[queueHead].sockfd);
+      queueHead = (queueHead + 1) % (queueLen + 1);
+      queueCount--;
+    }
 
-      case 0: // Child: Connect to client and exchange data
-        // Restart on new port and wait for client
-
-        // Generate new random port number for client
-        srand(time(NULL));
-        randPort = rand() % (MAX_PORT + 1 - MIN_PORT) + MIN_PORT;
-
-        // Open the socket
-        sockfd = socket(AF_INET, SOCK_STREAM, 0);
-        if (sockfd < 0)
-          error("ERROR opening socket");
-        // Set server address and port number
-        bzero((char *) &serv_addr, sizeof(serv_addr));
-        portno = randPort;  // set to new random port number
-        serv_addr.sin_family = AF_INET;
-        serv_addr.sin_port = htons(portno);
-        serv_addr.sin_addr.s_addr = INADDR_ANY;
-
-        // Bind socket to address and start listening
-        while (bind(sockfd, (struct sockaddr *) &serv_addr,
-               sizeof(serv_addr)) < 0)
-        {
-          randPort = rand() % (MAX_PORT + 1 - MIN_PORT) + MIN_PORT;
-          bzero((char *) &serv_addr, sizeof(serv_addr));
-          portno = randPort;  // set to new random port number
-          serv_addr.sin_family = AF_INET;
-          serv_addr.sin_port = htons(portno);
-          serv_addr.sin_addr.s_addr = INADDR_ANY;
-        }
+    // Hand queued clients to children while slots are free
+    while (queueCount > 0 && inFlight < maxInFlight)
+    {
+      newsockfd = queue[queueHead].sockfd;
+      queueHead = (queueHead + 1) % (queueLen + 1);
+      queueCount--;
+      if (dispatchClient(newsockfd, sockfd, maxBytes) == 0)
+        inFlight++;
+    }
 
-        // Send new port number to client
-        convertedNum = htonl(randPort);
-        returnStatus = write(newsockfd, &convertedNum, sizeof(convertedNum));
-        if (returnStatus < 0)
-          error("ERROR sending port number to client");
-
-        listen(sockfd, 1); // allow 1 client only
-        // Accept client and get new socket file descriptor
-        clilen = sizeof(cli_addr);
-        newsockfd = accept(sockfd, (struct sockaddr *) &cli_addr, &clilen);
-        if (newsockfd < 0)
-          error("ERROR on accept");
-
-        /******** Start data exchange ********/
-
-        // Read data size of plaintext
-        returnStatus = read(newsockfd, &receivedNum, sizeof(receivedNum));
-        if (returnStatus > 0)
-          receivedNum = ntohl(receivedNum);
-        else
-          error("ERROR reading data size");
-        // Read the plaintext from socket
-        readSock(newsockfd, txtBuffer, receivedNum);
-
-        // Read data size of key
-        returnStatus = read(newsockfd, &receivedNum, sizeof(receivedNum));
-        if (returnStatus > 0)
-        {
-          receivedNum = ntohl(receivedNum);
-        }
-        else
-          error("ERROR reading data size");
-        // Read key from socket
-        readSock(newsockfd, keyBuffer, receivedNum);
-
-        // Perform the encryption
-        ciphertext = encrypt(txtBuffer, keyBuffer);
-
-        // Write the data size of ciphertext back to the socket
-        dataSizeNum = strlen(ciphertext);
-        convertedNum = htonl(dataSizeNum);
-        returnStatus = write(newsockfd, &convertedNum, sizeof(convertedNum));
-        if (returnStatus < 0)
-          error("ERROR writing data size");
-        // Write ciphertext back to the socket
-        writeSock(newsockfd, ciphertext);
-
-        close(newsockfd);
+    // A replaced daemon exits once its last client is served
+    if (draining && inFlight == 0 && queueCount == 0)
+    {
+      if (verbose)
+        fprintf(stderr, "%d: drained, exiting\n", (int) getpid());
+      exit(0);
+    }
+
+    // Sleep until a client arrives, a child exits or a queued client expires
+    pollTimeout = -1;
+    if (queueCount > 0)
+      pollTimeout = queue[queueHead].arrival + queueTimeout - now;
+    if (poll(fds, 3, pollTimeout) < 0 && errno != EINTR)
+      error("ERROR on poll");
+
+    if (fds[1].revents & POLLIN)
+      while (read(sigPipe[0], drain, sizeof(drain)) > 0)
+        ;
+
+    // SIGHUP: start the new image; keep serving until it is ready
+    if (reloadRequested)
+    {
+      reloadRequested = 0;
+      if (!draining && readyfd < 0)
+      {
+        reloadPID = startReload(argv, sockfd, &readyfd);
+        fds[2].fd = readyfd;
+      }
+    }
+
+    // The new image either reports ready or dies before doing so
+    if (readyfd >= 0 && (fds[2].revents & (POLLIN | POLLHUP)))
+    {
+      if (read(readyfd, drain, 1) == 1)
+      {
+        // It shares the listening socket: stop accepting and drain
         close(sockfd);
-        childExitStatus = 1;
-        break;
+        sockfd = -1;
+        fds[0].fd = -1;
+        draining = 1;
+        if (verbose)
+          fprintf(stderr, "%d: replaced by %d, draining %d requests\n",
+                  (int) getpid(), (int) reloadPID, inFlight + queueCount);
+      }
+      else
+        fprintf(stderr, "reload failed, still serving\n");
+      close(readyfd);
+      readyfd = -1;
+      fds[2].fd = -1;
+      continue;
+    }
 
-      default: // Parent: Continue the loop
+    if (!(fds[0].revents & POLLIN))
+      continue;
+
+    // Accept everything that is waiting in the listen backlog
+    while (1)
+    {
+      clilen = sizeof(cli_addr);
+      newsockfd = accept(sockfd, (struct sockaddr *) &cli_addr, &clilen);
+      if (newsockfd < 0)
+      {
+        if (errno == ECONNABORTED)
+          continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+          perror("ERROR on accept");
         break;
+      }
+      fcntl(newsockfd, F_SETFD, FD_CLOEXEC);  // keep out of a new image
+
+      if (queueCount == 0 && inFlight < maxInFlight)
+      {
+        if (dispatchClient(newsockfd, sockfd, maxBytes) == 0)
+          inFlight++;
+      }
+      else if (queueCount < queueLen)
+      {
+        queue[(queueHead + queueCount) % (queueLen + 1)].sockfd = newsockfd;
+        queue[(queueHead + queueCount) % (queueLen + 1)].arrival = nowMs();
+        queueCount++;
+      }
+      else
+        rejectClient(newsockfd);  // queue is full: fail fast
     }
   }
 
@@ -192,117 +515,1258 @@ int main(int argc, char *argv[])
 }
 
 /*********************************************************************
- ** readSock
- ** Description: Reads data from the specified socket to the specified
- ** buffer. Takes the total data size to be read as a parameter
- ** Parameters: int sockfd, char* buffer, int size
+ ** dispatchClient
+ ** Description: Sends the valid identifier to the client and forks a
+ ** child to serve it, handing it a free pool listener if there is a
+ ** port range. Returns 0 if a child was started, otherwise the client
+ ** is told the server is busy and -1 is returned.
+ ** Parameters: int clientfd, int listenfd, int maxBytes
  *********************************************************************/
-void readSock(int sockfd, char* buffer, int size)
+int dispatchClient(int clientfd, int listenfd, int maxBytes)
 {
-  char tempBuffer[BUFF_SIZE];
-  int bytesRead;
+  int convertedNum,
+      slot = takePort();
+  uint64_t forked = traceNow();
+  pid_t childPID;
 
-  // Read data from socket
-  bzero(buffer, BUFF_SIZE);
+  childPID = fork();
 
-  do
+  switch (childPID)
   {
-    bzero(tempBuffer, BUFF_SIZE);
-    // Continue reading into temp buffer until buffer length = size
-    bytesRead = read(sockfd, tempBuffer, size);
-    if (bytesRead < 0)
-      error("ERROR reading from socket");
+    case -1: // Fork failure: shed the client instead of exiting
+      perror("fork failed");
+      rejectClient(clientfd);
+      return -1;
+
+    case 0: // Child: Connect to client and exchange data
+      close(listenfd);
+      close(sigPipe[0]);
+      close(sigPipe[1]);
+      signal(SIGCHLD, SIG_DFL);
+      traceSpan(TRACE_FORK, forked, 0);
+      redirectSlot = slot;
 
-    strcat(buffer, tempBuffer);
+      // Send valid identifier to otp_enc
+      convertedNum = htonl(1);
+      if (write(clientfd, &convertedNum, sizeof(convertedNum)) < 0)
+        error("ERROR sending identifier");
+
+      exit(serveClient(clientfd, maxBytes) < 0 ? 1 : 0);
+
+    default: // Parent: Continue the loop
+      if (slot >= 0)
+        redirectPool.owners[slot] = childPID;
+      close(clientfd);
+      return 0;
   }
-  while (strlen(buffer) != size);
 }
 
 /*********************************************************************
- ** writeSock
- ** Description: Writes data to the specified socket from the
- ** specified buffer in "chunks" of 1000 bytes.
- ** Parameters: int sockfd, char* buffer
+ ** runPrefork
+ ** Description: Prefork mode. Opens one SO_REUSEPORT listener per
+ ** worker, steers each connection to the listener of the worker on
+ ** the CPU that received it, and forks the workers pinned to the CPUs
+ ** in cpuList. The parent keeps every listener open so the steering
+ ** order survives, and replaces workers that exit. Workers only exit
+ ** on their own errors; a bad or abandoned request just drops its
+ ** client (see serveClient).
+ ** Parameters: int portno, int backlog, int workers, char* cpuList,
+ ** int maxBytes
  *********************************************************************/
-void writeSock(int sockfd, char* buffer)
+int runPrefork(int portno, int backlog, int workers, char* cpuList,
+               int maxBytes)
 {
-  int bytesWrit,
-      totalBytesWrit = 0,
-      dataRemaining = strlen(buffer),
+  int cpuCount,
       index,
-      tempIndex;
-  char tempBuffer[BUFF_SIZE];
+      other,
+      childStatus;
+  int* cpus;
+  int* listeners;
+  pid_t* pids;
+  pid_t childPID;
 
-  bytesWrit = write(sockfd, buffer, strlen(buffer));
-  if (bytesWrit < 0)
-    error("ERROR writing to socket");
-  else if (bytesWrit < strlen(buffer))
+  cpus = malloc(sizeof(int) * workers);
+  listeners = malloc(sizeof(int) * workers);
+  pids = malloc(sizeof(pid_t) * workers);
+  if (cpus == NULL || listeners == NULL || pids == NULL)
+    error("ERROR allocating workers");
+
+  cpuCount = parseCpuList(cpuList, cpus, workers);
+  if (cpuCount <= 0)
   {
-    // Continue to write until all data has been sent
-    while (totalBytesWrit != strlen(buffer))
+    fprintf(stderr, "ERROR, bad CPU list %s\n",
+            cpuList != NULL ? cpuList : "");
+    exit(1);
+  }
+  // Fewer CPUs than workers: share them, each CPU's workers adjacent
+  // as steerByCpu needs
+  for (index = workers - 1; index > 0 && cpuCount < workers; index--)
+    cpus[index] = cpus[(long) index * cpuCount / workers];
+
+  for (index = 0; index < workers; index++)
+  {
+    listeners[index] = reuseportListener(portno, backlog, cpus[index]);
+    if (listeners[index] < 0)
+      error("ERROR on binding");
+  }
+  if (steerByCpu(listeners[0], cpus, workers) < 0)
+  {
+    if (errno == EINVAL)
     {
-      totalBytesWrit += bytesWrit;
-      index = totalBytesWrit + 1;
-      tempIndex = 0;
-      do
-      // Copy remaining data to be written into temp buffer
+      fprintf(stderr, "ERROR, repeated CPUs in list %s must be adjacent\n",
+              cpuList != NULL ? cpuList : "");
+      exit(1);
+    }
+    perror("warning: CPU steering unavailable, hashing connections");
+  }
+
+  // Workers ignore hot reload; a restart is needed to replace them
+  signal(SIGHUP, SIG_IGN);
+
+  for (index = 0; index < workers; index++)
+    pids[index] = -1;
+
+  while (1)
+  {
+    // (Re)start every worker that is not running
+    for (index = 0; index < workers; index++)
+    {
+      if (pids[index] > 0)
+        continue;
+      childPID = fork();
+      if (childPID < 0)
+      {
+        perror("fork failed");
+        break;
+      }
+      if (childPID == 0)
       {
-        tempBuffer[tempIndex] = buffer[index];
-        index++;
-        tempIndex++;
-      } while (buffer[index] != '\0');
+        for (other = 0; other < workers; other++)
+          if (other != index)
+            close(listeners[other]);
+        if (redirectPool.count > 0)
+          redirectSlot = index;  // each worker owns one pool listener
+        runWorker(listeners[index], cpus[index], maxBytes);
+        exit(0);
+      }
+      pids[index] = childPID;
+      if (verbose)
+        fprintf(stderr, "worker %d: pid %d on cpu %d (node %d)\n", index,
+                (int) childPID, cpus[index], cpuNode(cpus[index]));
+    }
 
-      bytesWrit = write(sockfd, tempBuffer, strlen(tempBuffer));
+    childPID = wait(&childStatus);
+    if (childPID < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      error("ERROR waiting for workers");
     }
+    for (index = 0; index < workers; index++)
+      if (pids[index] == childPID)
+        pids[index] = -1;
+
+    // A worker that died abnormally is restarted after a short pause
+    if (!WIFEXITED(childStatus) || WEXITSTATUS(childStatus) != 0)
+      usleep(RESPAWN_DELAY_MS * 1000);
   }
+
+  return 0;
 }
 
 /*********************************************************************
- ** encrypt
- ** Description: Encryption is based on 27 possible values: A-Z and
- ** space. Converts ASCII values to values from 0-26.
- ** Parameters: char* plaintext, char* key
+ ** runWorker
+ ** Description: Body of a prefork worker. Pins itself to cpu, builds
+ ** its request arena there so first touch puts it on the local NUMA
+ ** node, then accepts and serves clients one at a time. The arena is
+ ** reused for every request, so under -v the heap allocation count
+ ** stops growing once the largest request size has been seen. A
+ ** client that fails or abandons its request is dropped, and the
+ ** worker goes back to accept; under -v it is logged.
+ ** Parameters: int listenfd, int cpu, int maxBytes
  *********************************************************************/
-char* encrypt(char* plaintext, char* key)
+void runWorker(int listenfd, int cpu, int maxBytes)
 {
-  int plainVal,     // plainVal and keyVal are the ASCII values - 65
-      keyVal,       // so values are 0-26 (space = 26)
-      encryptedChar,
-      index = 0;
+  int clientfd,
+      convertedNum;
 
-  plaintext[strlen(plaintext) - 1] = '\0'; // remove newline
+  signal(SIGCHLD, SIG_DFL);
+  preforkWorker = 1;
+  if (pinToCpu(cpu) < 0)
+    perror("warning: could not pin worker");
 
-  while (plaintext[index] != '\0')
+  arenaFree(&requestArena);
+  if (arenaInit(&requestArena, DEFAULT_ARENA_SIZE) < 0)
+    error("ERROR allocating request arena");
+  memset(requestArena.base, 0, requestArena.capacity);
+
+  while (1)
   {
-    // Convert ASCII numbers into vals from 0-26 (space = 26)
-    if (plaintext[index] == ASCII_SPACE)
-      plainVal = 26;
-    else
-      plainVal = plaintext[index] - 65;
+    clientfd = accept(listenfd, NULL, NULL);
+    if (clientfd < 0)
+    {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      error("ERROR on accept");
+    }
 
-    if (key[index] == ASCII_SPACE)
-      keyVal = 26;
-    else
-      keyVal = key[index] - 65;
+    // Send valid identifier to otp_enc
+    convertedNum = htonl(1);
+    if (write(clientfd, &convertedNum, sizeof(convertedNum)) < 0)
+    {
+      close(clientfd);
+      continue;
+    }
 
-    if (plainVal + keyVal > 27)
-      encryptedChar = plainVal + keyVal - 27;
-    else
-      encryptedChar = (plainVal + keyVal) % 27;
-    // Write over the plaintext array with encrypted chars
-    // that are converted back into ASCII values
-    if (encryptedChar == 26)
-      plaintext[index] = ASCII_SPACE;
+    if (serveClient(clientfd, maxBytes) < 0 && verbose)
+      fprintf(stderr, "%d: client dropped\n", (int) getpid());
+  }
+}
+
+/*********************************************************************
+ ** runEvents
+ ** Description: Event mode (-E): serves up to eventLimit connections
+ ** in this one process as coroutines on an epoll loop (otp_event.h)
+ ** instead of a child each. Every client is redirected to the same
+ ** listener, the -P range's first port or else a kernel-chosen one.
+ ** Framed requests are handed to a forked child (see handOff). The
+ ** cipher runs in -Q byte quanta shared by weight (-W) across the
+ ** connections, so large requests do not hold up small ones. Hot
+ ** reload is not supported, as in prefork mode.
+ ** Parameters: int listenfd, int backlog, int maxBytes
+ *********************************************************************/
+int runEvents(int listenfd, int backlog, int maxBytes)
+{
+  struct eventTask clients,
+                   requests;
+  struct sockaddr_in serv_addr;
+  socklen_t len = sizeof(serv_addr);
+  struct rlimit files;
+
+  signal(SIGHUP, SIG_IGN);
+  signal(SIGCHLD, SIG_IGN);  // handed-off children reap themselves
+  eventMaxBytes = maxBytes;
+
+  // Every connection holds a descriptor; take all the kernel allows
+  if (getrlimit(RLIMIT_NOFILE, &files) == 0 &&
+      files.rlim_cur < files.rlim_max)
+  {
+    files.rlim_cur = files.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &files);
+  }
+
+  if (redirectPool.count > 0)
+  {
+    requests.fd = redirectPool.fds[0];
+    eventPort = redirectPool.ports[0];
+  }
+  else
+  {
+    // Port 0 asks the kernel for any free port
+    requests.fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    bzero((char *) &serv_addr, sizeof(serv_addr));
+    serv_addr.sin_family = AF_INET;
+    serv_addr.sin_addr.s_addr = INADDR_ANY;
+    if (requests.fd < 0 ||
+        bind(requests.fd, (struct sockaddr *) &serv_addr, len) < 0 ||
+        listen(requests.fd, backlog) < 0 ||
+        getsockname(requests.fd, (struct sockaddr *) &serv_addr, &len) < 0)
+      error("ERROR opening redirect listener");
+    eventPort = ntohs(serv_addr.sin_port);
+  }
+
+  if (eventInit(&eventLoop) < 0)
+    error("ERROR creating epoll instance");
+  eventLoop.quantum = eventQuantum;
+  clients.fd = listenfd;
+  clients.run = acceptClients;
+  requests.run = acceptRequests;
+  clients.finish = requests.finish = NULL;
+  clients.deadline = requests.deadline = NO_DEADLINE;
+  clients.weight = requests.weight = 1;
+  if (eventAdd(&eventLoop, &clients) < 0 ||
+      eventAdd(&eventLoop, &requests) < 0)
+    error("ERROR adding listeners to epoll");
+  if (verbose)
+  {
+    fprintf(stderr, "%d: event mode, up to %d connections, redirecting "
+            "to port %d\n", (int) getpid(), eventLimit, eventPort);
+    fprintf(stderr, "%d: %ld byte quantum, %d client weight rules\n",
+            (int) getpid(), eventQuantum, weightRuleCount);
+  }
+
+  eventRun(&eventLoop);
+  error("ERROR on epoll_wait");
+  return 1;
+}
+
+/*********************************************************************
+ ** acceptClients
+ ** Description: Task of the main listener in event mode. Sends each
+ ** new client the valid identifier and the redirect port in one write
+ ** and hangs up, or BUSY_ID once eventLimit connections are open.
+ ** Parameters: struct eventTask* task
+ *********************************************************************/
+int acceptClients(struct eventTask* task)
+{
+  int clientfd;
+  uint32_t words[2];
+
+  while (1)
+  {
+    clientfd = accept4(task->fd, NULL, NULL, SOCK_CLOEXEC);
+    if (clientfd < 0)
+    {
+      if (errno == ECONNABORTED || errno == EINTR)
+        continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+        perror("ERROR on accept");
+      break;
+    }
+    if (eventActive >= eventLimit)
+    {
+      rejectClient(clientfd);
+      continue;
+    }
+
+    // Send valid identifier to otp_enc and the port to come back on;
+    // a new socket's buffer always takes both
+    words[0] = htonl(1);
+    words[1] = htonl(eventPort);
+    send(clientfd, words, sizeof(words), MSG_DONTWAIT | MSG_NOSIGNAL);
+    close(clientfd);
+  }
+
+  task->waitFor = EPOLLIN;
+  return TASK_WAIT;
+}
+
+/*********************************************************************
+ ** acceptRequests
+ ** Description: Task of the redirect listener in event mode. Starts a
+ ** serveEvent task for each connection, with the -L profile's socket
+ ** options and the -W weight of its address.
+ ** Parameters: struct eventTask* task
+ *********************************************************************/
+int acceptRequests(struct eventTask* task)
+{
+  struct requestTask* state;
+  struct transport link;
+  struct sockaddr_in peer;
+  socklen_t peerLen;
+  int sockfd;
+
+  while (1)
+  {
+    peerLen = sizeof(peer);
+    sockfd = accept4(task->fd, (struct sockaddr*) &peer, &peerLen,
+                     SOCK_CLOEXEC);
+    if (sockfd < 0)
+    {
+      if (errno == ECONNABORTED || errno == EINTR)
+        continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+        perror("ERROR on accept");
+      break;
+    }
+    state = calloc(1, sizeof(struct requestTask));
+    if (state == NULL)
+    {
+      close(sockfd);
+      continue;
+    }
+    transportSetup(&link, sockfd, transportProfile);
+    state->task.fd = sockfd;
+    state->task.run = serveEvent;
+    state->task.finish = finishEvent;
+    state->task.deadline = netDeadline(CLIENT_TIMEOUT);
+    state->task.weight = clientWeight(&peer);
+    eventActive++;
+    if (eventAdd(&eventLoop, &state->task) < 0)
+      finishEvent(&state->task);
+  }
+
+  task->waitFor = EPOLLIN;
+  return TASK_WAIT;
+}
+
+/*********************************************************************
+ ** serveEvent
+ ** Description: Body of an event mode connection: the same sequence
+ ** as requestRead and handleRequest, suspended wherever the socket
+ ** has no data or room. Reads the size or extended header, the plaintext
+ ** and the key or seed descriptor, encrypts in turns with the other
+ ** connections (taskCompute), and writes back the size and ciphertext;
+ ** under -k it then waits up to KEEPALIVE_IDLE for the next request.
+ ** A request that breaks the protocol is logged and its connection
+ ** closed, where a child would exit.
+ ** Parameters: struct eventTask* task
+ *********************************************************************/
+int serveEvent(struct eventTask* task)
+{
+  struct requestTask* state = (struct requestTask*) task;
+  struct otpRequest* request = &state->request;
+  uint32_t word;
+
+  TASK_BEGIN(task);
+  do
+  {
+    // The text size, or an extended header
+    TASK_AWAIT(task, taskRead(task, &state->word, sizeof(state->word)));
+    task->deadline = netDeadline(CLIENT_TIMEOUT);
+    request->flags = 0;
+    word = ntohl(state->word);
+    if (word & FRAME_HEADER_BIT)
+    {
+      if (word & ~(FRAME_HEADER_BIT | FRAME_FLAGS))
+        return eventError(state, "unsupported header flags %#x",
+                          word & ~FRAME_HEADER_BIT);
+      request->flags = word & FRAME_FLAGS;
+      if ((word & FRAME_FLAG_SEED) && (word & FRAME_FLAG_MAC))
+        return eventError(state, "seed keys are not supported in frames");
+      // Event mode does not trace; the request ID is read and dropped
+      if (word & FRAME_FLAG_TRACE)
+        TASK_AWAIT(task, taskRead(task, state->words, sizeof(uint64_t)));
+      if (request->flags & FRAME_FLAG_MAC)
+        return handOff(state);
+      TASK_AWAIT(task, taskRead(task, &state->word, sizeof(state->word)));
+      word = ntohl(state->word);
+    }
+    if (word == 0 || word > (uint32_t) eventMaxBytes)
+      return eventError(state, "request of %u bytes exceeds limit of %d",
+                        word, eventMaxBytes);
+    request->textLen = word;
+
+    // The plaintext
+    request->text = malloc(request->textLen + 1);
+    if (request->text == NULL)
+      return eventError(state, "allocating %d byte text buffer",
+                        request->textLen);
+    TASK_AWAIT(task, taskRead(task, request->text, request->textLen));
+    request->text[request->textLen] = '\0';
+    if (requestCheckSymbols(request->text, request->textLen, 1, "text",
+                            request) < 0)
+      return eventError(state, "%s", request->error);
+
+    // The key, or the seed descriptor that names it
+    if (request->flags & FRAME_FLAG_SEED)
+    {
+      TASK_AWAIT(task, taskRead(task, state->words, sizeof(state->words)));
+      request->seed.id = (uint64_t) ntohl(state->words[0]) << 32 |
+                         ntohl(state->words[1]);
+      request->seed.segment = (uint64_t) ntohl(state->words[2]) << 32 |
+                              ntohl(state->words[3]);
+      request->seed.offset = (uint64_t) ntohl(state->words[4]) << 32 |
+                             ntohl(state->words[5]);
+      // Into an arena of the connection's own: the shared one is free
+      // again before every suspension, and the encryption may suspend
+      if (requestDeriveKey(request, padSeed, &state->keyArena) < 0)
+        return eventError(state, "%s", request->error);
+    }
     else
-      plaintext[index] = encryptedChar + 65;
+    {
+      TASK_AWAIT(task, taskRead(task, &state->word, sizeof(state->word)));
+      word = ntohl(state->word);
+      if (word == 0 || word > (uint32_t) eventMaxBytes)
+        return eventError(state, "key of %u bytes exceeds limit of %d",
+                          word, eventMaxBytes);
+      if ((int) word < request->textLen - 1)
+        return eventError(state, "key of %u bytes is too short", word);
+      request->keyLen = word;
+      request->key = malloc(request->keyLen + 1);
+      if (request->key == NULL)
+        return eventError(state, "allocating %d byte key buffer",
+                          request->keyLen);
+      TASK_AWAIT(task, taskRead(task, request->key, request->keyLen));
+      request->key[request->keyLen] = '\0';
+      if (requestCheckSymbols(request->key, request->keyLen, 1, "key",
+                              request) < 0)
+        return eventError(state, "%s", request->error);
+    }
+
+    // Encrypt a quantum at a time, taking turns with the other
+    // connections, then write the size and ciphertext back together
+    TASK_AWAIT(task, taskCompute(task, request->textLen - 1,
+                                 encryptQuantum));
+    request->text[request->textLen - 1] = '\n';
+    if (request->flags & FRAME_FLAG_SEED)
+    {
+      arenaFree(&state->keyArena);
+      request->key = NULL;
+    }
+    state->reply = htonl(request->textLen);
+    state->parts[0].iov_base = &state->reply;
+    state->parts[0].iov_len = sizeof(state->reply);
+    state->parts[1].iov_base = request->text;
+    state->parts[1].iov_len = request->textLen;
+    TASK_AWAIT(task, taskWritev(task, state->parts, 2));
+
+    if (verbose)
+      fprintf(stderr, "%d: %d byte request, %d connections\n",
+              (int) getpid(), request->textLen, eventActive);
+    free(request->text);
+    free(request->key);
+    request->text = request->key = NULL;
+    task->deadline = netDeadline(KEEPALIVE_IDLE);
+  } while (keepAlive);
+  TASK_END(task);
+}
+
+/*********************************************************************
+ ** eventError
+ ** Description: Logs why a request in event mode is refused and
+ ** returns TASK_FAILED, which closes its connection
+ ** Parameters: struct requestTask* state, const char* format, ...
+ *********************************************************************/
+int eventError(struct requestTask* state, const char* format, ...)
+{
+  va_list args;
+
+  va_start(args, format);
+  vsnprintf(state->request.error, sizeof(state->request.error), format,
+            args);
+  va_end(args);
+  fprintf(stderr, "ERROR: %s\n", state->request.error);
+  return TASK_FAILED;
+}
+
+/*********************************************************************
+ ** encryptQuantum
+ ** Description: taskCompute work of serveEvent: encrypts count symbols
+ ** of the connection's request from offset on, in place
+ ** Parameters: struct eventTask* task, size_t offset, size_t count
+ *********************************************************************/
+void encryptQuantum(struct eventTask* task, size_t offset, size_t count)
+{
+  struct otpRequest* request = &((struct requestTask*) task)->request;
+
+  cipher->encrypt((uint8_t*) request->text + offset,
+                  (uint8_t*) request->key + offset,
+                  (uint8_t*) request->text + offset, count);
+}
+
+/*********************************************************************
+ ** parseWeights
+ ** Description: Adds the -W rules in list, comma-separated
+ ** addr[/bits]=weight entries, to weightRules. Returns 0, or -1 if
+ ** one is malformed or there are more than MAX_WEIGHT_RULES.
+ ** Parameters: const char* list
+ *********************************************************************/
+int parseWeights(const char* list)
+{
+  struct weightRule* rule;
+  struct in_addr addr;
+  char *copy = strdup(list),  // cut up at the separators
+       *entry,
+       *next,
+       *bits,
+       *weight;
+  int prefix,
+      status = -1;
+
+  if (copy == NULL)
+    return -1;
+  for (entry = copy; entry != NULL; entry = next)
+  {
+    next = strchr(entry, ',');
+    if (next != NULL)
+      *next++ = '\0';
+    weight = strchr(entry, '=');
+    if (weight == NULL || weightRuleCount >= MAX_WEIGHT_RULES)
+      goto done;
+    *weight++ = '\0';
+    bits = strchr(entry, '/');
+    if (bits != NULL)
+      *bits++ = '\0';
+    prefix = bits != NULL ? atoi(bits) : 32;
+    if (inet_pton(AF_INET, entry, &addr) != 1 || prefix < 0 || prefix > 32)
+      goto done;
 
-    index++;
+    rule = &weightRules[weightRuleCount++];
+    rule->mask = prefix == 0 ? 0 : htonl(0xffffffffu << (32 - prefix));
+    rule->addr = addr.s_addr & rule->mask;
+    rule->weight = atoi(weight);
+    if (rule->weight < 1)
+      goto done;
   }
+  status = 0;
+
+done:
+  free(copy);
+  return status;
+}
+
+/*********************************************************************
+ ** clientWeight
+ ** Description: Returns the weight of the first -W rule that matches
+ ** addr, or 1
+ ** Parameters: const struct sockaddr_in* addr
+ *********************************************************************/
+int clientWeight(const struct sockaddr_in* addr)
+{
+  int index;
+
+  for (index = 0; index < weightRuleCount; index++)
+    if ((addr->sin_addr.s_addr & weightRules[index].mask) ==
+        weightRules[index].addr)
+      return weightRules[index].weight;
+  return 1;
+}
+
+/*********************************************************************
+ ** finishEvent
+ ** Description: Frees an event mode connection once the loop has
+ ** closed its socket
+ ** Parameters: struct eventTask* task
+ *********************************************************************/
+void finishEvent(struct eventTask* task)
+{
+  struct requestTask* state = (struct requestTask*) task;
+
+  free(state->request.text);
+  if (!(state->request.flags & FRAME_FLAG_SEED))
+    free(state->request.key);
+  arenaFree(&state->keyArena);
+  free(state);
+  eventActive--;
+}
+
+/*********************************************************************
+ ** handOff
+ ** Description: Forks a child to serve a framed request, whose frames
+ ** handleFramed reads blocking, after its extended header. The child
+ ** keeps only its own connection; under -k it goes on to serve the
+ ** client's later requests itself. The loop closes the parent's copy.
+ ** Parameters: struct requestTask* state
+ *********************************************************************/
+int handOff(struct requestTask* state)
+{
+  struct eventTask* other;
+  int sockfd = state->task.fd,
+      served;
+  pid_t childPID = fork();
+
+  if (childPID < 0)
+  {
+    perror("fork failed");
+    return TASK_FAILED;
+  }
+  if (childPID > 0)
+    return TASK_DONE;
+
+  // Otherwise connections the parent closes would stay open here
+  for (other = eventLoop.head; other != NULL; other = other->next)
+    if (other->fd != sockfd)
+      close(other->fd);
+  close(eventLoop.epfd);
+  fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) & ~O_NONBLOCK);
+
+  transportSetup(&clientLink, sockfd, transportProfile);
+  served = handleFramed(sockfd, eventMaxBytes);
+  if (served < 0)
+    exit(1);
+  finishRequest(served);
+  while (keepAlive && nextRequest(sockfd))
+    if (handleRequest(sockfd, eventMaxBytes) < 0)
+      exit(1);
+  exit(0);
+}
+
+/*********************************************************************
+ ** serveClient
+ ** Description: Runs in the child or prefork worker. Redirects the
+ ** client to a port of its own, then serves one plaintext/key request
+ ** on it, or under -k every request the client sends on it until it
+ ** hangs up (which is how otp_proxy reuses connections). Replies go
+ ** out as the -L transport profile says. Its spans are flushed to the
+ ** trace file when it is done. Returns 0, or -1 if the redirect or a
+ ** request failed; the client is then dropped without a reply and the
+ ** request arena is reset for the next one.
+ ** Parameters: int clientfd, int maxBytes
+ *********************************************************************/
+int serveClient(int clientfd, int maxBytes)
+{
+  int newsockfd,
+      status = -1;
+  uint64_t start = traceNow();
+
+  newsockfd = redirectClient(clientfd);
+  if (newsockfd >= 0)
+  {
+    transportSetup(&clientLink, newsockfd, transportProfile);
+    do
+      status = handleRequest(newsockfd, maxBytes);
+    while (status == 0 && keepAlive && nextRequest(newsockfd));
+    close(newsockfd);
+  }
+  close(clientfd);
+  if (status < 0)
+    arenaReset(&requestArena);
+
+  traceSpan(TRACE_SERVE, start, 0);
+  traceFlush();
+  traceRequest(0);  // a prefork worker's next request is untraced yet
+  return status;
+}
+
+/*********************************************************************
+ ** nextRequest
+ ** Description: Waits up to KEEPALIVE_IDLE for the client to start
+ ** another request on a kept-alive connection. Returns 1 if it did,
+ ** 0 if it hung up or stayed idle.
+ ** Parameters: int sockfd
+ *********************************************************************/
+int nextRequest(int sockfd)
+{
+  char peek;
+
+  if (netWait(sockfd, POLLIN, netDeadline(KEEPALIVE_IDLE)) < 0)
+    return 0;
+  return recv(sockfd, &peek, 1, MSG_PEEK) == 1;
+}
+
+/*********************************************************************
+ ** redirectClient
+ ** Description: Sends the client the port of a listener for its
+ ** request and returns the socket of the client's connection to it.
+ ** The listener is this process's pool listener under -P; otherwise
+ ** it is opened on port 0, so the kernel hands every child its own
+ ** free port and concurrent children never retry binds. Returns -1,
+ ** after reporting why, if the client does not come back: it reset
+ ** the first connection instead of reading the port, or it missed
+ ** CLIENT_TIMEOUT (WORKER_REDIRECT_MS in a prefork worker, which has
+ ** other clients waiting).
+ ** Parameters: int clientfd
+ *********************************************************************/
+int redirectClient(int clientfd)
+{
+  int sockfd,
+      newsockfd = -1,
+      portno,
+      returnStatus,    // value returned from read or write
+      convertedNum;
+  uint64_t start = traceNow();
+  socklen_t clilen;    // size of client address
+  struct sockaddr_in serv_addr,
+         cli_addr;
+  struct pollfd waits[2];
+  long deadline,
+       timeout;
+
+  if (redirectSlot >= 0)
+  {
+    sockfd = redirectPool.fds[redirectSlot];
+    portno = redirectPool.ports[redirectSlot];
+
+    // A client that gave up on an earlier redirect may connect late;
+    // drop it so it is not mistaken for this one
+    while (netWait(sockfd, POLLIN, netDeadline(0)) == 0 &&
+           (newsockfd = accept(sockfd, NULL, NULL)) >= 0)
+      close(newsockfd);
+  }
+  else
+  {
+    // Open the socket
+    sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (sockfd < 0)
+    {
+      perror("ERROR opening socket");
+      return -1;
+    }
+    // Port 0 asks the kernel for any free port
+    bzero((char *) &serv_addr, sizeof(serv_addr));
+    serv_addr.sin_family = AF_INET;
+    serv_addr.sin_port = 0;
+    serv_addr.sin_addr.s_addr = INADDR_ANY;
+    if (bind(sockfd, (struct sockaddr *) &serv_addr, sizeof(serv_addr)) < 0)
+    {
+      perror("ERROR on binding");
+      goto done;
+    }
+
+    // Listen before announcing the port so the client never races us
+    listen(sockfd, 1); // allow 1 client only
+
+    // Find out which port the kernel assigned
+    clilen = sizeof(serv_addr);
+    if (getsockname(sockfd, (struct sockaddr *) &serv_addr, &clilen) < 0)
+    {
+      perror("ERROR reading redirect port");
+      goto done;
+    }
+    portno = ntohs(serv_addr.sin_port);
+    traceSpan(TRACE_BIND, start, portno);
+    start = traceNow();
+  }
+
+  // Send new port number to client
+  convertedNum = htonl(portno);
+  returnStatus = send(clientfd, &convertedNum, sizeof(convertedNum),
+                      MSG_NOSIGNAL);
+  if (returnStatus < 0)
+  {
+    perror("ERROR sending port number to client");
+    newsockfd = -1;
+    goto done;
+  }
+
+  // Accept client and get new socket file descriptor; a client that
+  // never comes back must not hold this process and its slot for long.
+  // One that closes the first connection after reading the port is
+  // on its way, but a reset means it walked away without reading it.
+  waits[0].fd = sockfd;
+  waits[0].events = POLLIN;
+  waits[1].fd = clientfd;
+  waits[1].events = 0;  // POLLERR and POLLHUP are always reported
+  deadline = netDeadline(preforkWorker ? WORKER_REDIRECT_MS
+                                       : CLIENT_TIMEOUT);
+  do
+  {
+    timeout = deadline - netNowMs();
+    returnStatus = poll(waits, 2, timeout > 0 ? timeout : 0);
+  } while (returnStatus < 0 && errno == EINTR);
+  newsockfd = -1;
+  if (returnStatus == 0 || waits[0].revents == 0)
+  {
+    fprintf(stderr, "ERROR: client did not come back on redirect port "
+            "%d\n", portno);
+    goto done;
+  }
+  clilen = sizeof(cli_addr);
+  newsockfd = accept(sockfd, (struct sockaddr *) &cli_addr, &clilen);
+  if (newsockfd < 0)
+    perror("ERROR on accept");
+  else
+    traceSpan(TRACE_ACCEPT, start, portno);
+
+done:
+  // Pool listeners stay open for the next request
+  if (redirectSlot < 0)
+    close(sockfd);
+  return newsockfd;
+}
+
+/*********************************************************************
+ ** openPortPool
+ ** Description: Opens up to want redirect listeners on the ports of
+ ** range ("low-high"), skipping ports that are in use, such as those
+ ** a predecessor still holds while it drains after a reload. The
+ ** listeners are not passed on to a new image. Returns the number
+ ** opened, or -1 if range is malformed or memory runs out.
+ ** Parameters: const char* range, int want
+ *********************************************************************/
+int openPortPool(const char* range, int want)
+{
+  char* end;
+  long first,
+       last,
+       port;
+  int sockfd,
+      reuse = 1;
+  struct sockaddr_in serv_addr;
+
+  first = strtol(range, &end, 10);
+  if (end == range || *end != '-')
+    return -1;
+  last = strtol(end + 1, &end, 10);
+  if (*end != '\0' || first < 1 || last > 65535 || last < first)
+    return -1;
+
+  redirectPool.fds = malloc(sizeof(int) * want);
+  redirectPool.ports = malloc(sizeof(int) * want);
+  redirectPool.owners = malloc(sizeof(pid_t) * want);
+  if (redirectPool.fds == NULL || redirectPool.ports == NULL ||
+      redirectPool.owners == NULL)
+    return -1;
+
+  for (port = first; port <= last && redirectPool.count < want; port++)
+  {
+    sockfd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sockfd < 0)
+      return -1;
+    // Connections from an earlier run may still be in TIME_WAIT
+    setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    bzero((char *) &serv_addr, sizeof(serv_addr));
+    serv_addr.sin_family = AF_INET;
+    serv_addr.sin_port = htons(port);
+    serv_addr.sin_addr.s_addr = INADDR_ANY;
+    if (bind(sockfd, (struct sockaddr *) &serv_addr, sizeof(serv_addr)) < 0 ||
+        listen(sockfd, 1) < 0)
+    {
+      close(sockfd);
+      continue;
+    }
+    redirectPool.fds[redirectPool.count] = sockfd;
+    redirectPool.ports[redirectPool.count] = port;
+    redirectPool.owners[redirectPool.count] = 0;
+    redirectPool.count++;
+  }
+  return redirectPool.count;
+}
+
+/*********************************************************************
+ ** takePort
+ ** Description: Returns the index of a free pool listener, or -1 if
+ ** there is no pool or every listener is in use (the child then
+ ** falls back to a kernel-assigned port)
+ ** Parameters: none
+ *********************************************************************/
+int takePort()
+{
+  int index;
+
+  for (index = 0; index < redirectPool.count; index++)
+    if (redirectPool.owners[index] == 0)
+      return index;
+  return -1;
+}
+
+/*********************************************************************
+ ** releasePort
+ ** Description: Frees the pool listener used by a finished child
+ ** Parameters: pid_t owner
+ *********************************************************************/
+void releasePort(pid_t owner)
+{
+  int index;
+
+  for (index = 0; index < redirectPool.count; index++)
+    if (redirectPool.owners[index] == owner)
+      redirectPool.owners[index] = 0;
+}
+
+/*********************************************************************
+ ** handleRequest
+ ** Description: Reads the plaintext and key into arena buffers sized
+ ** from their declared lengths (see requestRead) and writes back the
+ ** ciphertext. Requests larger than maxBytes are refused, and the client
+ ** has CLIENT_TIMEOUT to send its request and take the reply. The
+ ** arena is reset afterwards.
+ ** Framed requests are handed to handleFramed, where maxBytes and the
+ ** timeout apply to each frame instead. A seed descriptor request has
+ ** its key derived from the -K seed. Returns 0, or -1 if the request
+ ** failed and the client must be dropped; the arena is then left for
+ ** the caller to reset.
+ ** Parameters: int sockfd, int maxBytes
+ *********************************************************************/
+int handleRequest(int sockfd, int maxBytes)
+{
+  int dataSizeNum,
+      convertedNum,
+      served;
+  uint64_t start = traceNow();
+  long deadline = netDeadline(CLIENT_TIMEOUT);
+  struct otpRequest request;
+  struct iovec reply[2];
+  char *ciphertext;
+
+  /******** Start data exchange ********/
+
+  // Read the plaintext and key, or the extended header (otp_request.h)
+  if (requestRead(sockfd, maxBytes, &requestArena, &request, deadline) < 0)
+    return requestError(&request);
+  if (request.flags & FRAME_FLAG_TRACE)
+    traceRequest(request.id);
+  if (request.flags & FRAME_FLAG_MAC)
+  {
+    served = handleFramed(sockfd, maxBytes);
+    if (served < 0)
+      return -1;
+    finishRequest(served);
+    return 0;
+  }
+  if ((request.flags & FRAME_FLAG_SEED) &&
+      requestDeriveKey(&request, padSeed, &requestArena) < 0)
+    return requestError(&request);
+  traceSpan(TRACE_READ, start, 0);
+
+  // Perform the encryption
+  start = traceNow();
+  ciphertext = encrypt(request.text, request.key, request.textLen);
+  traceSpan(TRACE_CIPHER, start, 0);
+  start = traceNow();
+
+  // Write the data size and ciphertext back to the socket together
+  dataSizeNum = request.textLen;
+  convertedNum = htonl(dataSizeNum);
+  reply[0].iov_base = &convertedNum;
+  reply[0].iov_len = sizeof(convertedNum);
+  reply[1].iov_base = ciphertext;
+  reply[1].iov_len = dataSizeNum;
+  if (transportSend(&clientLink, reply, 2, deadline) < 0)
+  {
+    perror("ERROR writing to socket");
+    return -1;
+  }
+  traceSpan(TRACE_WRITE, start, 0);
+
+  finishRequest(request.textLen);
+  return 0;
+}
+
+/*********************************************************************
+ ** handleFramed
+ ** Description: Serves a request in the framed protocol (otp_frame.h)
+ ** after its extended header. Each frame's request tag, encryption
+ ** and response tag are computed together, FRAME_MAC_BLOCK bytes at a
+ ** time, so the frame is read from memory once while it is in cache.
+ ** A bad frame or tag drops the client without a reply, which the
+ ** client reports as an error. Returns the number of symbols served,
+ ** or -1 if the client was dropped.
+ ** Parameters: int sockfd, int maxBytes
+ *********************************************************************/
+int handleFramed(int sockfd, int maxBytes)
+{
+  struct frameHeader frame = { 0, 0 };
+  struct otpRequest failure;
+  struct macState request,
+         response;
+  uint64_t tag = 0,
+           start;
+  long deadline;
+  uint32_t sequence = 0,
+           limit = FRAME_MAX;
+  size_t done,
+         block;
+  uint8_t *text,
+          *key,
+          *result;
+  int served = 0;
+
+  if (limit > (uint32_t) maxBytes)
+    limit = maxBytes;
+  text = arenaAlloc(&requestArena, limit);
+  key = arenaAlloc(&requestArena, limit + FRAME_KEY_EXTRA);
+  result = arenaAlloc(&requestArena, limit);
+  if (text == NULL || key == NULL || result == NULL)
+  {
+    perror("ERROR allocating request buffer");
+    return -1;
+  }
+
+  do
+  {
+    // Frames must arrive in order and fit the buffers
+    start = traceNow();
+    deadline = netDeadline(CLIENT_TIMEOUT);
+    if (requestReadFrame(sockfd, sequence, limit, &frame, text, key, &tag,
+                         &failure, deadline) < 0)
+      return requestError(&failure);
+    traceSpan(TRACE_READ, start, sequence);
+
+    // One pass per block: authenticate, encrypt, tag the result
+    start = traceNow();
+    macFrameHeader(&request, key + frame.length, &frame);
+    macFrameHeader(&response, key + frame.length + MAC_KEY_SYMBOLS, &frame);
+    for (done = 0; done < frame.length; done += block)
+    {
+      block = frame.length - done;
+      if (block > FRAME_MAC_BLOCK)
+        block = FRAME_MAC_BLOCK;
+      macUpdate(&request, text + done, block);
+      macUpdate(&request, key + done, block);
+      cipher->encrypt(text + done, key + done, result + done, block);
+      macUpdate(&response, text + done, block);
+      macUpdate(&response, result + done, block);
+    }
+    traceSpan(TRACE_CIPHER, start, sequence);
+    if (macFinal(&request) != tag)
+    {
+      fprintf(stderr, "ERROR: frame %u failed authentication\n", sequence);
+      return -1;
+    }
+
+    start = traceNow();
+    if (frameSend(sockfd, &frame, result, frame.length, NULL, 0,
+                  macFinal(&response), deadline) < 0)
+    {
+      perror("ERROR writing frame");
+      return -1;
+    }
+    traceSpan(TRACE_WRITE, start, sequence);
+    served += frame.length;
+    sequence++;
+  } while (frame.length > 0);
+
+  return served;
+}
+
+/*********************************************************************
+ ** finishRequest
+ ** Description: Resets the request arena and logs its use
+ ** Parameters: int textLen
+ *********************************************************************/
+void finishRequest(int textLen)
+{
+  arenaReset(&requestArena);
+  if (verbose)
+    fprintf(stderr, "%d: %d byte request, arena %zu bytes, "
+            "%lu heap allocations, %lu resets\n", (int) getpid(), textLen,
+            requestArena.capacity, requestArena.allocations,
+            requestArena.resets);
+  if (verbose && clientLink.zcSent > 0)
+    fprintf(stderr, "%d: %u zero-copy sends, %lu copied by the kernel\n",
+            (int) getpid(), clientLink.zcSent, clientLink.zcCopied);
+}
+
+/*********************************************************************
+ ** requestError
+ ** Description: Reports why a request could not be read and returns
+ ** -1, for the caller to drop the client without a reply
+ ** Parameters: struct otpRequest* request
+ *********************************************************************/
+int requestError(struct otpRequest* request)
+{
+  fprintf(stderr, "ERROR: %s\n", request->error);
+  return -1;
+}
+
+/*********************************************************************
+ ** rejectClient
+ ** Description: Sends the busy identifier so the client can back off
+ ** and retry, then closes the connection.
+ ** Parameters: int clientfd
+ *********************************************************************/
+void rejectClient(int clientfd)
+{
+  int convertedNum = htonl(BUSY_ID);
+
+  // Best effort: the client may already have given up
+  send(clientfd, &convertedNum, sizeof(convertedNum), MSG_DONTWAIT);
+  close(clientfd);
+}
+
+/*********************************************************************
+ ** onChildExit
+ ** Description: SIGCHLD handler. Wakes the accept loop, which does
+ ** the actual reaping outside of signal context.
+ ** Parameters: int signo
+ *********************************************************************/
+void onChildExit(int signo)
+{
+  int savedErrno = errno;
+
+  (void) signo;
+  write(sigPipe[1], "c", 1);
+  errno = savedErrno;
+}
+
+/*********************************************************************
+ ** onReload
+ ** Description: SIGHUP handler. Flags a hot reload and wakes the
+ ** accept loop, which starts it outside of signal context.
+ ** Parameters: int signo
+ *********************************************************************/
+void onReload(int signo)
+{
+  int savedErrno = errno;
+
+  (void) signo;
+  reloadRequested = 1;
+  write(sigPipe[1], "h", 1);
+  errno = savedErrno;
+}
+
+/*********************************************************************
+ ** startReload
+ ** Description: Forks and execs argv again with the listening socket
+ ** left open across the exec. Its number, and the write end of a pipe
+ ** on which the new image reports that it is ready, are passed in the
+ ** environment. Returns the new image's pid and stores the read end
+ ** of the pipe in readyfd, or returns -1 if it could not be started.
+ ** Parameters: char* argv[], int listenfd, int* readyfd
+ *********************************************************************/
+pid_t startReload(char* argv[], int listenfd, int* readyfd)
+{
+  int ready[2];
+  char value[16];
+  pid_t childPID;
+
+  if (pipe(ready) < 0)
+  {
+    perror("ERROR creating reload pipe");
+    return -1;
+  }
+  fcntl(ready[0], F_SETFD, FD_CLOEXEC);
+
+  childPID = fork();
+  if (childPID < 0)
+  {
+    perror("fork failed");
+    close(ready[0]);
+    close(ready[1]);
+    return -1;
+  }
+
+  if (childPID == 0)
+  {
+    // Only the listener and the ready pipe survive the exec
+    fcntl(listenfd, F_SETFD, 0);
+    snprintf(value, sizeof(value), "%d", listenfd);
+    setenv(LISTEN_FD_ENV, value, 1);
+    snprintf(value, sizeof(value), "%d", ready[1]);
+    setenv(READY_FD_ENV, value, 1);
+
+    execvp(argv[0], argv);
+    perror("ERROR starting new daemon image");
+    _exit(1);
+  }
+
+  close(ready[1]);
+  *readyfd = ready[0];
+  return childPID;
+}
+
+/*********************************************************************
+ ** signalReady
+ ** Description: Run by a new image once it is listening. Writes one
+ ** byte to the predecessor's ready pipe, if there is one, so the
+ ** predecessor stops accepting and drains.
+ ** Parameters: none
+ *********************************************************************/
+void signalReady()
+{
+  char* value = getenv(READY_FD_ENV);
+  int readyfd;
+
+  if (value == NULL)
+    return;
+  readyfd = atoi(value);
+  unsetenv(READY_FD_ENV);
+
+  if (write(readyfd, "r", 1) < 0)
+    perror("ERROR signalling predecessor");
+  close(readyfd);
+}
+
+/*********************************************************************
+ ** nowMs
+ ** Description: Returns the monotonic clock in milliseconds
+ ** Parameters: none
+ *********************************************************************/
+long nowMs()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+/*********************************************************************
+ ** encrypt
+ ** Description: Encryption is based on 27 possible values: A-Z and
+ ** space. Encrypts the size bytes of text before the trailing newline
+ ** in place using the selected cipher engine. size is the declared
+ ** length, not strlen, so a NUL in the text cannot shorten it to -1.
+ ** Parameters: char* plaintext, char* key, int size
+ *********************************************************************/
+char* encrypt(char* plaintext, char* key, int size)
+{
+  size_t length = size - 1;  // leave out the newline
 
-  // Add newline back onto string and print result
-  int strLength = strlen(plaintext);
-  plaintext[strLength] = '\n';
-  plaintext[strLength + 1] = '\0';
+  cipher->encrypt((uint8_t*) plaintext, (uint8_t*) key,
+                  (uint8_t*) plaintext, length);
+  plaintext[length] = '\n';
 
   return plaintext;
 }
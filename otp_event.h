@@ -0,0 +1,460 @@
+/*********************************************************************
+ ** Program Filename: otp_event.h
+ ** Author: Peter Nguyen
+ ** Date: 10/19/26
+ ** CS 344-400, Program 4
+ ** Description: A small coroutine runtime on epoll for the daemons'
+ ** event mode (-E). Each connection is a task whose body is written
+ ** as the same straight sequence as the blocking handler, with
+ ** TASK_AWAIT around every socket step:
+ **     TASK_BEGIN(task);
+ **     TASK_AWAIT(task, taskRead(task, &size, sizeof(size)));
+ **     ...
+ **     TASK_END(task);
+ ** A step that would block suspends the task until epoll reports its
+ ** socket ready, and the body resumes at that TASK_AWAIT. Locals do
+ ** not survive a suspension, so a task keeps its state in the struct
+ ** that embeds its eventTask, and only one TASK_AWAIT may sit on a
+ ** line, and not inside a switch of the body's own. An idle
+ ** connection costs that struct and its socket, not a process.
+ ** CPU work goes through taskCompute, which runs it in quanta under
+ ** deficit round-robin: a task whose work is not done waits on the
+ ** loop's run queue instead of a socket, and each loop pass gives
+ ** every queued task quantum * weight more bytes. A multi-megabyte
+ ** request then delays a small one by one round, not its whole
+ ** cipher pass. Reads and writes move at most EVENT_IO_BURST bytes
+ ** per resume for the same reason.
+ *********************************************************************/
+
+#ifndef OTP_EVENT_H
+#define OTP_EVENT_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "otp_net.h"
+
+#define EVENT_BATCH 256   // ready sockets taken per epoll_wait
+#define EVENT_TICK_MS 250  // how often deadlines are checked
+#define EVENT_IOV_MAX 4    // parts a taskWritev can send
+#define EVENT_IO_BURST (256 << 10)  // bytes moved per resume, each way
+#define EVENT_QUANTUM (64 << 10)    // default bytes of work per round
+
+enum taskStatus
+{
+  TASK_WAIT,    // suspended until its socket is ready or its turn comes
+  TASK_DONE,    // finished; the loop closes its socket
+  TASK_FAILED   // a step failed with errno set; closed the same way
+};
+
+// Starts or resumes the body at its last TASK_AWAIT
+#define TASK_BEGIN(task) switch ((task)->line) { case 0:
+
+// Runs step, which returns 1 when done, 0 to wait for the socket (or
+// with waitFor 0 for its next round) and -1 on failure, until it is
+// done, suspending the task in between
+#define TASK_AWAIT(task, step) \
+  do \
+  { \
+    (task)->moved = 0; \
+    (task)->line = __LINE__; \
+    __attribute__((fallthrough)); \
+    case __LINE__: \
+    switch (step) \
+    { \
+      case 0: return TASK_WAIT; \
+      case -1: return TASK_FAILED; \
+    } \
+  } while (0)
+
+#define TASK_END(task) } return TASK_DONE
+
+// A coroutine and its socket, embedded first in the task's own state
+struct eventTask
+{
+  int fd,
+      line,             // where the body resumes, 0 before it starts
+      weight,           // share of each round's work, 1 if unset
+      queued;           // on the run queue, waiting for its turn
+  uint32_t waitFor,     // epoll events the task is suspended on, or 0
+           registered;  // events epoll watches for it now
+  size_t moved;         // progress of the pending read, write or work
+  long deficit;         // bytes of work it may still do this round
+  long deadline;        // NO_DEADLINE, or when the task is dropped
+  int (*run)(struct eventTask* task);       // the body
+  void (*finish)(struct eventTask* task);   // frees the task, may be NULL
+  struct eventTask *prev,
+                   *next,
+                   *runNext;  // next task on the run queue
+};
+
+struct eventLoop
+{
+  int epfd;
+  long count;             // live tasks
+  long nextSweep;         // when deadlines are next checked
+  long quantum;           // bytes of work per round for weight 1
+  struct eventTask* head; // every live task, for the deadline sweep
+  struct eventTask *runHead,  // tasks with work left, in round order
+                   *runTail;
+};
+
+/*********************************************************************
+ ** taskRead
+ ** Description: Step that reads len bytes into buffer, at most
+ ** EVENT_IO_BURST of them per resume. A peer that closes first fails
+ ** it with ECONNRESET.
+ ** Parameters: struct eventTask* task, void* buffer, size_t len
+ *********************************************************************/
+static inline int taskRead(struct eventTask* task, void* buffer, size_t len)
+{
+  size_t burst = task->moved + EVENT_IO_BURST;
+  ssize_t got;
+
+  while (task->moved < len)
+  {
+    // Level-triggered epoll wakes it again at once for the rest
+    if (task->moved >= burst)
+    {
+      task->waitFor = EPOLLIN;
+      return 0;
+    }
+    got = recv(task->fd, (char*) buffer + task->moved, len - task->moved,
+               0);
+    if (got > 0)
+    {
+      task->moved += got;
+      continue;
+    }
+    if (got == 0)
+    {
+      errno = ECONNRESET;
+      return -1;
+    }
+    if (errno == EINTR)
+      continue;
+    if (errno != EAGAIN && errno != EWOULDBLOCK)
+      return -1;
+    task->waitFor = EPOLLIN;
+    return 0;
+  }
+  return 1;
+}
+
+/*********************************************************************
+ ** taskWritev
+ ** Description: Step that writes the count (at most EVENT_IOV_MAX)
+ ** parts in order, in as few sends as the socket allows and at most
+ ** EVENT_IO_BURST bytes per resume
+ ** Parameters: struct eventTask* task, const struct iovec* parts,
+ ** int count
+ *********************************************************************/
+static inline int taskWritev(struct eventTask* task,
+                             const struct iovec* parts, int count)
+{
+  struct iovec rest[EVENT_IOV_MAX];
+  struct msghdr message;
+  size_t skip,
+         room,
+         total = 0,
+         burst = task->moved + EVENT_IO_BURST;
+  ssize_t sent;
+  int index,
+      left;
+
+  for (index = 0; index < count; index++)
+    total += parts[index].iov_len;
+  while (1)
+  {
+    if (task->moved >= total)
+      return 1;
+    if (task->moved >= burst)
+    {
+      task->waitFor = EPOLLOUT;  // the socket may still have room
+      return 0;
+    }
+
+    // Send what is left after the bytes already moved, up to the burst
+    skip = task->moved;
+    room = burst - task->moved;
+    left = 0;
+    for (index = 0; index < count && room > 0; index++)
+    {
+      if (skip >= parts[index].iov_len)
+      {
+        skip -= parts[index].iov_len;
+        continue;
+      }
+      rest[left].iov_base = (char*) parts[index].iov_base + skip;
+      rest[left].iov_len = parts[index].iov_len - skip;
+      if (rest[left].iov_len > room)
+        rest[left].iov_len = room;
+      room -= rest[left].iov_len;
+      skip = 0;
+      left++;
+    }
+
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = rest;
+    message.msg_iovlen = left;
+    sent = sendmsg(task->fd, &message, MSG_NOSIGNAL);
+    if (sent >= 0)
+    {
+      task->moved += sent;
+      continue;
+    }
+    if (errno == EINTR)
+      continue;
+    if (errno != EAGAIN && errno != EWOULDBLOCK)
+      return -1;
+    task->waitFor = EPOLLOUT;
+    return 0;
+  }
+}
+
+/*********************************************************************
+ ** taskCompute
+ ** Description: Step that calls work on the len bytes of the task's
+ ** request in pieces no larger than its deficit. When the deficit
+ ** runs out first, the task waits on the run queue for its next
+ ** round. A task with nothing left keeps no credit, as in deficit
+ ** round-robin.
+ ** Parameters: struct eventTask* task, size_t len,
+ ** void (*work)(struct eventTask* task, size_t offset, size_t count)
+ *********************************************************************/
+static inline int taskCompute(struct eventTask* task, size_t len,
+                              void (*work)(struct eventTask* task,
+                                           size_t offset, size_t count))
+{
+  size_t count;
+
+  while (task->moved < len)
+  {
+    if (task->deficit <= 0)
+    {
+      task->waitFor = 0;
+      return 0;
+    }
+    count = len - task->moved;
+    if (count > (size_t) task->deficit)
+      count = task->deficit;
+    work(task, task->moved, count);
+    task->moved += count;
+    task->deficit -= count;
+  }
+  task->deficit = 0;
+  return 1;
+}
+
+/*********************************************************************
+ ** eventInit
+ ** Description: Creates the loop's epoll instance. Returns 0, or -1
+ ** with errno set.
+ ** Parameters: struct eventLoop* loop
+ *********************************************************************/
+static inline int eventInit(struct eventLoop* loop)
+{
+  loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+  loop->count = 0;
+  loop->nextSweep = netNowMs() + EVENT_TICK_MS;
+  loop->quantum = EVENT_QUANTUM;
+  loop->head = NULL;
+  loop->runHead = loop->runTail = NULL;
+  return loop->epfd < 0 ? -1 : 0;
+}
+
+/*********************************************************************
+ ** eventDrop
+ ** Description: Removes task from the loop, closes its socket and
+ ** hands it to its finish function
+ ** Parameters: struct eventLoop* loop, struct eventTask* task
+ *********************************************************************/
+static inline void eventDrop(struct eventLoop* loop, struct eventTask* task)
+{
+  if (task->prev != NULL)
+    task->prev->next = task->next;
+  else
+    loop->head = task->next;
+  if (task->next != NULL)
+    task->next->prev = task->prev;
+  loop->count--;
+  // Closing is not enough while a forked child shares the socket
+  epoll_ctl(loop->epfd, EPOLL_CTL_DEL, task->fd, NULL);
+  close(task->fd);
+  if (task->finish != NULL)
+    task->finish(task);
+}
+
+/*********************************************************************
+ ** eventResume
+ ** Description: Runs task until it suspends or ends. A suspended task
+ ** is watched for the events it waits on, or with work left joins
+ ** the tail of the run queue; one that ended is dropped. A queued
+ ** task keeps its epoll registration, so a small request costs no
+ ** extra epoll_ctl, and the loop ignores its events until its turn.
+ ** Parameters: struct eventLoop* loop, struct eventTask* task
+ *********************************************************************/
+static inline void eventResume(struct eventLoop* loop, struct eventTask* task)
+{
+  struct epoll_event event;
+
+  if (task->run(task) != TASK_WAIT)
+  {
+    eventDrop(loop, task);
+    return;
+  }
+  if (task->waitFor == 0)
+  {
+    task->queued = 1;
+    task->runNext = NULL;
+    if (loop->runTail != NULL)
+      loop->runTail->runNext = task;
+    else
+      loop->runHead = task;
+    loop->runTail = task;
+    return;
+  }
+  if (task->waitFor == task->registered)
+    return;
+  event.events = task->waitFor;
+  event.data.ptr = task;
+  if (epoll_ctl(loop->epfd, EPOLL_CTL_MOD, task->fd, &event) < 0)
+  {
+    eventDrop(loop, task);
+    return;
+  }
+  task->registered = task->waitFor;
+}
+
+/*********************************************************************
+ ** eventAdd
+ ** Description: Makes task's socket non-blocking, adds it to the loop
+ ** and starts its body, since the socket may already be readable.
+ ** The caller sets fd, run, finish, deadline and weight (0 for 1).
+ ** Returns 0, or -1 with errno set, in which case task is not added.
+ ** Parameters: struct eventLoop* loop, struct eventTask* task
+ *********************************************************************/
+static inline int eventAdd(struct eventLoop* loop, struct eventTask* task)
+{
+  struct epoll_event event;
+
+  fcntl(task->fd, F_SETFL, fcntl(task->fd, F_GETFL) | O_NONBLOCK);
+  task->line = 0;
+  task->moved = 0;
+  task->deficit = 0;
+  task->queued = 0;
+  if (task->weight < 1)
+    task->weight = 1;
+  task->waitFor = task->registered = EPOLLIN;
+  event.events = EPOLLIN;
+  event.data.ptr = task;
+  if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, task->fd, &event) < 0)
+    return -1;
+
+  task->prev = NULL;
+  task->next = loop->head;
+  if (loop->head != NULL)
+    loop->head->prev = task;
+  loop->head = task;
+  loop->count++;
+  eventResume(loop, task);
+  return 0;
+}
+
+/*********************************************************************
+ ** eventSweep
+ ** Description: Drops the tasks whose deadline has passed, except
+ ** those on the run queue, which are busy rather than idle. Returns
+ ** how many were dropped.
+ ** Parameters: struct eventLoop* loop
+ *********************************************************************/
+static inline int eventSweep(struct eventLoop* loop)
+{
+  struct eventTask *task,
+                   *next;
+  long now = netNowMs();
+  int dropped = 0;
+
+  for (task = loop->head; task != NULL; task = next)
+  {
+    next = task->next;
+    if (task->deadline != NO_DEADLINE && task->deadline <= now &&
+        !task->queued)
+    {
+      eventDrop(loop, task);
+      dropped++;
+    }
+  }
+  return dropped;
+}
+
+/*********************************************************************
+ ** eventRound
+ ** Description: Runs one deficit round-robin round: every task on the
+ ** run queue when it starts gets quantum * weight more bytes of work
+ ** and runs until it suspends again. Tasks that still have work
+ ** rejoin at the tail, for the next round.
+ ** Parameters: struct eventLoop* loop
+ *********************************************************************/
+static inline void eventRound(struct eventLoop* loop)
+{
+  struct eventTask *task,
+                   *last = loop->runTail;
+
+  while ((task = loop->runHead) != NULL)
+  {
+    loop->runHead = task->runNext;
+    if (loop->runHead == NULL)
+      loop->runTail = NULL;
+    task->queued = 0;
+    task->deficit += loop->quantum * task->weight;
+    eventResume(loop, task);
+    if (task == last)
+      break;
+  }
+}
+
+/*********************************************************************
+ ** eventRun
+ ** Description: Resumes tasks as their sockets become ready, runs a
+ ** round of queued work after each batch, and drops tasks past their
+ ** deadline every EVENT_TICK_MS. Only returns if epoll fails, with
+ ** errno set.
+ ** Parameters: struct eventLoop* loop
+ *********************************************************************/
+static inline int eventRun(struct eventLoop* loop)
+{
+  struct epoll_event events[EVENT_BATCH];
+  struct eventTask* task;
+  int ready,
+      index;
+
+  while (1)
+  {
+    // Queued work only lets new events in between rounds
+    ready = epoll_wait(loop->epfd, events, EVENT_BATCH,
+                       loop->runHead != NULL ? 0 : EVENT_TICK_MS);
+    if (ready < 0 && errno != EINTR)
+      return -1;
+    for (index = 0; index < ready; index++)
+    {
+      // A queued task's events wait for its turn
+      task = events[index].data.ptr;
+      if (!task->queued)
+        eventResume(loop, task);
+    }
+    eventRound(loop);
+
+    if (netNowMs() >= loop->nextSweep)
+    {
+      eventSweep(loop);
+      loop->nextSweep = netNowMs() + EVENT_TICK_MS;
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,324 @@
+/*********************************************************************
+ ** Program Filename: otp_frame.h
+ ** Author: Peter Nguyen
+ ** Date: 10/19/26
+ ** CS 344-400, Program 4
+ ** Description: Framed protocol with one-time authenticators. After
+ ** the redirect, a client may send an extended header where the
+ ** plain protocol sends the text size: a word with the high bit set
+ ** and flags in the low bits. FRAME_FLAG_TRACE adds a 64-bit request
+ ** ID after the word (see otp_trace.h); without FRAME_FLAG_MAC the
+ ** plain protocol follows. FRAME_FLAG_SEED, plain protocol only,
+ ** replaces the key size and key with a seed descriptor
+ ** (otp_seed.h). FRAME_FLAG_MAC selects frames: the text,
+ ** without its newline, travels in frames numbered from 0 and ends
+ ** with an empty frame:
+ **   client: length, sequence, text[length],
+ **           key[length + FRAME_KEY_EXTRA], request tag
+ **   daemon: length, sequence, result[length], response tag
+ ** All words are 32-bit network order; tags are 64-bit. Each frame
+ ** carries two fresh MAC keys of 26 pad symbols after its cipher key:
+ ** the request tag covers the text and cipher key, the response tag
+ ** covers text and result, both taken in FRAME_MAC_BLOCK pieces and
+ ** interleaved so the daemon can authenticate in the cipher pass.
+ ** The MAC is a polynomial evaluated mod 2^61 - 1 plus a one-time
+ ** offset, so each key is used for exactly one message.
+ *********************************************************************/
+
+#ifndef OTP_FRAME_H
+#define OTP_FRAME_H
+
+#include <endian.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include "otp_net.h"
+
+#define FRAME_HEADER_BIT 0x80000000u  // first word: framed, not a size
+#define FRAME_FLAG_MAC 0x1u           // framed, tagged exchange follows
+#define FRAME_FLAG_TRACE 0x2u         // a request ID follows the word
+#define FRAME_FLAG_SEED 0x4u          // key derived from a seed segment
+#define FRAME_FLAGS (FRAME_FLAG_MAC | FRAME_FLAG_TRACE | FRAME_FLAG_SEED)
+#define FRAME_CHUNK 16384             // symbols per frame sent by clients
+#define FRAME_MAX 65536               // largest frame a daemon accepts
+#define FRAME_MAC_BLOCK 4096          // interleaving unit of the tags
+#define MAC_KEY_SYMBOLS 26
+#define FRAME_KEY_EXTRA (2 * MAC_KEY_SYMBOLS)
+
+// Frames, including the empty last one, for n symbols of text
+#define FRAME_COUNT(n) (((n) + FRAME_CHUNK - 1) / FRAME_CHUNK + 1)
+// Pad symbols consumed by n symbols of text in framed mode
+#define FRAME_KEY_LENGTH(n) ((n) + FRAME_COUNT(n) * FRAME_KEY_EXTRA)
+
+static const uint64_t MAC_PRIME = (1ULL << 61) - 1;
+
+struct frameHeader
+{
+  uint32_t length,
+           sequence;
+};
+
+// Running polynomial MAC; 7 message bytes form one field element
+struct macState
+{
+  uint64_t r,
+           s,
+           acc,
+           limb,
+           total;
+  int limbBytes;
+};
+
+/*********************************************************************
+ ** macMultiply
+ ** Description: Returns a * b mod 2^61 - 1 for a, b < 2^62
+ ** Parameters: uint64_t a, uint64_t b
+ *********************************************************************/
+static inline uint64_t macMultiply(uint64_t a, uint64_t b)
+{
+  unsigned __int128 product = (unsigned __int128) a * b;
+  uint64_t x = (uint64_t) (product & MAC_PRIME) + (uint64_t) (product >> 61);
+
+  x = (x & MAC_PRIME) + (x >> 61);
+  return x >= MAC_PRIME ? x - MAC_PRIME : x;
+}
+
+/*********************************************************************
+ ** macKeyValue
+ ** Description: Reads 13 pad symbols as a base-27 number mod 2^61 - 1
+ ** Parameters: const uint8_t* key
+ *********************************************************************/
+static inline uint64_t macKeyValue(const uint8_t* key)
+{
+  uint64_t value = 0;
+  int index;
+
+  for (index = 0; index < MAC_KEY_SYMBOLS / 2; index++)
+    value = value * 27 + (key[index] == ' ' ? 26 : key[index] - 'A');
+  return value % MAC_PRIME;
+}
+
+/*********************************************************************
+ ** macInit
+ ** Description: Starts a MAC keyed by MAC_KEY_SYMBOLS pad symbols:
+ ** the first half gives the evaluation point, the second the offset
+ ** Parameters: struct macState* mac, const uint8_t* key
+ *********************************************************************/
+static inline void macInit(struct macState* mac, const uint8_t* key)
+{
+  mac->r = macKeyValue(key);
+  mac->s = macKeyValue(key + MAC_KEY_SYMBOLS / 2);
+  mac->acc = 0;
+  mac->limb = 0;
+  mac->total = 0;
+  mac->limbBytes = 0;
+}
+
+/*********************************************************************
+ ** macUpdate
+ ** Description: Adds n bytes to the message
+ ** Parameters: struct macState* mac, const uint8_t* data, size_t n
+ *********************************************************************/
+static inline void macUpdate(struct macState* mac, const uint8_t* data,
+                             size_t n)
+{
+  uint64_t word;
+  size_t index = 0;
+
+  mac->total += n;
+
+  // Finish a limb left over from the last call
+  while (mac->limbBytes > 0 && index < n)
+  {
+    mac->limb |= (uint64_t) data[index++] << (8 * mac->limbBytes);
+    if (++mac->limbBytes == 7)
+    {
+      mac->acc = macMultiply(mac->acc + mac->limb, mac->r);
+      mac->limb = 0;
+      mac->limbBytes = 0;
+    }
+  }
+
+  // Whole limbs straight from the buffer
+  for (; index + 8 <= n; index += 7)
+  {
+    memcpy(&word, data + index, sizeof(word));
+    word = le64toh(word) & 0xffffffffffffffULL;  // same order as below
+    mac->acc = macMultiply(mac->acc + word, mac->r);
+  }
+
+  for (; index < n; index++)
+    mac->limb |= (uint64_t) data[index] << (8 * mac->limbBytes++);
+  if (mac->limbBytes == 7)
+  {
+    mac->acc = macMultiply(mac->acc + mac->limb, mac->r);
+    mac->limb = 0;
+    mac->limbBytes = 0;
+  }
+}
+
+/*********************************************************************
+ ** macFinal
+ ** Description: Returns the tag: the last partial limb (marked so
+ ** trailing zeros count) and the message length are added, then the
+ ** one-time offset
+ ** Parameters: struct macState* mac
+ *********************************************************************/
+static inline uint64_t macFinal(struct macState* mac)
+{
+  if (mac->limbBytes > 0)
+    mac->acc = macMultiply(mac->acc + (mac->limb |
+                           (1ULL << (8 * mac->limbBytes))), mac->r);
+  mac->acc = macMultiply(mac->acc + (mac->total & MAC_PRIME), mac->r);
+  return (mac->acc + mac->s) % MAC_PRIME;
+}
+
+/*********************************************************************
+ ** macFrameHeader
+ ** Description: Starts a frame MAC and adds the frame header to it,
+ ** so a tag also covers the frame's position and length
+ ** Parameters: struct macState* mac, const uint8_t* key,
+ ** const struct frameHeader* header
+ *********************************************************************/
+static inline void macFrameHeader(struct macState* mac, const uint8_t* key,
+                                  const struct frameHeader* header)
+{
+  uint32_t words[2];
+
+  words[0] = htonl(header->sequence);
+  words[1] = htonl(header->length);
+  macInit(mac, key);
+  macUpdate(mac, (const uint8_t*) words, sizeof(words));
+}
+
+/*********************************************************************
+ ** frameTag
+ ** Description: Computes a request tag (first = text, second = cipher
+ ** key, keyed by the frame's first MAC key) or a response tag
+ ** (first = text, second = result, second MAC key). The two inputs
+ ** are taken FRAME_MAC_BLOCK bytes at a time, alternately.
+ ** Parameters: const struct frameHeader* header, const uint8_t* first,
+ ** const uint8_t* second, const uint8_t* macKey
+ *********************************************************************/
+static inline uint64_t frameTag(const struct frameHeader* header,
+                                const uint8_t* first, const uint8_t* second,
+                                const uint8_t* macKey)
+{
+  struct macState mac;
+  size_t done,
+         block;
+
+  macFrameHeader(&mac, macKey, header);
+  for (done = 0; done < header->length; done += block)
+  {
+    block = header->length - done;
+    if (block > FRAME_MAC_BLOCK)
+      block = FRAME_MAC_BLOCK;
+    macUpdate(&mac, first + done, block);
+    macUpdate(&mac, second + done, block);
+  }
+  return macFinal(&mac);
+}
+
+/*********************************************************************
+ ** frameSendStart
+ ** Description: Writes the extended header: the flags word, then the
+ ** request ID (high word first) if flags has FRAME_FLAG_TRACE.
+ ** Returns 0, or -1 with errno set.
+ ** Parameters: int sockfd, uint32_t flags, uint64_t request,
+ ** long deadline
+ *********************************************************************/
+static inline int frameSendStart(int sockfd, uint32_t flags,
+                                 uint64_t request, long deadline)
+{
+  uint32_t words[3];
+
+  words[0] = htonl(FRAME_HEADER_BIT | flags);
+  words[1] = htonl((uint32_t) (request >> 32));
+  words[2] = htonl((uint32_t) request);
+  return writeFull(sockfd, words, flags & FRAME_FLAG_TRACE
+                   ? sizeof(words) : sizeof(words[0]), deadline);
+}
+
+/*********************************************************************
+ ** frameSend
+ ** Description: Writes a whole frame in one message: the header,
+ ** the first and second payloads (either may be empty) and the tag.
+ ** Separate small writes would let Nagle's algorithm hold the tag
+ ** back until the peer's delayed ACK. Returns 0, or -1 with errno
+ ** set.
+ ** Parameters: int sockfd, const struct frameHeader* header,
+ ** const uint8_t* first, size_t firstLen, const uint8_t* second,
+ ** size_t secondLen, uint64_t tag, long deadline
+ *********************************************************************/
+static inline int frameSend(int sockfd, const struct frameHeader* header,
+                            const uint8_t* first, size_t firstLen,
+                            const uint8_t* second, size_t secondLen,
+                            uint64_t tag, long deadline)
+{
+  uint32_t words[2],
+           tagWords[2];
+  struct iovec parts[4];
+
+  words[0] = htonl(header->length);
+  words[1] = htonl(header->sequence);
+  tagWords[0] = htonl((uint32_t) (tag >> 32));
+  tagWords[1] = htonl((uint32_t) tag);
+  parts[0].iov_base = words;
+  parts[0].iov_len = sizeof(words);
+  parts[1].iov_base = (void*) first;
+  parts[1].iov_len = firstLen;
+  parts[2].iov_base = (void*) second;
+  parts[2].iov_len = secondLen;
+  parts[3].iov_base = tagWords;
+  parts[3].iov_len = sizeof(tagWords);
+  return writevFull(sockfd, parts, 4, deadline);
+}
+
+/*********************************************************************
+ ** frameRecvHeader
+ ** Description: Reads a frame header. Returns 0, or -1 with errno
+ ** set (ECONNRESET if the peer closed).
+ ** Parameters: int sockfd, struct frameHeader* header, long deadline
+ *********************************************************************/
+static inline int frameRecvHeader(int sockfd, struct frameHeader* header,
+                                  long deadline)
+{
+  uint32_t words[2];
+
+  if (readFull(sockfd, words, sizeof(words), deadline) < 0)
+    return -1;
+  header->length = ntohl(words[0]);
+  header->sequence = ntohl(words[1]);
+  return 0;
+}
+
+/*********************************************************************
+ ** frameRecvTag
+ ** Description: Reads a 64-bit tag. Returns 0, or -1 with errno set.
+ ** Parameters: int sockfd, uint64_t* tag, long deadline
+ *********************************************************************/
+static inline int frameRecvTag(int sockfd, uint64_t* tag, long deadline)
+{
+  uint32_t words[2];
+
+  if (readFull(sockfd, words, sizeof(words), deadline) < 0)
+    return -1;
+  *tag = (uint64_t) ntohl(words[0]) << 32 | ntohl(words[1]);
+  return 0;
+}
+
+/*********************************************************************
+ ** frameRecvRequest
+ ** Description: Reads the request ID of an extended header, which is
+ ** encoded like a tag. Returns 0, or -1 with errno set.
+ ** Parameters: int sockfd, uint64_t* request, long deadline
+ *********************************************************************/
+static inline int frameRecvRequest(int sockfd, uint64_t* request,
+                                   long deadline)
+{
+  return frameRecvTag(sockfd, request, deadline);
+}
+
+#endif
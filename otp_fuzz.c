@@ -0,0 +1,802 @@
+/*********************************************************************
+ ** Program Filename: otp_fuzz.c
+ ** Author: Peter Nguyen
+ ** Date: 10/19/26
+ ** CS 344-400, Program 4
+ ** Description: Fuzz harness for the code that handles untrusted
+ ** input. The first byte of an input picks a target, the rest is fed
+ ** to it:
+ **   request  the daemons' parser (otp_request.h), through a socket
+ **            pair, the framed loop with its tags and cipher pass,
+ **            and key derivation for seed descriptors
+ **   cipher   every engine against the scalar one, both directions,
+ **            at any length and alignment, in exactly sized buffers
+ **   lz       the decoder on arbitrary input, whole and in chunks,
+ **            and compress/decompress round trips
+ ** A broken invariant calls abort(), so any fuzzer reports it like a
+ ** crash. Build it one of three ways:
+ **   libFuzzer  clang -g -O1 -fsanitize=fuzzer,address -DOTP_LIBFUZZER
+ **   AFL        afl-cc -O2, then afl-fuzz -i seeds -o out -- ./otp_fuzz @@
+ **   standalone gcc -O2 (add -fsanitize=address to catch overreads)
+ ** Standalone, files on the command line are replayed (as AFL and
+ ** libFuzzer crash files are), and without files the harness mutates
+ ** its own seeds for -n runs, saving any input that crashes or hangs
+ ** to otp_fuzz-crash. -c dir writes the seeds as a starting corpus.
+ ** Usage: otp_fuzz [-n runs] [-s seed] [-c corpusDir] [file ...]
+ *********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include "otp_net.h"
+#include "otp_arena.h"
+#include "otp_cipher.h"
+#include "otp_frame.h"
+#include "otp_request.h"
+#include "otp_seed.h"
+#include "otp_compress.h"
+
+#define FUZZ_MAX_INPUT 65536      // larger inputs are cut to this
+#define FUZZ_MAX_BYTES 69999      // the daemons' default -m
+#define FUZZ_TIMEOUT 10           // seconds before a run counts as hung
+
+// Targets, picked by the first input byte modulo FUZZ_TARGET_COUNT
+enum fuzzTarget
+{
+  FUZZ_REQUEST,
+  FUZZ_CIPHER,
+  FUZZ_LZ,
+  FUZZ_TARGET_COUNT
+};
+
+const char* const fuzzTargetNames[FUZZ_TARGET_COUNT] =
+{
+  "request", "cipher", "lz"
+};
+
+const int DEFAULT_RUNS = 100000;
+const int SEED_COUNT = 7;
+const int SHORT_KEY_SEED = 5;  // the one seed a daemon must refuse
+const char* CRASH_FILE = "otp_fuzz-crash";
+const uint8_t FUZZ_SEED_KEY[SEED_KEY_BYTES] = "otp_fuzz fixed seed key 012345";
+
+struct arena fuzzArena;           // like the daemon's request arena
+struct seedKey fuzzSeed;          // like a daemon's -K seed
+const uint8_t* currentInput;      // saved by onCrash
+size_t currentSize;
+
+// Function prototypes
+void error(const char *msg);
+int fuzzOne(const uint8_t* data, size_t size);
+int fuzzRequest(const uint8_t* data, size_t size);
+void fuzzFrames(int sockfd, struct otpRequest* request);
+int fuzzCipher(const uint8_t* data, size_t size);
+int fuzzLz(const uint8_t* data, size_t size);
+void check(int condition, const char* what);
+size_t makeSeed(int index, uint8_t* out, uint64_t* state);
+size_t putWord(uint8_t* out, uint32_t word);
+size_t mutate(uint8_t* data, size_t size, uint64_t* state);
+uint64_t nextRandom(uint64_t* state);
+void writeFile(const char* path, const uint8_t* data, size_t size);
+uint8_t* readFile(const char* path, size_t* size);
+void onCrash(int signo);
+
+#ifdef OTP_LIBFUZZER
+
+/*********************************************************************
+ ** LLVMFuzzerTestOneInput
+ ** Description: libFuzzer entry point
+ ** Parameters: const uint8_t* data, size_t size
+ *********************************************************************/
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+  fuzzOne(data, size);
+  return 0;
+}
+
+#else
+
+int main(int argc, char *argv[])
+{
+  int option,
+      runs = DEFAULT_RUNS,
+      run,
+      index,
+      counts[FUZZ_TARGET_COUNT][2];  // rejected, accepted
+  uint64_t state = 0,
+           seed;
+  uint8_t *data,
+          *seeds[SEED_COUNT];
+  size_t size,
+         seedSizes[SEED_COUNT];
+  char *corpus = NULL,
+       path[4096];
+  struct sigaction sa;
+  struct timespec start,
+                  end;
+
+  while ((option = getopt(argc, argv, "n:s:c:")) != -1)
+  {
+    switch (option)
+    {
+      case 'n': runs = atoi(optarg); break;
+      case 's': state = strtoull(optarg, NULL, 0); break;
+      case 'c': corpus = optarg; break;
+      default:
+        fprintf(stderr, "usage: %s [-n runs] [-s seed] [-c corpusDir] "
+                "[file ...]\n", argv[0]);
+        exit(1);
+    }
+  }
+  if (state == 0)
+    state = time(NULL) ^ ((uint64_t) getpid() << 32);
+  seed = state;  // -s seed repeats this run
+  memset(counts, 0, sizeof(counts));
+
+  // Replay: run each file once, the way AFL runs ./otp_fuzz @@
+  if (optind < argc)
+  {
+    for (index = optind; index < argc; index++)
+    {
+      data = readFile(argv[index], &size);
+      printf("%s: %s\n", argv[index],
+             fuzzOne(data, size) ? "accepted" : "rejected");
+      free(data);
+    }
+    return 0;
+  }
+
+  for (index = 0; index < SEED_COUNT; index++)
+  {
+    seeds[index] = malloc(FUZZ_MAX_INPUT);
+    if (seeds[index] == NULL)
+      error("ERROR allocating seeds");
+    seedSizes[index] = makeSeed(index, seeds[index], &state);
+    if (corpus != NULL)
+    {
+      mkdir(corpus, 0755);
+      snprintf(path, sizeof(path), "%s/seed-%d", corpus, index);
+      writeFile(path, seeds[index], seedSizes[index]);
+      free(seeds[index]);
+    }
+  }
+  if (corpus != NULL)
+  {
+    printf("wrote %d seeds to %s\n", SEED_COUNT, corpus);
+    return 0;
+  }
+
+  // Keep the input of a run that crashes or hangs
+  data = malloc(FUZZ_MAX_INPUT);
+  if (data == NULL)
+    error("ERROR allocating input");
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = onCrash;
+  sa.sa_flags = SA_RESETHAND;
+  sigaction(SIGSEGV, &sa, NULL);
+  sigaction(SIGBUS, &sa, NULL);
+  sigaction(SIGABRT, &sa, NULL);
+  sigaction(SIGFPE, &sa, NULL);
+  sigaction(SIGALRM, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  printf("fuzzing %d runs from seed %#llx\n", runs,
+         (unsigned long long) seed);
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (run = 0; run < runs; run++)
+  {
+    // Each seed runs once as it is, then mutated copies of them
+    index = run < SEED_COUNT ? run : (int) (nextRandom(&state) % SEED_COUNT);
+    memcpy(data, seeds[index], seedSizes[index]);
+    size = seedSizes[index];
+    if (run >= SEED_COUNT)
+      size = mutate(data, size, &state);
+
+    currentInput = data;
+    currentSize = size;
+    alarm(FUZZ_TIMEOUT);
+    option = fuzzOne(data, size);
+    if (size > 0)
+      counts[data[0] % FUZZ_TARGET_COUNT][option]++;
+    if (run < SEED_COUNT && option != (run != SHORT_KEY_SEED))
+    {
+      fprintf(stderr, "ERROR: seed %d was %s\n", run,
+              option ? "accepted" : "rejected");
+      abort();
+    }
+  }
+  alarm(0);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  printf("%d runs in %.2f s, no crashes or hangs\n", runs,
+         end.tv_sec - start.tv_sec + (end.tv_nsec - start.tv_nsec) / 1e9);
+  for (index = 0; index < FUZZ_TARGET_COUNT; index++)
+    printf("  %-8s %8d accepted %8d rejected\n", fuzzTargetNames[index],
+           counts[index][1], counts[index][0]);
+  for (index = 0; index < SEED_COUNT; index++)
+    free(seeds[index]);
+  free(data);
+  return 0;
+}
+
+#endif
+
+/*********************************************************************
+ ** fuzzOne
+ ** Description: Runs the target picked by the first byte on the rest
+ ** of the input. Returns 1 if the target accepted the input (a valid
+ ** request, a decodable stream), 0 if it rejected it.
+ ** Parameters: const uint8_t* data, size_t size
+ *********************************************************************/
+int fuzzOne(const uint8_t* data, size_t size)
+{
+  static int ready = 0;
+
+  if (!ready)
+  {
+    if (arenaInit(&fuzzArena, 0) < 0)
+      error("ERROR allocating arena");
+    if (seedInit(&fuzzSeed, FUZZ_SEED_KEY) < 0)
+      error("ERROR checking seed expansion");
+    signal(SIGPIPE, SIG_IGN);
+    ready = 1;
+  }
+  if (size == 0)
+    return 0;
+  if (size > FUZZ_MAX_INPUT)
+    size = FUZZ_MAX_INPUT;
+
+  switch (data[0] % FUZZ_TARGET_COUNT)
+  {
+    case FUZZ_REQUEST: return fuzzRequest(data + 1, size - 1);
+    case FUZZ_CIPHER: return fuzzCipher(data + 1, size - 1);
+    default: return fuzzLz(data + 1, size - 1);
+  }
+}
+
+/*********************************************************************
+ ** fuzzRequest
+ ** Description: Sends data down one end of a socket pair and closes
+ ** it, then parses the other end the way handleRequest does. A
+ ** request that parses must meet every limit the daemon relies on;
+ ** its cipher runs in place like the daemon's, so an out of range
+ ** length shows up as an overrun under a sanitizer.
+ ** Parameters: const uint8_t* data, size_t size
+ *********************************************************************/
+int fuzzRequest(const uint8_t* data, size_t size)
+{
+  struct otpRequest request;
+  int fds[2],
+      buffer = 2 * FUZZ_MAX_INPUT,
+      accepted;
+  ssize_t sent;
+
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+    error("ERROR creating socket pair");
+  setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &buffer, sizeof(buffer));
+  sent = size > 0 ? send(fds[0], data, size, MSG_DONTWAIT) : 0;
+  check(sent == (ssize_t) size, "socket pair holds the whole input");
+  shutdown(fds[0], SHUT_WR);  // the parser sees EOF after the input
+
+  accepted = requestRead(fds[1], FUZZ_MAX_BYTES, &fuzzArena, &request,
+                         NO_DEADLINE) == 0;
+  if (accepted && (request.flags & FRAME_FLAG_SEED))
+    accepted = requestDeriveKey(&request, &fuzzSeed, &fuzzArena) == 0;
+  if (!accepted)
+    check(request.error[0] != '\0', "failed read has a message");
+  else if (request.flags & FRAME_FLAG_MAC)
+  {
+    check(request.text == NULL && request.key == NULL,
+          "framed request has no plain buffers");
+    fuzzFrames(fds[1], &request);
+  }
+  else
+  {
+    check(request.textLen >= 1 && request.textLen <= FUZZ_MAX_BYTES,
+          "text length within limit");
+    check(request.keyLen >= request.textLen - 1 &&
+          request.keyLen <= FUZZ_MAX_BYTES, "key covers the text");
+    check(request.text[request.textLen] == '\0' &&
+          request.key[request.keyLen] == '\0', "buffers are terminated");
+    cipherEngines[CIPHER_ENGINE_COUNT - 1].encrypt(
+      (uint8_t*) request.text, (uint8_t*) request.key,
+      (uint8_t*) request.text, request.textLen - 1);
+  }
+
+  close(fds[0]);
+  close(fds[1]);
+  arenaReset(&fuzzArena);
+  return accepted;
+}
+
+/*********************************************************************
+ ** fuzzFrames
+ ** Description: Reads frames after a framed header like handleFramed:
+ ** each is authenticated and ciphered in one fused pass, whose tag
+ ** must match the one frameTag (the client's computation) gives.
+ ** Stops at the empty frame or the first bad one.
+ ** Parameters: int sockfd, struct otpRequest* request
+ *********************************************************************/
+void fuzzFrames(int sockfd, struct otpRequest* request)
+{
+  struct frameHeader frame = { 0, 0 };
+  struct macState mac;
+  uint64_t tag;
+  uint32_t sequence = 0,
+           limit = FRAME_MAX < FUZZ_MAX_BYTES ? FRAME_MAX : FUZZ_MAX_BYTES;
+  size_t done,
+         block;
+  uint8_t *text = arenaAlloc(&fuzzArena, limit),
+          *key = arenaAlloc(&fuzzArena, limit + FRAME_KEY_EXTRA),
+          *result = arenaAlloc(&fuzzArena, limit);
+
+  check(text != NULL && key != NULL && result != NULL, "frame buffers");
+  while (requestReadFrame(sockfd, sequence, limit, &frame, text, key, &tag,
+                          request, NO_DEADLINE) == 0)
+  {
+    check(frame.length <= limit && frame.sequence == sequence,
+          "frame within limit and in order");
+    macFrameHeader(&mac, key + frame.length, &frame);
+    for (done = 0; done < frame.length; done += block)
+    {
+      block = frame.length - done;
+      if (block > FRAME_MAC_BLOCK)
+        block = FRAME_MAC_BLOCK;
+      macUpdate(&mac, text + done, block);
+      macUpdate(&mac, key + done, block);
+      cipherEngines[CIPHER_ENGINE_COUNT - 1].encrypt(text + done,
+        key + done, result + done, block);
+    }
+    check(macFinal(&mac) == frameTag(&frame, text, key, key + frame.length),
+          "fused tag equals frameTag");
+    if (frame.length == 0)
+      break;
+    sequence++;
+  }
+}
+
+/*********************************************************************
+ ** fuzzCipher
+ ** Description: The first byte gives an alignment offset, the rest
+ ** is split into text and key. Mapped to symbols, every supported
+ ** engine must agree with the scalar one in both directions and
+ ** decryption must undo encryption, and every validator must accept
+ ** the symbols, stop at a newline planted inside them, and find the
+ ** same first bad byte in the raw input as the scalar one. A newline
+ ** is enciphered differently by each engine, so a validator that
+ ** passed one would let a request's output depend on the CPU.
+ ** Ciphering the raw bytes, which are outside the alphabet, engines
+ ** only have to stay in bounds.
+ ** Buffers are allocated at their exact size so a sanitizer catches
+ ** a vector tail that reads or writes one byte too far.
+ ** Parameters: const uint8_t* data, size_t size
+ *********************************************************************/
+int fuzzCipher(const uint8_t* data, size_t size)
+{
+  size_t offset,
+         n,
+         index,
+         newline;
+  uint8_t *text,
+          *key,
+          *expected,
+          *actual,
+          *raw;
+  int engine;
+
+  if (size < 1)
+    return 0;
+  offset = data[0] % 64;
+  n = (size - 1) / 2;
+  text = malloc(offset + n + 1);
+  key = malloc(n + 1);
+  expected = malloc(n + 1);
+  actual = malloc(offset + n + 1);
+  raw = malloc(n + 1);
+  if (text == NULL || key == NULL || expected == NULL || actual == NULL ||
+      raw == NULL)
+    error("ERROR allocating cipher buffers");
+
+  for (index = 0; index < n; index++)
+  {
+    text[offset + index] = symbolChar(data[1 + index] % 27);
+    key[index] = symbolChar(data[1 + n + index] % 27);
+  }
+  newline = n > 1 ? (data[1] + 256 * data[2]) % (n - 1) : 0;
+
+  for (engine = 0; engine < CIPHER_ENGINE_COUNT; engine++)
+  {
+    if (!cipherEngines[engine].supported())
+      continue;
+
+    scalarEncrypt(text + offset, key, expected, n);
+    cipherEngines[engine].encrypt(text + offset, key, actual + offset, n);
+    check(memcmp(expected, actual + offset, n) == 0,
+          "engine encrypts like scalar");
+    cipherEngines[engine].decrypt(actual + offset, key, actual + offset, n);
+    check(memcmp(text + offset, actual + offset, n) == 0,
+          "decryption undoes encryption");
+
+    scalarDecrypt(text + offset, key, expected, n);
+    cipherEngines[engine].decrypt(text + offset, key, actual + offset, n);
+    check(memcmp(expected, actual + offset, n) == 0,
+          "engine decrypts like scalar");
+
+    check(cipherEngines[engine].findInvalid(text + offset, n) == n,
+          "validator accepts symbols");
+    check(cipherEngines[engine].findInvalid(data + 1, size - 1) ==
+          scalarFindInvalid(data + 1, size - 1),
+          "validator finds the first bad byte like scalar");
+
+    if (n > 1)
+    {
+      text[offset + newline] = '\n';
+      check(cipherEngines[engine].findInvalid(text + offset, n) == newline,
+            "validator stops at a newline inside the symbols");
+      text[offset + newline] = symbolChar(data[1 + newline] % 27);
+    }
+
+    // Out of alphabet: any output, but no out of bounds access
+    cipherEngines[engine].encrypt(data + 1, data + 1 + n, raw, n);
+    cipherEngines[engine].decrypt(data + 1, data + 1 + n, raw, n);
+  }
+
+  free(text);
+  free(key);
+  free(expected);
+  free(actual);
+  free(raw);
+  return 1;
+}
+
+/*********************************************************************
+ ** fuzzLz
+ ** Description: Decodes the input as a compressed stream, whole and
+ ** in chunks cut at points the input picks; the two must agree, stay
+ ** within LZ_DECODE_BOUND and produce only symbols. Then compresses
+ ** the input mapped to symbols and checks it decompresses back.
+ ** Returns 1 if the input was a valid stream.
+ ** Parameters: const uint8_t* data, size_t size
+ *********************************************************************/
+int fuzzLz(const uint8_t* data, size_t size)
+{
+  struct lzDecoder dec;
+  uint8_t *chunked,
+          *symbols;
+  char *whole,
+       *packed,
+       *unpacked;
+  size_t wholeLen = 0,
+         done = 0,
+         written = 0,
+         chunk,
+         index;
+  long got;
+  int valid;
+
+  // Whole stream at once
+  whole = lzDecompress((const char*) data, size, &wholeLen);
+  valid = whole != NULL;
+  if (valid)
+  {
+    check(wholeLen <= LZ_DECODE_BOUND(size), "decoded within bound");
+    for (index = 0; index < wholeLen; index++)
+      check(lzValue(whole[index]) >= 0, "decoded only symbols");
+  }
+
+  // The same stream in uneven chunks
+  chunked = malloc(LZ_DECODE_BOUND(size) + 1);
+  if (chunked == NULL)
+    error("ERROR allocating lz buffers");
+  lzDecoderInit(&dec);
+  got = 0;
+  while (done < size && got >= 0)
+  {
+    chunk = 1 + data[done] % 61;
+    if (chunk > size - done)
+      chunk = size - done;
+    got = lzDecodeChunk(&dec, data + done, chunk, chunked + written);
+    if (got >= 0)
+      written += got;
+    done += chunk;
+  }
+  check(valid == (got >= 0 && dec.state == 0), "chunking keeps validity");
+  if (valid)
+    check(written == wholeLen && memcmp(whole, chunked, wholeLen) == 0,
+          "chunked decode matches whole decode");
+  free(whole);
+  free(chunked);
+
+  // Round trip of the input as symbols
+  symbols = malloc(size + 1);
+  packed = malloc(LZ_ENCODE_BOUND(size) + 1);
+  if (symbols == NULL || packed == NULL)
+    error("ERROR allocating lz buffers");
+  for (index = 0; index < size; index++)
+    symbols[index] = symbolChar(data[index] % 27);
+  got = lzCompress((const char*) symbols, size, packed);
+  if (got < 0)
+    error("ERROR allocating lz encoder");
+  check((size_t) got <= LZ_ENCODE_BOUND(size), "compressed within bound");
+  unpacked = lzDecompress(packed, got, &wholeLen);
+  check(unpacked != NULL && wholeLen == size &&
+        memcmp(unpacked, symbols, size) == 0, "lz round trip");
+  free(unpacked);
+  free(packed);
+  free(symbols);
+  return valid;
+}
+
+/*********************************************************************
+ ** check
+ ** Description: Aborts with a message if an invariant does not hold
+ ** Parameters: int condition, const char* what
+ *********************************************************************/
+void check(int condition, const char* what)
+{
+  if (!condition)
+  {
+    fprintf(stderr, "otp_fuzz: check failed: %s\n", what);
+    abort();
+  }
+}
+
+/*********************************************************************
+ ** makeSeed
+ ** Description: Builds valid input number index into out and returns
+ ** its length: plain, traced and framed requests, a cipher input, a
+ ** compressed stream, a plain request with a short key and one with
+ ** a seed descriptor for fuzzSeed
+ ** Parameters: int index, uint8_t* out, uint64_t* state
+ *********************************************************************/
+size_t makeSeed(int index, uint8_t* out, uint64_t* state)
+{
+  struct frameHeader frame;
+  struct seedKey seed;
+  uint8_t text[3000],
+          key[3000 + FRAME_KEY_EXTRA];
+  uint64_t tag;
+  size_t size = 0,
+         length = 40 + nextRandom(state) % 200;
+  long packed;
+
+  cipherRandomSymbols(text, sizeof(text), state);
+  cipherRandomSymbols(key, sizeof(key), state);
+  switch (index)
+  {
+    case 1:  // traced plain request
+      out[size++] = FUZZ_REQUEST;
+      size += putWord(out + size, FRAME_HEADER_BIT | FRAME_FLAG_TRACE);
+      size += putWord(out + size, 0x01234567);
+      size += putWord(out + size, 0x89abcdef);
+      // fall through
+    case 0:  // plain request, text with its newline
+    case 5:  // and one whose key is too short
+      if (index != 1)
+        out[size++] = FUZZ_REQUEST;
+      size += putWord(out + size, length + 1);
+      memcpy(out + size, text, length);
+      size += length;
+      out[size++] = '\n';
+      if (index == 5)
+        length -= 2;
+      size += putWord(out + size, length);
+      memcpy(out + size, key, length);
+      return size + length;
+
+    case 2:  // framed request: two frames, then the empty one
+      out[size++] = FUZZ_REQUEST;
+      size += putWord(out + size, FRAME_HEADER_BIT | FRAME_FLAG_MAC);
+      for (frame.sequence = 0; frame.sequence < 3; frame.sequence++)
+      {
+        frame.length = frame.sequence < 2 ? length + frame.sequence : 0;
+        tag = frameTag(&frame, text, key, key + frame.length);
+        size += putWord(out + size, frame.length);
+        size += putWord(out + size, frame.sequence);
+        memcpy(out + size, text, frame.length);
+        size += frame.length;
+        memcpy(out + size, key, frame.length + FRAME_KEY_EXTRA);
+        size += frame.length + FRAME_KEY_EXTRA;
+        size += putWord(out + size, tag >> 32);
+        size += putWord(out + size, tag);
+      }
+      return size;
+
+    case 3:  // cipher: alignment byte, text and key
+      out[size++] = FUZZ_CIPHER;
+      out[size++] = nextRandom(state) % 64;
+      memcpy(out + size, text, length);
+      memcpy(out + size + length, key, length);
+      return size + 2 * length;
+
+    case 6:  // seed descriptor in place of the key
+      if (seedInit(&seed, FUZZ_SEED_KEY) < 0)
+        error("ERROR checking seed expansion");
+      out[size++] = FUZZ_REQUEST;
+      size += putWord(out + size, FRAME_HEADER_BIT | FRAME_FLAG_SEED);
+      size += putWord(out + size, length + 1);
+      memcpy(out + size, text, length);
+      size += length;
+      out[size++] = '\n';
+      size += putWord(out + size, seed.id >> 32);
+      size += putWord(out + size, seed.id);
+      size += putWord(out + size, 0);
+      size += putWord(out + size, nextRandom(state) % 100);
+      size += putWord(out + size, 0);
+      size += putWord(out + size, nextRandom(state) % 1000000);
+      return size;
+
+    default:  // compressed text with repeats
+      out[size++] = FUZZ_LZ;
+      memcpy(text + 1000, text, 1000);
+      packed = lzCompress((const char*) text, 2000, (char*) out + size);
+      return size + packed;
+  }
+}
+
+/*********************************************************************
+ ** putWord
+ ** Description: Stores word in network order at out, returns 4
+ ** Parameters: uint8_t* out, uint32_t word
+ *********************************************************************/
+size_t putWord(uint8_t* out, uint32_t word)
+{
+  word = htonl(word);
+  memcpy(out, &word, sizeof(word));
+  return sizeof(word);
+}
+
+/*********************************************************************
+ ** mutate
+ ** Description: Applies one to eight random edits to size bytes of
+ ** data, which has room for FUZZ_MAX_INPUT, and returns the new size.
+ ** Edits flip bits, set bytes, drop or repeat a range, cut the tail,
+ ** or plant a 32-bit word that stresses the length checks.
+ ** Parameters: uint8_t* data, size_t size, uint64_t* state
+ *********************************************************************/
+size_t mutate(uint8_t* data, size_t size, uint64_t* state)
+{
+  static const uint32_t words[] =
+  {
+    0, 1, 2, 69999, 70000, 65536, 65537, 0x7fffffff, 0x80000000,
+    0x80000001, 0x80000002, 0x80000003, 0x80000004, 0xffffffff
+  };
+  size_t at,
+         length;
+  int edits = 1 + nextRandom(state) % 8;
+
+  while (edits-- > 0 && size > 1)
+  {
+    at = 1 + nextRandom(state) % (size - 1);  // keep the target byte
+    length = 1 + nextRandom(state) % 16;
+    switch (nextRandom(state) % 6)
+    {
+      case 0:
+        data[at] ^= 1 << (nextRandom(state) % 8);
+        break;
+      case 1:
+        data[at] = nextRandom(state);
+        break;
+      case 2:  // drop a range
+        if (length > size - at)
+          length = size - at;
+        memmove(data + at, data + at + length, size - at - length);
+        size -= length;
+        break;
+      case 3:  // repeat a range
+        if (length > size - at)
+          length = size - at;
+        if (size + length > FUZZ_MAX_INPUT)
+          break;
+        memmove(data + at + length, data + at, size - at);
+        size += length;
+        break;
+      case 4:
+        size = at;
+        break;
+      default:  // a length or header word, aligned or not
+        if (at + 4 > size)
+          break;
+        putWord(data + at, words[nextRandom(state) %
+                                 (sizeof(words) / sizeof(words[0]))]);
+        break;
+    }
+  }
+  return size;
+}
+
+/*********************************************************************
+ ** nextRandom
+ ** Description: Steps a xorshift generator and returns its state
+ ** Parameters: uint64_t* state
+ *********************************************************************/
+uint64_t nextRandom(uint64_t* state)
+{
+  *state ^= *state << 13;
+  *state ^= *state >> 7;
+  *state ^= *state << 17;
+  return *state;
+}
+
+/*********************************************************************
+ ** writeFile
+ ** Description: Writes size bytes of data to a new file at path
+ ** Parameters: const char* path, const uint8_t* data, size_t size
+ *********************************************************************/
+void writeFile(const char* path, const uint8_t* data, size_t size)
+{
+  FILE* filePtr = fopen(path, "wb");
+
+  if (filePtr == NULL)
+    error("ERROR creating file");
+  if (fwrite(data, 1, size, filePtr) != size || fclose(filePtr) != 0)
+    error("ERROR writing file");
+}
+
+/*********************************************************************
+ ** readFile
+ ** Description: Reads a whole file into a new buffer and stores its
+ ** length in size
+ ** Parameters: const char* path, size_t* size
+ *********************************************************************/
+uint8_t* readFile(const char* path, size_t* size)
+{
+  FILE* filePtr = fopen(path, "rb");
+  uint8_t* data = malloc(FUZZ_MAX_INPUT);
+
+  if (filePtr == NULL)
+    error("ERROR opening input");
+  if (data == NULL)
+    error("ERROR allocating input");
+  *size = fread(data, 1, FUZZ_MAX_INPUT, filePtr);
+  fclose(filePtr);
+  return data;
+}
+
+/*********************************************************************
+ ** onCrash
+ ** Description: Signal handler for crashes, aborts and the hang
+ ** alarm: saves the current input to CRASH_FILE with async-signal-
+ ** safe calls, then lets the signal end the process
+ ** Parameters: int signo
+ *********************************************************************/
+void onCrash(int signo)
+{
+  static const char hung[] = "otp_fuzz: run hung, input saved\n",
+                    crashed[] = "otp_fuzz: crashed, input saved\n";
+  int fd = open(CRASH_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+  if (fd >= 0)
+  {
+    write(fd, currentInput, currentSize);
+    close(fd);
+  }
+  if (signo == SIGALRM)
+  {
+    write(STDERR_FILENO, hung, sizeof(hung) - 1);
+    signo = SIGABRT;
+  }
+  else
+    write(STDERR_FILENO, crashed, sizeof(crashed) - 1);
+  signal(signo, SIG_DFL);
+  raise(signo);
+}
+
+/*********************************************************************
+ ** error
+ ** Description: Displays an error message
+ ** Parameters: const char *msg
+ *********************************************************************/
+void error(const char *msg)
+{
+  perror(msg);
+  exit(1);
+}
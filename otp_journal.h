@@ -0,0 +1,445 @@
+/*********************************************************************
+ ** Program Filename: otp_journal.h
+ ** Author: Peter Nguyen
+ ** Date: 10/19/26
+ ** CS 344-400, Program 4
+ ** Description: Key consumption journal. Every pad range handed to
+ ** the daemon is appended to an mmap'd, append-only log so that no
+ ** pad byte is ever used twice, across runs and across concurrent
+ ** processes. Consumed ranges are also kept in memory, per pad, as
+ ** sorted and coalesced intervals, so an overlap check is a binary
+ ** search. Appends are not flushed one by one: callers claim a group
+ ** of ranges and make them durable with a single journalSync before
+ ** any of them is used.
+ *********************************************************************/
+
+#ifndef OTP_JOURNAL_H
+#define OTP_JOURNAL_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const char JOURNAL_MAGIC[8] = { 'O', 'T', 'P', 'J',
+                                      'R', 'N', 'L', '1' };
+static const uint64_t JOURNAL_GROWTH = 4096;  // records added per resize
+
+// On-disk layout: a header followed by fixed-size records
+struct journalHeader
+{
+  char magic[8];
+  uint64_t count;   // records written so far
+};
+
+struct journalRecord
+{
+  uint64_t padId;
+  uint64_t start;   // first pad byte used
+  uint64_t end;     // one past the last pad byte used
+};
+
+// Consumed ranges of one pad, sorted by start and never overlapping
+struct padRanges
+{
+  uint64_t padId;
+  struct journalRecord* ranges;
+  size_t count,
+         capacity;
+};
+
+struct padJournal
+{
+  int fd;
+  size_t mapLen;
+  struct journalHeader* header;
+  struct journalRecord* records;
+  uint64_t loaded;      // records already folded into pads
+  uint64_t synced;      // records known to be on disk
+  struct padRanges* pads;
+  size_t padCount,
+         padCapacity;
+};
+
+/*********************************************************************
+ ** journalPadId
+ ** Description: Identifies a pad by an FNV-1a hash of its first 64
+ ** bytes, so copies of the same pad share one history no matter how
+ ** much of it a client reads.
+ ** Parameters: const char* pad, size_t len
+ *********************************************************************/
+static inline uint64_t journalPadId(const char* pad, size_t len)
+{
+  uint64_t hash = 14695981039346656037ULL;
+  size_t index;
+
+  for (index = 0; index < len && index < 64; index++)
+  {
+    hash ^= (unsigned char) pad[index];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+/*********************************************************************
+ ** journalFindPad
+ ** Description: Returns the range list for padId, creating an empty
+ ** one if create is set. Pads are kept sorted by id and found by
+ ** binary search. Returns NULL if missing or out of memory.
+ ** Parameters: struct padJournal* journal, uint64_t padId, int create
+ *********************************************************************/
+static inline struct padRanges* journalFindPad(struct padJournal* journal,
+                                               uint64_t padId, int create)
+{
+  size_t low = 0,
+         high = journal->padCount,
+         mid;
+  struct padRanges* grown;
+
+  while (low < high)
+  {
+    mid = (low + high) / 2;
+    if (journal->pads[mid].padId < padId)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  if (low < journal->padCount && journal->pads[low].padId == padId)
+    return &journal->pads[low];
+  if (!create)
+    return NULL;
+
+  if (journal->padCount == journal->padCapacity)
+  {
+    journal->padCapacity = journal->padCapacity ? journal->padCapacity * 2
+                                                : 8;
+    grown = realloc(journal->pads,
+                    journal->padCapacity * sizeof(struct padRanges));
+    if (grown == NULL)
+      return NULL;
+    journal->pads = grown;
+  }
+  memmove(&journal->pads[low + 1], &journal->pads[low],
+          (journal->padCount - low) * sizeof(struct padRanges));
+  memset(&journal->pads[low], 0, sizeof(struct padRanges));
+  journal->pads[low].padId = padId;
+  journal->padCount++;
+  return &journal->pads[low];
+}
+
+/*********************************************************************
+ ** rangesLowerBound
+ ** Description: Index of the first range whose end is past start,
+ ** i.e. the only range that could overlap or touch [start, ...).
+ ** Parameters: struct padRanges* pad, uint64_t start
+ *********************************************************************/
+static inline size_t rangesLowerBound(struct padRanges* pad, uint64_t start)
+{
+  size_t low = 0,
+         high = pad->count,
+         mid;
+
+  while (low < high)
+  {
+    mid = (low + high) / 2;
+    if (pad->ranges[mid].end < start)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  return low;
+}
+
+/*********************************************************************
+ ** rangesOverlap
+ ** Description: Returns true if any byte of [start, end) is consumed
+ ** Parameters: struct padRanges* pad, uint64_t start, uint64_t end
+ *********************************************************************/
+static inline int rangesOverlap(struct padRanges* pad, uint64_t start,
+                                uint64_t end)
+{
+  size_t index = rangesLowerBound(pad, start + 1);
+
+  return index < pad->count && pad->ranges[index].start < end;
+}
+
+/*********************************************************************
+ ** rangesInsert
+ ** Description: Adds [start, end) and coalesces it with the ranges it
+ ** touches, so sequential consumption stays a single interval.
+ ** Returns 0 on success, -1 if out of memory.
+ ** Parameters: struct padRanges* pad, uint64_t start, uint64_t end
+ *********************************************************************/
+static inline int rangesInsert(struct padRanges* pad, uint64_t start,
+                               uint64_t end)
+{
+  size_t first = rangesLowerBound(pad, start),
+         last = first;
+  struct journalRecord* grown;
+
+  // Swallow every range that overlaps or touches the new one
+  while (last < pad->count && pad->ranges[last].start <= end)
+  {
+    if (pad->ranges[last].start < start)
+      start = pad->ranges[last].start;
+    if (pad->ranges[last].end > end)
+      end = pad->ranges[last].end;
+    last++;
+  }
+
+  if (first == last)
+  {
+    if (pad->count == pad->capacity)
+    {
+      pad->capacity = pad->capacity ? pad->capacity * 2 : 8;
+      grown = realloc(pad->ranges, pad->capacity * sizeof(*grown));
+      if (grown == NULL)
+        return -1;
+      pad->ranges = grown;
+    }
+    memmove(&pad->ranges[first + 1], &pad->ranges[first],
+            (pad->count - first) * sizeof(struct journalRecord));
+    pad->count++;
+    last = first + 1;
+  }
+  else if (last - first > 1)
+  {
+    memmove(&pad->ranges[first + 1], &pad->ranges[last],
+            (pad->count - last) * sizeof(struct journalRecord));
+    pad->count -= last - first - 1;
+  }
+
+  pad->ranges[first].start = start;
+  pad->ranges[first].end = end;
+  return 0;
+}
+
+/*********************************************************************
+ ** journalMap
+ ** Description: (Re)maps the journal file at its current size
+ ** Parameters: struct padJournal* journal
+ *********************************************************************/
+static inline int journalMap(struct padJournal* journal)
+{
+  struct stat info;
+  void* map;
+
+  if (fstat(journal->fd, &info) < 0)
+    return -1;
+  if (journal->header != NULL)
+    munmap(journal->header, journal->mapLen);
+  journal->header = NULL;
+
+  map = mmap(NULL, info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+             journal->fd, 0);
+  if (map == MAP_FAILED)
+    return -1;
+  journal->header = map;
+  journal->records = (struct journalRecord*) (journal->header + 1);
+  journal->mapLen = info.st_size;
+  return 0;
+}
+
+/*********************************************************************
+ ** journalCapacity
+ ** Description: Number of records the current mapping can hold
+ ** Parameters: struct padJournal* journal
+ *********************************************************************/
+static inline uint64_t journalCapacity(struct padJournal* journal)
+{
+  return (journal->mapLen - sizeof(struct journalHeader)) /
+         sizeof(struct journalRecord);
+}
+
+/*********************************************************************
+ ** journalRefresh
+ ** Description: Folds records appended by other processes since the
+ ** last call into the in-memory ranges. Caller holds the lock.
+ ** Parameters: struct padJournal* journal
+ *********************************************************************/
+static inline int journalRefresh(struct padJournal* journal)
+{
+  struct journalRecord* record;
+  struct padRanges* pad;
+
+  if (journal->header->count > journalCapacity(journal) &&
+      journalMap(journal) < 0)
+    return -1;
+
+  while (journal->loaded < journal->header->count)
+  {
+    record = &journal->records[journal->loaded];
+    pad = journalFindPad(journal, record->padId, 1);
+    if (pad == NULL || rangesInsert(pad, record->start, record->end) < 0)
+      return -1;
+    journal->loaded++;
+  }
+  return 0;
+}
+
+/*********************************************************************
+ ** journalOpen
+ ** Description: Opens or creates the journal at path and loads the
+ ** consumed ranges it records. Returns 0, or -1 with errno set.
+ ** Parameters: struct padJournal* journal, const char* path
+ *********************************************************************/
+static inline int journalOpen(struct padJournal* journal, const char* path)
+{
+  struct stat info;
+  int status = -1;
+
+  memset(journal, 0, sizeof(*journal));
+  journal->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (journal->fd < 0)
+    return -1;
+
+  flock(journal->fd, LOCK_EX);
+  if (fstat(journal->fd, &info) < 0)
+    goto done;
+
+  // A new journal gets a header and room for the first records
+  if (info.st_size == 0)
+  {
+    if (ftruncate(journal->fd, sizeof(struct journalHeader) +
+                  JOURNAL_GROWTH * sizeof(struct journalRecord)) < 0 ||
+        journalMap(journal) < 0)
+      goto done;
+    memcpy(journal->header->magic, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+    journal->header->count = 0;
+  }
+  else if (journalMap(journal) < 0)
+    goto done;
+
+  if (journal->mapLen < sizeof(struct journalHeader) ||
+      memcmp(journal->header->magic, JOURNAL_MAGIC,
+             sizeof(JOURNAL_MAGIC)) != 0)
+  {
+    errno = EINVAL;
+    goto done;
+  }
+
+  status = journalRefresh(journal);
+  journal->synced = journal->header->count;
+
+done:
+  flock(journal->fd, LOCK_UN);
+  return status;
+}
+
+/*********************************************************************
+ ** journalClaim
+ ** Description: Atomically checks that no byte of [start, end) of the
+ ** pad has been used and appends the range. Returns 0 when claimed,
+ ** -1 with errno EEXIST if any of it was already used, or another
+ ** errno on I/O failure. The claim is durable only after journalSync.
+ ** Parameters: struct padJournal* journal, uint64_t padId,
+ ** uint64_t start, uint64_t end
+ *********************************************************************/
+static inline int journalClaim(struct padJournal* journal, uint64_t padId,
+                               uint64_t start, uint64_t end)
+{
+  struct padRanges* pad;
+  struct journalRecord* record;
+  int status = -1;
+
+  if (start >= end)
+    return 0;
+
+  flock(journal->fd, LOCK_EX);
+  if (journalRefresh(journal) < 0)
+    goto done;
+
+  pad = journalFindPad(journal, padId, 1);
+  if (pad == NULL)
+    goto done;
+  if (rangesOverlap(pad, start, end))
+  {
+    errno = EEXIST;
+    goto done;
+  }
+
+  // Grow the file when the mapping is full
+  if (journal->header->count == journalCapacity(journal))
+  {
+    if (ftruncate(journal->fd, journal->mapLen +
+                  JOURNAL_GROWTH * sizeof(struct journalRecord)) < 0 ||
+        journalMap(journal) < 0)
+      goto done;
+  }
+
+  record = &journal->records[journal->header->count];
+  record->padId = padId;
+  record->start = start;
+  record->end = end;
+  // Publish the record only after it is fully written
+  __atomic_store_n(&journal->header->count, journal->header->count + 1,
+                   __ATOMIC_RELEASE);
+
+  if (rangesInsert(pad, start, end) < 0)
+    goto done;
+  journal->loaded++;
+  status = 0;
+
+done:
+  flock(journal->fd, LOCK_UN);
+  return status;
+}
+
+/*********************************************************************
+ ** journalSync
+ ** Description: Flushes every record claimed since the last sync with
+ ** one msync. Returns 0, or -1 with errno set.
+ ** Parameters: struct padJournal* journal
+ *********************************************************************/
+static inline int journalSync(struct padJournal* journal)
+{
+  long pageSize = sysconf(_SC_PAGESIZE);
+  size_t from,
+         to;
+
+  if (journal->synced == journal->loaded)
+    return 0;
+
+  // The header page holds the count; the tail holds the new records
+  from = (sizeof(struct journalHeader) +
+          journal->synced * sizeof(struct journalRecord)) / pageSize *
+         pageSize;
+  to = sizeof(struct journalHeader) +
+       journal->loaded * sizeof(struct journalRecord);
+  if (msync((char*) journal->header + from, to - from, MS_SYNC) < 0 ||
+      msync(journal->header, pageSize, MS_SYNC) < 0)
+    return -1;
+
+  journal->synced = journal->loaded;
+  return 0;
+}
+
+/*********************************************************************
+ ** journalClose
+ ** Description: Syncs outstanding claims and releases the journal.
+ ** Returns 0, or -1 with errno set if the claims may not be on disk;
+ ** their pad bytes must then not be used.
+ ** Parameters: struct padJournal* journal
+ *********************************************************************/
+static inline int journalClose(struct padJournal* journal)
+{
+  size_t index;
+  int status = journalSync(journal),
+      savedErrno = errno;
+
+  for (index = 0; index < journal->padCount; index++)
+    free(journal->pads[index].ranges);
+  free(journal->pads);
+  if (journal->header != NULL)
+    munmap(journal->header, journal->mapLen);
+  close(journal->fd);
+  errno = savedErrno;
+  return status;
+}
+
+#endif
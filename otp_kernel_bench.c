@@ -0,0 +1,1045 @@
+/*********************************************************************
+ ** Program Filename: otp_kernel_bench.c
+ ** Author: Peter Nguyen
+ ** Date: 10/19/26
+ ** CS 344-400, Program 4
+ ** Description: Benchmarks the cipher engines and the socket read
+ ** and write helpers over payloads from 64 B up to 1 GB. Reports
+ ** GB/s, cycles/byte, cache misses (through perf_event_open when the
+ ** kernel allows it) and the spread over repetitions. With -b it
+ ** becomes a regression gate that fails when throughput drops more
+ ** than a set percentage below a stored baseline. With -N it instead
+ ** compares an engine on the CPU whose node holds the buffers with a
+ ** CPU on another node. The lz kernels time otp_compress.h on
+ ** redundant text and report how much pad it saves. The seed kernels
+ ** time key derivation from a seed (otp_seed.h), which has to keep
+ ** up with the cipher for descriptor requests to pay off. The rtt
+ ** kernels time request/reply round trips under each transport
+ ** profile (otp_transport.h) up to MAX_RTT_SIZE.
+ *********************************************************************/
+
+#define _GNU_SOURCE  // CPU affinity in otp_cpu.h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/perf_event.h>
+#include "otp_net.h"
+#include "otp_cipher.h"
+#include "otp_cpu.h"
+#include "otp_compress.h"
+#include "otp_seed.h"
+#include "otp_transport.h"
+
+const long DEFAULT_MIN_SIZE = 64;
+const long DEFAULT_MAX_SIZE = 1L << 30;   // 1 GB
+const int DEFAULT_REPS = 5;
+const double DEFAULT_THRESHOLD = 10.0;    // percent
+const long BYTES_PER_SAMPLE = 64L << 20;  // work per timed sample
+const int MAX_RESULTS = 1024;
+const long MAX_LZ_SIZE = 64L << 20;       // lz buffers take 4x the size
+const long MAX_RTT_SIZE = 16L << 20;
+const long MAX_RTT_LOOPS = 20;  // a plain round trip can take 40 ms
+
+// Cipher engine kernels timed for each size
+enum benchKind { BENCH_ENCRYPT, BENCH_DECRYPT, BENCH_VALIDATE,
+                 BENCH_KIND_COUNT };
+static const char* const benchKindNames[BENCH_KIND_COUNT] =
+  { "encrypt", "decrypt", "validate" };
+
+// One row of the report, also the format of the baseline file
+struct benchResult
+{
+  char kernel[32];
+  long size;
+  double gbps,
+         spread,        // relative standard deviation in percent
+         cyclesPerByte,
+         missesPerKB;   // -1 when no counter is available
+};
+
+// Hardware counters opened once per run, -1 when unavailable
+struct benchCounters
+{
+  int cycles,
+      misses;
+};
+
+// Function prototypes
+void error(const char *msg);
+int openCounter(unsigned long config);
+void startCounters(struct benchCounters* counters);
+void stopCounters(struct benchCounters* counters, long long* cycles,
+                  long long* misses);
+double nowSeconds();
+unsigned long long readTsc();
+void benchCipher(struct cipherEngine* engine, int kind, long size,
+                 int reps, uint8_t* text, uint8_t* key,
+                 struct benchCounters* counters, struct benchResult* result);
+void benchPlacement(struct cipherEngine* engine, long size, int reps,
+                    uint8_t* text, uint8_t* key, int localCpu, int remoteCpu,
+                    struct benchCounters* counters,
+                    struct benchResult* results);
+void benchSocket(long size, int reps, uint8_t* buffer,
+                 struct benchCounters* counters, struct benchResult* result);
+void benchTransport(int profile, long size, int reps, uint8_t* buffer,
+                    struct benchCounters* counters,
+                    struct benchResult* result);
+void benchLz(long size, int reps, char* corpus, char* packed,
+             struct benchCounters* counters, struct benchResult* results);
+void fillCorpus(char* corpus, long size, const char* path);
+int benchSeed(long size, int reps, uint8_t* out,
+              struct benchCounters* counters, struct benchResult* results);
+void summarize(double* samples, int reps, long long bytes,
+               long long cycles, long long misses, unsigned long long tsc,
+               struct benchResult* result);
+void printResult(FILE* out, struct benchResult* result);
+int checkBaseline(const char* path, struct benchResult* results, int count,
+                  double threshold);
+
+int main(int argc, char *argv[])
+{
+  int option,
+      reps = DEFAULT_REPS,
+      engine,
+      kind,
+      count = 0,
+      runCipher = 1,
+      runSocket = 1,
+      runLz = 1,
+      runSeed = 1,
+      runTransport = 1,
+      profile,
+      localCpu = -1,   // -N: CPU that first touches the buffers
+      remoteCpu = -1;  // -N: CPU that then runs the kernel remotely
+  long minSize = DEFAULT_MIN_SIZE,
+       maxSize = DEFAULT_MAX_SIZE,
+       size;
+  double threshold = DEFAULT_THRESHOLD;
+  char *engineName = NULL,
+       *baselinePath = NULL,
+       *savePath = NULL,
+       *corpusPath = NULL,  // sample text for lz, else generated
+       *corpus = NULL,
+       *packed = NULL;
+  long lzSize = 0;
+  uint8_t *text,
+          *key;
+  uint64_t state = 0x2545F4914F6CDD1DULL;
+  struct benchCounters counters;
+  struct benchResult* results;
+  struct cipherEngine* placed = NULL;
+  FILE* filePtr;
+
+  while ((option = getopt(argc, argv, "e:k:m:M:r:b:t:w:N:z:")) != -1)
+  {
+    switch (option)
+    {
+      case 'e': engineName = optarg; break;
+      case 'k':
+        runCipher = strstr(optarg, "cipher") != NULL;
+        runSocket = strstr(optarg, "socket") != NULL;
+        runLz = strstr(optarg, "lz") != NULL;
+        runSeed = strstr(optarg, "seed") != NULL;
+        runTransport = strstr(optarg, "rtt") != NULL;
+        break;
+      case 'm': minSize = atol(optarg); break;
+      case 'M': maxSize = atol(optarg); break;
+      case 'r': reps = atoi(optarg); break;
+      case 'b': baselinePath = optarg; break;
+      case 't': threshold = atof(optarg); break;
+      case 'w': savePath = optarg; break;
+      case 'z': corpusPath = optarg; break;
+      case 'N':
+        if (sscanf(optarg, "%d,%d", &localCpu, &remoteCpu) != 2)
+          localCpu = remoteCpu = -1;
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-e engine] [-k cipher,socket,lz,seed,rtt] "
+                "[-z corpus] [-N localCpu,remoteCpu] [-m minBytes] "
+                "[-M maxBytes] [-r reps] [-w saveFile] "
+                "[-b baselineFile [-t dropPercent]]\n", argv[0]);
+        exit(1);
+    }
+  }
+  if (minSize < 1 || maxSize < minSize || reps < 1)
+  {
+    fprintf(stderr, "ERROR, bad size range or repetition count\n");
+    exit(1);
+  }
+
+  if (cipherSelfTest() != 0)
+    fprintf(stderr, "warning: failed engines are skipped\n");
+
+  // Placement mode: buffers are first touched on the local CPU's node
+  if (localCpu >= 0)
+  {
+    placed = cipherSelect(engineName);
+    if (placed == NULL || pinToCpu(remoteCpu) < 0 || pinToCpu(localCpu) < 0)
+    {
+      fprintf(stderr, "ERROR, bad engine or CPUs for -N\n");
+      exit(1);
+    }
+    printf("# %s buffers on cpu %d (node %d), remote cpu %d (node %d)\n",
+           placed->name, localCpu, cpuNode(localCpu), remoteCpu,
+           cpuNode(remoteCpu));
+  }
+
+  results = malloc(sizeof(struct benchResult) * MAX_RESULTS);
+  text = malloc(maxSize);
+  key = malloc(maxSize);
+  if (results == NULL || text == NULL || key == NULL)
+    error("ERROR allocating benchmark buffers");
+  cipherRandomSymbols(text, maxSize, &state);
+  cipherRandomSymbols(key, maxSize, &state);
+
+  if (runLz)
+  {
+    lzSize = maxSize < MAX_LZ_SIZE ? maxSize : MAX_LZ_SIZE;
+    corpus = malloc(lzSize);
+    packed = malloc(LZ_ENCODE_BOUND(lzSize) + LZ_DECODE_BOUND(lzSize));
+    if (corpus == NULL || packed == NULL)
+      error("ERROR allocating lz buffers");
+    fillCorpus(corpus, lzSize, corpusPath);
+  }
+
+  counters.cycles = openCounter(PERF_COUNT_HW_CPU_CYCLES);
+  counters.misses = openCounter(PERF_COUNT_HW_CACHE_MISSES);
+  if (counters.cycles < 0)
+    fprintf(stderr, "note: no perf counters, cycles/byte from the TSC\n");
+
+  printf("# kernel size GB/s spread%% cycles/B misses/KB\n");
+
+  for (size = minSize; size <= maxSize && count + 1 < MAX_RESULTS; size *= 4)
+  {
+    if (placed != NULL)
+    {
+      benchPlacement(placed, size, reps, text, key, localCpu, remoteCpu,
+                     &counters, &results[count]);
+      printResult(stdout, &results[count++]);
+      printResult(stdout, &results[count++]);
+      fflush(stdout);
+      continue;
+    }
+    if (runCipher)
+    {
+      for (engine = 0; engine < CIPHER_ENGINE_COUNT; engine++)
+      {
+        if (engineName != NULL &&
+            strcmp(engineName, cipherEngines[engine].name) != 0)
+          continue;
+        if (!cipherEngines[engine].supported() ||
+            cipherEngines[engine].failed)
+          continue;
+        for (kind = 0; kind < BENCH_KIND_COUNT && count < MAX_RESULTS;
+             kind++)
+        {
+          benchCipher(&cipherEngines[engine], kind, size, reps, text,
+                      key, &counters, &results[count]);
+          printResult(stdout, &results[count++]);
+        }
+      }
+    }
+    if (runSocket && count < MAX_RESULTS)
+    {
+      benchSocket(size, reps, text, &counters, &results[count]);
+      printResult(stdout, &results[count++]);
+    }
+    if (runTransport && size <= MAX_RTT_SIZE &&
+        count + TRANSPORT_PROFILE_COUNT <= MAX_RESULTS)
+    {
+      for (profile = 0; profile < TRANSPORT_PROFILE_COUNT; profile++)
+      {
+        benchTransport(profile, size, reps, text, &counters,
+                       &results[count]);
+        printResult(stdout, &results[count++]);
+      }
+    }
+    if (runLz && size <= lzSize && count + 1 < MAX_RESULTS)
+    {
+      benchLz(size, reps, corpus, packed, &counters, &results[count]);
+      printResult(stdout, &results[count++]);
+      printResult(stdout, &results[count++]);
+    }
+    if (runSeed && count + 1 < MAX_RESULTS)
+    {
+      option = benchSeed(size, reps, key, &counters, &results[count]);
+      while (option-- > 0)
+        printResult(stdout, &results[count++]);
+    }
+    fflush(stdout);
+  }
+
+  if (savePath != NULL)
+  {
+    filePtr = fopen(savePath, "w");
+    if (filePtr == NULL)
+      error("ERROR writing baseline file");
+    fprintf(filePtr, "# kernel size GB/s spread%% cycles/B misses/KB\n");
+    for (engine = 0; engine < count; engine++)
+      printResult(filePtr, &results[engine]);
+    fclose(filePtr);
+  }
+
+  if (baselinePath != NULL)
+    return checkBaseline(baselinePath, results, count, threshold);
+  return 0;
+}
+
+/*********************************************************************
+ ** benchCipher
+ ** Description: Times one engine kernel (benchKindNames) over size
+ ** bytes. The validator scans text that is all symbols, its worst
+ ** case, since it never stops early. Each
+ ** of the reps samples runs the kernel often enough to cover about
+ ** BYTES_PER_SAMPLE bytes, so small sizes are not lost in timer noise.
+ ** Parameters: struct cipherEngine* engine, int kind, long size,
+ ** int reps, uint8_t* text, uint8_t* key,
+ ** struct benchCounters* counters, struct benchResult* result
+ *********************************************************************/
+void benchCipher(struct cipherEngine* engine, int kind, long size,
+                 int reps, uint8_t* text, uint8_t* key,
+                 struct benchCounters* counters, struct benchResult* result)
+{
+  cipherFn kernel = kind == BENCH_DECRYPT ? engine->decrypt :
+                    engine->encrypt;
+  size_t valid = 0;
+  long loops = BYTES_PER_SAMPLE / size,
+       loop;
+  long long cycles = 0,
+            misses = 0,
+            sampleCycles,
+            sampleMisses;
+  unsigned long long tsc = 0,
+                     tscStart;
+  double* samples = malloc(sizeof(double) * reps);
+  double start;
+  int rep;
+
+  if (samples == NULL)
+    error("ERROR allocating samples");
+  if (loops < 1)
+    loops = 1;
+
+  // Warm up caches and page tables before timing
+  kernel(text, key, text, size);
+  if (kind == BENCH_VALIDATE &&
+      engine->findInvalid(text, size) != (size_t) size)
+    error("ERROR benchmark text is not all symbols");
+
+  for (rep = 0; rep < reps; rep++)
+  {
+    startCounters(counters);
+    tscStart = readTsc();
+    start = nowSeconds();
+    for (loop = 0; loop < loops; loop++)
+    {
+      if (kind == BENCH_VALIDATE)
+        valid += engine->findInvalid(text, size);
+      else
+        kernel(text, key, text, size);  // in place, like the daemons
+    }
+    samples[rep] = nowSeconds() - start;
+    tsc += readTsc() - tscStart;
+    stopCounters(counters, &sampleCycles, &sampleMisses);
+    cycles += sampleCycles;
+    misses += sampleMisses;
+  }
+
+  if (kind == BENCH_VALIDATE && valid != (size_t) size * loops * reps)
+    error("ERROR validator rejected benchmark text");
+  snprintf(result->kernel, sizeof(result->kernel), "%s-%s", engine->name,
+           benchKindNames[kind]);
+  result->size = size;
+  summarize(samples, reps, (long long) size * loops, cycles, misses, tsc,
+            result);
+  free(samples);
+}
+
+/*********************************************************************
+ ** benchPlacement
+ ** Description: Runs the encrypt kernel of engine over size bytes
+ ** twice: pinned to localCpu, whose node first touched the buffers,
+ ** and pinned to remoteCpu. Fills two results, suffixed -local and
+ ** -remote. On a single-node machine both should match.
+ ** Parameters: struct cipherEngine* engine, long size, int reps,
+ ** uint8_t* text, uint8_t* key, int localCpu, int remoteCpu,
+ ** struct benchCounters* counters, struct benchResult* results
+ *********************************************************************/
+void benchPlacement(struct cipherEngine* engine, long size, int reps,
+                    uint8_t* text, uint8_t* key, int localCpu, int remoteCpu,
+                    struct benchCounters* counters,
+                    struct benchResult* results)
+{
+  pinToCpu(localCpu);
+  benchCipher(engine, 0, size, reps, text, key, counters, &results[0]);
+  snprintf(results[0].kernel, sizeof(results[0].kernel), "%s-local",
+           engine->name);
+
+  pinToCpu(remoteCpu);
+  benchCipher(engine, 0, size, reps, text, key, counters, &results[1]);
+  snprintf(results[1].kernel, sizeof(results[1].kernel), "%s-remote",
+           engine->name);
+
+  pinToCpu(localCpu);
+}
+
+/*********************************************************************
+ ** benchSocket
+ ** Description: Times writeFull/readFull moving size bytes across a
+ ** loopback TCP connection, the path every request takes. A forked
+ ** child writes while the parent reads and is timed.
+ ** Parameters: long size, int reps, uint8_t* buffer,
+ ** struct benchCounters* counters, struct benchResult* result
+ *********************************************************************/
+void benchSocket(long size, int reps, uint8_t* buffer,
+                 struct benchCounters* counters, struct benchResult* result)
+{
+  long loops = BYTES_PER_SAMPLE / size,
+       loop;
+  long long cycles = 0,
+            misses = 0,
+            sampleCycles,
+            sampleMisses;
+  unsigned long long tsc = 0,
+                     tscStart;
+  double* samples = malloc(sizeof(double) * reps);
+  double start;
+  int listenfd,
+      sockfd,
+      rep;
+  struct sockaddr_in addr;
+  socklen_t len = sizeof(addr);
+  pid_t childPID;
+
+  if (samples == NULL)
+    error("ERROR allocating samples");
+  if (loops < 1)
+    loops = 1;
+
+  // Listen on a kernel-chosen loopback port
+  listenfd = socket(AF_INET, SOCK_STREAM, 0);
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (listenfd < 0 || bind(listenfd, (struct sockaddr*) &addr, len) < 0 ||
+      listen(listenfd, 1) < 0 ||
+      getsockname(listenfd, (struct sockaddr*) &addr, &len) < 0)
+    error("ERROR opening loopback listener");
+
+  fflush(stdout);  // or the child's exit prints the rows again
+  childPID = fork();
+  if (childPID < 0)
+    error("fork failed");
+  if (childPID == 0)
+  {
+    // Writer: one warm-up payload, then reps * loops payloads
+    sockfd = connectTimeout(&addr, 2000);
+    if (sockfd < 0)
+      error("ERROR connecting to loopback listener");
+    for (loop = 0; loop < (long) reps * loops + 1; loop++)
+      if (writeFull(sockfd, buffer, size, NO_DEADLINE) < 0)
+        error("ERROR writing to socket");
+    close(sockfd);
+    exit(0);
+  }
+
+  sockfd = accept(listenfd, NULL, NULL);
+  if (sockfd < 0)
+    error("ERROR on accept");
+  if (readFull(sockfd, buffer, size, NO_DEADLINE) < 0)
+    error("ERROR reading from socket");
+
+  for (rep = 0; rep < reps; rep++)
+  {
+    startCounters(counters);
+    tscStart = readTsc();
+    start = nowSeconds();
+    for (loop = 0; loop < loops; loop++)
+      if (readFull(sockfd, buffer, size, NO_DEADLINE) < 0)
+        error("ERROR reading from socket");
+    samples[rep] = nowSeconds() - start;
+    tsc += readTsc() - tscStart;
+    stopCounters(counters, &sampleCycles, &sampleMisses);
+    cycles += sampleCycles;
+    misses += sampleMisses;
+  }
+
+  close(sockfd);
+  close(listenfd);
+  waitpid(childPID, NULL, 0);
+
+  // The buffer now holds socket data; restore valid symbols for later
+  // cipher runs
+  {
+    uint64_t state = 0x2545F4914F6CDD1DULL;
+    cipherRandomSymbols(buffer, size, &state);
+  }
+
+  snprintf(result->kernel, sizeof(result->kernel), "socket-loopback");
+  result->size = size;
+  summarize(samples, reps, (long long) size * loops, cycles, misses, tsc,
+            result);
+  free(samples);
+}
+
+/*********************************************************************
+ ** benchTransport
+ ** Description: Times request/reply round trips of size byte payloads
+ ** across a loopback TCP connection with both ends on profile: the
+ ** parent sends a size and payload with transportSend and a forked
+ ** child echoes them back the same way. GB/s counts both directions,
+ ** and a comment line gives the time per round trip, which is what
+ ** the latency profile is for.
+ ** Parameters: int profile, long size, int reps, uint8_t* buffer,
+ ** struct benchCounters* counters, struct benchResult* result
+ *********************************************************************/
+void benchTransport(int profile, long size, int reps, uint8_t* buffer,
+                    struct benchCounters* counters,
+                    struct benchResult* result)
+{
+  long loops = BYTES_PER_SAMPLE / size / 2,
+       loop;
+  long long cycles = 0,
+            misses = 0,
+            sampleCycles,
+            sampleMisses;
+  unsigned long long tsc = 0,
+                     tscStart;
+  double* samples = malloc(sizeof(double) * reps);
+  double start,
+         total = 0;
+  int listenfd,
+      sockfd,
+      rep;
+  uint32_t header = htonl(size);
+  struct sockaddr_in addr;
+  struct iovec parts[2];
+  struct transport link;
+  socklen_t len = sizeof(addr);
+  pid_t childPID;
+
+  if (samples == NULL)
+    error("ERROR allocating samples");
+  if (loops > MAX_RTT_LOOPS)
+    loops = MAX_RTT_LOOPS;
+  if (loops < 1)
+    loops = 1;
+  parts[0].iov_base = &header;
+  parts[0].iov_len = sizeof(header);
+  parts[1].iov_base = buffer;
+  parts[1].iov_len = size;
+
+  // Listen on a kernel-chosen loopback port
+  listenfd = socket(AF_INET, SOCK_STREAM, 0);
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (listenfd < 0 || bind(listenfd, (struct sockaddr*) &addr, len) < 0 ||
+      listen(listenfd, 1) < 0 ||
+      getsockname(listenfd, (struct sockaddr*) &addr, &len) < 0)
+    error("ERROR opening loopback listener");
+
+  fflush(stdout);  // or the child's exit prints the rows again
+  childPID = fork();
+  if (childPID < 0)
+    error("fork failed");
+  if (childPID == 0)
+  {
+    // Echo: one warm-up round trip, then reps * loops of them
+    sockfd = accept(listenfd, NULL, NULL);
+    if (sockfd < 0)
+      error("ERROR on accept");
+    transportSetup(&link, sockfd, profile);
+    for (loop = 0; loop < (long) reps * loops + 1; loop++)
+    {
+      if (readFull(sockfd, &header, sizeof(header), NO_DEADLINE) < 0 ||
+          readFull(sockfd, buffer, size, NO_DEADLINE) < 0)
+        error("ERROR reading from socket");
+      if (transportSend(&link, parts, 2, NO_DEADLINE) < 0)
+        error("ERROR writing to socket");
+    }
+    close(sockfd);
+    exit(0);
+  }
+
+  sockfd = connectTimeout(&addr, 2000);
+  if (sockfd < 0)
+    error("ERROR connecting to loopback listener");
+  transportSetup(&link, sockfd, profile);
+
+  for (rep = -1; rep < reps; rep++)
+  {
+    startCounters(counters);
+    tscStart = readTsc();
+    start = nowSeconds();
+    for (loop = 0; loop < (rep < 0 ? 1 : loops); loop++)
+    {
+      if (transportSend(&link, parts, 2, NO_DEADLINE) < 0)
+        error("ERROR writing to socket");
+      if (readFull(sockfd, &header, sizeof(header), NO_DEADLINE) < 0 ||
+          readFull(sockfd, buffer, size, NO_DEADLINE) < 0)
+        error("ERROR reading from socket");
+    }
+    stopCounters(counters, &sampleCycles, &sampleMisses);
+    if (rep < 0)
+      continue;  // the warm-up round trip
+    samples[rep] = nowSeconds() - start;
+    total += samples[rep];
+    tsc += readTsc() - tscStart;
+    cycles += sampleCycles;
+    misses += sampleMisses;
+  }
+
+  close(sockfd);
+  close(listenfd);
+  waitpid(childPID, NULL, 0);
+
+  snprintf(result->kernel, sizeof(result->kernel), "rtt-%s",
+           transportNames[profile]);
+  result->size = size;
+  summarize(samples, reps, (long long) size * loops * 2, cycles, misses,
+            tsc, result);
+  printf("# %s %ld: %.1f us per round trip", result->kernel, size,
+         total / ((double) reps * loops) * 1e6);
+  if (link.zcSent > 0)
+    printf(", %lu of %u zero-copy sends copied", link.zcCopied,
+           link.zcSent);
+  printf("\n");
+  free(samples);
+}
+
+/*********************************************************************
+ ** benchLz
+ ** Description: Times compressing size bytes of the corpus and then
+ ** decompressing the result, filling two results (lz-compress and
+ ** lz-decompress, both in input bytes per second). Also prints the
+ ** pad saved, which is what the CPU time buys. packed must hold
+ ** LZ_ENCODE_BOUND(size) + LZ_DECODE_BOUND of that.
+ ** Parameters: long size, int reps, char* corpus, char* packed,
+ ** struct benchCounters* counters, struct benchResult* results
+ *********************************************************************/
+void benchLz(long size, int reps, char* corpus, char* packed,
+             struct benchCounters* counters, struct benchResult* results)
+{
+  long loops = BYTES_PER_SAMPLE / size / 16,  // lz is far slower
+       loop,
+       packedLen = 0;
+  long long cycles,
+            misses,
+            sampleCycles,
+            sampleMisses;
+  unsigned long long tsc,
+                     tscStart;
+  double* samples = malloc(sizeof(double) * reps);
+  double start;
+  char* unpacked = packed + LZ_ENCODE_BOUND(size);
+  struct lzDecoder dec;
+  int rep,
+      pass;
+
+  if (samples == NULL)
+    error("ERROR allocating samples");
+  if (loops < 1)
+    loops = 1;
+  packedLen = lzCompress(corpus, size, packed);
+
+  for (pass = 0; pass < 2; pass++)
+  {
+    cycles = 0;
+    misses = 0;
+    tsc = 0;
+    for (rep = 0; rep < reps; rep++)
+    {
+      startCounters(counters);
+      tscStart = readTsc();
+      start = nowSeconds();
+      for (loop = 0; loop < loops; loop++)
+      {
+        if (pass == 0)
+          packedLen = lzCompress(corpus, size, packed);
+        else
+        {
+          lzDecoderInit(&dec);
+          lzDecodeChunk(&dec, (uint8_t*) packed, packedLen,
+                        (uint8_t*) unpacked);
+        }
+      }
+      samples[rep] = nowSeconds() - start;
+      tsc += readTsc() - tscStart;
+      stopCounters(counters, &sampleCycles, &sampleMisses);
+      cycles += sampleCycles;
+      misses += sampleMisses;
+    }
+
+    snprintf(results[pass].kernel, sizeof(results[pass].kernel), "%s",
+             pass == 0 ? "lz-compress" : "lz-decompress");
+    results[pass].size = size;
+    summarize(samples, reps, (long long) size * loops, cycles, misses, tsc,
+              &results[pass]);
+  }
+
+  if (memcmp(unpacked, corpus, size) != 0)
+    fprintf(stderr, "ERROR: lz round trip failed at %ld bytes\n", size);
+  printf("# lz %ld bytes -> %ld symbols of pad, %.1f%% saved\n", size,
+         packedLen, 100.0 * (size - packedLen) / size);
+  free(samples);
+}
+
+/*********************************************************************
+ ** benchSeed
+ ** Description: Times deriving size symbols of a seed segment into
+ ** out, once with the generic blocks and scalar symbol map
+ ** (seed-generic) and once with what seedInit picked for this CPU
+ ** (seed-vector). Fills a result for each and returns how many.
+ ** Parameters: long size, int reps, uint8_t* out,
+ ** struct benchCounters* counters, struct benchResult* results
+ *********************************************************************/
+int benchSeed(long size, int reps, uint8_t* out,
+              struct benchCounters* counters, struct benchResult* results)
+{
+  static const uint8_t seedBytes[SEED_KEY_BYTES] = "otp_kernel_bench seed";
+  struct seedKey seed,
+                 generic;
+  long loops = BYTES_PER_SAMPLE / size / 4,  // a few times the cipher
+       loop;
+  long long cycles,
+            misses,
+            sampleCycles,
+            sampleMisses;
+  unsigned long long tsc,
+                     tscStart;
+  struct seedKey* variant;
+  double* samples = malloc(sizeof(double) * reps);
+  double start;
+  int rep,
+      count = 0;
+
+  if (samples == NULL)
+    error("ERROR allocating samples");
+  if (seedInit(&seed, seedBytes) < 0)
+    error("ERROR checking seed expansion");
+  generic = seed;
+  generic.blocks = seedBlocksGeneric;
+  generic.map = seedMapScalar;
+  if (loops < 1)
+    loops = 1;
+
+  for (count = 0; count < 2; count++)
+  {
+    if (count == 0)
+      variant = &generic;
+    else
+      variant = &seed;
+
+    cycles = 0;
+    misses = 0;
+    tsc = 0;
+    seedExpand(variant, 1, 0, out, size);  // warm up
+    for (rep = 0; rep < reps; rep++)
+    {
+      startCounters(counters);
+      tscStart = readTsc();
+      start = nowSeconds();
+      for (loop = 0; loop < loops; loop++)
+        seedExpand(variant, 1, loop * size, out, size);
+      samples[rep] = nowSeconds() - start;
+      tsc += readTsc() - tscStart;
+      stopCounters(counters, &sampleCycles, &sampleMisses);
+      cycles += sampleCycles;
+      misses += sampleMisses;
+    }
+
+    snprintf(results[count].kernel, sizeof(results[count].kernel), "%s",
+             count == 0 ? "seed-generic" : "seed-vector");
+    results[count].size = size;
+    summarize(samples, reps, (long long) size * loops, cycles, misses, tsc,
+              &results[count]);
+  }
+  free(samples);
+  return count;
+}
+
+/*********************************************************************
+ ** fillCorpus
+ ** Description: Fills corpus with size symbols of sample text: the
+ ** contents of path repeated, or generated words when path is NULL.
+ ** Letters are upper-cased and anything else becomes a space.
+ ** Parameters: char* corpus, long size, const char* path
+ *********************************************************************/
+void fillCorpus(char* corpus, long size, const char* path)
+{
+  static const char* words[] =
+  {
+    "THE ", "PAD ", "IS ", "USED ", "ONCE ", "AND ", "NEVER ", "AGAIN ",
+    "SO ", "EVERY ", "MESSAGE ", "STAYS ", "SECRET ", "FROM ", "ALL ",
+    "WHO ", "DO ", "NOT ", "HOLD ", "KEY ", "QUIZ ", "ZONE "
+  };
+  uint64_t state = 88172645463325252ULL;
+  long filled = 0,
+       count = 0,
+       index;
+  const char* word;
+  FILE* filePtr = NULL;
+  int c;
+
+  if (path != NULL)
+  {
+    filePtr = fopen(path, "r");
+    if (filePtr == NULL)
+      error("ERROR opening corpus");
+    while (filled < size && (c = fgetc(filePtr)) != EOF)
+    {
+      if (c >= 'a' && c <= 'z')
+        c -= 'a' - 'A';
+      corpus[filled++] = c >= 'A' && c <= 'Z' ? c : ' ';
+    }
+    fclose(filePtr);
+    count = filled;
+  }
+
+  if (count > 0)
+  {
+    for (index = count; index < size; index++)
+      corpus[index] = corpus[index % count];
+    return;
+  }
+
+  while (filled < size)
+  {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    word = words[state % (sizeof(words) / sizeof(words[0]))];
+    for (index = 0; word[index] != '\0' && filled < size; index++)
+      corpus[filled++] = word[index];
+  }
+}
+
+/*********************************************************************
+ ** summarize
+ ** Description: Turns per-sample times and counter totals into the
+ ** figures of one report row. Throughput is the mean over samples
+ ** and spread is its relative standard deviation.
+ ** Parameters: double* samples, int reps, long long bytes,
+ ** long long cycles, long long misses, unsigned long long tsc,
+ ** struct benchResult* result
+ *********************************************************************/
+void summarize(double* samples, int reps, long long bytes,
+               long long cycles, long long misses, unsigned long long tsc,
+               struct benchResult* result)
+{
+  double mean = 0,
+         variance = 0,
+         gbps;
+  int rep;
+
+  for (rep = 0; rep < reps; rep++)
+    mean += bytes / samples[rep] / 1e9;
+  mean /= reps;
+  for (rep = 0; rep < reps; rep++)
+  {
+    gbps = bytes / samples[rep] / 1e9;
+    variance += (gbps - mean) * (gbps - mean);
+  }
+  variance /= reps;
+
+  result->gbps = mean;
+  result->spread = mean > 0 ? 100.0 * sqrt(variance) / mean : 0;
+  // Prefer real core cycles; fall back to reference (TSC) cycles
+  result->cyclesPerByte = (cycles > 0 ? (double) cycles : (double) tsc) /
+                          ((double) bytes * reps);
+  result->missesPerKB = misses >= 0 && cycles > 0
+                        ? misses * 1024.0 / ((double) bytes * reps) : -1;
+}
+
+/*********************************************************************
+ ** printResult
+ ** Description: Writes one report row; the same format is read back
+ ** as a baseline
+ ** Parameters: FILE* out, struct benchResult* result
+ *********************************************************************/
+void printResult(FILE* out, struct benchResult* result)
+{
+  fprintf(out, "%-16s %11ld %9.3f %7.2f %9.3f %9.2f\n", result->kernel,
+          result->size, result->gbps, result->spread, result->cyclesPerByte,
+          result->missesPerKB);
+}
+
+/*********************************************************************
+ ** checkBaseline
+ ** Description: Compares each result with the row of the same kernel
+ ** and size in the baseline file. Returns 1 (failure) if any result
+ ** is more than threshold percent slower, if a baseline row has no
+ ** result to compare with, or if nothing was compared; otherwise 0.
+ ** Parameters: const char* path, struct benchResult* results,
+ ** int count, double threshold
+ *********************************************************************/
+int checkBaseline(const char* path, struct benchResult* results, int count,
+                  double threshold)
+{
+  char line[256],
+       kernel[32];
+  long size;
+  double gbps,
+         change;
+  int index,
+      matched,
+      compared = 0,
+      misses = 0,
+      regressions = 0;
+  FILE* filePtr;
+
+  filePtr = fopen(path, "r");
+  if (filePtr == NULL)
+    error("ERROR opening baseline file");
+
+  while (fgets(line, sizeof(line), filePtr) != NULL)
+  {
+    if (line[0] == '#' ||
+        sscanf(line, "%31s %ld %lf", kernel, &size, &gbps) != 3)
+      continue;
+    matched = 0;
+    for (index = 0; index < count; index++)
+    {
+      if (strcmp(results[index].kernel, kernel) != 0 ||
+          results[index].size != size || gbps <= 0)
+        continue;
+      change = 100.0 * (results[index].gbps - gbps) / gbps;
+      matched = 1;
+      compared++;
+      if (change < -threshold)
+      {
+        printf("REGRESSION %s %ld: %.3f GB/s vs baseline %.3f (%.1f%%)\n",
+               kernel, size, results[index].gbps, gbps, change);
+        regressions++;
+      }
+    }
+    // A kernel or size that was not run must not pass unnoticed
+    if (!matched)
+    {
+      printf("MISSING %s %ld: no result to compare with the baseline\n",
+             kernel, size);
+      misses++;
+    }
+  }
+  fclose(filePtr);
+
+  printf("# gate: %d compared, %d missing, %d regressed beyond %.1f%%\n",
+         compared, misses, regressions, threshold);
+  if (compared == 0)
+    printf("# gate: no result matched the baseline %s\n", path);
+  return regressions > 0 || misses > 0 || compared == 0;
+}
+
+/*********************************************************************
+ ** openCounter
+ ** Description: Opens a hardware counter for this process. Returns
+ ** -1 when perf events are unsupported or not permitted.
+ ** Parameters: unsigned long config
+ *********************************************************************/
+int openCounter(unsigned long config)
+{
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.size = sizeof(attr);
+  attr.config = config;
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/*********************************************************************
+ ** startCounters
+ ** Description: Resets and enables the open counters
+ ** Parameters: struct benchCounters* counters
+ *********************************************************************/
+void startCounters(struct benchCounters* counters)
+{
+  if (counters->cycles >= 0)
+  {
+    ioctl(counters->cycles, PERF_EVENT_IOC_RESET, 0);
+    ioctl(counters->cycles, PERF_EVENT_IOC_ENABLE, 0);
+  }
+  if (counters->misses >= 0)
+  {
+    ioctl(counters->misses, PERF_EVENT_IOC_RESET, 0);
+    ioctl(counters->misses, PERF_EVENT_IOC_ENABLE, 0);
+  }
+}
+
+/*********************************************************************
+ ** stopCounters
+ ** Description: Disables the counters and reads them. Values are 0
+ ** (cycles) or -1 (misses) for counters that are not open.
+ ** Parameters: struct benchCounters* counters, long long* cycles,
+ ** long long* misses
+ *********************************************************************/
+void stopCounters(struct benchCounters* counters, long long* cycles,
+                  long long* misses)
+{
+  *cycles = 0;
+  *misses = -1;
+  if (counters->cycles >= 0)
+  {
+    ioctl(counters->cycles, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(counters->cycles, cycles, sizeof(*cycles)) != sizeof(*cycles))
+      *cycles = 0;
+  }
+  if (counters->misses >= 0)
+  {
+    ioctl(counters->misses, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(counters->misses, misses, sizeof(*misses)) != sizeof(*misses))
+      *misses = -1;
+  }
+}
+
+/*********************************************************************
+ ** nowSeconds
+ ** Description: Returns the monotonic clock in seconds
+ ** Parameters: none
+ *********************************************************************/
+double nowSeconds()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*********************************************************************
+ ** readTsc
+ ** Description: Reads the time stamp counter, or 0 off x86
+ ** Parameters: none
+ *********************************************************************/
+unsigned long long readTsc()
+{
+#ifdef OTP_CIPHER_X86
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+/*********************************************************************
+ ** error
+ ** Description: Displays an error message
+ ** Parameters: const char *msg
+ *********************************************************************/
+void error(const char *msg)
+{
+  perror(msg);
+  exit(1);
+}
@@ -0,0 +1,322 @@
+/*********************************************************************
+ ** Program Filename: otp_net.h
+ ** Author: Peter Nguyen
+ ** Date: 10/19/26
+ ** CS 344-400, Program 4
+ ** Description: Connection manager shared by the clients. Provides
+ ** non-blocking connects with a timeout, retries with jittered
+ ** exponential backoff, and socket reads and writes that give up at
+ ** a deadline instead of blocking forever.
+ *********************************************************************/
+
+#ifndef OTP_NET_H
+#define OTP_NET_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+
+static const int NO_DEADLINE = -1;
+
+// Retry budget and timeouts for one connection attempt sequence
+struct netPolicy
+{
+  int connectMs;   // timeout for a single connect
+  int retries;     // attempts before giving up
+  int baseMs;      // first backoff ceiling
+  int capMs;       // largest backoff ceiling
+};
+
+/*********************************************************************
+ ** netNowMs
+ ** Description: Returns the monotonic clock in milliseconds
+ ** Parameters: none
+ *********************************************************************/
+static inline long netNowMs(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+/*********************************************************************
+ ** netDeadline
+ ** Description: Converts a relative timeout into an absolute deadline.
+ ** A negative timeout means no deadline.
+ ** Parameters: int timeoutMs
+ *********************************************************************/
+static inline long netDeadline(int timeoutMs)
+{
+  if (timeoutMs < 0)
+    return NO_DEADLINE;
+  return netNowMs() + timeoutMs;
+}
+
+/*********************************************************************
+ ** netWait
+ ** Description: Waits until fd is ready for the given poll events or
+ ** the deadline passes. Returns 0 when ready, -1 with errno set to
+ ** ETIMEDOUT otherwise.
+ ** Parameters: int fd, short events, long deadline
+ *********************************************************************/
+static inline int netWait(int fd, short events, long deadline)
+{
+  struct pollfd pfd;
+  int timeout,
+      status;
+
+  pfd.fd = fd;
+  pfd.events = events;
+  do
+  {
+    timeout = -1;
+    if (deadline != NO_DEADLINE)
+    {
+      timeout = deadline - netNowMs();
+      if (timeout < 0)
+        timeout = 0;
+    }
+    status = poll(&pfd, 1, timeout);
+  } while (status < 0 && errno == EINTR);
+
+  if (status == 0)
+    errno = ETIMEDOUT;
+  return status > 0 ? 0 : -1;
+}
+
+/*********************************************************************
+ ** netBackoff
+ ** Description: Sleeps before a retry. The delay is random up to an
+ ** exponentially growing ceiling ("full jitter") so that clients
+ ** turned away together do not come back in lockstep.
+ ** Parameters: int attempt, int baseMs, int capMs
+ *********************************************************************/
+static inline void netBackoff(int attempt, int baseMs, int capMs)
+{
+  long ceiling = baseMs;
+
+  while (attempt-- > 0 && ceiling < capMs)
+    ceiling *= 2;
+  if (ceiling > capMs)
+    ceiling = capMs;
+
+  usleep((rand() % (ceiling + 1)) * 1000);
+}
+
+/*********************************************************************
+ ** connectFrom
+ ** Description: Opens a TCP socket, binds it to source unless that is
+ ** NULL, and connects it to addr without blocking for longer than
+ ** timeoutMs. Returns the connected socket in blocking mode, or -1
+ ** with errno set.
+ ** Parameters: const struct sockaddr_in* addr,
+ ** const struct sockaddr_in* source, int timeoutMs
+ *********************************************************************/
+static inline int connectFrom(const struct sockaddr_in* addr,
+                              const struct sockaddr_in* source,
+                              int timeoutMs)
+{
+  int sockfd,
+      flags,
+      soError = 0;
+  socklen_t len = sizeof(soError);
+
+  sockfd = socket(AF_INET, SOCK_STREAM, 0);
+  if (sockfd < 0)
+    return -1;
+  if (source != NULL &&
+      bind(sockfd, (const struct sockaddr *) source, sizeof(*source)) < 0)
+    goto fail;
+
+  flags = fcntl(sockfd, F_GETFL, 0);
+  fcntl(sockfd, F_SETFL, flags | O_NONBLOCK);
+
+  if (connect(sockfd, (const struct sockaddr *) addr, sizeof(*addr)) < 0)
+  {
+    if (errno != EINPROGRESS)
+      goto fail;
+    if (netWait(sockfd, POLLOUT, netDeadline(timeoutMs)) < 0)
+      goto fail;
+    // The outcome of the connect is reported through SO_ERROR
+    getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &soError, &len);
+    if (soError != 0)
+    {
+      errno = soError;
+      goto fail;
+    }
+  }
+
+  fcntl(sockfd, F_SETFL, flags);
+  return sockfd;
+
+fail:
+  soError = errno;
+  close(sockfd);
+  errno = soError;
+  return -1;
+}
+
+/*********************************************************************
+ ** connectTimeout
+ ** Description: connectFrom with the source address left to the
+ ** kernel
+ ** Parameters: const struct sockaddr_in* addr, int timeoutMs
+ *********************************************************************/
+static inline int connectTimeout(const struct sockaddr_in* addr, int timeoutMs)
+{
+  return connectFrom(addr, NULL, timeoutMs);
+}
+
+/*********************************************************************
+ ** connectRetry
+ ** Description: Calls connectTimeout until it succeeds or the retry
+ ** budget in policy is spent, backing off between attempts.
+ ** Returns the connected socket or -1 with errno from the last try.
+ ** Parameters: const struct sockaddr_in* addr,
+ ** const struct netPolicy* policy
+ *********************************************************************/
+static inline int connectRetry(const struct sockaddr_in* addr,
+                               const struct netPolicy* policy)
+{
+  int sockfd = -1,
+      attempt;
+
+  for (attempt = 0; attempt < policy->retries; attempt++)
+  {
+    if (attempt > 0)
+      netBackoff(attempt - 1, policy->baseMs, policy->capMs);
+    sockfd = connectTimeout(addr, policy->connectMs);
+    if (sockfd >= 0)
+      break;
+  }
+  return sockfd;
+}
+
+/*********************************************************************
+ ** readFull
+ ** Description: Reads exactly len bytes unless the deadline passes
+ ** or the peer closes first. Returns 0 on success, -1 with errno set
+ ** to ETIMEDOUT, ECONNRESET (early close) or the read error.
+ ** Parameters: int fd, void* buffer, size_t len, long deadline
+ *********************************************************************/
+static inline int readFull(int fd, void* buffer, size_t len, long deadline)
+{
+  char* pos = buffer;
+  ssize_t bytesRead;
+
+  while (len > 0)
+  {
+    if (deadline != NO_DEADLINE && netWait(fd, POLLIN, deadline) < 0)
+      return -1;
+    bytesRead = recv(fd, pos, len,
+                     deadline != NO_DEADLINE ? MSG_DONTWAIT : 0);
+    if (bytesRead < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)
+        continue;
+      return -1;
+    }
+    if (bytesRead == 0)
+    {
+      errno = ECONNRESET;
+      return -1;
+    }
+    pos += bytesRead;
+    len -= bytesRead;
+  }
+  return 0;
+}
+
+/*********************************************************************
+ ** writeFull
+ ** Description: Writes exactly len bytes unless the deadline passes.
+ ** Returns 0 on success, -1 with errno set otherwise.
+ ** Parameters: int fd, const void* buffer, size_t len, long deadline
+ *********************************************************************/
+static inline int writeFull(int fd, const void* buffer, size_t len,
+                            long deadline)
+{
+  const char* pos = buffer;
+  ssize_t bytesWrit;
+
+  while (len > 0)
+  {
+    if (deadline != NO_DEADLINE && netWait(fd, POLLOUT, deadline) < 0)
+      return -1;
+    // Never block inside send, or a full socket buffer would outlive
+    // the deadline
+    bytesWrit = send(fd, pos, len, MSG_NOSIGNAL |
+                     (deadline != NO_DEADLINE ? MSG_DONTWAIT : 0));
+    if (bytesWrit < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)
+        continue;
+      return -1;
+    }
+    pos += bytesWrit;
+    len -= bytesWrit;
+  }
+  return 0;
+}
+
+/*********************************************************************
+ ** writevFull
+ ** Description: Writes all count parts in order, as one message where
+ ** the socket buffer allows, unless the deadline passes. parts is
+ ** updated as data goes out. Returns 0 on success, -1 with errno set
+ ** otherwise.
+ ** Parameters: int fd, struct iovec* parts, int count, long deadline
+ *********************************************************************/
+static inline int writevFull(int fd, struct iovec* parts, int count,
+                             long deadline)
+{
+  struct msghdr message;
+  ssize_t bytesWrit;
+
+  memset(&message, 0, sizeof(message));
+  while (count > 0)
+  {
+    // Skip parts that are empty or already sent
+    if (parts->iov_len == 0)
+    {
+      parts++;
+      count--;
+      continue;
+    }
+    if (deadline != NO_DEADLINE && netWait(fd, POLLOUT, deadline) < 0)
+      return -1;
+    message.msg_iov = parts;
+    message.msg_iovlen = count;
+    bytesWrit = sendmsg(fd, &message, MSG_NOSIGNAL |
+                        (deadline != NO_DEADLINE ? MSG_DONTWAIT : 0));
+    if (bytesWrit < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)
+        continue;
+      return -1;
+    }
+    while (count > 0 && (size_t) bytesWrit >= parts->iov_len)
+    {
+      bytesWrit -= parts->iov_len;
+      parts++;
+      count--;
+    }
+    if (count > 0)
+    {
+      parts->iov_base = (char*) parts->iov_base + bytesWrit;
+      parts->iov_len -= bytesWrit;
+    }
+  }
+  return 0;
+}
+
+#endif
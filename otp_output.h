@@ -0,0 +1,285 @@
+/*********************************************************************
+ ** Program Filename: otp_output.h
+ ** Author: Peter Nguyen
+ ** Date: 10/19/26
+ ** CS 344-400, Program 4
+ ** Description: Output stage of the clients: where the result of a
+ ** request goes, stdout or the -o file, and how it gets there.
+ ** Received bytes are never NUL terminated or passed through stdio.
+ **   pipe      a plain reply is spliced from the socket into the pipe,
+ **             so its bytes never enter user memory
+ **   file      received chunks are gathered in one OUTPUT_BATCH
+ **             buffer, read into it in place, and written in large
+ **             writes; -o files are preallocated with fallocate
+ **   terminal  written as each chunk arrives
+ ** Framed and streamed answers must be authenticated before they are
+ ** written, so they go through the batch buffer on pipes as well.
+ ** vmsplice is not used for them: the pipe would keep references to
+ ** the buffer's pages, and a reader that splices them on (pv, tee)
+ ** would see the buffer after it is reused for the next frames.
+ *********************************************************************/
+
+#ifndef OTP_OUTPUT_H
+#define OTP_OUTPUT_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "otp_net.h"
+
+#define OUTPUT_BATCH (1 << 20)  // bytes gathered per write
+
+enum outputKind
+{
+  OUTPUT_FILE,
+  OUTPUT_PIPE,
+  OUTPUT_TERMINAL  // or anything else that wants bytes as they come
+};
+
+struct outputSink
+{
+  int fd,
+      kind,
+      owned;           // fd was opened by outputCreate
+  uint8_t* batch;      // OUTPUT_BATCH bytes gathered for the next write
+  size_t pending;      // bytes of batch not yet written
+  unsigned long long spliced,  // bytes moved from a socket in the kernel
+                     written;  // bytes written from batch or the caller
+};
+
+/*********************************************************************
+ ** outputOpen
+ ** Description: Sets up sink to write to fd, which stays open after
+ ** outputClose. Returns 0, or -1 with errno set.
+ ** Parameters: struct outputSink* sink, int fd
+ *********************************************************************/
+static inline int outputOpen(struct outputSink* sink, int fd)
+{
+  struct stat info;
+
+  memset(sink, 0, sizeof(*sink));
+  sink->fd = fd;
+  if (fstat(fd, &info) < 0)
+    return -1;
+  if (S_ISFIFO(info.st_mode))
+    sink->kind = OUTPUT_PIPE;
+  else if (S_ISREG(info.st_mode) || S_ISBLK(info.st_mode))
+    sink->kind = OUTPUT_FILE;
+  else
+    sink->kind = OUTPUT_TERMINAL;
+  sink->batch = malloc(OUTPUT_BATCH);
+  return sink->batch == NULL ? -1 : 0;
+}
+
+/*********************************************************************
+ ** outputCreate
+ ** Description: Sets up sink to write to a new file at path,
+ ** replacing any file there, with sizeHint bytes (if known, else 0)
+ ** preallocated so the writes do not allocate blocks one by one. The
+ ** file keeps its written size if the request fails. Returns 0, or
+ ** -1 with errno set.
+ ** Parameters: struct outputSink* sink, const char* path, off_t sizeHint
+ *********************************************************************/
+static inline int outputCreate(struct outputSink* sink, const char* path,
+                               off_t sizeHint)
+{
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+
+  if (fd < 0)
+    return -1;
+  // File systems without fallocate just allocate as they are written
+  if (sizeHint > 0 && fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, sizeHint) < 0 &&
+      errno != EOPNOTSUPP && errno != ENOSYS)
+  {
+    close(fd);
+    return -1;
+  }
+  if (outputOpen(sink, fd) < 0)
+  {
+    close(fd);
+    return -1;
+  }
+  sink->owned = 1;
+  return 0;
+}
+
+/*********************************************************************
+ ** outputWriteFd
+ ** Description: Writes len bytes of data to sink's descriptor.
+ ** Returns 0, or -1 with errno set.
+ ** Parameters: struct outputSink* sink, const uint8_t* data, size_t len
+ *********************************************************************/
+static inline int outputWriteFd(struct outputSink* sink, const uint8_t* data,
+                                size_t len)
+{
+  ssize_t count;
+
+  while (len > 0)
+  {
+    count = write(sink->fd, data, len);
+    if (count < 0 && errno == EINTR)
+      continue;
+    if (count < 0)
+      return -1;
+    sink->written += count;
+    data += count;
+    len -= count;
+  }
+  return 0;
+}
+
+/*********************************************************************
+ ** outputFlush
+ ** Description: Writes out the bytes gathered in sink's batch.
+ ** Returns 0, or -1 with errno set.
+ ** Parameters: struct outputSink* sink
+ *********************************************************************/
+static inline int outputFlush(struct outputSink* sink)
+{
+  size_t pending = sink->pending;
+
+  sink->pending = 0;
+  return outputWriteFd(sink, sink->batch, pending);
+}
+
+/*********************************************************************
+ ** outputReserve
+ ** Description: Returns room for len (at most OUTPUT_BATCH) bytes at
+ ** the end of sink's batch, for the caller to receive into before
+ ** outputCommit, flushing the batch first if it is too full. Returns
+ ** NULL, with errno set, if that flush fails.
+ ** Parameters: struct outputSink* sink, size_t len
+ *********************************************************************/
+static inline uint8_t* outputReserve(struct outputSink* sink, size_t len)
+{
+  if (sink->pending + len > OUTPUT_BATCH && outputFlush(sink) < 0)
+    return NULL;
+  return sink->batch + sink->pending;
+}
+
+/*********************************************************************
+ ** outputCommit
+ ** Description: Adds the first len bytes of the last outputReserve to
+ ** the output. Returns 0, or -1 with errno set.
+ ** Parameters: struct outputSink* sink, size_t len
+ *********************************************************************/
+static inline int outputCommit(struct outputSink* sink, size_t len)
+{
+  sink->pending += len;
+  if (sink->kind == OUTPUT_TERMINAL)
+    return outputFlush(sink);
+  return 0;
+}
+
+/*********************************************************************
+ ** outputWrite
+ ** Description: Adds len bytes of data to the output, writing data
+ ** directly if it would fill the batch anyway. Returns 0, or -1 with
+ ** errno set.
+ ** Parameters: struct outputSink* sink, const void* data, size_t len
+ *********************************************************************/
+static inline int outputWrite(struct outputSink* sink, const void* data,
+                              size_t len)
+{
+  uint8_t* room;
+
+  if (sink->pending + len > OUTPUT_BATCH)
+  {
+    if (outputFlush(sink) < 0)
+      return -1;
+    if (len >= OUTPUT_BATCH)
+      return outputWriteFd(sink, data, len);
+  }
+  room = outputReserve(sink, len);
+  if (room == NULL)
+    return -1;
+  memcpy(room, data, len);
+  return outputCommit(sink, len);
+}
+
+/*********************************************************************
+ ** outputFromSocket
+ ** Description: Moves the next len bytes received on sockfd to the
+ ** output, spliced into a pipe or read in place into the batch.
+ ** Returns 0, or -1 with errno set (ECONNRESET if the peer closes
+ ** first, ETIMEDOUT if the deadline passes).
+ ** Parameters: struct outputSink* sink, int sockfd, size_t len,
+ ** long deadline
+ *********************************************************************/
+static inline int outputFromSocket(struct outputSink* sink, int sockfd,
+                                   size_t len, long deadline)
+{
+  uint8_t* room;
+  size_t chunk;
+  ssize_t moved;
+
+  // Bytes already gathered go first
+  if (sink->kind == OUTPUT_PIPE && len > 0 && outputFlush(sink) < 0)
+    return -1;
+  while (sink->kind == OUTPUT_PIPE && len > 0)
+  {
+    if (netWait(sockfd, POLLIN, deadline) < 0)
+      return -1;
+    moved = splice(sockfd, NULL, sink->fd, NULL, len,
+                   SPLICE_F_MOVE | SPLICE_F_MORE);
+    if (moved == 0)
+    {
+      errno = ECONNRESET;
+      return -1;
+    }
+    if (moved < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      // A non-blocking pipe that is full waits for its reader
+      if (errno == EAGAIN && netWait(sink->fd, POLLOUT, deadline) == 0)
+        continue;
+      if (errno != EINVAL)
+        return -1;
+      sink->kind = OUTPUT_FILE;  // this kernel cannot; copy the rest
+      break;
+    }
+    sink->spliced += moved;
+    len -= moved;
+  }
+
+  while (len > 0)
+  {
+    chunk = len < OUTPUT_BATCH ? len : OUTPUT_BATCH;
+    room = outputReserve(sink, chunk);
+    if (room == NULL || readFull(sockfd, room, chunk, deadline) < 0 ||
+        outputCommit(sink, chunk) < 0)
+      return -1;
+    len -= chunk;
+  }
+  return 0;
+}
+
+/*********************************************************************
+ ** outputClose
+ ** Description: Writes out what is gathered, frees the batch and
+ ** closes the -o file, if any. Returns 0, or -1 with errno set if
+ ** any of it failed.
+ ** Parameters: struct outputSink* sink
+ *********************************************************************/
+static inline int outputClose(struct outputSink* sink)
+{
+  int status = outputFlush(sink);
+
+  free(sink->batch);
+  sink->batch = NULL;
+  if (sink->owned && close(sink->fd) < 0)
+    status = -1;
+  return status;
+}
+
+#endif
@@ -0,0 +1,291 @@
+/*********************************************************************
+ ** Program Filename: otp_pad.h
+ ** Author: Peter Nguyen
+ ** Date: 10/19/26
+ ** CS 344-400, Program 4
+ ** Description: Streaming reader for keygen pads. Key material is
+ ** always consumed in order, so a helper thread loads the next chunk
+ ** into a second buffer while the caller copies out of the current
+ ** one. The kernel is told the file is read sequentially, and chunks
+ ** already consumed are dropped from the page cache, so a huge pad
+ ** costs two chunk buffers of memory rather than its whole size.
+ ** Programs using it need -pthread on C libraries older than glibc
+ ** 2.34.
+ *********************************************************************/
+
+#ifndef OTP_PAD_H
+#define OTP_PAD_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#define PAD_HEAD_SIZE 64  // bytes that identify a pad in the journal
+
+// State of one of the two chunk buffers
+enum padChunkState
+{
+  PAD_EMPTY,    // owned by the read-ahead thread
+  PAD_FULL,     // loaded, owned by the caller
+  PAD_END       // no more data (end of pad or read error)
+};
+
+struct padChunk
+{
+  char* data;
+  size_t filled,
+         used;
+  off_t start;  // file offset of data[0]
+  enum padChunkState state;
+};
+
+struct padReader
+{
+  int fd,
+      current,        // chunk the caller is consuming
+      readError;      // errno from the read-ahead thread, or 0
+  off_t length,       // pad length without trailing newlines
+        position,     // file offset of the next byte handed out
+        readAhead;    // file offset the thread reads next
+  size_t chunkSize;
+  struct padChunk chunks[2];
+  char head[PAD_HEAD_SIZE];  // first bytes of the pad, for the journal
+  size_t headLen;
+  unsigned long waits;       // times the caller blocked on a chunk
+  int stop;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+};
+
+/*********************************************************************
+ ** padFill
+ ** Description: Read-ahead thread. Loads chunks alternately into the
+ ** two buffers as the caller frees them, until the end of the pad or
+ ** until the reader is closed.
+ ** Parameters: void* arg (struct padReader*)
+ *********************************************************************/
+static inline void* padFill(void* arg)
+{
+  struct padReader* reader = arg;
+  struct padChunk* chunk;
+  ssize_t count = 0;
+  size_t want,
+         filled;
+  int next = reader->current,
+      stop;
+
+  while (1)
+  {
+    chunk = &reader->chunks[next];
+    pthread_mutex_lock(&reader->lock);
+    while (chunk->state != PAD_EMPTY && !reader->stop)
+      pthread_cond_wait(&reader->changed, &reader->lock);
+    stop = reader->stop;
+    pthread_mutex_unlock(&reader->lock);
+    if (stop)
+      return NULL;
+
+    // Read one chunk without holding the lock
+    want = reader->chunkSize;
+    if (reader->length - reader->readAhead < (off_t) want)
+      want = reader->length - reader->readAhead;
+    filled = 0;
+    while (filled < want)
+    {
+      count = pread(reader->fd, chunk->data + filled, want - filled,
+                    reader->readAhead + filled);
+      if (count < 0 && errno == EINTR)
+        continue;
+      if (count <= 0)
+        break;
+      filled += count;
+    }
+
+    pthread_mutex_lock(&reader->lock);
+    if (filled < want)
+      reader->readError = count < 0 ? errno : EIO;
+    chunk->start = reader->readAhead;
+    chunk->filled = filled;
+    chunk->used = 0;
+    chunk->state = filled > 0 ? PAD_FULL : PAD_END;
+    reader->readAhead += filled;
+    pthread_cond_broadcast(&reader->changed);
+    pthread_mutex_unlock(&reader->lock);
+
+    if (filled < reader->chunkSize || reader->readAhead >= reader->length)
+    {
+      // Mark the other chunk too so the caller never waits on it
+      if (filled > 0)
+      {
+        chunk = &reader->chunks[next ^ 1];
+        pthread_mutex_lock(&reader->lock);
+        while (chunk->state != PAD_EMPTY && !reader->stop)
+          pthread_cond_wait(&reader->changed, &reader->lock);
+        chunk->state = PAD_END;
+        chunk->filled = 0;
+        pthread_cond_broadcast(&reader->changed);
+        pthread_mutex_unlock(&reader->lock);
+      }
+      return NULL;
+    }
+    next ^= 1;
+  }
+}
+
+/*********************************************************************
+ ** padOpen
+ ** Description: Opens a pad for streaming from byte offset onwards
+ ** with chunkSize bytes per buffer and starts the read-ahead thread.
+ ** Trailing newlines are not part of the pad. Returns 0, or -1 with
+ ** errno set.
+ ** Parameters: struct padReader* reader, const char* path,
+ ** off_t offset, size_t chunkSize
+ *********************************************************************/
+static inline int padOpen(struct padReader* reader, const char* path,
+                          off_t offset, size_t chunkSize)
+{
+  struct stat info;
+  char last;
+  int status;
+
+  memset(reader, 0, sizeof(*reader));
+  reader->fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (reader->fd < 0)
+    return -1;
+  if (fstat(reader->fd, &info) < 0)
+    goto fail;
+
+  // Trim the newline keygen writes after the key
+  reader->length = info.st_size;
+  while (reader->length > 0 &&
+         pread(reader->fd, &last, 1, reader->length - 1) == 1 &&
+         last == '\n')
+    reader->length--;
+
+  reader->headLen = reader->length < PAD_HEAD_SIZE ? reader->length
+                                                   : PAD_HEAD_SIZE;
+  if (pread(reader->fd, reader->head, reader->headLen, 0) !=
+      (ssize_t) reader->headLen)
+    goto fail;
+
+  if (offset > reader->length)
+    offset = reader->length;
+  reader->position = offset;
+  reader->readAhead = offset;
+  reader->chunkSize = chunkSize;
+  posix_fadvise(reader->fd, offset, 0, POSIX_FADV_SEQUENTIAL);
+
+  reader->chunks[0].data = malloc(chunkSize);
+  reader->chunks[1].data = malloc(chunkSize);
+  if (reader->chunks[0].data == NULL || reader->chunks[1].data == NULL)
+  {
+    errno = ENOMEM;
+    goto fail;
+  }
+
+  pthread_mutex_init(&reader->lock, NULL);
+  pthread_cond_init(&reader->changed, NULL);
+  status = pthread_create(&reader->thread, NULL, padFill, reader);
+  if (status != 0)
+  {
+    pthread_cond_destroy(&reader->changed);
+    pthread_mutex_destroy(&reader->lock);
+    errno = status;
+    goto fail;
+  }
+  return 0;
+
+fail:
+  status = errno;
+  free(reader->chunks[0].data);
+  free(reader->chunks[1].data);
+  close(reader->fd);
+  errno = status;
+  return -1;
+}
+
+/*********************************************************************
+ ** padRead
+ ** Description: Copies the next len bytes of the pad into dest.
+ ** Blocks only if the read-ahead thread has fallen behind. Each
+ ** chunk is dropped from the page cache once it is used up. Returns
+ ** the number of bytes copied, which is less than len only at the
+ ** end of the pad, or -1 with errno set if the pad could not be read.
+ ** Parameters: struct padReader* reader, char* dest, size_t len
+ *********************************************************************/
+static inline ssize_t padRead(struct padReader* reader, char* dest,
+                              size_t len)
+{
+  struct padChunk* chunk;
+  size_t copied = 0,
+         count;
+
+  while (copied < len)
+  {
+    chunk = &reader->chunks[reader->current];
+    pthread_mutex_lock(&reader->lock);
+    if (chunk->state == PAD_EMPTY)
+      reader->waits++;
+    while (chunk->state == PAD_EMPTY)
+      pthread_cond_wait(&reader->changed, &reader->lock);
+    pthread_mutex_unlock(&reader->lock);
+    if (chunk->state == PAD_END)
+    {
+      if (reader->readError != 0)
+      {
+        errno = reader->readError;
+        return -1;
+      }
+      break;
+    }
+
+    count = chunk->filled - chunk->used;
+    if (count > len - copied)
+      count = len - copied;
+    memcpy(dest + copied, chunk->data + chunk->used, count);
+    chunk->used += count;
+    copied += count;
+    reader->position += count;
+
+    if (chunk->used == chunk->filled)
+    {
+      // Consumed pad never needs to be cached again
+      posix_fadvise(reader->fd, chunk->start, chunk->filled,
+                    POSIX_FADV_DONTNEED);
+      pthread_mutex_lock(&reader->lock);
+      chunk->state = PAD_EMPTY;
+      pthread_cond_broadcast(&reader->changed);
+      pthread_mutex_unlock(&reader->lock);
+      reader->current ^= 1;
+    }
+  }
+  return copied;
+}
+
+/*********************************************************************
+ ** padClose
+ ** Description: Stops the read-ahead thread and releases the reader
+ ** Parameters: struct padReader* reader
+ *********************************************************************/
+static inline void padClose(struct padReader* reader)
+{
+  pthread_mutex_lock(&reader->lock);
+  reader->stop = 1;
+  pthread_cond_broadcast(&reader->changed);
+  pthread_mutex_unlock(&reader->lock);
+  pthread_join(reader->thread, NULL);
+
+  pthread_cond_destroy(&reader->changed);
+  pthread_mutex_destroy(&reader->lock);
+  free(reader->chunks[0].data);
+  free(reader->chunks[1].data);
+  close(reader->fd);
+}
+
+#endif
@@ -0,0 +1,768 @@
+/*********************************************************************
+ ** Program Filename: otp_padcheck.c
+ ** Author: Peter Nguyen
+ ** Date: 10/19/26
+ ** CS 344-400, Program 4
+ ** Description: Audits pad files such as keygen writes. Each file is
+ ** mapped and split into CHECK_CHUNK pieces that worker threads take
+ ** in turn, and one pass over every piece counts each of the 27
+ ** symbols and sums the products of adjacent symbol values. From
+ ** those come the invalid bytes (anything else, a final newline
+ ** aside), a chi-squared test of the counts against a uniform pad
+ ** and Knuth's serial correlation coefficient, each with its
+ ** p-value. The pass is vectorized: within a block of BLOCK_STEPS
+ ** vectors, which stays in L1, each symbol is compared against the
+ ** whole block into four sets of byte counters, and adjacent values
+ ** are multiplied with maddubs. The fastest count engine the CPU
+ ** supports is used once it agrees with the scalar one on a test
+ ** buffer. Prints one line of name=value pairs per file, the path
+ ** last, and exits 1 if any file could not be read or failed a test
+ ** at level alpha.
+ ** Usage: otp_padcheck [-t threads] [-a cpuList] [-e engine]
+ **        [-p alpha] padFile...
+ *********************************************************************/
+
+#define _GNU_SOURCE  // CPU affinity in otp_cpu.h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "otp_cipher.h"
+#include "otp_cpu.h"
+
+#define SYMBOLS 27
+#define MAX_THREADS 256
+#define BLOCK_STEPS 256  // vectors per block; 64 per byte counter
+
+const size_t CHECK_CHUNK = 16 << 20;  // bytes a worker takes at a time
+const double DEFAULT_ALPHA = 1e-4;    // chance a good pad fails a test
+const size_t SELF_TEST_SIZE = 100003; // odd, so every tail path runs
+
+// What one pass over some symbols found
+struct padCounts
+{
+  uint64_t symbols[SYMBOLS];  // by value, space last
+  unsigned __int128 pairs;    // sum of value * next value
+};
+
+typedef void (*countFn)(const uint8_t* in, size_t n,
+                        struct padCounts* counts);
+
+struct countEngine
+{
+  const char* name;
+  int (*supported)(void);
+  countFn count;
+  int failed;  // set when the self-test disagrees with scalar
+};
+
+// One file being checked, shared by its workers
+struct checkJob
+{
+  const uint8_t* pad;
+  size_t length,    // symbols checked, without a final newline
+         next;      // first byte of the next chunk to take
+  struct countEngine* engine;
+};
+
+struct checkWorker
+{
+  pthread_t thread;
+  int cpu;                 // -1 leaves it unpinned
+  struct checkJob* job;
+  struct padCounts counts;
+  size_t firstInvalid;     // job->length if none was found
+};
+
+// Function prototypes
+void error(const char *msg);
+int symbolIndex(uint8_t c);
+int pairValue(uint8_t c);
+void scalarCount(const uint8_t* in, size_t n, struct padCounts* counts);
+int countSelfTest(struct countEngine* engines);
+struct countEngine* countSelect(struct countEngine* engines,
+                                const char* name);
+void* checkChunks(void* argument);
+int checkFile(const char* path, struct countEngine* engine, int* cpus,
+              int threads, double alpha);
+double chiSquaredP(double chi2);
+double serialCorrelation(const struct padCounts* counts, size_t n,
+                         double* p);
+double nowSeconds();
+
+/******** Scalar reference ********/
+
+/*********************************************************************
+ ** symbolIndex
+ ** Description: Returns the value of a pad symbol, 0-25 for 'A'-'Z'
+ ** and 26 for space, or -1 for any other byte (newline included,
+ ** as in symbolValid)
+ ** Parameters: uint8_t c
+ *********************************************************************/
+int symbolIndex(uint8_t c)
+{
+  if ((uint8_t) (c - 'A') < 26)
+    return c - 'A';
+  return c == ' ' ? 26 : -1;
+}
+
+/*********************************************************************
+ ** pairValue
+ ** Description: Returns the value c has in a product of adjacent
+ ** symbols: its symbol value, or 0 if it is not a symbol
+ ** Parameters: uint8_t c
+ *********************************************************************/
+int pairValue(uint8_t c)
+{
+  int value = symbolIndex(c);
+
+  return value < 0 ? 0 : value;
+}
+
+/*********************************************************************
+ ** scalarCount
+ ** Description: Adds the symbols of n bytes and the products of the
+ ** n - 1 adjacent pairs among them to counts, an invalid byte
+ ** counting as 0 in a product; the reference every other engine is
+ ** checked against
+ ** Parameters: const uint8_t* in, size_t n, struct padCounts* counts
+ *********************************************************************/
+void scalarCount(const uint8_t* in, size_t n, struct padCounts* counts)
+{
+  size_t index;
+  int value;
+
+  for (index = 0; index < n; index++)
+  {
+    value = symbolIndex(in[index]);
+    if (value >= 0)
+      counts->symbols[value]++;
+    if (index + 1 < n)
+      counts->pairs += pairValue(in[index]) * pairValue(in[index + 1]);
+  }
+}
+
+static int scalarSupported(void)
+{
+  return 1;
+}
+
+#ifdef OTP_CIPHER_X86
+
+/******** AVX2: blocks of 256 x 32 symbols ********/
+
+/*********************************************************************
+ ** avx2CheckValues
+ ** Description: Returns the symbol values of 32 bytes, 0 for invalid
+ ** ones
+ ** Parameters: __m256i chars
+ *********************************************************************/
+__attribute__((target("avx2")))
+static inline __m256i avx2CheckValues(__m256i chars)
+{
+  __m256i letter = _mm256_sub_epi8(chars, _mm256_set1_epi8('A')),
+          valid;
+
+  valid = _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_min_epu8(letter,
+                                                  _mm256_set1_epi8(25)),
+                                             letter),
+                          _mm256_cmpeq_epi8(chars, _mm256_set1_epi8(' ')));
+  return _mm256_and_si256(avx2Values(chars), valid);
+}
+
+/*********************************************************************
+ ** avx2Sum64
+ ** Description: Returns the sum of the four 64-bit lanes of sum
+ ** Parameters: __m256i sum
+ *********************************************************************/
+__attribute__((target("avx2")))
+static inline uint64_t avx2Sum64(__m256i sum)
+{
+  __m128i half = _mm_add_epi64(_mm256_castsi256_si128(sum),
+                               _mm256_extracti128_si256(sum, 1));
+
+  return _mm_cvtsi128_si64(half) + _mm_extract_epi64(half, 1);
+}
+
+/*********************************************************************
+ ** avx2Tally
+ ** Description: Returns how many of the bytes from in to end (a
+ ** multiple of 128 bytes, at most BLOCK_STEPS vectors) equal c. Four
+ ** sets of byte counters take turns, so the adds do not wait on each
+ ** other.
+ ** Parameters: const uint8_t* in, const uint8_t* end, uint8_t c
+ *********************************************************************/
+__attribute__((target("avx2")))
+static inline uint64_t avx2Tally(const uint8_t* in, const uint8_t* end,
+                                 uint8_t c)
+{
+  const __m256i* at = (const __m256i*) in;
+  __m256i target = _mm256_set1_epi8(c),
+          zero = _mm256_setzero_si256(),
+          tally0 = zero,
+          tally1 = zero,
+          tally2 = zero,
+          tally3 = zero;
+
+  // Named, not an array, so the counters stay in registers
+  for (; (const uint8_t*) at < end; at += 4)
+  {
+    tally0 = _mm256_sub_epi8(tally0, _mm256_cmpeq_epi8(
+               _mm256_loadu_si256(at), target));
+    tally1 = _mm256_sub_epi8(tally1, _mm256_cmpeq_epi8(
+               _mm256_loadu_si256(at + 1), target));
+    tally2 = _mm256_sub_epi8(tally2, _mm256_cmpeq_epi8(
+               _mm256_loadu_si256(at + 2), target));
+    tally3 = _mm256_sub_epi8(tally3, _mm256_cmpeq_epi8(
+               _mm256_loadu_si256(at + 3), target));
+  }
+  return avx2Sum64(_mm256_add_epi64(
+           _mm256_add_epi64(_mm256_sad_epu8(tally0, zero),
+                            _mm256_sad_epu8(tally1, zero)),
+           _mm256_add_epi64(_mm256_sad_epu8(tally2, zero),
+                            _mm256_sad_epu8(tally3, zero))));
+}
+
+/*********************************************************************
+ ** avx2Count
+ ** Description: scalarCount 32 symbols per step. Each block of up to
+ ** BLOCK_STEPS steps is tallied for each symbol in turn, then
+ ** multiplied by the block one byte on.
+ ** Parameters: const uint8_t* in, size_t n, struct padCounts* counts
+ *********************************************************************/
+__attribute__((target("avx2")))
+static void avx2Count(const uint8_t* in, size_t n, struct padCounts* counts)
+{
+  __m256i products,
+          zero = _mm256_setzero_si256(),
+          ones = _mm256_set1_epi16(1);
+  size_t index = 0,
+         at,
+         end;
+  int symbol;
+
+  // Every step also reads the byte after it, for the last product
+  while (index + 128 < n)
+  {
+    end = index + ((n - 1 - index) / 128) * 128;
+    if (end - index > BLOCK_STEPS * 32)
+      end = index + BLOCK_STEPS * 32;
+
+    for (symbol = 0; symbol < SYMBOLS; symbol++)
+      counts->symbols[symbol] += avx2Tally(in + index, in + end,
+                                           symbolChar(symbol));
+
+    // At most 2 * 26 * 26 per 32-bit lane and step
+    products = zero;
+    for (at = index; at < end; at += 32)
+      products = _mm256_add_epi32(products, _mm256_madd_epi16(
+                   _mm256_maddubs_epi16(
+                     avx2CheckValues(_mm256_loadu_si256(
+                       (const __m256i*) (in + at))),
+                     avx2CheckValues(_mm256_loadu_si256(
+                       (const __m256i*) (in + at + 1)))),
+                   ones));
+    counts->pairs += avx2Sum64(_mm256_add_epi64(
+                       _mm256_unpacklo_epi32(products, zero),
+                       _mm256_unpackhi_epi32(products, zero)));
+    index = end;
+  }
+
+  // The steps took the pair across into the tail too
+  scalarCount(in + index, n - index, counts);
+}
+
+/******** AVX-512: blocks of 256 x 64 symbols ********/
+
+/*********************************************************************
+ ** avx512CheckValues
+ ** Description: Returns the symbol values of 64 bytes, 0 for invalid
+ ** ones
+ ** Parameters: __m512i chars
+ *********************************************************************/
+__attribute__((target("avx512f,avx512bw")))
+static inline __m512i avx512CheckValues(__m512i chars)
+{
+  __mmask64 valid = _mm512_cmple_epu8_mask(_mm512_sub_epi8(chars,
+                                             _mm512_set1_epi8('A')),
+                                           _mm512_set1_epi8(25)) |
+                    _mm512_cmpeq_epi8_mask(chars, _mm512_set1_epi8(' '));
+
+  return _mm512_maskz_mov_epi8(valid, avx512Values(chars));
+}
+
+/*********************************************************************
+ ** avx512Tally
+ ** Description: avx2Tally over 256-byte steps, the byte counters
+ ** taking the compare masks directly
+ ** Parameters: const uint8_t* in, const uint8_t* end, uint8_t c
+ *********************************************************************/
+__attribute__((target("avx512f,avx512bw")))
+static inline uint64_t avx512Tally(const uint8_t* in, const uint8_t* end,
+                                   uint8_t c)
+{
+  __m512i target = _mm512_set1_epi8(c),
+          zero = _mm512_setzero_si512(),
+          one = _mm512_set1_epi8(1),
+          tally0 = zero,
+          tally1 = zero,
+          tally2 = zero,
+          tally3 = zero;
+
+  for (; in < end; in += 256)
+  {
+    tally0 = _mm512_mask_add_epi8(tally0, _mm512_cmpeq_epi8_mask(
+               _mm512_loadu_si512(in), target), tally0, one);
+    tally1 = _mm512_mask_add_epi8(tally1, _mm512_cmpeq_epi8_mask(
+               _mm512_loadu_si512(in + 64), target), tally1, one);
+    tally2 = _mm512_mask_add_epi8(tally2, _mm512_cmpeq_epi8_mask(
+               _mm512_loadu_si512(in + 128), target), tally2, one);
+    tally3 = _mm512_mask_add_epi8(tally3, _mm512_cmpeq_epi8_mask(
+               _mm512_loadu_si512(in + 192), target), tally3, one);
+  }
+  return _mm512_reduce_add_epi64(_mm512_add_epi64(
+           _mm512_add_epi64(_mm512_sad_epu8(tally0, zero),
+                            _mm512_sad_epu8(tally1, zero)),
+           _mm512_add_epi64(_mm512_sad_epu8(tally2, zero),
+                            _mm512_sad_epu8(tally3, zero))));
+}
+
+/*********************************************************************
+ ** avx512Count
+ ** Description: avx2Count 64 symbols per step
+ ** Parameters: const uint8_t* in, size_t n, struct padCounts* counts
+ *********************************************************************/
+__attribute__((target("avx512f,avx512bw")))
+static void avx512Count(const uint8_t* in, size_t n,
+                        struct padCounts* counts)
+{
+  __m512i products,
+          ones = _mm512_set1_epi16(1);
+  size_t index = 0,
+         at,
+         end;
+  int symbol;
+
+  while (index + 256 < n)
+  {
+    end = index + ((n - 1 - index) / 256) * 256;
+    if (end - index > BLOCK_STEPS * 64)
+      end = index + BLOCK_STEPS * 64;
+
+    for (symbol = 0; symbol < SYMBOLS; symbol++)
+      counts->symbols[symbol] += avx512Tally(in + index, in + end,
+                                             symbolChar(symbol));
+
+    products = _mm512_setzero_si512();
+    for (at = index; at < end; at += 64)
+      products = _mm512_add_epi32(products, _mm512_madd_epi16(
+                   _mm512_maddubs_epi16(
+                     avx512CheckValues(_mm512_loadu_si512(in + at)),
+                     avx512CheckValues(_mm512_loadu_si512(in + at + 1))),
+                   ones));
+    counts->pairs += (uint32_t) _mm512_reduce_add_epi32(products);
+    index = end;
+  }
+
+  // The steps took the pair across into the tail too
+  scalarCount(in + index, n - index, counts);
+}
+
+#endif
+
+/******** Registry and dispatch ********/
+
+// In order of preference, slowest first: the last that works wins
+static struct countEngine countEngines[] =
+{
+  { "scalar", scalarSupported, scalarCount, 0 },
+#ifdef OTP_CIPHER_X86
+  { "avx2", avx2Supported, avx2Count, 0 },
+  { "avx512", avx512Supported, avx512Count, 0 },
+#endif
+  { NULL, NULL, NULL, 0 }
+};
+
+int main(int argc, char *argv[])
+{
+  int option,
+      threads = 0,
+      count,
+      status = 0,
+      cpus[MAX_THREADS];
+  char* cpuList = NULL;
+  char* engineName = NULL;
+  char* end;
+  double alpha = DEFAULT_ALPHA;
+  struct countEngine* engine;
+
+  while ((option = getopt(argc, argv, "t:a:e:p:")) != -1)
+  {
+    switch (option)
+    {
+      case 't': threads = atoi(optarg); break;
+      case 'a': cpuList = optarg; break;
+      case 'e': engineName = optarg; break;
+      case 'p':
+        alpha = strtod(optarg, &end);
+        if (*end != '\0' || !(alpha > 0 && alpha < 1))
+          argc = 0;  // force the usage message
+        break;
+      default: argc = 0; break;
+    }
+  }
+  count = parseCpuList(cpuList, cpus, MAX_THREADS);
+  if (optind >= argc || count < 1 || threads < 0 || threads > MAX_THREADS)
+  {
+    fprintf(stderr, "usage: %s [-t threads] [-a cpuList] [-e engine] "
+            "[-p alpha] padFile...\n", argv[0]);
+    exit(1);
+  }
+
+  // One worker per allowed CPU unless -t says otherwise; only -a pins
+  if (threads == 0)
+    threads = count;
+  for (option = 0; option < threads; option++)
+    cpus[option] = cpuList != NULL ? cpus[option % count] : -1;
+
+  if (countSelfTest(countEngines) > 0)
+    fprintf(stderr, "warning: count engines disagree with scalar, "
+            "not using them\n");
+  engine = countSelect(countEngines, engineName);
+  if (engine == NULL)
+  {
+    fprintf(stderr, "ERROR, count engine %s is not available\n",
+            engineName);
+    exit(1);
+  }
+
+  for (; optind < argc; optind++)
+    status |= checkFile(argv[optind], engine, cpus, threads, alpha);
+  return status;
+}
+
+/*********************************************************************
+ ** countSelfTest
+ ** Description: Runs every supported engine on the same buffer of
+ ** symbols, with invalid bytes and a run of one symbol in it, and
+ ** marks those whose counts differ from scalar's as failed. Returns
+ ** the number of failed engines.
+ ** Parameters: struct countEngine* engines
+ *********************************************************************/
+int countSelfTest(struct countEngine* engines)
+{
+  uint8_t* buffer = malloc(SELF_TEST_SIZE);
+  uint64_t state = 0x9e3779b97f4a7c15ULL;
+  struct padCounts expected,
+                   got;
+  size_t index;
+  int failed = 0;
+
+  if (buffer == NULL)
+    error("ERROR allocating self-test buffer");
+  cipherRandomSymbols(buffer, SELF_TEST_SIZE, &state);
+  for (index = 0; index < SELF_TEST_SIZE; index += 4099)
+    buffer[index] = (uint8_t) (index * 7);   // mostly invalid bytes
+  memset(buffer + 5000, 'Q', 20000);         // byte counters at 64
+  buffer[SELF_TEST_SIZE - 1] = '\n';
+
+  memset(&expected, 0, sizeof(expected));
+  scalarCount(buffer, SELF_TEST_SIZE, &expected);
+  for (; engines->name != NULL; engines++)
+  {
+    if (!engines->supported())
+      continue;
+    memset(&got, 0, sizeof(got));
+    engines->count(buffer, SELF_TEST_SIZE, &got);
+    if (memcmp(got.symbols, expected.symbols, sizeof(got.symbols)) != 0 ||
+        got.pairs != expected.pairs)
+    {
+      engines->failed = 1;
+      failed++;
+    }
+  }
+  free(buffer);
+  return failed;
+}
+
+/*********************************************************************
+ ** countSelect
+ ** Description: Returns the engine called name, or with a NULL name
+ ** the fastest one, if supported and not failed; else NULL
+ ** Parameters: struct countEngine* engines, const char* name
+ *********************************************************************/
+struct countEngine* countSelect(struct countEngine* engines,
+                                const char* name)
+{
+  struct countEngine* chosen = NULL;
+
+  for (; engines->name != NULL; engines++)
+  {
+    if (engines->failed || !engines->supported())
+      continue;
+    if (name == NULL || strcmp(name, engines->name) == 0)
+      chosen = engines;
+  }
+  return chosen;
+}
+
+/*********************************************************************
+ ** checkChunks
+ ** Description: Body of a worker thread: takes chunks of the job's
+ ** pad until none are left and counts them, with the pair that
+ ** crosses into the next chunk, into its own counts. The first
+ ** invalid byte is only looked for in chunks that have one.
+ ** Parameters: void* argument, the struct checkWorker
+ *********************************************************************/
+void* checkChunks(void* argument)
+{
+  struct checkWorker* worker = argument;
+  struct checkJob* job = worker->job;
+  struct padCounts chunk;
+  uint64_t valid;
+  size_t start,
+         length,
+         index;
+  int symbol;
+
+  if (worker->cpu >= 0 && pinToCpu(worker->cpu) < 0)
+    perror("ERROR pinning worker");
+  memset(&worker->counts, 0, sizeof(worker->counts));
+  worker->firstInvalid = job->length;
+
+  while (1)
+  {
+    start = __atomic_fetch_add(&job->next, CHECK_CHUNK, __ATOMIC_RELAXED);
+    if (start >= job->length)
+      break;
+    length = job->length - start < CHECK_CHUNK ? job->length - start
+                                               : CHECK_CHUNK;
+    memset(&chunk, 0, sizeof(chunk));
+    job->engine->count(job->pad + start, length, &chunk);
+
+    if (start + length < job->length)
+      chunk.pairs += pairValue(job->pad[start + length - 1]) *
+                     pairValue(job->pad[start + length]);
+    valid = 0;
+    for (symbol = 0; symbol < SYMBOLS; symbol++)
+    {
+      worker->counts.symbols[symbol] += chunk.symbols[symbol];
+      valid += chunk.symbols[symbol];
+    }
+    worker->counts.pairs += chunk.pairs;
+
+    if (valid < length && start < worker->firstInvalid)
+    {
+      for (index = start; symbolIndex(job->pad[index]) >= 0; index++)
+        ;
+      worker->firstInvalid = index;
+    }
+  }
+  return NULL;
+}
+
+/*********************************************************************
+ ** checkFile
+ ** Description: Checks the pad at path with threads workers (pinned
+ ** to cpus, where not -1) and prints its report line. A final
+ ** newline is not part of the pad. Returns 0 if the pad passed, 1 if
+ ** it failed or could not be read.
+ ** Parameters: const char* path, struct countEngine* engine,
+ ** int* cpus, int threads, double alpha
+ *********************************************************************/
+int checkFile(const char* path, struct countEngine* engine, int* cpus,
+              int threads, double alpha)
+{
+  struct checkWorker workers[MAX_THREADS];
+  struct checkJob job;
+  struct padCounts counts;
+  struct stat info;
+  uint64_t valid = 0;
+  size_t firstInvalid;
+  double start = nowSeconds(),
+         elapsed,
+         expected,
+         chi2 = 0,
+         chi2P,
+         serial,
+         serialP;
+  void* pad;
+  int fd,
+      index,
+      symbol,
+      passed;
+
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0 || fstat(fd, &info) < 0)
+  {
+    perror(path);
+    if (fd >= 0)
+      close(fd);
+    return 1;
+  }
+  if (info.st_size < 2)
+  {
+    fprintf(stderr, "%s: no pad symbols\n", path);
+    close(fd);
+    return 1;
+  }
+  pad = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (pad == MAP_FAILED)
+  {
+    perror(path);
+    return 1;
+  }
+  madvise(pad, info.st_size, MADV_SEQUENTIAL);
+
+  job.pad = pad;
+  job.length = info.st_size;
+  if (job.pad[job.length - 1] == '\n')
+    job.length--;
+  job.next = 0;
+  job.engine = engine;
+  for (index = 0; index < threads; index++)
+  {
+    workers[index].cpu = cpus[index];
+    workers[index].job = &job;
+    errno = pthread_create(&workers[index].thread, NULL, checkChunks,
+                           &workers[index]);
+    if (errno != 0)
+      error("ERROR starting worker thread");
+  }
+
+  memset(&counts, 0, sizeof(counts));
+  firstInvalid = job.length;
+  for (index = 0; index < threads; index++)
+  {
+    pthread_join(workers[index].thread, NULL);
+    for (symbol = 0; symbol < SYMBOLS; symbol++)
+      counts.symbols[symbol] += workers[index].counts.symbols[symbol];
+    counts.pairs += workers[index].counts.pairs;
+    if (workers[index].firstInvalid < firstInvalid)
+      firstInvalid = workers[index].firstInvalid;
+  }
+  // The serial test wraps around: the last symbol pairs with the first
+  counts.pairs += pairValue(job.pad[job.length - 1]) * pairValue(job.pad[0]);
+  elapsed = nowSeconds() - start;
+
+  for (index = 0; index < SYMBOLS; index++)
+    valid += counts.symbols[index];
+  expected = (double) valid / SYMBOLS;
+  for (index = 0; index < SYMBOLS && valid > 0; index++)
+    chi2 += (counts.symbols[index] - expected) *
+            (counts.symbols[index] - expected) / expected;
+  chi2P = chiSquaredP(chi2);
+  serial = serialCorrelation(&counts, job.length, &serialP);
+  passed = valid == job.length && chi2P >= alpha && serialP >= alpha;
+
+  printf("result=%s symbols=%zu invalid=%llu firstInvalid=%lld "
+         "chi2=%.3f chi2P=%.6g serial=%.3e serialP=%.6g counts=",
+         passed ? "pass" : "fail", job.length,
+         (unsigned long long) (job.length - valid),
+         firstInvalid < job.length ? (long long) firstInvalid : -1LL, chi2,
+         chi2P, serial, serialP);
+  for (index = 0; index < SYMBOLS; index++)
+    printf("%s%llu", index > 0 ? "," : "",
+           (unsigned long long) counts.symbols[index]);
+  printf(" engine=%s threads=%d seconds=%.4f gbps=%.2f file=%s\n",
+         engine->name, threads, elapsed, job.length / elapsed / 1e9, path);
+  fflush(stdout);
+
+  munmap(pad, info.st_size);
+  return !passed;
+}
+
+/*********************************************************************
+ ** chiSquaredP
+ ** Description: Returns the chance that counts of a uniform pad give
+ ** a chi-squared of at least chi2, with SYMBOLS - 1 = 26 degrees of
+ ** freedom: Q(13, chi2 / 2), which for a whole first argument is a
+ ** finite Poisson sum
+ ** Parameters: double chi2
+ *********************************************************************/
+double chiSquaredP(double chi2)
+{
+  double half = chi2 / 2,
+         term = 1,
+         sum = 1;
+  int k;
+
+  for (k = 1; k < (SYMBOLS - 1) / 2; k++)
+  {
+    term *= half / k;
+    sum += term;
+  }
+  return fmin(1, exp(log(sum) - half));
+}
+
+/*********************************************************************
+ ** serialCorrelation
+ ** Description: Returns Knuth's serial correlation coefficient of the
+ ** n symbol values counted (invalid ones as 0), each paired with the
+ ** next and the last with the first, and stores in p the two-sided
+ ** chance of one as far from its mean -1/(n-1) for a random pad, its
+ ** deviation being about 1/sqrt(n). Sums are exact in 128 bits.
+ ** Parameters: const struct padCounts* counts, size_t n, double* p
+ *********************************************************************/
+double serialCorrelation(const struct padCounts* counts, size_t n,
+                         double* p)
+{
+  unsigned __int128 sum = 0,
+                    squares = 0;
+  long double numerator,
+              denominator,
+              serial,
+              mean,
+              deviation;
+  int value;
+
+  for (value = 0; value < SYMBOLS; value++)
+  {
+    sum += (unsigned __int128) value * counts->symbols[value];
+    squares += (unsigned __int128) value * value * counts->symbols[value];
+  }
+  numerator = (long double) (__int128) (n * counts->pairs - sum * sum);
+  denominator = (long double) (__int128) (n * squares - sum * sum);
+  *p = 1;
+  if (n < 4 || denominator <= 0)
+    return 0;
+
+  serial = numerator / denominator;
+  mean = -1.0L / (n - 1);
+  deviation = sqrtl((long double) n * (n - 3) / (n + 1)) / (n - 1);
+  *p = erfc(fabsl(serial - mean) / deviation / sqrt(2));
+  return serial;
+}
+
+/*********************************************************************
+ ** nowSeconds
+ ** Description: Returns the monotonic clock in seconds
+ ** Parameters: none
+ *********************************************************************/
+double nowSeconds()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*********************************************************************
+ ** error
+ ** Description: Displays an error message
+ ** Parameters: const char *msg
+ *********************************************************************/
+void error(const char *msg)
+{
+  perror(msg);
+  exit(1);
+}
@@ -0,0 +1,318 @@
+/*********************************************************************
+ ** Program Filename: otp_padpool.h
+ ** Author: Peter Nguyen
+ ** Date: 10/19/26
+ ** CS 344-400, Program 4
+ ** Description: Pool of pre-generated pad segments for keygen -d.
+ ** Worker threads keep up to capacity segments ready in the pool
+ ** directory, each a key file of segmentSymbols random symbols and a
+ ** newline, written through mmap as fill-N.tmp, checked with
+ ** symbolsFindInvalid, synced, and only then renamed to ready-N.pad.
+ ** Issuing a segment renames it to issued-N.pad, so a ready file is
+ ** issued once. A directory serves one pool at a time: poolOpen holds
+ ** an exclusive flock on it, so serials, which start past every name
+ ** found at startup, are never allocated twice and no rename replaces
+ ** another pool's segment. Symbols come from
+ ** getrandom through the seed map (otp_seed.h), which rejects bytes
+ ** of SEED_ACCEPT or more so all 27 are equally likely; no seed is
+ ** involved, these are true pads.
+ *********************************************************************/
+
+#ifndef OTP_PADPOOL_H
+#define OTP_PADPOOL_H
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/random.h>
+#include <sys/stat.h>
+#include "otp_cipher.h"
+#include "otp_seed.h"
+
+#define POOL_PATH_MAX 512
+
+struct padPool
+{
+  const char* dir;
+  int lockfd;              // the directory, flocked while the pool is open
+  long segmentSymbols;
+  int capacity,            // segments kept ready
+      head,                // oldest ready segment in ready
+      count,               // segments ready now
+      filling,             // segments being generated
+      stopping;
+  uint64_t* ready;         // serials of the ready segments, a ring
+  uint64_t nextSerial;
+  unsigned long issued,
+                generated,
+                stalls,    // takes that found the pool empty
+                failures;  // segments lost to errors or bad symbols
+  pthread_mutex_t lock;
+  pthread_cond_t changed;  // a segment became ready or was taken
+  struct seedKey mapper;   // only its byte-to-symbol map is used
+};
+
+/*********************************************************************
+ ** poolPath
+ ** Description: Writes the path of segment serial in state ("fill",
+ ** "ready" or "issued") to path
+ ** Parameters: const struct padPool* pool, const char* state,
+ ** uint64_t serial, char* path
+ *********************************************************************/
+static inline void poolPath(const struct padPool* pool, const char* state,
+                            uint64_t serial, char* path)
+{
+  snprintf(path, POOL_PATH_MAX, "%s/%s-%" PRIu64 "%s", pool->dir, state,
+           serial, strcmp(state, "fill") == 0 ? ".tmp" : ".pad");
+}
+
+/*********************************************************************
+ ** poolOpen
+ ** Description: Sets up a pool of capacity segments of segmentSymbols
+ ** in dir, creating it if needed. Ready segments left by an earlier
+ ** run are kept (up to capacity), unfinished ones deleted. Returns 0,
+ ** or -1 with errno set (EBUSY if another pool has dir).
+ ** Parameters: struct padPool* pool, const char* dir, int capacity,
+ ** long segmentSymbols
+ *********************************************************************/
+static inline int poolOpen(struct padPool* pool, const char* dir,
+                           int capacity, long segmentSymbols)
+{
+  uint8_t zero[SEED_KEY_BYTES] = { 0 };
+  char path[POOL_PATH_MAX],
+       state[16];
+  uint64_t serial;
+  struct dirent* entry;
+  struct stat info;
+  DIR* dirPtr;
+
+  memset(pool, 0, sizeof(*pool));
+  pool->dir = dir;
+  pool->capacity = capacity;
+  pool->segmentSymbols = segmentSymbols;
+  pool->ready = malloc(sizeof(uint64_t) * capacity);
+  if (pool->ready == NULL || seedInit(&pool->mapper, zero) < 0)
+    return -1;
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->changed, NULL);
+
+  if (mkdir(dir, 0700) < 0 && errno != EEXIST)
+    return -1;
+  pool->lockfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (pool->lockfd < 0)
+    return -1;
+  if (flock(pool->lockfd, LOCK_EX | LOCK_NB) < 0)
+  {
+    if (errno == EWOULDBLOCK)
+      errno = EBUSY;
+    close(pool->lockfd);
+    return -1;
+  }
+  dirPtr = opendir(dir);
+  if (dirPtr == NULL)
+    return -1;
+  while ((entry = readdir(dirPtr)) != NULL)
+  {
+    if (sscanf(entry->d_name, "%15[a-z]-%" SCNu64, state, &serial) != 2)
+      continue;
+    if (serial >= pool->nextSerial)
+      pool->nextSerial = serial + 1;
+    poolPath(pool, state, serial, path);
+    if (strcmp(state, "fill") == 0)
+      unlink(path);
+    else if (strcmp(state, "ready") == 0 && pool->count < capacity &&
+             stat(path, &info) == 0 && info.st_size == segmentSymbols + 1)
+      pool->ready[pool->count++] = serial;
+  }
+  closedir(dirPtr);
+  return 0;
+}
+
+/*********************************************************************
+ ** poolGenerate
+ ** Description: Writes segment serial: fills fill-N.tmp through mmap,
+ ** checks every symbol, syncs it and renames it to ready-N.pad.
+ ** Returns 0, or -1 with errno set (EIO if a symbol was bad).
+ ** Parameters: struct padPool* pool, uint64_t serial
+ *********************************************************************/
+static inline int poolGenerate(struct padPool* pool, uint64_t serial)
+{
+  uint8_t random[SEED_BATCH_BYTES],
+          mapped[SEED_BATCH_BYTES + 16];  // the map stores 8 at a time
+  char fillPath[POOL_PATH_MAX],
+       readyPath[POOL_PATH_MAX];
+  size_t length = pool->segmentSymbols,
+         filled = 0,
+         count;
+  uint8_t* segment;
+  int fd,
+      status = -1;
+
+  poolPath(pool, "fill", serial, fillPath);
+  poolPath(pool, "ready", serial, readyPath);
+  fd = open(fillPath, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+  if (fd < 0)
+    return -1;
+  if (ftruncate(fd, length + 1) < 0)
+    goto done;
+  segment = mmap(NULL, length + 1, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+                 0);
+  if (segment == MAP_FAILED)
+    goto done;
+
+  while (filled < length)
+  {
+    if (getrandom(random, sizeof(random), 0) != sizeof(random))
+    {
+      if (errno == EINTR)
+        continue;
+      munmap(segment, length + 1);
+      goto done;
+    }
+    count = pool->mapper.map(&pool->mapper, random, mapped);
+    if (count > length - filled)
+      count = length - filled;
+    memcpy(segment + filled, mapped, count);
+    filled += count;
+  }
+  segment[length] = '\n';
+
+  // Pre-validated: a segment with a bad symbol is never made ready
+  if (symbolsFindInvalid(segment, length) != length)
+    errno = EIO;
+  else if (msync(segment, length + 1, MS_SYNC) == 0 &&
+           rename(fillPath, readyPath) == 0)
+    status = 0;
+  munmap(segment, length + 1);
+
+done:
+  close(fd);
+  if (status < 0)
+    unlink(fillPath);
+  return status;
+}
+
+/*********************************************************************
+ ** poolRefill
+ ** Description: Body of a refill thread: generates segments while
+ ** fewer than capacity are ready or being generated, then sleeps
+ ** until one is taken. Returns once the pool is stopping.
+ ** Parameters: void* argument, the struct padPool
+ *********************************************************************/
+static inline void* poolRefill(void* argument)
+{
+  struct padPool* pool = argument;
+  uint64_t serial;
+  int status;
+
+  pthread_mutex_lock(&pool->lock);
+  while (1)
+  {
+    while (!pool->stopping && pool->count + pool->filling >= pool->capacity)
+      pthread_cond_wait(&pool->changed, &pool->lock);
+    if (pool->stopping)
+      break;
+    serial = pool->nextSerial++;
+    pool->filling++;
+    pthread_mutex_unlock(&pool->lock);
+
+    status = poolGenerate(pool, serial);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->filling--;
+    if (status == 0)
+    {
+      pool->ready[(pool->head + pool->count) % pool->capacity] = serial;
+      pool->count++;
+      pool->generated++;
+    }
+    else
+    {
+      pool->failures++;
+      perror("ERROR generating pad segment");
+    }
+    pthread_cond_broadcast(&pool->changed);
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+/*********************************************************************
+ ** poolTake
+ ** Description: Issues the oldest ready segment, waiting up to
+ ** timeoutMs if there is none (a refill stall), and writes the path
+ ** it was issued under to path. Returns 0, or -1 with errno set
+ ** (ETIMEDOUT if nothing became ready in time).
+ ** Parameters: struct padPool* pool, int timeoutMs, char* path
+ *********************************************************************/
+static inline int poolTake(struct padPool* pool, int timeoutMs, char* path)
+{
+  char readyPath[POOL_PATH_MAX];
+  struct timespec until;
+  uint64_t serial;
+  int status = 0;
+
+  clock_gettime(CLOCK_REALTIME, &until);
+  until.tv_sec += timeoutMs / 1000;
+  until.tv_nsec += (timeoutMs % 1000) * 1000000L;
+  if (until.tv_nsec >= 1000000000L)
+  {
+    until.tv_sec++;
+    until.tv_nsec -= 1000000000L;
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  if (pool->count == 0)
+    pool->stalls++;
+  while (pool->count == 0 && status == 0)
+    status = pthread_cond_timedwait(&pool->changed, &pool->lock, &until);
+  if (pool->count == 0)
+  {
+    pthread_mutex_unlock(&pool->lock);
+    errno = ETIMEDOUT;
+    return -1;
+  }
+  serial = pool->ready[pool->head];
+  pool->head = (pool->head + 1) % pool->capacity;
+  pool->count--;
+  pthread_cond_broadcast(&pool->changed);  // a refill thread may start
+  pthread_mutex_unlock(&pool->lock);
+
+  // The serial left the ring under the lock, so no other take has it
+  poolPath(pool, "ready", serial, readyPath);
+  poolPath(pool, "issued", serial, path);
+  if (rename(readyPath, path) < 0)
+    return -1;
+  pthread_mutex_lock(&pool->lock);
+  pool->issued++;
+  pthread_mutex_unlock(&pool->lock);
+  return 0;
+}
+
+/*********************************************************************
+ ** poolStats
+ ** Description: Writes the pool's counters to text as one line of
+ ** name=value pairs
+ ** Parameters: struct padPool* pool, char* text, size_t size
+ *********************************************************************/
+static inline void poolStats(struct padPool* pool, char* text, size_t size)
+{
+  pthread_mutex_lock(&pool->lock);
+  snprintf(text, size, "level=%d capacity=%d filling=%d symbols=%ld "
+           "issued=%lu generated=%lu stalls=%lu failures=%lu\n",
+           pool->count, pool->capacity, pool->filling, pool->segmentSymbols,
+           pool->issued, pool->generated, pool->stalls, pool->failures);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+#endif
@@ -0,0 +1,706 @@
+/*********************************************************************
+ ** Program Filename: otp_proxy.c
+ ** Author: Peter Nguyen
+ ** Date: 10/19/26
+ ** CS 344-400, Program 4
+ ** Description: Front end that spreads requests over several
+ ** otp_enc_d or otp_dec_d instances (backends), so capacity scales
+ ** by starting more of them. Clients connect to it as to a daemon,
+ ** legacy protocol included: it answers with the identifier of the
+ ** backend it picked, redirects the client to a port of its own and
+ ** relays the request and the response.
+ ** Each request goes to the healthy backend with the fewest requests
+ ** in flight. Health is checked passively: a backend that refuses a
+ ** connection or breaks off the handshake is skipped for
+ ** HEALTH_RETRY_MS, then tried again, and one that reports busy is
+ ** skipped for that request only. If every backend is down or busy
+ ** the client gets the busy identifier and backs off as usual.
+ ** With -k the backends must run with -k too: their redirected
+ ** connections are kept in a pool per backend and reused, which
+ ** saves two connects and a fork per request.
+ ** The relay copies the request through without parsing it and only
+ ** follows the response, plain (size, data) or framed (frames up to
+ ** the empty one), to know when the backend connection is free.
+ ** Usage: otp_proxy [-c maxClients] [-k] [-v] port backend...
+ ** where each backend is [host:]port
+ *********************************************************************/
+
+#define _GNU_SOURCE  // accept4
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "otp_net.h"
+#include "otp_frame.h"
+
+const int BUSY_ID = 3;                // identifier of an overloaded daemon
+const int DEFAULT_MAX_CLIENTS = 256;  // sessions relayed at once
+const int POOL_SIZE = 64;             // idle connections kept per backend
+const int CONNECT_MS = 1000;          // to a backend, per connect
+const int HANDSHAKE_MS = 2000;        // for a backend's identifier and port
+const int HEALTH_RETRY_MS = 1000;     // a failed backend is skipped this long
+const int CLIENT_TIMEOUT = 10000;     // ms a relay may go without progress
+#define MAX_BACKENDS 64
+#define RELAY_BUFFER 65536            // bytes buffered in each direction
+
+// A daemon requests are spread over
+struct backend
+{
+  struct sockaddr_in addr;
+  char name[48];       // host:port, for messages
+  int identifier,      // sent by its handshake, 0 until the first one
+      inFlight,        // requests being relayed to it
+      failures,        // consecutive failed connects or handshakes
+      idleCount;
+  int* idle;           // pooled connections (-k)
+  long downUntil;      // skipped until then after a failure
+};
+
+// Bytes on their way from one socket to the other
+struct relayPipe
+{
+  uint8_t data[RELAY_BUFFER];
+  size_t start,
+         end;
+};
+
+// Where the relay is in the response, and what it learned of the request
+struct relayState
+{
+  uint8_t first[4],      // first word of the request
+          head[8];       // size, or frame length and sequence
+  size_t firstHave,
+         headHave,
+         skip;           // response bytes left before the next header
+  int framed,            // request had FRAME_FLAG_MAC
+      last,              // the bytes being skipped end the response
+      complete;
+};
+
+pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+struct backend backends[MAX_BACKENDS];
+int backendCount = 0,
+    activeClients = 0,
+    nextStart = 0,       // rotates the tie break between equal backends
+    keepAlive = 0,
+    verbose = 0;
+
+// Function prototypes
+void error(const char *msg);
+int parseBackend(const char* spec, struct backend* target);
+void* serveSession(void* arg);
+struct backend* pickBackend(char* tried);
+int openBackend(struct backend* target);
+void releaseBackend(struct backend* target, int sockfd, int reusable);
+void markDown(struct backend* target, const char* why);
+void markUp(struct backend* target, int identifier);
+int redirectClient(int clientfd);
+int relay(int clientfd, int backendfd);
+void relayFollowRequest(struct relayState* state, const uint8_t* data,
+                        size_t n);
+void relayFollowResponse(struct relayState* state, const uint8_t* data,
+                         size_t n);
+void rejectClient(int clientfd);
+
+int main(int argc, char *argv[])
+{
+  int sockfd,
+      clientfd,
+      option,
+      reuse = 1,
+      maxClients = DEFAULT_MAX_CLIENTS;
+  struct sockaddr_in serv_addr;
+  pthread_attr_t attr;
+  pthread_t thread;
+
+  while ((option = getopt(argc, argv, "c:kv")) != -1)
+  {
+    switch (option)
+    {
+      case 'c': maxClients = atoi(optarg); break;
+      case 'k': keepAlive = 1; break;
+      case 'v': verbose = 1; break;
+      default:
+        fprintf(stderr, "usage: %s [-c maxClients] [-k] [-v] port "
+                "[host:]port...\n", argv[0]);
+        exit(1);
+    }
+  }
+  if (argc - optind < 2)
+  {
+    fprintf(stderr, "ERROR, need a port and at least one backend\n");
+    exit(1);
+  }
+  if (argc - optind - 1 > MAX_BACKENDS || maxClients < 1)
+  {
+    fprintf(stderr, "ERROR, at most %d backends and 1 client or more\n",
+            MAX_BACKENDS);
+    exit(1);
+  }
+  for (option = optind + 1; option < argc; option++)
+  {
+    if (parseBackend(argv[option], &backends[backendCount]) < 0)
+    {
+      fprintf(stderr, "ERROR, bad backend %s\n", argv[option]);
+      exit(1);
+    }
+    backendCount++;
+  }
+
+  // A client or backend that hangs up mid-write must not kill the proxy
+  signal(SIGPIPE, SIG_IGN);
+
+  // Open the socket
+  sockfd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (sockfd < 0)
+    error("ERROR opening socket");
+  setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  bzero((char *) &serv_addr, sizeof(serv_addr));
+  serv_addr.sin_family = AF_INET;
+  serv_addr.sin_port = htons(atoi(argv[optind]));
+  serv_addr.sin_addr.s_addr = INADDR_ANY;
+  if (bind(sockfd, (struct sockaddr *) &serv_addr, sizeof(serv_addr)) < 0)
+    error("ERROR on binding");
+  listen(sockfd, DEFAULT_MAX_CLIENTS);
+
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+  // One thread per session; the pool and the counters are shared
+  while (1)
+  {
+    clientfd = accept4(sockfd, NULL, NULL, SOCK_CLOEXEC);
+    if (clientfd < 0)
+    {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      error("ERROR on accept");
+    }
+
+    pthread_mutex_lock(&poolLock);
+    option = activeClients < maxClients;
+    if (option)
+      activeClients++;
+    pthread_mutex_unlock(&poolLock);
+    if (!option)
+    {
+      rejectClient(clientfd);
+      continue;
+    }
+
+    if (pthread_create(&thread, &attr, serveSession,
+                       (void*) (intptr_t) clientfd) != 0)
+    {
+      perror("ERROR starting session");
+      rejectClient(clientfd);
+      pthread_mutex_lock(&poolLock);
+      activeClients--;
+      pthread_mutex_unlock(&poolLock);
+    }
+  }
+
+  return 0;
+}
+
+/*********************************************************************
+ ** parseBackend
+ ** Description: Fills target from spec, "port" for this host or
+ ** "host:port" with a dotted IPv4 host. Returns 0, or -1 if spec is
+ ** malformed or memory runs out.
+ ** Parameters: const char* spec, struct backend* target
+ *********************************************************************/
+int parseBackend(const char* spec, struct backend* target)
+{
+  char host[32];
+  const char* colon = strrchr(spec, ':');
+  char* end;
+  long port;
+
+  memset(target, 0, sizeof(*target));
+  target->addr.sin_family = AF_INET;
+  target->addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (colon != NULL)
+  {
+    if (colon - spec >= (long) sizeof(host))
+      return -1;
+    memcpy(host, spec, colon - spec);
+    host[colon - spec] = '\0';
+    if (inet_pton(AF_INET, host, &target->addr.sin_addr) != 1)
+      return -1;
+    spec = colon + 1;
+  }
+  port = strtol(spec, &end, 10);
+  if (end == spec || *end != '\0' || port < 1 || port > 65535)
+    return -1;
+  target->addr.sin_port = htons(port);
+  inet_ntop(AF_INET, &target->addr.sin_addr, host, sizeof(host));
+  snprintf(target->name, sizeof(target->name), "%s:%ld", host, port);
+
+  target->idle = malloc(sizeof(int) * POOL_SIZE);
+  return target->idle == NULL ? -1 : 0;
+}
+
+/*********************************************************************
+ ** serveSession
+ ** Description: Thread body for one client. Gets a connection to the
+ ** least loaded backend that answers, hands the client its
+ ** identifier, redirects the client to a port of the proxy and
+ ** relays the request. The backend connection goes back to the pool
+ ** if the response was relayed in full.
+ ** Parameters: void* arg, the client socket
+ *********************************************************************/
+void* serveSession(void* arg)
+{
+  int clientfd = (int) (intptr_t) arg,
+      datafd,
+      backendfd = -1,
+      convertedNum,
+      done = 0;
+  char tried[MAX_BACKENDS];
+  struct backend* target = NULL;
+
+  // Try backends in order of load until one hands over a connection
+  memset(tried, 0, sizeof(tried));
+  while (backendfd < 0 && (target = pickBackend(tried)) != NULL)
+  {
+    backendfd = openBackend(target);
+    if (backendfd < 0)
+      releaseBackend(target, -1, 0);
+  }
+
+  if (backendfd < 0)
+    rejectClient(clientfd);
+  else
+  {
+    convertedNum = htonl(target->identifier);
+    datafd = -1;
+    if (writeFull(clientfd, &convertedNum, sizeof(convertedNum),
+                  netDeadline(CLIENT_TIMEOUT)) == 0)
+      datafd = redirectClient(clientfd);
+    if (datafd >= 0)
+    {
+      done = relay(datafd, backendfd) == 0;
+      close(datafd);
+    }
+    releaseBackend(target, backendfd, done);
+    close(clientfd);
+  }
+
+  pthread_mutex_lock(&poolLock);
+  activeClients--;
+  pthread_mutex_unlock(&poolLock);
+  return NULL;
+}
+
+/*********************************************************************
+ ** pickBackend
+ ** Description: Returns the backend with the fewest requests in
+ ** flight among those that are not down and not yet in tried, and
+ ** counts the request against it, or NULL if none is left. Ties go
+ ** round robin.
+ ** Parameters: char* tried, one flag per backend
+ *********************************************************************/
+struct backend* pickBackend(char* tried)
+{
+  struct backend* best = NULL;
+  long now = netNowMs();
+  int index,
+      slot;
+
+  pthread_mutex_lock(&poolLock);
+  for (index = 0; index < backendCount; index++)
+  {
+    slot = (nextStart + index) % backendCount;
+    if (tried[slot] || backends[slot].downUntil > now)
+      continue;
+    if (best == NULL || backends[slot].inFlight < best->inFlight)
+      best = &backends[slot];
+  }
+  if (best != NULL)
+  {
+    best->inFlight++;
+    tried[best - backends] = 1;
+    nextStart = (best - backends + 1) % backendCount;
+  }
+  pthread_mutex_unlock(&poolLock);
+  return best;
+}
+
+/*********************************************************************
+ ** openBackend
+ ** Description: Returns a connection to target's request port: an
+ ** idle pooled one that is still open, or a new one through the
+ ** daemon handshake (identifier, then redirect). Marks target down
+ ** if it cannot be reached. Returns -1 if it is down or busy.
+ ** Parameters: struct backend* target
+ *********************************************************************/
+int openBackend(struct backend* target)
+{
+  int sockfd,
+      receivedNum,
+      identifier;
+  long deadline;
+  struct sockaddr_in addr = target->addr;
+  struct pollfd check;
+
+  // Pooled connections the backend has closed since read as ready
+  pthread_mutex_lock(&poolLock);
+  while (target->idleCount > 0)
+  {
+    check.fd = target->idle[--target->idleCount];
+    check.events = POLLIN;
+    if (poll(&check, 1, 0) == 0)
+    {
+      pthread_mutex_unlock(&poolLock);
+      return check.fd;
+    }
+    close(check.fd);
+  }
+  pthread_mutex_unlock(&poolLock);
+
+  sockfd = connectTimeout(&addr, CONNECT_MS);
+  if (sockfd < 0)
+  {
+    markDown(target, "connect failed");
+    return -1;
+  }
+  deadline = netDeadline(HANDSHAKE_MS);
+  if (readFull(sockfd, &receivedNum, sizeof(receivedNum), deadline) < 0)
+  {
+    close(sockfd);
+    markDown(target, "no identifier");
+    return -1;
+  }
+  identifier = ntohl(receivedNum);
+  if (identifier == BUSY_ID)
+  {
+    close(sockfd);
+    return -1;  // alive, just full: only this request goes elsewhere
+  }
+  if (readFull(sockfd, &receivedNum, sizeof(receivedNum), deadline) < 0)
+  {
+    close(sockfd);
+    markDown(target, "no redirect port");
+    return -1;
+  }
+  close(sockfd);
+
+  // Follow the redirect, as a client would
+  addr.sin_port = htons(ntohl(receivedNum));
+  sockfd = connectTimeout(&addr, CONNECT_MS);
+  if (sockfd < 0)
+  {
+    markDown(target, "redirect failed");
+    return -1;
+  }
+  markUp(target, identifier);
+  return sockfd;
+}
+
+/*********************************************************************
+ ** releaseBackend
+ ** Description: Ends a request on target. A connection whose
+ ** response was relayed in full is pooled under -k (closed if the
+ ** pool is full), any other is closed, as the backend's position in
+ ** the protocol is unknown. Pass -1 if there is no connection.
+ ** Parameters: struct backend* target, int sockfd, int reusable
+ *********************************************************************/
+void releaseBackend(struct backend* target, int sockfd, int reusable)
+{
+  pthread_mutex_lock(&poolLock);
+  target->inFlight--;
+  if (sockfd >= 0 && reusable && keepAlive && target->idleCount < POOL_SIZE)
+  {
+    target->idle[target->idleCount++] = sockfd;
+    sockfd = -1;
+  }
+  pthread_mutex_unlock(&poolLock);
+  if (sockfd >= 0)
+    close(sockfd);
+}
+
+/*********************************************************************
+ ** markDown
+ ** Description: Records a failed connect or handshake: target is
+ ** skipped for HEALTH_RETRY_MS and its pooled connections are closed
+ ** Parameters: struct backend* target, const char* why
+ *********************************************************************/
+void markDown(struct backend* target, const char* why)
+{
+  pthread_mutex_lock(&poolLock);
+  target->failures++;
+  target->downUntil = netNowMs() + HEALTH_RETRY_MS;
+  while (target->idleCount > 0)
+    close(target->idle[--target->idleCount]);
+  pthread_mutex_unlock(&poolLock);
+  if (verbose)
+    fprintf(stderr, "backend %s down (%s), retry in %d ms\n", target->name,
+            why, HEALTH_RETRY_MS);
+}
+
+/*********************************************************************
+ ** markUp
+ ** Description: Records a completed handshake and the identifier
+ ** target sent, clearing its failures
+ ** Parameters: struct backend* target, int identifier
+ *********************************************************************/
+void markUp(struct backend* target, int identifier)
+{
+  int recovered;
+
+  pthread_mutex_lock(&poolLock);
+  recovered = target->failures > 0;
+  target->failures = 0;
+  target->identifier = identifier;
+  pthread_mutex_unlock(&poolLock);
+  if (verbose && recovered)
+    fprintf(stderr, "backend %s up\n", target->name);
+}
+
+/*********************************************************************
+ ** redirectClient
+ ** Description: Sends the client the port of a listener the kernel
+ ** picked for it, as the daemons do, and returns the socket of the
+ ** client's connection to it, or -1 if the client did not come back
+ ** within CLIENT_TIMEOUT
+ ** Parameters: int clientfd
+ *********************************************************************/
+int redirectClient(int clientfd)
+{
+  int sockfd,
+      newsockfd = -1,
+      convertedNum;
+  socklen_t len;
+  struct sockaddr_in serv_addr;
+
+  sockfd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (sockfd < 0)
+    return -1;
+  bzero((char *) &serv_addr, sizeof(serv_addr));
+  serv_addr.sin_family = AF_INET;
+  serv_addr.sin_port = 0;
+  serv_addr.sin_addr.s_addr = INADDR_ANY;
+  len = sizeof(serv_addr);
+  if (bind(sockfd, (struct sockaddr *) &serv_addr, sizeof(serv_addr)) < 0 ||
+      listen(sockfd, 1) < 0 ||
+      getsockname(sockfd, (struct sockaddr *) &serv_addr, &len) < 0)
+  {
+    close(sockfd);
+    return -1;
+  }
+
+  convertedNum = htonl(ntohs(serv_addr.sin_port));
+  if (writeFull(clientfd, &convertedNum, sizeof(convertedNum),
+                netDeadline(CLIENT_TIMEOUT)) == 0 &&
+      netWait(sockfd, POLLIN, netDeadline(CLIENT_TIMEOUT)) == 0)
+    newsockfd = accept4(sockfd, NULL, NULL, SOCK_CLOEXEC);
+  close(sockfd);
+  return newsockfd;
+}
+
+/*********************************************************************
+ ** relay
+ ** Description: Copies the request from clientfd to backendfd and the
+ ** response back, each direction through its own buffer, so neither
+ ** side is blocked while the other is writing. Returns 0 once the
+ ** whole response has reached the client, or -1 if either side hung
+ ** up or stalled for CLIENT_TIMEOUT first.
+ ** Parameters: int clientfd, int backendfd
+ *********************************************************************/
+int relay(int clientfd, int backendfd)
+{
+  struct relayPipe up,    // on the thread's stack, 128 KB in all
+                   down;
+  struct relayState state;
+  struct pollfd fds[2];
+  ssize_t count;
+  int status = -1,
+      noDelay = 1;
+
+  memset(&state, 0, sizeof(state));
+  up.start = up.end = 0;
+  down.start = down.end = 0;
+  // Pieces are passed on as they come: Nagle would hold back the last
+  // one until the delayed ACK, some 40 ms per request
+  setsockopt(clientfd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+  setsockopt(backendfd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+  fcntl(clientfd, F_SETFL, fcntl(clientfd, F_GETFL) | O_NONBLOCK);
+  fcntl(backendfd, F_SETFL, fcntl(backendfd, F_GETFL) | O_NONBLOCK);
+  fds[0].fd = clientfd;
+  fds[1].fd = backendfd;
+
+  while (!state.complete || down.start < down.end)
+  {
+    // Read a side only once what came from it has been passed on
+    fds[0].events = (up.end == 0 ? POLLIN : 0) |
+                    (down.start < down.end ? POLLOUT : 0);
+    fds[1].events = (down.end == 0 && !state.complete ? POLLIN : 0) |
+                    (up.start < up.end ? POLLOUT : 0);
+    count = poll(fds, 2, CLIENT_TIMEOUT);
+    if (count < 0 && errno == EINTR)
+      continue;
+    if (count <= 0)
+      break;
+    if ((fds[0].revents | fds[1].revents) & (POLLERR | POLLNVAL))
+      break;
+
+    if (fds[0].revents & (POLLIN | POLLHUP) && up.end == 0)
+    {
+      count = recv(clientfd, up.data, RELAY_BUFFER, 0);
+      if (count <= 0 && !(count < 0 && errno == EAGAIN))
+        break;  // the client gave up before the response was done
+      if (count > 0)
+      {
+        relayFollowRequest(&state, up.data, count);
+        up.end = count;
+      }
+    }
+    if (fds[1].revents & (POLLIN | POLLHUP) && down.end == 0)
+    {
+      count = recv(backendfd, down.data, RELAY_BUFFER, 0);
+      if (count <= 0 && !(count < 0 && errno == EAGAIN))
+        break;  // the backend failed the request
+      if (count > 0)
+      {
+        relayFollowResponse(&state, down.data, count);
+        down.end = count;
+      }
+    }
+
+    if (fds[1].revents & POLLOUT && up.start < up.end)
+    {
+      count = send(backendfd, up.data + up.start, up.end - up.start, 0);
+      if (count < 0 && errno != EAGAIN)
+        break;
+      if (count > 0)
+        up.start += count;
+    }
+    if (fds[0].revents & POLLOUT && down.start < down.end)
+    {
+      count = send(clientfd, down.data + down.start,
+                   down.end - down.start, 0);
+      if (count < 0 && errno != EAGAIN)
+        break;
+      if (count > 0)
+        down.start += count;
+    }
+    if (up.start == up.end)
+      up.start = up.end = 0;
+    if (down.start == down.end)
+      down.start = down.end = 0;
+  }
+
+  // Unsent request bytes mean the backend is mid-request: not reusable
+  if (state.complete && down.start == down.end && up.end == 0)
+    status = 0;
+  fcntl(backendfd, F_SETFL, fcntl(backendfd, F_GETFL) & ~O_NONBLOCK);
+  return status;
+}
+
+/*********************************************************************
+ ** relayFollowRequest
+ ** Description: Takes the first word of the request from the n bytes
+ ** at data, which tells whether the response will be framed
+ ** Parameters: struct relayState* state, const uint8_t* data, size_t n
+ *********************************************************************/
+void relayFollowRequest(struct relayState* state, const uint8_t* data,
+                        size_t n)
+{
+  uint32_t word;
+
+  while (n > 0 && state->firstHave < sizeof(state->first))
+  {
+    state->first[state->firstHave++] = *data++;
+    n--;
+    if (state->firstHave == sizeof(state->first))
+    {
+      memcpy(&word, state->first, sizeof(word));
+      word = ntohl(word);
+      state->framed = (word & FRAME_HEADER_BIT) && (word & FRAME_FLAG_MAC);
+    }
+  }
+}
+
+/*********************************************************************
+ ** relayFollowResponse
+ ** Description: Advances through the n response bytes at data and
+ ** sets state->complete at the end of the response: after the data
+ ** of a plain response, or after the tag of the empty frame
+ ** Parameters: struct relayState* state, const uint8_t* data, size_t n
+ *********************************************************************/
+void relayFollowResponse(struct relayState* state, const uint8_t* data,
+                         size_t n)
+{
+  size_t headSize = state->framed ? 8 : 4,
+         take;
+  uint32_t word;
+
+  while (n > 0 && !state->complete)
+  {
+    if (state->skip > 0)
+    {
+      take = n < state->skip ? n : state->skip;
+      state->skip -= take;
+      data += take;
+      n -= take;
+      state->complete = state->skip == 0 && state->last;
+      continue;
+    }
+
+    take = headSize - state->headHave;
+    if (take > n)
+      take = n;
+    memcpy(state->head + state->headHave, data, take);
+    state->headHave += take;
+    data += take;
+    n -= take;
+    if (state->headHave < headSize)
+      break;
+
+    // Plain: the size; framed: length, then sequence and data and tag
+    state->headHave = 0;
+    memcpy(&word, state->head, sizeof(word));
+    word = ntohl(word);
+    state->skip = state->framed ? (size_t) word + 8 : word;
+    state->last = !state->framed || word == 0;
+    state->complete = state->skip == 0 && state->last;
+  }
+}
+
+/*********************************************************************
+ ** rejectClient
+ ** Description: Sends the busy identifier so the client can back off
+ ** and retry, then closes the connection.
+ ** Parameters: int clientfd
+ *********************************************************************/
+void rejectClient(int clientfd)
+{
+  int convertedNum = htonl(BUSY_ID);
+
+  // Best effort: the client may already have given up
+  send(clientfd, &convertedNum, sizeof(convertedNum), MSG_DONTWAIT);
+  close(clientfd);
+}
+
+/*********************************************************************
+ ** error
+ ** Description: Displays an error message
+ ** Parameters: const char *msg
+ *********************************************************************/
+void error(const char *msg)
+{
+  perror(msg);
+  exit(1);
+}
@@ -0,0 +1,287 @@
+/*********************************************************************
+ ** Program Filename: otp_request.h
+ ** Author: Peter Nguyen
+ ** Date: 10/19/26
+ ** CS 344-400, Program 4
+ ** Description: Request parsing shared by otp_enc_d and otp_dec_d.
+ ** Everything a client sends after the redirect is read here: the
+ ** text size or extended header (otp_frame.h), the request ID, the
+ ** text and key of the plain protocol, and the frames of the framed
+ ** one. Every length is checked before anything is read into a
+ ** buffer, and text and key are checked for bytes outside the
+ ** alphabet before they reach a cipher engine. Failures return -1
+ ** with a message in the request instead of exiting, so otp_fuzz can
+ ** drive the same code the daemons run.
+ *********************************************************************/
+
+#ifndef OTP_REQUEST_H
+#define OTP_REQUEST_H
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include "otp_net.h"
+#include "otp_arena.h"
+#include "otp_cipher.h"
+#include "otp_frame.h"
+#include "otp_seed.h"
+
+struct otpRequest
+{
+  uint32_t flags;   // extended header flags, 0 for the plain protocol
+  uint64_t id;      // request ID, 0 without FRAME_FLAG_TRACE
+  char *text,       // plain protocol: text with its newline, and key,
+       *key;        // both NUL terminated; NULL for framed requests,
+                    // key NULL with FRAME_FLAG_SEED
+  int textLen,
+      keyLen;
+  struct seedDescriptor seed;  // FRAME_FLAG_SEED: the key to derive
+  char error[96];   // why the last call failed
+};
+
+/*********************************************************************
+ ** requestFail
+ ** Description: Stores a message in request and returns -1
+ ** Parameters: struct otpRequest* request, const char* format, ...
+ *********************************************************************/
+static inline int requestFail(struct otpRequest* request,
+                              const char* format, ...)
+{
+  va_list args;
+
+  va_start(args, format);
+  vsnprintf(request->error, sizeof(request->error), format, args);
+  va_end(args);
+  return -1;
+}
+
+/*********************************************************************
+ ** requestReadSize
+ ** Description: Reads a 4-byte size into size and checks that it is
+ ** between 1 and maxBytes. Returns 0, or -1 with request->error set.
+ ** Parameters: int sockfd, int maxBytes, const char* what, int* size,
+ ** struct otpRequest* request, long deadline
+ *********************************************************************/
+static inline int requestReadSize(int sockfd, int maxBytes,
+                                  const char* what, int* size,
+                                  struct otpRequest* request, long deadline)
+{
+  uint32_t word;
+
+  if (readFull(sockfd, &word, sizeof(word), deadline) < 0)
+    return requestFail(request, "reading %s size: %s", what,
+                       strerror(errno));
+  word = ntohl(word);
+  if (word == 0 || word > (uint32_t) maxBytes)
+    return requestFail(request, "%s of %u bytes exceeds limit of %d",
+                       what, word, maxBytes);
+  *size = word;
+  return 0;
+}
+
+/*********************************************************************
+ ** requestReadText
+ ** Description: Allocates size + 1 bytes from arena, reads size bytes
+ ** into them and terminates the string. Returns the buffer, or NULL
+ ** with request->error set.
+ ** Parameters: int sockfd, struct arena* arena, int size,
+ ** const char* what, struct otpRequest* request, long deadline
+ *********************************************************************/
+static inline char* requestReadText(int sockfd, struct arena* arena,
+                                    int size, const char* what,
+                                    struct otpRequest* request,
+                                    long deadline)
+{
+  char* buffer = arenaAlloc(arena, size + 1);
+
+  if (buffer == NULL)
+  {
+    requestFail(request, "allocating %d byte %s buffer", size, what);
+    return NULL;
+  }
+  if (readFull(sockfd, buffer, size, deadline) < 0)
+  {
+    requestFail(request, "reading %s: %s", what, strerror(errno));
+    return NULL;
+  }
+  buffer[size] = '\0';
+  return buffer;
+}
+
+/*********************************************************************
+ ** requestCheckSymbols
+ ** Description: Checks that the size bytes at buffer are all 'A'-'Z'
+ ** or space, but for a final newline where finalNewline is set (plain
+ ** text and key; frames have none). A newline anywhere else would be
+ ** enciphered differently by each engine. Returns 0, or -1 with
+ ** request->error naming the first bad byte and its offset.
+ ** Parameters: const void* buffer, size_t size, int finalNewline,
+ ** const char* what, struct otpRequest* request
+ *********************************************************************/
+static inline int requestCheckSymbols(const void* buffer, size_t size,
+                                      int finalNewline, const char* what,
+                                      struct otpRequest* request)
+{
+  size_t index;
+
+  if (finalNewline && size > 0 &&
+      ((const uint8_t*) buffer)[size - 1] == '\n')
+    size--;
+  index = symbolsFindInvalid(buffer, size);
+
+  if (index < size)
+    return requestFail(request, "bad character 0x%02x at offset %zu of %s",
+                       ((const uint8_t*) buffer)[index], index, what);
+  return 0;
+}
+
+/*********************************************************************
+ ** requestRead
+ ** Description: Reads the start of a request. A plain request is read
+ ** whole into arena buffers (text and key, neither over maxBytes, the
+ ** key at least as long as the text without its newline). With
+ ** FRAME_FLAG_SEED a seed descriptor takes the key's place and key is
+ ** NULL; the caller derives it. For a framed request only the
+ ** extended header is read and text is NULL; the caller reads the
+ ** frames with requestReadFrame. Returns 0, or -1 with request->error
+ ** set.
+ ** Parameters: int sockfd, int maxBytes, struct arena* arena,
+ ** struct otpRequest* request, long deadline
+ *********************************************************************/
+static inline int requestRead(int sockfd, int maxBytes, struct arena* arena,
+                              struct otpRequest* request, long deadline)
+{
+  uint32_t word;
+
+  memset(request, 0, sizeof(*request));
+
+  // The text size, or an extended header
+  if (readFull(sockfd, &word, sizeof(word), deadline) < 0)
+    return requestFail(request, "reading data size: %s", strerror(errno));
+  word = ntohl(word);
+  if (word & FRAME_HEADER_BIT)
+  {
+    if (word & ~(FRAME_HEADER_BIT | FRAME_FLAGS))
+      return requestFail(request, "unsupported header flags %#x",
+                         word & ~FRAME_HEADER_BIT);
+    request->flags = word & FRAME_FLAGS;
+    if ((word & FRAME_FLAG_SEED) && (word & FRAME_FLAG_MAC))
+      return requestFail(request, "seed keys are not supported in frames");
+    if ((word & FRAME_FLAG_TRACE) &&
+        frameRecvRequest(sockfd, &request->id, deadline) < 0)
+      return requestFail(request, "reading request ID: %s",
+                         strerror(errno));
+    if (word & FRAME_FLAG_MAC)
+      return 0;
+    if (requestReadSize(sockfd, maxBytes, "request", &request->textLen,
+                        request, deadline) < 0)
+      return -1;
+  }
+  else if (word == 0 || word > (uint32_t) maxBytes)
+    return requestFail(request, "request of %u bytes exceeds limit of %d",
+                       word, maxBytes);
+  else
+    request->textLen = word;
+
+  request->text = requestReadText(sockfd, arena, request->textLen, "text",
+                                  request, deadline);
+  if (request->text == NULL ||
+      requestCheckSymbols(request->text, request->textLen, 1, "text",
+                          request) < 0)
+    return -1;
+
+  if (request->flags & FRAME_FLAG_SEED)
+  {
+    if (seedRecvDescriptor(sockfd, &request->seed, deadline) < 0)
+      return requestFail(request, "reading seed descriptor: %s",
+                         strerror(errno));
+    return 0;
+  }
+  if (requestReadSize(sockfd, maxBytes, "key", &request->keyLen, request,
+                      deadline) < 0)
+    return -1;
+  if (request->keyLen < request->textLen - 1)
+    return requestFail(request, "key of %d bytes is too short",
+                       request->keyLen);
+  request->key = requestReadText(sockfd, arena, request->keyLen, "key",
+                                 request, deadline);
+  if (request->key == NULL)
+    return -1;
+  return requestCheckSymbols(request->key, request->keyLen, 1, "key",
+                             request);
+}
+
+/*********************************************************************
+ ** requestDeriveKey
+ ** Description: For a FRAME_FLAG_SEED request, expands the key its
+ ** descriptor names from seed (NULL when the daemon has none) into
+ ** an arena buffer as long as the text without its newline. Returns
+ ** 0, or -1 with request->error set.
+ ** Parameters: struct otpRequest* request, const struct seedKey* seed,
+ ** struct arena* arena
+ *********************************************************************/
+static inline int requestDeriveKey(struct otpRequest* request,
+                                   const struct seedKey* seed,
+                                   struct arena* arena)
+{
+  if (seed == NULL)
+    return requestFail(request, "no seed loaded for seed descriptor");
+  if (request->seed.id != seed->id)
+    return requestFail(request, "unknown seed %016llx",
+                       (unsigned long long) request->seed.id);
+  request->keyLen = request->textLen - 1;
+  request->key = arenaAlloc(arena, request->keyLen + 1);
+  if (request->key == NULL)
+    return requestFail(request, "allocating %d byte key buffer",
+                       request->keyLen);
+  if (seedExpand(seed, request->seed.segment, request->seed.offset,
+                 (uint8_t*) request->key, request->keyLen) < 0)
+    return requestFail(request, "segment %llu offset %llu is out of range",
+                       (unsigned long long) request->seed.segment,
+                       (unsigned long long) request->seed.offset);
+  request->key[request->keyLen] = '\0';
+  return 0;
+}
+
+/*********************************************************************
+ ** requestReadFrame
+ ** Description: Reads one client frame: its header, which must carry
+ ** sequence and at most limit bytes, then the text, the key with its
+ ** FRAME_KEY_EXTRA MAC symbols, and the tag. text must hold limit
+ ** bytes and key limit + FRAME_KEY_EXTRA. Text and key must be
+ ** symbols; the tag is not checked.
+ ** Returns 0, or -1 with request->error set.
+ ** Parameters: int sockfd, uint32_t sequence, uint32_t limit,
+ ** struct frameHeader* frame, uint8_t* text, uint8_t* key,
+ ** uint64_t* tag, struct otpRequest* request, long deadline
+ *********************************************************************/
+static inline int requestReadFrame(int sockfd, uint32_t sequence,
+                                   uint32_t limit, struct frameHeader* frame,
+                                   uint8_t* text, uint8_t* key,
+                                   uint64_t* tag, struct otpRequest* request,
+                                   long deadline)
+{
+  if (frameRecvHeader(sockfd, frame, deadline) < 0)
+    return requestFail(request, "reading frame header: %s",
+                       strerror(errno));
+  if (frame->sequence != sequence || frame->length > limit)
+    return requestFail(request, "bad frame %u of %u bytes, expected "
+                       "frame %u", frame->sequence, frame->length,
+                       sequence);
+  if (readFull(sockfd, text, frame->length, deadline) < 0 ||
+      readFull(sockfd, key, frame->length + FRAME_KEY_EXTRA, deadline) < 0 ||
+      frameRecvTag(sockfd, tag, deadline) < 0)
+    return requestFail(request, "reading frame %u: %s", sequence,
+                       strerror(errno));
+  if (requestCheckSymbols(text, frame->length, 0, "frame text",
+                          request) < 0 ||
+      requestCheckSymbols(key, frame->length + FRAME_KEY_EXTRA, 0,
+                          "frame key", request) < 0)
+    return -1;
+  return 0;
+}
+
+#endif
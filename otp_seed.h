@@ -0,0 +1,526 @@
+/*********************************************************************
+ ** Program Filename: otp_seed.h
+ ** Author: Peter Nguyen
+ ** Date: 10/19/26
+ ** CS 344-400, Program 4
+ ** Description: Seed-derived pad segments, an optional mode for when
+ ** storing and shipping multi-GB pads costs too much.
+ **
+ ** NOT A ONE-TIME PAD. Symbols derived from a seed are only as strong
+ ** as ChaCha20 and the secrecy of the 32-byte seed: the scheme is a
+ ** stream cipher, computationally secure at best, and loses the
+ ** information-theoretic guarantee of a keygen pad. Use real pads
+ ** where that guarantee is the point.
+ **
+ ** A seed file (keygen -s) holds a 256-bit ChaCha20 key. Segment s,
+ ** page p of a seed is the keystream under nonce (p, s) with counter
+ ** 0, 1, ..., mapped to symbols by rejection: bytes below 243 give
+ ** byte % 27, the rest are skipped, so every symbol is uniform. Each
+ ** page holds SEED_PAGE_SYMBOLS symbols, which gives random access to
+ ** any offset at the cost of at most one page. A request then names
+ ** its key with a 24-byte descriptor (seed ID, segment, offset)
+ ** instead of carrying it, and the daemon, which holds the same
+ ** seed, expands it. Eight ChaCha20 blocks are computed at once with
+ ** GCC vector extensions (AVX2 when the CPU has it), and the mapping
+ ** is done 16 bytes at a time with SSSE3 shuffles.
+ *********************************************************************/
+
+#ifndef OTP_SEED_H
+#define OTP_SEED_H
+
+#include <endian.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include "otp_net.h"
+#include "otp_cipher.h"
+
+#define SEED_KEY_BYTES 32
+#define SEED_PAGE_SYMBOLS 4096
+#define SEED_LANES 8                         // blocks computed together
+#define SEED_BATCH_BYTES (SEED_LANES * 64)
+#define SEED_ID_SEGMENT UINT64_MAX           // reserved for the seed ID
+#define SEED_MAX_OFFSET ((uint64_t) SEED_PAGE_SYMBOLS << 32)
+#define SEED_FILE_TAG "OTPSEED "             // then 64 hex digits
+#define SEED_ACCEPT 243                      // 9 * 27: bytes mapped evenly
+
+typedef uint32_t seedVector __attribute__((vector_size(4 * SEED_LANES)));
+
+struct seedKey
+{
+  uint32_t key[8];
+  uint64_t id;   // names the seed in descriptors without revealing it
+  uint8_t symbols[256];   // keystream byte to symbol, below SEED_ACCEPT
+  void (*blocks)(const uint32_t input[16], uint8_t* out);
+  size_t (*map)(const struct seedKey* seed, const uint8_t* in,
+                uint8_t* out);
+};
+
+// Indices of the accepted bytes of 8, by mask of the rejected ones
+static uint8_t seedPackTable[256][8];
+
+// Sent in place of the key by a client using FRAME_FLAG_SEED
+struct seedDescriptor
+{
+  uint64_t id,
+           segment,
+           offset;   // symbol offset into the segment
+};
+
+/*********************************************************************
+ ** seedRotate
+ ** Description: Rotates a 32-bit word left by count
+ ** Parameters: uint32_t word, int count
+ *********************************************************************/
+static inline uint32_t seedRotate(uint32_t word, int count)
+{
+  return word << count | word >> (32 - count);
+}
+
+#define SEED_QUARTER(a, b, c, d, rotate)             \
+  do                                                 \
+  {                                                  \
+    a += b; d ^= a; d = rotate(d, 16);               \
+    c += d; b ^= c; b = rotate(b, 12);               \
+    a += b; d ^= a; d = rotate(d, 8);                \
+    c += d; b ^= c; b = rotate(b, 7);                \
+  } while (0)
+
+#define SEED_DOUBLE_ROUND(x, rotate)                              \
+  do                                                              \
+  {                                                               \
+    SEED_QUARTER(x[0], x[4], x[8], x[12], rotate);                \
+    SEED_QUARTER(x[1], x[5], x[9], x[13], rotate);                \
+    SEED_QUARTER(x[2], x[6], x[10], x[14], rotate);               \
+    SEED_QUARTER(x[3], x[7], x[11], x[15], rotate);               \
+    SEED_QUARTER(x[0], x[5], x[10], x[15], rotate);               \
+    SEED_QUARTER(x[1], x[6], x[11], x[12], rotate);               \
+    SEED_QUARTER(x[2], x[7], x[8], x[13], rotate);                \
+    SEED_QUARTER(x[3], x[4], x[9], x[14], rotate);                \
+  } while (0)
+
+/*********************************************************************
+ ** seedBlock
+ ** Description: Computes one 64-byte ChaCha20 block (RFC 8439) of the
+ ** state in input; the reference for seedBlocks
+ ** Parameters: const uint32_t input[16], uint8_t out[64]
+ *********************************************************************/
+static inline void seedBlock(const uint32_t input[16], uint8_t out[64])
+{
+  uint32_t x[16],
+           word;
+  int index;
+
+  memcpy(x, input, sizeof(x));
+  for (index = 0; index < 10; index++)
+    SEED_DOUBLE_ROUND(x, seedRotate);
+  for (index = 0; index < 16; index++)
+  {
+    word = htole32(x[index] + input[index]);
+    memcpy(out + 4 * index, &word, 4);
+  }
+}
+
+#define SEED_ROTATE_VECTOR(v, count) ((v) << (count) | (v) >> (32 - (count)))
+
+/*********************************************************************
+ ** seedBlocksBody
+ ** Description: Computes SEED_LANES consecutive ChaCha20 blocks,
+ ** counters input[12] onwards, one block per vector lane, and stores
+ ** them in order at out. Inlined into each target-specific wrapper.
+ ** Parameters: const uint32_t input[16], uint8_t* out
+ *********************************************************************/
+__attribute__((always_inline))
+static inline void seedBlocksBody(const uint32_t input[16], uint8_t* out)
+{
+  seedVector x[16],
+             start[16];
+  uint32_t word;
+  int index,
+      lane;
+
+  for (index = 0; index < 16; index++)
+    for (lane = 0; lane < SEED_LANES; lane++)
+      start[index][lane] = input[index] + (index == 12 ? lane : 0);
+  memcpy(x, start, sizeof(x));
+  for (index = 0; index < 10; index++)
+    SEED_DOUBLE_ROUND(x, SEED_ROTATE_VECTOR);
+
+  for (index = 0; index < 16; index++)
+    x[index] += start[index];
+  for (lane = 0; lane < SEED_LANES; lane++)
+    for (index = 0; index < 16; index++)
+    {
+      word = htole32(x[index][lane]);
+      memcpy(out + 64 * lane + 4 * index, &word, 4);
+    }
+}
+
+static inline void seedBlocksGeneric(const uint32_t input[16], uint8_t* out)
+{
+  seedBlocksBody(input, out);
+}
+
+#ifdef OTP_CIPHER_X86
+__attribute__((target("avx2")))
+static inline void seedBlocksAvx2(const uint32_t input[16], uint8_t* out)
+{
+  seedBlocksBody(input, out);
+}
+#endif
+
+/*********************************************************************
+ ** seedMapScalar
+ ** Description: Maps the SEED_BATCH_BYTES keystream bytes at in to
+ ** symbols at out, skipping rejected bytes, and returns how many it
+ ** kept. Stores one byte past each kept one, so out needs
+ ** SEED_BATCH_BYTES bytes of room. The reference for seedMapSsse3.
+ ** Parameters: const struct seedKey* seed, const uint8_t* in,
+ ** uint8_t* out
+ *********************************************************************/
+static inline size_t seedMapScalar(const struct seedKey* seed,
+                                   const uint8_t* in, uint8_t* out)
+{
+  size_t count = 0;
+  int index;
+
+  for (index = 0; index < SEED_BATCH_BYTES; index++)
+  {
+    out[count] = seed->symbols[in[index]];
+    count += in[index] < SEED_ACCEPT;
+  }
+  return count;
+}
+
+#ifdef OTP_CIPHER_X86
+/*********************************************************************
+ ** seedMapSsse3
+ ** Description: seedMapScalar 16 bytes at a time: reduces every byte
+ ** mod 27 by conditional subtraction of 216, 108, 54 and 27, then
+ ** packs each half's accepted symbols together with a shuffle from
+ ** seedPackTable. The scalar loop carries a dependency on its output
+ ** position through every byte; this one only through every 8.
+ ** Parameters: const struct seedKey* seed, const uint8_t* in,
+ ** uint8_t* out
+ *********************************************************************/
+__attribute__((target("ssse3,popcnt")))
+static inline size_t seedMapSsse3(const struct seedKey* seed,
+                                  const uint8_t* in, uint8_t* out)
+{
+  const __m128i bias = _mm_set1_epi8((char) 0x80),
+                limit = _mm_set1_epi8(SEED_ACCEPT - 1 - 0x80),
+                letters = _mm_set1_epi8('A'),
+                last = _mm_set1_epi8(26),
+                gap = _mm_set1_epi8('A' + 26 - ' '),
+                high = _mm_set1_epi8(8);
+  __m128i values,
+          symbols,
+          pack;
+  size_t count = 0;
+  unsigned rejected;
+  int index,
+      multiple;
+
+  (void) seed;
+  for (index = 0; index < SEED_BATCH_BYTES; index += 16)
+  {
+    values = _mm_loadu_si128((const __m128i*) (in + index));
+    rejected = _mm_movemask_epi8(
+        _mm_cmpgt_epi8(_mm_xor_si128(values, bias), limit));
+    for (multiple = 8 * 27; multiple >= 27; multiple /= 2)
+      values = _mm_min_epu8(values,
+          _mm_sub_epi8(values, _mm_set1_epi8((char) multiple)));
+    symbols = _mm_sub_epi8(_mm_add_epi8(values, letters),
+        _mm_and_si128(_mm_cmpeq_epi8(values, last), gap));
+
+    pack = _mm_loadl_epi64((const __m128i*) seedPackTable[rejected & 0xFF]);
+    _mm_storel_epi64((__m128i*) (out + count),
+                     _mm_shuffle_epi8(symbols, pack));
+    count += 8 - __builtin_popcount(rejected & 0xFF);
+    pack = _mm_add_epi8(high,
+        _mm_loadl_epi64((const __m128i*) seedPackTable[rejected >> 8]));
+    _mm_storel_epi64((__m128i*) (out + count),
+                     _mm_shuffle_epi8(symbols, pack));
+    count += 8 - __builtin_popcount(rejected >> 8);
+  }
+  return count;
+}
+#endif
+
+/*********************************************************************
+ ** seedState
+ ** Description: Fills a ChaCha20 input state for page of segment:
+ ** constants, key, counter 0 and nonce (page, segment)
+ ** Parameters: const struct seedKey* seed, uint64_t segment,
+ ** uint32_t page, uint32_t input[16]
+ *********************************************************************/
+static inline void seedState(const struct seedKey* seed, uint64_t segment,
+                             uint32_t page, uint32_t input[16])
+{
+  input[0] = 0x61707865;  // "expand 32-byte k"
+  input[1] = 0x3320646e;
+  input[2] = 0x79622d32;
+  input[3] = 0x6b206574;
+  memcpy(input + 4, seed->key, sizeof(seed->key));
+  input[12] = 0;
+  input[13] = page;
+  input[14] = (uint32_t) segment;
+  input[15] = (uint32_t) (segment >> 32);
+}
+
+/*********************************************************************
+ ** seedPage
+ ** Description: Writes the SEED_PAGE_SYMBOLS symbols of one page to
+ ** out, which needs SEED_BATCH_BYTES bytes of slack after them: the
+ ** mapping stores every byte and only advances past accepted ones.
+ ** Parameters: const struct seedKey* seed, uint64_t segment,
+ ** uint32_t page, uint8_t* out
+ *********************************************************************/
+static inline void seedPage(const struct seedKey* seed, uint64_t segment,
+                            uint32_t page, uint8_t* out)
+{
+  uint32_t input[16];
+  uint8_t batch[SEED_BATCH_BYTES];
+  size_t filled = 0;
+
+  seedState(seed, segment, page, input);
+  while (filled < SEED_PAGE_SYMBOLS)
+  {
+    seed->blocks(input, batch);
+    input[12] += SEED_LANES;
+    filled += seed->map(seed, batch, out + filled);
+  }
+}
+
+/*********************************************************************
+ ** seedExpand
+ ** Description: Writes n symbols of segment, starting at symbol
+ ** offset, to out. Returns 0, or -1 with errno set to EINVAL if the
+ ** range is outside the segment or names the reserved one.
+ ** Parameters: const struct seedKey* seed, uint64_t segment,
+ ** uint64_t offset, uint8_t* out, size_t n
+ *********************************************************************/
+static inline int seedExpand(const struct seedKey* seed, uint64_t segment,
+                             uint64_t offset, uint8_t* out, size_t n)
+{
+  uint8_t page[SEED_PAGE_SYMBOLS + SEED_BATCH_BYTES];
+  size_t skip,
+         count;
+
+  if (segment == SEED_ID_SEGMENT || offset > SEED_MAX_OFFSET ||
+      n > SEED_MAX_OFFSET - offset)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  while (n > 0)
+  {
+    // Only the first and last pages are partly used
+    seedPage(seed, segment, offset / SEED_PAGE_SYMBOLS, page);
+    skip = offset % SEED_PAGE_SYMBOLS;
+    count = SEED_PAGE_SYMBOLS - skip;
+    if (count > n)
+      count = n;
+    memcpy(out, page + skip, count);
+    out += count;
+    offset += count;
+    n -= count;
+  }
+  return 0;
+}
+
+/*********************************************************************
+ ** seedSelfTest
+ ** Description: Checks seedBlock against the RFC 8439 section 2.3.2
+ ** test vector, the vector blocks against seedBlock and the symbol
+ ** map against seedMapScalar. Returns 0, or -1 if any disagrees.
+ ** Parameters: const struct seedKey* seed
+ *********************************************************************/
+static inline int seedSelfTest(const struct seedKey* seed)
+{
+  static const uint8_t expected[16] =
+  {
+    0x10, 0xf1, 0xe7, 0xe4, 0xd1, 0x3b, 0x59, 0x15,
+    0x50, 0x0f, 0xdd, 0x1f, 0xa3, 0x20, 0x71, 0xc4
+  };
+  uint32_t input[16];
+  uint8_t block[64],
+          batch[SEED_BATCH_BYTES],
+          mapped[SEED_BATCH_BYTES],
+          reference[SEED_BATCH_BYTES];
+  size_t count;
+  int index;
+
+  // Key 00 01 .. 1f, counter 1, nonce 00000009 0000004a 00000000
+  input[0] = 0x61707865;
+  input[1] = 0x3320646e;
+  input[2] = 0x79622d32;
+  input[3] = 0x6b206574;
+  for (index = 0; index < 8; index++)
+    input[4 + index] = 0x03020100 + 0x04040404 * index;
+  input[12] = 1;
+  input[13] = 0x09000000;
+  input[14] = 0x4a000000;
+  input[15] = 0;
+  seedBlock(input, block);
+  if (memcmp(block, expected, sizeof(expected)) != 0)
+    return -1;
+
+  seedState(seed, 1, 2, input);
+  input[12] = 0xFFFFFFFC;  // lanes wrap the counter
+  seed->blocks(input, batch);
+  for (index = 0; index < SEED_LANES; index++)
+  {
+    seedBlock(input, block);
+    if (memcmp(block, batch + 64 * index, 64) != 0)
+      return -1;
+    input[12]++;
+  }
+
+  for (index = 0; index < SEED_BATCH_BYTES; index++)
+    batch[index] = index * 167;  // every byte value, in no order
+  count = seedMapScalar(seed, batch, reference);
+  if (seed->map(seed, batch, mapped) != count ||
+      memcmp(mapped, reference, count) != 0)
+    return -1;
+  return 0;
+}
+
+/*********************************************************************
+ ** seedInit
+ ** Description: Sets up seed from its 32 key bytes: picks the vector
+ ** blocks and symbol map for this CPU, fills the map tables and
+ ** derives the seed ID from the reserved segment. Returns 0, or -1
+ ** with errno set to EIO if the self-test fails.
+ ** Parameters: struct seedKey* seed, const uint8_t key[SEED_KEY_BYTES]
+ *********************************************************************/
+static inline int seedInit(struct seedKey* seed,
+                           const uint8_t key[SEED_KEY_BYTES])
+{
+  uint32_t input[16];
+  uint8_t block[64];
+  uint64_t id;
+  int index,
+      count,
+      bit;
+
+  for (index = 0; index < 8; index++)
+  {
+    memcpy(&seed->key[index], key + 4 * index, 4);
+    seed->key[index] = le32toh(seed->key[index]);
+  }
+  for (index = 0; index < 256; index++)
+  {
+    seed->symbols[index] = symbolChar(index % 27);
+    for (count = 0, bit = 0; bit < 8; bit++)
+      if (!(index & 1 << bit))
+        seedPackTable[index][count++] = bit;
+  }
+  seed->blocks = seedBlocksGeneric;
+  seed->map = seedMapScalar;
+#ifdef OTP_CIPHER_X86
+  if (__builtin_cpu_supports("avx2"))
+    seed->blocks = seedBlocksAvx2;
+  if (__builtin_cpu_supports("ssse3") && __builtin_cpu_supports("popcnt"))
+    seed->map = seedMapSsse3;
+#endif
+  if (seedSelfTest(seed) < 0)
+  {
+    errno = EIO;
+    return -1;
+  }
+
+  seedState(seed, SEED_ID_SEGMENT, UINT32_MAX, input);
+  seedBlock(input, block);
+  memcpy(&id, block, sizeof(id));
+  seed->id = le64toh(id);
+  return 0;
+}
+
+/*********************************************************************
+ ** seedLoad
+ ** Description: Reads a seed file written by keygen -s: SEED_FILE_TAG
+ ** and 64 hex digits. Returns 0, or -1 with errno set (EINVAL if the
+ ** file is not a seed).
+ ** Parameters: struct seedKey* seed, const char* path
+ *********************************************************************/
+static inline int seedLoad(struct seedKey* seed, const char* path)
+{
+  uint8_t key[SEED_KEY_BYTES];
+  char text[sizeof(SEED_FILE_TAG) + 2 * SEED_KEY_BYTES + 1];
+  unsigned value;
+  FILE* filePtr;
+  int index;
+
+  filePtr = fopen(path, "r");
+  if (filePtr == NULL)
+    return -1;
+  if (fgets(text, sizeof(text), filePtr) == NULL)
+    text[0] = '\0';
+  fclose(filePtr);
+
+  if (strncmp(text, SEED_FILE_TAG, strlen(SEED_FILE_TAG)) != 0)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  for (index = 0; index < SEED_KEY_BYTES; index++)
+  {
+    if (sscanf(text + strlen(SEED_FILE_TAG) + 2 * index, "%2x", &value) != 1)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+    key[index] = value;
+  }
+  index = seedInit(seed, key);
+  memset(key, 0, sizeof(key));
+  return index;
+}
+
+/*********************************************************************
+ ** seedSendDescriptor
+ ** Description: Writes a descriptor as three 64-bit words, high word
+ ** first like tags. Returns 0, or -1 with errno set.
+ ** Parameters: int sockfd, const struct seedDescriptor* descriptor,
+ ** long deadline
+ *********************************************************************/
+static inline int seedSendDescriptor(int sockfd,
+                                     const struct seedDescriptor* descriptor,
+                                     long deadline)
+{
+  uint32_t words[6];
+
+  words[0] = htonl((uint32_t) (descriptor->id >> 32));
+  words[1] = htonl((uint32_t) descriptor->id);
+  words[2] = htonl((uint32_t) (descriptor->segment >> 32));
+  words[3] = htonl((uint32_t) descriptor->segment);
+  words[4] = htonl((uint32_t) (descriptor->offset >> 32));
+  words[5] = htonl((uint32_t) descriptor->offset);
+  return writeFull(sockfd, words, sizeof(words), deadline);
+}
+
+/*********************************************************************
+ ** seedRecvDescriptor
+ ** Description: Reads a descriptor written by seedSendDescriptor.
+ ** Returns 0, or -1 with errno set.
+ ** Parameters: int sockfd, struct seedDescriptor* descriptor,
+ ** long deadline
+ *********************************************************************/
+static inline int seedRecvDescriptor(int sockfd,
+                                     struct seedDescriptor* descriptor,
+                                     long deadline)
+{
+  uint32_t words[6];
+
+  if (readFull(sockfd, words, sizeof(words), deadline) < 0)
+    return -1;
+  descriptor->id = (uint64_t) ntohl(words[0]) << 32 | ntohl(words[1]);
+  descriptor->segment = (uint64_t) ntohl(words[2]) << 32 | ntohl(words[3]);
+  descriptor->offset = (uint64_t) ntohl(words[4]) << 32 | ntohl(words[5]);
+  return 0;
+}
+
+#endif
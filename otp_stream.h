@@ -0,0 +1,431 @@
+/*********************************************************************
+ ** Program Filename: otp_stream.h
+ ** Author: Peter Nguyen
+ ** Date: 10/19/26
+ ** CS 344-400, Program 4
+ ** Description: Pipelined framed exchange for the clients (-S). The
+ ** plain exchange reads the whole text and key, checks them, sends
+ ** them and only then waits for the answer, so a large request costs
+ ** disk + network + cipher time in sequence. Here three stages run
+ ** at once over a ring of STREAM_DEPTH frames:
+ **   reader thread: reads the next FRAME_CHUNK symbols of text and
+ **                  their pad slice, and checks both for bad bytes
+ **   sender thread: sends loaded frames with their request tags
+ **   caller:        receives each answer in place in the output batch
+ **                  (otp_output.h), authenticates it and commits it
+ ** A slot is reused only after its answer is authenticated, since
+ ** the response tag covers the text. The text file must be a single
+ ** line; its length is known from its size, so the pad slice can be
+ ** checked and journaled before anything is sent. A bad byte found
+ ** later stops the exchange, and the output may already hold the
+ ** result of the frames before it.
+ ** Programs using it need -pthread on C libraries older than glibc
+ ** 2.34.
+ *********************************************************************/
+
+#ifndef OTP_STREAM_H
+#define OTP_STREAM_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "otp_net.h"
+#include "otp_pad.h"
+#include "otp_frame.h"
+#include "otp_cipher.h"
+#include "otp_trace.h"
+#include "otp_output.h"
+
+#define STREAM_DEPTH 8  // frames read ahead of their answers
+
+struct streamSlot
+{
+  uint8_t text[FRAME_CHUNK],
+          key[FRAME_CHUNK + FRAME_KEY_EXTRA];
+  uint32_t length;
+};
+
+struct otpStream
+{
+  int textFd,
+      sockfd,
+      sendMs,
+      stop;              // set when any stage fails
+  off_t textLen,         // symbols of text, without the newline
+        position;        // text offset the reader loads next
+  struct padReader* pad;
+  struct outputSink* output;
+  const char *textPath,
+             *padPath,
+             *peer;      // daemon name for messages
+  unsigned long loaded,  // frames read and checked
+                sent,    // frames on the wire
+                done,    // frames answered and written
+                frames;  // FRAME_COUNT(textLen)
+  struct streamSlot* slots;
+  char error[160];       // why the exchange stopped
+  pthread_t reader,
+            sender;
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+};
+
+/*********************************************************************
+ ** streamFail
+ ** Description: Records the first failure and wakes every stage so
+ ** they stop. Takes the lock.
+ ** Parameters: struct otpStream* stream, const char* format, ...
+ *********************************************************************/
+static inline void streamFail(struct otpStream* stream,
+                              const char* format, ...)
+{
+  va_list args;
+
+  pthread_mutex_lock(&stream->lock);
+  if (!stream->stop)
+  {
+    va_start(args, format);
+    vsnprintf(stream->error, sizeof(stream->error), format, args);
+    va_end(args);
+    stream->stop = 1;
+  }
+  pthread_cond_broadcast(&stream->changed);
+  pthread_mutex_unlock(&stream->lock);
+}
+
+/*********************************************************************
+ ** streamWait
+ ** Description: Blocks until ready(stream) holds or the exchange is
+ ** stopping. Returns 0, or -1 if it is stopping.
+ ** Parameters: struct otpStream* stream,
+ ** int (*ready)(struct otpStream*)
+ *********************************************************************/
+static inline int streamWait(struct otpStream* stream,
+                             int (*ready)(struct otpStream*))
+{
+  int stop;
+
+  pthread_mutex_lock(&stream->lock);
+  while (!stream->stop && !ready(stream))
+    pthread_cond_wait(&stream->changed, &stream->lock);
+  stop = stream->stop;
+  pthread_mutex_unlock(&stream->lock);
+  return stop ? -1 : 0;
+}
+
+// Wait conditions: a free slot, a frame to send, an answer to expect
+static inline int streamSlotFree(struct otpStream* stream)
+{
+  return stream->loaded - stream->done < STREAM_DEPTH;
+}
+
+static inline int streamFrameLoaded(struct otpStream* stream)
+{
+  return stream->sent < stream->loaded;
+}
+
+static inline int streamFrameSent(struct otpStream* stream)
+{
+  return stream->done < stream->sent;
+}
+
+/*********************************************************************
+ ** streamAdvance
+ ** Description: Adds one to counter under the lock and wakes the
+ ** other stages
+ ** Parameters: struct otpStream* stream, unsigned long* counter
+ *********************************************************************/
+static inline void streamAdvance(struct otpStream* stream,
+                                 unsigned long* counter)
+{
+  pthread_mutex_lock(&stream->lock);
+  (*counter)++;
+  pthread_cond_broadcast(&stream->changed);
+  pthread_mutex_unlock(&stream->lock);
+}
+
+/*********************************************************************
+ ** streamRead
+ ** Description: Reader thread. Loads each frame's text and pad slice
+ ** into the next free slot and checks them for symbols (a newline
+ ** counts as bad, the file must be one line), reporting file offsets.
+ ** Parameters: void* arg (struct otpStream*)
+ *********************************************************************/
+static inline void* streamRead(void* arg)
+{
+  struct otpStream* stream = arg;
+  struct streamSlot* slot;
+  size_t keyLen,
+         index;
+  ssize_t count;
+  off_t padStart;
+  uint32_t filled;
+
+  while (stream->loaded < stream->frames)
+  {
+    if (streamWait(stream, streamSlotFree) < 0)
+      return NULL;
+    slot = &stream->slots[stream->loaded % STREAM_DEPTH];
+    slot->length = stream->textLen - stream->position < FRAME_CHUNK ?
+                   stream->textLen - stream->position : FRAME_CHUNK;
+
+    for (filled = 0; filled < slot->length; filled += count)
+    {
+      count = pread(stream->textFd, slot->text + filled,
+                    slot->length - filled, stream->position + filled);
+      if (count < 0 && errno == EINTR)
+        count = 0;
+      else if (count <= 0)
+      {
+        streamFail(stream, "reading %s: %s", stream->textPath,
+                   count < 0 ? strerror(errno) : "file shrank");
+        return NULL;
+      }
+    }
+    index = symbolsFindInvalid(slot->text, slot->length);
+    if (index < slot->length)
+    {
+      streamFail(stream, "bad character 0x%02x at offset %lld in %s",
+                 slot->text[index], (long long) (stream->position + index),
+                 stream->textPath);
+      return NULL;
+    }
+
+    // The pad was checked to be long enough before the exchange began
+    padStart = stream->pad->position;
+    keyLen = slot->length + FRAME_KEY_EXTRA;
+    if (padRead(stream->pad, (char*) slot->key, keyLen) != (ssize_t) keyLen)
+    {
+      streamFail(stream, "reading %s: %s", stream->padPath,
+                 strerror(errno ? errno : EIO));
+      return NULL;
+    }
+    index = symbolsFindInvalid(slot->key, keyLen);
+    if (index < keyLen)
+    {
+      streamFail(stream, "bad character 0x%02x at offset %lld in %s",
+                 slot->key[index], (long long) (padStart + index),
+                 stream->padPath);
+      return NULL;
+    }
+
+    stream->position += slot->length;
+    streamAdvance(stream, &stream->loaded);
+  }
+  return NULL;
+}
+
+/*********************************************************************
+ ** streamSend
+ ** Description: Sender thread. Sends each loaded frame with its
+ ** request tag, each within sendMs.
+ ** Parameters: void* arg (struct otpStream*)
+ *********************************************************************/
+static inline void* streamSend(void* arg)
+{
+  struct otpStream* stream = arg;
+  struct streamSlot* slot;
+  struct frameHeader frame;
+  uint64_t phase;
+
+  while (stream->sent < stream->frames)
+  {
+    if (streamWait(stream, streamFrameLoaded) < 0)
+      return NULL;
+    slot = &stream->slots[stream->sent % STREAM_DEPTH];
+    frame.length = slot->length;
+    frame.sequence = stream->sent;
+    phase = traceNow();
+    if (frameSend(stream->sockfd, &frame, slot->text, frame.length,
+                  slot->key, frame.length + FRAME_KEY_EXTRA,
+                  frameTag(&frame, slot->text, slot->key,
+                           slot->key + frame.length),
+                  netDeadline(stream->sendMs)) < 0)
+    {
+      streamFail(stream, "writing frame %u: %s", frame.sequence,
+                 strerror(errno));
+      return NULL;
+    }
+    traceSpan(TRACE_SEND, phase, frame.sequence);
+    streamAdvance(stream, &stream->sent);
+  }
+  return NULL;
+}
+
+/*********************************************************************
+ ** streamReceive
+ ** Description: Runs in the caller. Receives each answer within
+ ** recvMs of the frame being sent into the output batch, where it
+ ** is committed once authenticated against its slot. Returns 0 after
+ ** the empty frame's answer, or -1 once any stage has failed.
+ ** Parameters: struct otpStream* stream, int recvMs
+ *********************************************************************/
+static inline int streamReceive(struct otpStream* stream, int recvMs)
+{
+  struct streamSlot* slot;
+  struct frameHeader reply;
+  uint8_t* out;
+  uint64_t tag,
+           phase;
+  long deadline;
+
+  while (stream->done < stream->frames)
+  {
+    if (streamWait(stream, streamFrameSent) < 0)
+      return -1;
+    slot = &stream->slots[stream->done % STREAM_DEPTH];
+    phase = traceNow();
+    deadline = netDeadline(recvMs);
+
+    // The daemon closes the connection rather than answer a bad frame
+    if (frameRecvHeader(stream->sockfd, &reply, deadline) < 0)
+    {
+      streamFail(stream, "%s did not answer frame %lu: %s", stream->peer,
+                 stream->done, strerror(errno));
+      return -1;
+    }
+    if (reply.sequence != stream->done || reply.length != slot->length)
+    {
+      streamFail(stream, "%s answered frame %lu with frame %u",
+                 stream->peer, stream->done, reply.sequence);
+      return -1;
+    }
+    out = outputReserve(stream->output, FRAME_CHUNK + 1);
+    if (out == NULL)
+    {
+      streamFail(stream, "writing output: %s", strerror(errno));
+      return -1;
+    }
+    if (readFull(stream->sockfd, out, reply.length, deadline) < 0 ||
+        frameRecvTag(stream->sockfd, &tag, deadline) < 0)
+    {
+      streamFail(stream, "receiving frame %lu: %s", stream->done,
+                 strerror(errno));
+      return -1;
+    }
+    traceSpan(TRACE_RECEIVE, phase, reply.sequence);
+    if (frameTag(&reply, slot->text, out,
+                 slot->key + slot->length + MAC_KEY_SYMBOLS) != tag)
+    {
+      streamFail(stream, "frame %lu from %s failed authentication",
+                 stream->done, stream->peer);
+      return -1;
+    }
+
+    // The empty frame ends the text, and the output with a newline
+    if (reply.length == 0)
+      out[0] = '\n';
+    if (outputCommit(stream->output, reply.length > 0 ? reply.length
+                                                      : 1) < 0)
+    {
+      streamFail(stream, "writing output: %s", strerror(errno));
+      return -1;
+    }
+    streamAdvance(stream, &stream->done);
+  }
+  return 0;
+}
+
+/*********************************************************************
+ ** streamOpen
+ ** Description: Opens the text file at textPath for a streamed
+ ** exchange keyed from pad (read from padPath) and sets textLen to
+ ** its length without trailing newlines. The exchange will consume
+ ** FRAME_KEY_LENGTH(textLen) pad symbols. Returns 0, or -1 with
+ ** errno set.
+ ** Parameters: struct otpStream* stream, const char* textPath,
+ ** struct padReader* pad, const char* padPath
+ *********************************************************************/
+static inline int streamOpen(struct otpStream* stream, const char* textPath,
+                             struct padReader* pad, const char* padPath)
+{
+  struct stat info;
+  char last;
+
+  memset(stream, 0, sizeof(*stream));
+  stream->textPath = textPath;
+  stream->pad = pad;
+  stream->padPath = padPath;
+  stream->textFd = open(textPath, O_RDONLY | O_CLOEXEC);
+  if (stream->textFd < 0)
+    return -1;
+  if (fstat(stream->textFd, &info) < 0)
+  {
+    close(stream->textFd);
+    return -1;
+  }
+  stream->textLen = info.st_size;
+  while (stream->textLen > 0 &&
+         pread(stream->textFd, &last, 1, stream->textLen - 1) == 1 &&
+         last == '\n')
+    stream->textLen--;
+  posix_fadvise(stream->textFd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  stream->frames = FRAME_COUNT(stream->textLen);
+  return 0;
+}
+
+/*********************************************************************
+ ** streamExchange
+ ** Description: Runs the framed exchange of a streamOpen'd text on
+ ** sockfd, just after the extended header, adding the result,
+ ** newline terminated, to output. peer names the daemon in messages.
+ ** Closes the text file. Returns 0, or -1 with stream->error set.
+ ** Parameters: struct otpStream* stream, int sockfd,
+ ** struct outputSink* output, const char* peer, int sendMs,
+ ** int recvMs
+ *********************************************************************/
+static inline int streamExchange(struct otpStream* stream, int sockfd,
+                                 struct outputSink* output, const char* peer,
+                                 int sendMs, int recvMs)
+{
+  int status;
+
+  stream->sockfd = sockfd;
+  stream->output = output;
+  stream->peer = peer;
+  stream->sendMs = sendMs;
+  stream->slots = malloc(sizeof(struct streamSlot) * STREAM_DEPTH);
+  if (stream->slots == NULL)
+  {
+    snprintf(stream->error, sizeof(stream->error), "allocating frames");
+    return -1;
+  }
+  pthread_mutex_init(&stream->lock, NULL);
+  pthread_cond_init(&stream->changed, NULL);
+
+  status = pthread_create(&stream->reader, NULL, streamRead, stream);
+  if (status == 0)
+  {
+    status = pthread_create(&stream->sender, NULL, streamSend, stream);
+    if (status == 0)
+    {
+      streamReceive(stream, recvMs);
+
+      // A sender stuck on a full socket needs the connection shut
+      if (stream->stop)
+        shutdown(sockfd, SHUT_RDWR);
+      pthread_join(stream->sender, NULL);
+    }
+    else
+      streamFail(stream, "starting sender: %s", strerror(status));
+    pthread_join(stream->reader, NULL);
+  }
+  else
+    streamFail(stream, "starting reader: %s", strerror(status));
+
+  pthread_cond_destroy(&stream->changed);
+  pthread_mutex_destroy(&stream->lock);
+  free(stream->slots);
+  close(stream->textFd);
+  return stream->stop ? -1 : 0;
+}
+
+#endif
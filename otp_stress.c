@@ -0,0 +1,921 @@
+/*********************************************************************
+ ** Program Filename: otp_stress.c
+ ** Author: Peter Nguyen
+ ** Date: 10/19/26
+ ** CS 344-400, Program 4
+ ** Description: Load generator for otp_enc_d and otp_dec_d. Runs a
+ ** series of load levels, each with that many concurrent client
+ ** processes sending random requests, and checks every reply against
+ ** the scalar cipher. For each level it reports throughput and the
+ ** median and 99th percentile of the redirect setup time (first
+ ** connect until connected to the child's port) and of the whole
+ ** request, so port allocation costs show up as load grows.
+ ** Requests can also misbehave on purpose: -s min-max draws each
+ ** size at random, -p sends a share of requests in small pieces with
+ ** pauses between them, and -x drops a share of connections at a
+ ** random point (before the redirect, or partway through the
+ ** request, half of them with a reset). After each level one plain
+ ** request checks that the daemon still serves, so a crashed daemon
+ ** or children stuck on dropped clients show up as down or busy.
+ ** Requests the daemon cut off count as closed, ones that ran into
+ ** the timeout as hung; the exit status is 1 if any request failed,
+ ** closed or hung, 2 if the daemon stopped answering.
+ ** -B backendCounts measures how otp_proxy scales instead: for each
+ ** count N it starts N otp_enc_d -k on the ports after port and an
+ ** otp_proxy -k on port in front of them (programs from -D dir, by
+ ** default the directory of otp_stress), runs the levels against the
+ ** proxy and stops them again. Compare req/s across the tables.
+ ** -M count:size[@addr] adds mixed load: count more clients, from addr
+ ** if given, send requests of size symbols back to back for as long
+ ** as each level runs, and a line per -M reports what they got
+ ** through. Compare the level's total p99 with and without them to
+ ** see how much large requests delay small ones; several -M from
+ ** different addresses show how the daemon's -E -W weights share it
+ ** (the daemon needs -m at least size).
+ ** Usage: otp_stress [-c clientLevels] [-n requests] [-s size[-max]]
+ **        [-p piecesPercent] [-x abortPercent] [-w timeoutMs]
+ **        [-M count:size[@addr]]... [-B backendCounts [-D dir]] port
+ *********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <limits.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "otp_net.h"
+#include "otp_cipher.h"
+
+const char* DEFAULT_LEVELS = "1,4,16,64";
+const int DEFAULT_REQUESTS = 50;      // per client and level
+const int DEFAULT_SIZE = 1024;        // symbols of text per request
+const int DEFAULT_TIMEOUT_MS = 10000;
+const int MAX_LEVELS = 32;
+const int MAX_PIECE = 256;            // largest write with -p
+const int PROBE_SIZE = 64;            // liveness check after each level
+const int PROBE_WAIT_MS = 15000;      // past the daemons' CLIENT_TIMEOUT
+const int BUSY_ID = 3;
+const int MAX_BACKENDS = 64;          // with -B, as in otp_proxy
+const int READY_WAIT_MS = 5000;       // for the -B programs to come up
+#define MAX_BULK 4                    // -M groups
+
+// How a request is sent
+enum stressMode
+{
+  SEND_WHOLE,      // in one write
+  SEND_PIECES,     // in small writes with pauses (-p)
+  SEND_ABORT       // dropped partway (-x)
+};
+
+// Outcome of one request
+enum stressStatus
+{
+  STRESS_OK,
+  STRESS_BUSY,     // the daemon had no free slot
+  STRESS_ABORTED,  // dropped on purpose with -x
+  STRESS_FAILED,   // could not connect, or a wrong reply
+  STRESS_CLOSED,   // the daemon closed or reset the connection
+  STRESS_HUNG,     // no progress before the timeout
+  STRESS_STATUS_COUNT
+};
+
+// One request's timings, written by a client into shared memory
+struct stressSample
+{
+  double redirect,  // seconds from first connect to the child's port
+         total;     // seconds from first connect to the full reply
+  int status,       // enum stressStatus
+      size;         // symbols of text
+};
+
+// What each client process needs to know
+struct stressConfig
+{
+  struct sockaddr_in addr,
+                     source;  // address to connect from, if sin_family set
+  int requests,
+      minSize,
+      maxSize,
+      piecesPercent,
+      abortPercent,
+      timeoutMs;
+};
+
+// -M: clients sending large requests for as long as a level runs
+struct bulkLoad
+{
+  struct stressConfig config;  // minSize is the request size
+  int clients;
+  const char* from;            // the addr given, or NULL
+};
+
+// What one bulk client got through, written into shared memory
+struct bulkStats
+{
+  int requests,
+      problems;  // failed, closed or hung
+  double bytes;
+};
+
+// Function prototypes
+void error(const char *msg) __attribute__((noreturn));
+int runLevels(struct stressConfig* config, int* levels, int levelCount,
+              struct bulkLoad* bulk, struct stressSample* samples);
+int parseBulk(char* spec, struct stressConfig* config,
+              struct bulkLoad* bulk);
+void runBulk(struct stressConfig* config, struct bulkStats* stats);
+int reportBulk(struct bulkLoad* bulk, struct bulkStats* stats,
+               double elapsed);
+int startBackends(const char* dir, int port, int count, pid_t* pids);
+pid_t startProgram(char* args[]);
+int waitReady(struct stressConfig* config);
+void runClient(struct stressConfig* config, struct stressSample* samples);
+int runRequest(struct stressConfig* config, int size, int mode,
+               uint8_t* request, uint8_t* reply, uint64_t* state,
+               struct stressSample* sample);
+int sendRequest(int sockfd, uint8_t* request, int length, int mode,
+                uint64_t* state, long deadline);
+int failure(int sockfd);
+int probeDaemon(struct stressConfig* config);
+int report(int clients, struct stressSample* samples, int count,
+           double elapsed);
+uint64_t nextRandom(uint64_t* state);
+double percentile(double* values, int count, double fraction);
+int compareDoubles(const void* a, const void* b);
+double nowSeconds();
+
+int main(int argc, char *argv[])
+{
+  int option,
+      levels[MAX_LEVELS],
+      levelCount = 0,
+      counts[MAX_LEVELS],
+      countCount = 0,
+      count,
+      bulkCount = 0,
+      maxClients = 0,
+      status,
+      problems = 0;
+  const char* levelList = DEFAULT_LEVELS;
+  char* backendList = NULL;  // -B: backend counts behind otp_proxy
+  char* bulkSpecs[MAX_BULK];  // -M: count:size[@addr]
+  char* end;
+  char dir[PATH_MAX] = ".";
+  pid_t pids[MAX_BACKENDS + 1];
+  struct stressConfig config;
+  struct bulkLoad bulk[MAX_BULK + 1];  // ends with one of no clients
+  struct stressSample* samples;
+
+  // -B finds the daemon and the proxy next to otp_stress by default
+  end = strrchr(argv[0], '/');
+  if (end != NULL && end - argv[0] < PATH_MAX)
+  {
+    memcpy(dir, argv[0], end - argv[0]);
+    dir[end - argv[0]] = '\0';
+  }
+
+  memset(&config, 0, sizeof(config));
+  config.requests = DEFAULT_REQUESTS;
+  config.minSize = DEFAULT_SIZE;
+  config.maxSize = DEFAULT_SIZE;
+  config.timeoutMs = DEFAULT_TIMEOUT_MS;
+
+  while ((option = getopt(argc, argv, "c:n:s:p:x:w:M:B:D:")) != -1)
+  {
+    switch (option)
+    {
+      case 'c': levelList = optarg; break;
+      case 'n': config.requests = atoi(optarg); break;
+      case 's':
+        config.minSize = strtol(optarg, &end, 10);
+        config.maxSize = *end == '-' ? atoi(end + 1) : config.minSize;
+        break;
+      case 'p': config.piecesPercent = atoi(optarg); break;
+      case 'x': config.abortPercent = atoi(optarg); break;
+      case 'w': config.timeoutMs = atoi(optarg); break;
+      case 'M':
+        // Checked once the other options are known, after the loop
+        if (bulkCount >= MAX_BULK)
+          argc = 0;
+        else
+          bulkSpecs[bulkCount++] = optarg;
+        break;
+      case 'B': backendList = optarg; break;
+      case 'D': snprintf(dir, sizeof(dir), "%s", optarg); break;
+      default: argc = 0; break;  // force the usage message
+    }
+  }
+
+  // Parse the comma separated client counts
+  while (*levelList != '\0' && levelCount < MAX_LEVELS && argc > 0)
+  {
+    levels[levelCount] = strtol(levelList, &end, 10);
+    if (end == levelList || levels[levelCount] < 1)
+      break;
+    if (levels[levelCount] > maxClients)
+      maxClients = levels[levelCount];
+    levelCount++;
+    levelList = *end == ',' ? end + 1 : end;
+  }
+  while (backendList != NULL && *backendList != '\0' &&
+         countCount < MAX_LEVELS && argc > 0)
+  {
+    counts[countCount] = strtol(backendList, &end, 10);
+    if (end == backendList || counts[countCount] < 1 ||
+        counts[countCount] > MAX_BACKENDS)
+      break;
+    countCount++;
+    backendList = *end == ',' ? end + 1 : end;
+  }
+
+  if (optind >= argc || levelCount == 0 || *levelList != '\0' ||
+      (backendList != NULL && (countCount == 0 || *backendList != '\0')) ||
+      config.requests < 1 || config.minSize < 1 ||
+      config.maxSize < config.minSize || config.timeoutMs < 1 ||
+      config.piecesPercent < 0 || config.abortPercent < 0 ||
+      config.piecesPercent + config.abortPercent > 100)
+    bulkCount = -1;
+  else
+  {
+    config.addr.sin_family = AF_INET;
+    config.addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    config.addr.sin_port = htons(atoi(argv[optind]));
+  }
+  for (count = 0; count < bulkCount; count++)
+    if (parseBulk(bulkSpecs[count], &config, &bulk[count]) < 0)
+      bulkCount = -1;
+  if (bulkCount < 0)
+  {
+    fprintf(stderr, "usage: %s [-c clientLevels] [-n requests] "
+            "[-s size[-max]] [-p piecesPercent] [-x abortPercent] "
+            "[-w timeoutMs] [-M count:size[@addr]]... "
+            "[-B backendCounts [-D dir]] port\n", argv[0]);
+    exit(1);
+  }
+
+  // Clients are processes, so their samples live in shared memory
+  samples = mmap(NULL, sizeof(struct stressSample) * maxClients *
+                 config.requests, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (samples == MAP_FAILED)
+    error("ERROR allocating samples");
+  bulk[bulkCount].clients = 0;
+
+  if (backendList == NULL)
+    return runLevels(&config, levels, levelCount, bulk, samples);
+
+  // -B: the same levels against each number of proxied backends
+  for (count = 0; count < countCount; count++)
+  {
+    printf("# %d otp_enc_d behind otp_proxy\n", counts[count]);
+    fflush(stdout);
+    if (startBackends(dir, atoi(argv[optind]), counts[count], pids) < 0)
+      error("ERROR starting backends");
+    status = waitReady(&config) == STRESS_OK ?
+             runLevels(&config, levels, levelCount, bulk, samples) : 2;
+    if (status == 2)
+      printf("proxy not answering with %d backends\n", counts[count]);
+
+    // The proxy first, so the backends' kept-alive children see it go
+    for (option = counts[count]; option >= 0; option--)
+    {
+      kill(pids[option], SIGTERM);
+      waitpid(pids[option], NULL, 0);
+    }
+    if (status == 2)
+      return 2;
+    problems += status;
+  }
+
+  return problems > 0;
+}
+
+/*********************************************************************
+ ** runLevels
+ ** Description: Runs each load level in turn, with the bulk clients
+ ** of every bulk load running alongside until its clients are done,
+ ** printing a line for each level and bulk load, and probes the
+ ** daemon after each level. Returns 2 if the daemon stopped
+ ** answering, 1 if any request failed, closed or hung, else 0.
+ ** Parameters: struct stressConfig* config, int* levels,
+ ** int levelCount, struct bulkLoad* bulk, struct stressSample* samples
+ *********************************************************************/
+int runLevels(struct stressConfig* config, int* levels, int levelCount,
+              struct bulkLoad* bulk, struct stressSample* samples)
+{
+  int level,
+      client,
+      index,
+      group,
+      bulkClients = 0,
+      problems = 0;
+  pid_t *clients,
+        *bulkPids;
+  struct bulkStats* stats;
+  double start,
+         elapsed;
+
+  for (group = 0; bulk[group].clients > 0; group++)
+    bulkClients += bulk[group].clients;
+  stats = mmap(NULL, sizeof(struct bulkStats) * (bulkClients + 1),
+               PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  bulkPids = malloc(sizeof(pid_t) * (bulkClients + 1));
+  if (stats == MAP_FAILED || bulkPids == NULL)
+    error("ERROR allocating bulk clients");
+
+  printf("%7s %8s %6s %6s %6s %6s %6s %9s %8s %12s %12s %12s %12s\n",
+         "clients", "requests", "failed", "closed", "hung", "busy",
+         "abort", "req/s", "MB/s", "redirect p50", "redirect p99",
+         "total p50", "total p99");
+  fflush(stdout);  // or every client would print it again at exit
+
+  for (level = 0; level < levelCount; level++)
+  {
+    start = nowSeconds();
+    memset(stats, 0, sizeof(struct bulkStats) * bulkClients);
+    client = 0;
+    for (group = 0; bulk[group].clients > 0; group++)
+      for (index = 0; index < bulk[group].clients; index++, client++)
+        switch (bulkPids[client] = fork())
+        {
+          case -1:
+            error("fork failed");
+          case 0:
+            runBulk(&bulk[group].config, &stats[client]);
+            exit(0);
+        }
+
+    clients = malloc(sizeof(pid_t) * levels[level]);
+    if (clients == NULL)
+      error("ERROR allocating clients");
+    for (client = 0; client < levels[level]; client++)
+    {
+      switch (clients[client] = fork())
+      {
+        case -1:
+          error("fork failed");
+        case 0:
+          runClient(config, samples + (size_t) client * config->requests);
+          exit(0);
+      }
+    }
+    // Only the clients: the -B programs are children too
+    for (client = 0; client < levels[level]; client++)
+      waitpid(clients[client], NULL, 0);
+    free(clients);
+    elapsed = nowSeconds() - start;
+
+    // Bulk clients only run while there are others to get in the way of
+    for (client = 0; client < bulkClients; client++)
+      kill(bulkPids[client], SIGTERM);
+    for (client = 0; client < bulkClients; client++)
+      waitpid(bulkPids[client], NULL, 0);
+    problems += report(levels[level], samples,
+                       levels[level] * config->requests, elapsed);
+    client = 0;
+    for (group = 0; bulk[group].clients > 0; group++)
+    {
+      problems += reportBulk(&bulk[group], stats + client, elapsed);
+      client += bulk[group].clients;
+    }
+
+    // Still serving? Dropped clients must not have used up its slots
+    switch (probeDaemon(config))
+    {
+      case STRESS_OK:
+        break;
+      case STRESS_BUSY:
+        printf("daemon still busy %d s after %d clients: slots held\n",
+               PROBE_WAIT_MS / 1000, levels[level]);
+        problems++;
+        break;
+      default:
+        printf("daemon not answering after %d clients\n", levels[level]);
+        return 2;
+    }
+    fflush(stdout);
+  }
+
+  free(bulkPids);
+  munmap(stats, sizeof(struct bulkStats) * (bulkClients + 1));
+  return problems > 0;
+}
+
+/*********************************************************************
+ ** parseBulk
+ ** Description: Sets up bulk from spec, count:size[@addr], with the
+ ** rest of its client settings taken from config. Returns 0, or -1
+ ** if spec is malformed.
+ ** Parameters: char* spec, struct stressConfig* config,
+ ** struct bulkLoad* bulk
+ *********************************************************************/
+int parseBulk(char* spec, struct stressConfig* config,
+              struct bulkLoad* bulk)
+{
+  char* end;
+
+  bulk->config = *config;
+  bulk->clients = strtol(spec, &end, 10);
+  if (*end != ':' || bulk->clients < 1)
+    return -1;
+  bulk->config.minSize = bulk->config.maxSize = strtol(end + 1, &end, 10);
+  if (bulk->config.minSize < 1 || (*end != '\0' && *end != '@'))
+    return -1;
+  bulk->from = NULL;
+  if (*end == '@')
+  {
+    bulk->from = end + 1;
+    bulk->config.source.sin_family = AF_INET;
+    if (inet_pton(AF_INET, bulk->from,
+                  &bulk->config.source.sin_addr) != 1)
+      return -1;
+  }
+  return 0;
+}
+
+/*********************************************************************
+ ** runBulk
+ ** Description: Body of one bulk client process: sends whole requests
+ ** of config's minSize, checked like any other, back to back until
+ ** it is killed, and counts them in stats
+ ** Parameters: struct stressConfig* config, struct bulkStats* stats
+ *********************************************************************/
+void runBulk(struct stressConfig* config, struct bulkStats* stats)
+{
+  uint8_t *request = malloc(2 * config->minSize + 9),
+          *reply = malloc(config->minSize + 1);
+  uint64_t state = nowSeconds() * 1e9 + getpid();
+  struct stressSample sample;
+
+  if (request == NULL || reply == NULL)
+    error("ERROR allocating request buffers");
+
+  while (1)
+  {
+    switch (runRequest(config, config->minSize, SEND_WHOLE, request, reply,
+                       &state, &sample))
+    {
+      case STRESS_OK:
+        stats->requests++;
+        stats->bytes += config->minSize;
+        break;
+      case STRESS_BUSY:
+        usleep(10000);
+        break;
+      default:
+        stats->problems++;
+        usleep(10000);
+    }
+  }
+}
+
+/*********************************************************************
+ ** reportBulk
+ ** Description: Prints one line for a bulk load over a level: its
+ ** requests, payload megabytes per second and problems. Returns the
+ ** number of problems.
+ ** Parameters: struct bulkLoad* bulk, struct bulkStats* stats,
+ ** double elapsed
+ *********************************************************************/
+int reportBulk(struct bulkLoad* bulk, struct bulkStats* stats,
+               double elapsed)
+{
+  double bytes = 0;
+  int client,
+      requests = 0,
+      problems = 0;
+
+  for (client = 0; client < bulk->clients; client++)
+  {
+    requests += stats[client].requests;
+    problems += stats[client].problems;
+    bytes += stats[client].bytes;
+  }
+  printf("%7s %d clients of %d symbols%s%s: %d requests, %d failed, "
+         "%.2f MB/s\n", "bulk", bulk->clients, bulk->config.minSize,
+         bulk->from != NULL ? " from " : "",
+         bulk->from != NULL ? bulk->from : "", requests, problems,
+         bytes / elapsed / 1e6);
+  fflush(stdout);
+  return problems;
+}
+
+/*********************************************************************
+ ** startBackends
+ ** Description: Starts count otp_enc_d -k from dir on the ports
+ ** after port, then otp_proxy -k on port in front of them, and stores
+ ** their pids in pids, the proxy's last. Returns 0, or -1 if a fork
+ ** failed.
+ ** Parameters: const char* dir, int port, int count, pid_t* pids
+ *********************************************************************/
+int startBackends(const char* dir, int port, int count, pid_t* pids)
+{
+  char daemonPath[PATH_MAX],
+       proxyPath[PATH_MAX],
+       ports[MAX_BACKENDS + 1][8];
+  char* args[MAX_BACKENDS + 4];
+  int index;
+
+  snprintf(daemonPath, sizeof(daemonPath), "%s/otp_enc_d", dir);
+  snprintf(proxyPath, sizeof(proxyPath), "%s/otp_proxy", dir);
+  for (index = 0; index <= count; index++)
+    snprintf(ports[index], sizeof(ports[index]), "%d", port + index);
+
+  for (index = 0; index < count; index++)
+  {
+    args[0] = daemonPath;
+    args[1] = "-k";
+    args[2] = ports[index + 1];
+    args[3] = NULL;
+    pids[index] = startProgram(args);
+    if (pids[index] < 0)
+      return -1;
+  }
+
+  args[0] = proxyPath;
+  args[1] = "-k";
+  for (index = 0; index <= count; index++)
+    args[2 + index] = ports[index];
+  args[3 + count] = NULL;
+  pids[count] = startProgram(args);
+  return pids[count] < 0 ? -1 : 0;
+}
+
+/*********************************************************************
+ ** startProgram
+ ** Description: Forks and runs the program args[0] with args.
+ ** Returns its pid, or -1 if the fork failed.
+ ** Parameters: char* args[]
+ *********************************************************************/
+pid_t startProgram(char* args[])
+{
+  pid_t childPID = fork();
+
+  if (childPID == 0)
+  {
+    execv(args[0], args);
+    perror(args[0]);
+    _exit(127);
+  }
+  return childPID;
+}
+
+/*********************************************************************
+ ** waitReady
+ ** Description: Probes until a request goes through or READY_WAIT_MS
+ ** has passed, for programs that were just started. Returns the
+ ** status of the last probe.
+ ** Parameters: struct stressConfig* config
+ *********************************************************************/
+int waitReady(struct stressConfig* config)
+{
+  double giveUp = nowSeconds() + READY_WAIT_MS / 1000.0;
+  int status;
+
+  while ((status = probeDaemon(config)) != STRESS_OK &&
+         nowSeconds() < giveUp)
+    usleep(50000);
+  return status;
+}
+
+/*********************************************************************
+ ** runClient
+ ** Description: Body of one client process: sends requests of random
+ ** symbols, with sizes and send modes drawn from config, one after
+ ** another and records each in samples
+ ** Parameters: struct stressConfig* config, struct stressSample* samples
+ *********************************************************************/
+void runClient(struct stressConfig* config, struct stressSample* samples)
+{
+  uint8_t *request = malloc(2 * config->maxSize + 9),
+          *reply = malloc(config->maxSize + 1);
+  uint64_t state = nowSeconds() * 1e9 + getpid();
+  int index,
+      size,
+      mode,
+      draw;
+
+  if (request == NULL || reply == NULL)
+    error("ERROR allocating request buffers");
+
+  for (index = 0; index < config->requests; index++)
+  {
+    size = config->minSize +
+           nextRandom(&state) % (config->maxSize - config->minSize + 1);
+    draw = nextRandom(&state) % 100;
+    if (draw < config->abortPercent)
+      mode = SEND_ABORT;
+    else if (draw < config->abortPercent + config->piecesPercent)
+      mode = SEND_PIECES;
+    else
+      mode = SEND_WHOLE;
+    samples[index].size = size;
+    samples[index].status = runRequest(config, size, mode, request, reply,
+                                       &state, &samples[index]);
+  }
+}
+
+/*********************************************************************
+ ** runRequest
+ ** Description: Performs one request of size random symbols in the
+ ** plain protocol, sent as mode says, and checks the reply with the
+ ** scalar cipher (encryption for otp_enc_d, decryption for
+ ** otp_dec_d). request must hold 2 * size + 9 bytes and reply
+ ** size + 1. Fills in the timings of sample and returns its status.
+ ** Parameters: struct stressConfig* config, int size, int mode,
+ ** uint8_t* request, uint8_t* reply, uint64_t* state,
+ ** struct stressSample* sample
+ *********************************************************************/
+int runRequest(struct stressConfig* config, int size, int mode,
+               uint8_t* request, uint8_t* reply, uint64_t* state,
+               struct stressSample* sample)
+{
+  struct sockaddr_in redirect = config->addr;
+  struct linger reset = { 1, 0 };
+  uint32_t word,
+           identifier;
+  uint8_t *text = request + 4,
+          *key = request + size + 9;
+  const struct sockaddr_in* source =
+    config->source.sin_family == AF_INET ? &config->source : NULL;
+  double start = nowSeconds();
+  long deadline = netDeadline(config->timeoutMs);
+  int sockfd,
+      index,
+      length = 2 * size + 9,
+      cut = -1;
+
+  sample->redirect = 0;
+  sample->total = 0;
+
+  // Size, text and newline, size, key: built whole, sent as mode says
+  word = htonl(size + 1);
+  memcpy(request, &word, sizeof(word));
+  cipherRandomSymbols(text, size, state);
+  text[size] = '\n';
+  word = htonl(size);
+  memcpy(request + size + 5, &word, sizeof(word));
+  cipherRandomSymbols(key, size, state);
+  if (mode == SEND_ABORT && nextRandom(state) % 4 != 0)
+    cut = nextRandom(state) % (length + 1);  // else drop before redirect
+
+  // Identifier, then the port of the child that will serve us
+  sockfd = connectFrom(&config->addr, source, config->timeoutMs);
+  if (sockfd < 0)
+    return errno == ETIMEDOUT ? STRESS_HUNG : STRESS_FAILED;
+  if (readFull(sockfd, &identifier, sizeof(identifier), deadline) < 0)
+    return failure(sockfd);
+  identifier = ntohl(identifier);
+  if (identifier == (uint32_t) BUSY_ID)
+  {
+    close(sockfd);
+    return STRESS_BUSY;
+  }
+  if (identifier != 1 && identifier != 2)
+  {
+    close(sockfd);
+    return STRESS_FAILED;
+  }
+  if (mode == SEND_ABORT && cut < 0)  // walk away before the redirect
+  {
+    close(sockfd);
+    return STRESS_ABORTED;
+  }
+  if (readFull(sockfd, &word, sizeof(word), deadline) < 0)
+    return failure(sockfd);
+  close(sockfd);
+  redirect.sin_port = htons(ntohl(word));
+  sockfd = connectFrom(&redirect, source, config->timeoutMs);
+  if (sockfd < 0)
+    return errno == ETIMEDOUT ? STRESS_HUNG : STRESS_FAILED;
+  sample->redirect = nowSeconds() - start;
+
+  if (mode == SEND_ABORT)
+  {
+    sendRequest(sockfd, request, cut, SEND_PIECES, state, deadline);
+    if (nextRandom(state) % 2 == 0)  // reset instead of a clean close
+      setsockopt(sockfd, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+    close(sockfd);
+    return STRESS_ABORTED;
+  }
+  if (sendRequest(sockfd, request, length, mode, state, deadline) < 0 ||
+      readFull(sockfd, &word, sizeof(word), deadline) < 0)
+    return failure(sockfd);
+  if (ntohl(word) != (uint32_t) size + 1)
+  {
+    close(sockfd);
+    return STRESS_FAILED;
+  }
+  if (readFull(sockfd, reply, size + 1, deadline) < 0)
+    return failure(sockfd);
+  close(sockfd);
+  sample->total = nowSeconds() - start;
+
+  // Reuse text as the expected reply
+  if (identifier == 1)
+    scalarEncrypt(text, key, text, size);
+  else
+    scalarDecrypt(text, key, text, size);
+  for (index = 0; index < size; index++)
+    if (reply[index] != text[index])
+      return STRESS_FAILED;
+  return STRESS_OK;
+}
+
+/*********************************************************************
+ ** sendRequest
+ ** Description: Writes length bytes of request in one write, or for
+ ** SEND_PIECES in pieces of 1 to MAX_PIECE bytes with Nagle off and
+ ** an occasional pause of up to a millisecond, so the daemon sees
+ ** its reads come back short. Returns 0, or -1 with errno set.
+ ** Parameters: int sockfd, uint8_t* request, int length, int mode,
+ ** uint64_t* state, long deadline
+ *********************************************************************/
+int sendRequest(int sockfd, uint8_t* request, int length, int mode,
+                uint64_t* state, long deadline)
+{
+  struct timespec pause;
+  int piece,
+      noDelay = 1;
+
+  if (mode == SEND_WHOLE)
+    return writeFull(sockfd, request, length, deadline);
+
+  setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+  while (length > 0)
+  {
+    piece = 1 + nextRandom(state) % MAX_PIECE;
+    if (piece > length)
+      piece = length;
+    if (writeFull(sockfd, request, piece, deadline) < 0)
+      return -1;
+    request += piece;
+    length -= piece;
+    if (nextRandom(state) % 4 == 0)
+    {
+      pause.tv_sec = 0;
+      pause.tv_nsec = nextRandom(state) % 1000000;
+      nanosleep(&pause, NULL);
+    }
+  }
+  return 0;
+}
+
+/*********************************************************************
+ ** failure
+ ** Description: Closes sockfd after a failed read or write and maps
+ ** errno to a status: hung on a timeout, closed if the daemon ended
+ ** the connection
+ ** Parameters: int sockfd
+ *********************************************************************/
+int failure(int sockfd)
+{
+  int status = errno == ETIMEDOUT ? STRESS_HUNG : STRESS_CLOSED;
+
+  close(sockfd);
+  return status;
+}
+
+/*********************************************************************
+ ** probeDaemon
+ ** Description: Sends one small, well-formed request and returns its
+ ** status. A busy daemon is retried for PROBE_WAIT_MS, long enough
+ ** for children waiting on dropped clients to give up.
+ ** Parameters: struct stressConfig* config
+ *********************************************************************/
+int probeDaemon(struct stressConfig* config)
+{
+  uint8_t request[2 * PROBE_SIZE + 9],
+          reply[PROBE_SIZE + 1];
+  uint64_t state = getpid();
+  double giveUp = nowSeconds() + PROBE_WAIT_MS / 1000.0;
+  struct stressSample sample;
+  int status;
+
+  while ((status = runRequest(config, PROBE_SIZE, SEND_WHOLE, request,
+                              reply, &state, &sample)) == STRESS_BUSY &&
+         nowSeconds() < giveUp)
+    usleep(100000);
+  return status;
+}
+
+/*********************************************************************
+ ** report
+ ** Description: Prints one line for a load level: counts by status,
+ ** throughput in requests and payload megabytes, and percentiles (in
+ ** milliseconds) over the successful requests. Returns the number of
+ ** requests that failed, were closed or hung.
+ ** Parameters: int clients, struct stressSample* samples, int count,
+ ** double elapsed
+ *********************************************************************/
+int report(int clients, struct stressSample* samples, int count,
+           double elapsed)
+{
+  double *redirect = malloc(sizeof(double) * count),
+         *total = malloc(sizeof(double) * count),
+         bytes = 0;
+  int index,
+      ok = 0,
+      statuses[STRESS_STATUS_COUNT];
+
+  if (redirect == NULL || total == NULL)
+    error("ERROR allocating report");
+
+  memset(statuses, 0, sizeof(statuses));
+  for (index = 0; index < count; index++)
+  {
+    statuses[samples[index].status]++;
+    if (samples[index].status == STRESS_OK)
+    {
+      redirect[ok] = samples[index].redirect * 1000;
+      total[ok++] = samples[index].total * 1000;
+      bytes += samples[index].size;
+    }
+  }
+
+  printf("%7d %8d %6d %6d %6d %6d %6d %9.1f %8.2f %12.3f %12.3f %12.3f "
+         "%12.3f\n", clients, count, statuses[STRESS_FAILED],
+         statuses[STRESS_CLOSED], statuses[STRESS_HUNG],
+         statuses[STRESS_BUSY], statuses[STRESS_ABORTED], ok / elapsed,
+         bytes / elapsed / 1e6, percentile(redirect, ok, 0.5),
+         percentile(redirect, ok, 0.99), percentile(total, ok, 0.5),
+         percentile(total, ok, 0.99));
+  fflush(stdout);
+  free(redirect);
+  free(total);
+  return statuses[STRESS_FAILED] + statuses[STRESS_CLOSED] +
+         statuses[STRESS_HUNG];
+}
+
+/*********************************************************************
+ ** percentile
+ ** Description: Sorts values and returns the one at fraction of the
+ ** way through them, or 0 if there are none
+ ** Parameters: double* values, int count, double fraction
+ *********************************************************************/
+double percentile(double* values, int count, double fraction)
+{
+  if (count == 0)
+    return 0;
+  qsort(values, count, sizeof(double), compareDoubles);
+  return values[(int) (fraction * (count - 1) + 0.5)];
+}
+
+/*********************************************************************
+ ** compareDoubles
+ ** Description: qsort comparator for ascending doubles
+ ** Parameters: const void* a, const void* b
+ *********************************************************************/
+int compareDoubles(const void* a, const void* b)
+{
+  double left = *(const double*) a,
+         right = *(const double*) b;
+
+  return (left > right) - (left < right);
+}
+
+/*********************************************************************
+ ** nowSeconds
+ ** Description: Returns the monotonic clock in seconds
+ ** Parameters: none
+ *********************************************************************/
+double nowSeconds()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*********************************************************************
+ ** nextRandom
+ ** Description: Steps a xorshift generator and returns its state
+ ** Parameters: uint64_t* state
+ *********************************************************************/
+uint64_t nextRandom(uint64_t* state)
+{
+  *state ^= *state << 13;
+  *state ^= *state >> 7;
+  *state ^= *state << 17;
+  return *state;
+}
+
+/*********************************************************************
+ ** error
+ ** Description: Displays an error message
+ ** Parameters: const char *msg
+ *********************************************************************/
+void error(const char *msg)
+{
+  perror(msg);
+  exit(1);
+}
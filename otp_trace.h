@@ -0,0 +1,235 @@
+/*********************************************************************
+ ** Program Filename: otp_trace.h
+ ** Author: Peter Nguyen
+ ** Date: 10/19/26
+ ** CS 344-400, Program 4
+ ** Description: Optional request tracing (-T traceFile). Each process
+ ** records timestamped spans into its own ring buffer: a span costs
+ ** one atomic increment and a store, with no lock and no system call.
+ ** The ring is appended to the trace file at request boundaries and
+ ** at exit, one write per flush, so clients and daemons can share a
+ ** file. Every span carries the 64-bit request ID the client picked
+ ** and sent in the extended header (FRAME_FLAG_TRACE in otp_frame.h).
+ ** Times come from CLOCK_MONOTONIC, which all processes share, so
+ ** otp_trace2json can put them on one timeline.
+ ** File format, in host byte order: any number of chunks, each a
+ ** struct traceChunk followed by count struct traceRecord.
+ *********************************************************************/
+
+#ifndef OTP_TRACE_H
+#define OTP_TRACE_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/random.h>
+#include <sys/uio.h>
+
+#define TRACE_MAGIC 0x5450544fu  // "OTPT"
+#define TRACE_RING_SIZE 4096     // spans kept between flushes
+
+// Span kinds; traceSpanNames must follow the same order
+enum traceSpan
+{
+  TRACE_REQUEST,   // client: whole exchange with the daemon
+  TRACE_CONNECT,   // client: connect and identifier, detail = attempts
+  TRACE_REDIRECT,  // client: read the port and connect to it
+  TRACE_SEND,      // client: send the request (detail = frame)
+  TRACE_RECEIVE,   // client: wait for and read the reply (detail = frame)
+  TRACE_FORK,      // daemon: from fork until the child runs
+  TRACE_BIND,      // daemon: open a redirect listener, detail = port
+  TRACE_ACCEPT,    // daemon: send the port and accept, detail = port
+  TRACE_READ,      // daemon: read the request (detail = frame)
+  TRACE_CIPHER,    // daemon: run the cipher (detail = frame)
+  TRACE_WRITE,     // daemon: write the reply (detail = frame)
+  TRACE_SERVE,     // daemon: whole request in the child
+  TRACE_SPAN_COUNT
+};
+
+static const char* const traceSpanNames[TRACE_SPAN_COUNT] =
+{
+  "request", "connect", "redirect", "send", "receive",
+  "fork", "bind", "accept", "read", "cipher", "write", "serve"
+};
+
+struct traceChunk
+{
+  uint32_t magic,
+           count;
+};
+
+struct traceRecord
+{
+  uint64_t request,  // request ID, 0 until the daemon has read it
+           start,    // CLOCK_MONOTONIC nanoseconds
+           end;
+  uint32_t pid;
+  uint16_t span,     // enum traceSpan
+           detail;
+};
+
+struct traceRing
+{
+  int fd;                  // trace file, or -1 when tracing is off
+  uint64_t request;        // ID stamped on new spans
+  unsigned long head,      // spans ever recorded
+                flushed,   // spans already written out
+                dropped;   // spans overwritten before a flush
+  struct traceRecord records[TRACE_RING_SIZE];
+};
+
+// One ring per process; a forked child starts from its parent's ring
+static struct traceRing traceRing = { .fd = -1 };
+
+/*********************************************************************
+ ** traceEnabled
+ ** Description: Returns 1 if this process is recording spans
+ ** Parameters: none
+ *********************************************************************/
+static inline int traceEnabled()
+{
+  return traceRing.fd >= 0;
+}
+
+/*********************************************************************
+ ** traceNow
+ ** Description: Returns the monotonic clock in nanoseconds, or 0 when
+ ** tracing is off so untraced runs skip the clock read
+ ** Parameters: none
+ *********************************************************************/
+static inline uint64_t traceNow()
+{
+  struct timespec ts;
+
+  if (traceRing.fd < 0)
+    return 0;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*********************************************************************
+ ** traceSpan
+ ** Description: Records a span of kind span from start (a traceNow
+ ** value) until now. If the ring is full the oldest unflushed span
+ ** is overwritten and counted as dropped at the next flush.
+ ** Parameters: int span, uint64_t start, unsigned detail
+ *********************************************************************/
+static inline void traceSpan(int span, uint64_t start, unsigned detail)
+{
+  struct traceRecord* record;
+  unsigned long slot;
+
+  if (traceRing.fd < 0)
+    return;
+  slot = __atomic_fetch_add(&traceRing.head, 1, __ATOMIC_RELAXED);
+  record = &traceRing.records[slot % TRACE_RING_SIZE];
+  record->request = traceRing.request;
+  record->start = start;
+  record->end = traceNow();
+  record->pid = getpid();
+  record->span = span;
+  record->detail = detail;
+}
+
+/*********************************************************************
+ ** traceRequest
+ ** Description: Sets the request ID for new spans and stamps it on
+ ** the unflushed spans recorded before it was known
+ ** Parameters: uint64_t request
+ *********************************************************************/
+static inline void traceRequest(uint64_t request)
+{
+  unsigned long slot;
+
+  traceRing.request = request;
+  for (slot = traceRing.flushed; slot != traceRing.head; slot++)
+    if (traceRing.records[slot % TRACE_RING_SIZE].request == 0)
+      traceRing.records[slot % TRACE_RING_SIZE].request = request;
+}
+
+/*********************************************************************
+ ** traceNewRequest
+ ** Description: Picks a random, nonzero request ID, makes it current
+ ** and returns it
+ ** Parameters: none
+ *********************************************************************/
+static inline uint64_t traceNewRequest()
+{
+  uint64_t request = 0;
+
+  if (getrandom(&request, sizeof(request), 0) != sizeof(request))
+    request = (traceNow() << 20) ^ getpid();
+  if (request == 0)
+    request = 1;
+  traceRequest(request);
+  return request;
+}
+
+/*********************************************************************
+ ** traceFlush
+ ** Description: Appends the spans recorded since the last flush to
+ ** the trace file in one write. Call it between requests, from the
+ ** thread that records spans.
+ ** Parameters: none
+ *********************************************************************/
+static inline void traceFlush()
+{
+  struct traceChunk chunk;
+  struct iovec parts[3];
+  unsigned long first,
+                count;
+  int partCount = 1;
+
+  if (traceRing.fd < 0 || traceRing.head == traceRing.flushed)
+    return;
+  if (traceRing.head - traceRing.flushed > TRACE_RING_SIZE)
+  {
+    traceRing.dropped += traceRing.head - traceRing.flushed -
+                         TRACE_RING_SIZE;
+    traceRing.flushed = traceRing.head - TRACE_RING_SIZE;
+  }
+
+  // The unflushed spans may wrap around the end of the ring
+  chunk.magic = TRACE_MAGIC;
+  chunk.count = traceRing.head - traceRing.flushed;
+  parts[0].iov_base = &chunk;
+  parts[0].iov_len = sizeof(chunk);
+  first = traceRing.flushed % TRACE_RING_SIZE;
+  count = TRACE_RING_SIZE - first;
+  if (count > chunk.count)
+    count = chunk.count;
+  parts[partCount].iov_base = &traceRing.records[first];
+  parts[partCount++].iov_len = count * sizeof(struct traceRecord);
+  if (count < chunk.count)
+  {
+    parts[partCount].iov_base = &traceRing.records[0];
+    parts[partCount++].iov_len = (chunk.count - count) *
+                                 sizeof(struct traceRecord);
+  }
+
+  // O_APPEND places each flush whole, after everyone else's
+  if (writev(traceRing.fd, parts, partCount) < 0)
+    traceRing.dropped += chunk.count;
+  traceRing.flushed = traceRing.head;
+}
+
+/*********************************************************************
+ ** traceOpen
+ ** Description: Turns tracing on, appending to the file at path, and
+ ** flushes the ring again at exit. Returns 0, or -1 with errno set.
+ ** Parameters: const char* path
+ *********************************************************************/
+static inline int traceOpen(const char* path)
+{
+  traceRing.fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+                      0644);
+  if (traceRing.fd < 0)
+    return -1;
+  atexit(traceFlush);
+  return 0;
+}
+
+#endif
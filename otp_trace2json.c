@@ -0,0 +1,156 @@
+/*********************************************************************
+ ** Program Filename: otp_trace2json.c
+ ** Author: Peter Nguyen
+ ** Date: 10/19/26
+ ** CS 344-400, Program 4
+ ** Description: Converts a binary trace file written with -T (see
+ ** otp_trace.h) into Chrome trace JSON for chrome://tracing or
+ ** Perfetto. Each request becomes one process in the viewer, with
+ ** the client and daemon processes that worked on it as its threads,
+ ** so the fork, bind, redirect and transfer spans line up on one
+ ** timeline.
+ ** Usage: otp_trace2json traceFile > trace.json
+ *********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "otp_trace.h"
+
+// Function prototypes
+void error(const char *msg);
+struct traceRecord* loadTrace(const char* path, size_t* count);
+int compareRecords(const void* a, const void* b);
+
+int main(int argc, char *argv[])
+{
+  struct traceRecord* records;
+  size_t count,
+         index;
+  uint64_t origin;
+  int process = 0,
+      first = 1;
+
+  if (argc != 2)
+  {
+    fprintf(stderr, "usage: %s traceFile\n", argv[0]);
+    exit(1);
+  }
+  records = loadTrace(argv[1], &count);
+
+  // Group spans by request, in time order within each
+  qsort(records, count, sizeof(struct traceRecord), compareRecords);
+  origin = count > 0 ? records[0].start : 0;
+  for (index = 0; index < count; index++)
+    if (records[index].start < origin)
+      origin = records[index].start;
+
+  printf("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+  for (index = 0; index < count; index++)
+  {
+    // A new request starts a new process row, named by its ID
+    if (index == 0 || records[index].request != records[index - 1].request)
+    {
+      process++;
+      printf("%s\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+             "\"args\":{\"name\":\"request %016" PRIx64 "\"}}",
+             first ? "" : ",", process, records[index].request);
+      first = 0;
+    }
+    printf(",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\","
+           "\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%u,"
+           "\"args\":{\"request\":\"%016" PRIx64 "\",\"detail\":%u}}",
+           records[index].span < TRACE_SPAN_COUNT
+           ? traceSpanNames[records[index].span] : "unknown",
+           records[index].span < TRACE_FORK ? "client" : "daemon",
+           (records[index].start - origin) / 1000.0,
+           (records[index].end - records[index].start) / 1000.0,
+           process, records[index].pid, records[index].request,
+           records[index].detail);
+  }
+  printf("\n]}\n");
+
+  fprintf(stderr, "%zu spans in %d requests\n", count, process);
+  free(records);
+  return 0;
+}
+
+/*********************************************************************
+ ** loadTrace
+ ** Description: Reads every chunk of a trace file and returns its
+ ** records in one array, storing their number in count. Exits with
+ ** an error if a chunk is damaged; a chunk cut short at the end of
+ ** the file (a process killed mid-write) is dropped with a warning.
+ ** Parameters: const char* path, size_t* count
+ *********************************************************************/
+struct traceRecord* loadTrace(const char* path, size_t* count)
+{
+  struct traceRecord* records = NULL;
+  struct traceChunk chunk;
+  size_t capacity = 0,
+         got;
+  long offset = 0;
+  FILE* filePtr;
+
+  filePtr = fopen(path, "rb");
+  if (filePtr == NULL)
+    error("ERROR opening trace file");
+
+  *count = 0;
+  while (fread(&chunk, sizeof(chunk), 1, filePtr) == 1)
+  {
+    if (chunk.magic != TRACE_MAGIC)
+    {
+      fprintf(stderr, "ERROR: %s is damaged at offset %ld\n", path, offset);
+      exit(1);
+    }
+    while (*count + chunk.count > capacity)
+    {
+      capacity = capacity == 0 ? 4096 : capacity * 2;
+      records = realloc(records, capacity * sizeof(struct traceRecord));
+      if (records == NULL)
+        error("ERROR allocating trace records");
+    }
+
+    got = fread(records + *count, sizeof(struct traceRecord), chunk.count,
+                filePtr);
+    if (got < chunk.count)
+    {
+      fprintf(stderr, "warning: last chunk of %s is cut short\n", path);
+      break;
+    }
+    *count += got;
+    offset += sizeof(chunk) + got * sizeof(struct traceRecord);
+  }
+  fclose(filePtr);
+  return records;
+}
+
+/*********************************************************************
+ ** compareRecords
+ ** Description: qsort comparator: by request ID, then start time
+ ** Parameters: const void* a, const void* b
+ *********************************************************************/
+int compareRecords(const void* a, const void* b)
+{
+  const struct traceRecord* left = a;
+  const struct traceRecord* right = b;
+
+  if (left->request != right->request)
+    return left->request < right->request ? -1 : 1;
+  if (left->start != right->start)
+    return left->start < right->start ? -1 : 1;
+  return 0;
+}
+
+/*********************************************************************
+ ** error
+ ** Description: Displays an error message
+ ** Parameters: const char *msg
+ *********************************************************************/
+void error(const char *msg)
+{
+  perror(msg);
+  exit(1);
+}
@@ -0,0 +1,250 @@
+/*********************************************************************
+ ** Program Filename: otp_transport.h
+ ** Author: Peter Nguyen
+ ** Date: 10/19/26
+ ** CS 344-400, Program 4
+ ** Description: Transport profiles for the request and reply of the
+ ** plain protocol, chosen with -L on the clients and daemons:
+ **   plain    a write per size and per payload, as before. Nagle
+ **            holds back each payload behind its size until the
+ **            peer's delayed ACK, up to 40 ms per request once a
+ **            connection has left TCP quickack.
+ **   latency  TCP_NODELAY, and sizes and payloads go out together in
+ **            one writev, so a request is a single message.
+ **   bulk     TCP_CORK while the parts are queued, so only full
+ **            segments go out, and TCP_NODELAY, without which Nagle
+ **            would still hold the tail once the cork comes off,
+ **            SO_SNDBUF/SO_RCVBUF of TRANSPORT_BULK_BUFFER, and
+ **            MSG_ZEROCOPY for payloads of TRANSPORT_ZEROCOPY_MIN
+ **            or more. The kernel then pins
+ **            the pages instead of copying them, and a send is only
+ **            over once its completion is read from the socket's
+ **            error queue, as the caller may reuse the buffer.
+ **            Over loopback the kernel copies such sends anyway (and
+ **            completes them only once the reader has them), so bulk
+ **            is for real NICs; otp_kernel_bench's rtt kernels show
+ **            what each profile costs.
+ ** Frames (otp_frame.h) are always written whole with writev; the
+ ** profiles' socket options apply to them as well.
+ *********************************************************************/
+
+#ifndef OTP_TRANSPORT_H
+#define OTP_TRANSPORT_H
+
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/errqueue.h>
+#include "otp_net.h"
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+
+#define TRANSPORT_BULK_BUFFER (4 << 20)    // bytes of socket buffer, each way
+#define TRANSPORT_ZEROCOPY_MIN (16 << 10)  // smaller sends are cheaper copied
+
+enum transportProfile
+{
+  TRANSPORT_PLAIN,
+  TRANSPORT_LATENCY,
+  TRANSPORT_BULK,
+  TRANSPORT_PROFILE_COUNT
+};
+
+static const char* const transportNames[TRANSPORT_PROFILE_COUNT] =
+{
+  "plain", "latency", "bulk"
+};
+
+// A connected socket and what its profile has sent zero-copy
+struct transport
+{
+  int sockfd,
+      profile,
+      zerocopy;         // SO_ZEROCOPY was accepted (bulk only)
+  uint32_t zcSent,      // MSG_ZEROCOPY sends; the kernel numbers them too
+           zcDone;      // of those, completions read from the error queue
+  unsigned long zcCopied;  // completions where the kernel copied after all
+};
+
+/*********************************************************************
+ ** transportParse
+ ** Description: Returns the profile called name, or -1 if there is
+ ** none
+ ** Parameters: const char* name
+ *********************************************************************/
+static inline int transportParse(const char* name)
+{
+  int profile;
+
+  for (profile = 0; profile < TRANSPORT_PROFILE_COUNT; profile++)
+    if (strcmp(name, transportNames[profile]) == 0)
+      return profile;
+  return -1;
+}
+
+/*********************************************************************
+ ** transportSetup
+ ** Description: Binds link to sockfd and sets the socket options of
+ ** profile. Buffer sizes set after the connect still grow the
+ ** buffers but not the window scale agreed in the handshake, which
+ ** caps the window at the default scale's reach.
+ ** Parameters: struct transport* link, int sockfd, int profile
+ *********************************************************************/
+static inline void transportSetup(struct transport* link, int sockfd,
+                                  int profile)
+{
+  int on = 1,
+      size = TRANSPORT_BULK_BUFFER;
+
+  memset(link, 0, sizeof(*link));
+  link->sockfd = sockfd;
+  link->profile = profile;
+  if (profile != TRANSPORT_PLAIN)
+    setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+  if (profile == TRANSPORT_BULK)
+  {
+    setsockopt(sockfd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    link->zerocopy = setsockopt(sockfd, SOL_SOCKET, SO_ZEROCOPY, &on,
+                                sizeof(on)) == 0;
+  }
+}
+
+/*********************************************************************
+ ** transportReap
+ ** Description: Reads zero-copy completions from the error queue
+ ** until every MSG_ZEROCOPY send of link has completed, so its
+ ** buffers may be reused. Returns 0, or -1 with errno set (ETIMEDOUT
+ ** if the deadline passes first).
+ ** Parameters: struct transport* link, long deadline
+ *********************************************************************/
+static inline int transportReap(struct transport* link, long deadline)
+{
+  char control[128];
+  struct msghdr message;
+  struct cmsghdr* header;
+  struct sock_extended_err* report;
+  uint32_t count;
+
+  while (link->zcDone != link->zcSent)
+  {
+    memset(&message, 0, sizeof(message));
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    if (recvmsg(link->sockfd, &message, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+        return -1;
+      // A queued completion raises POLLERR whatever events are asked for
+      if (netWait(link->sockfd, 0, deadline) < 0)
+        return -1;
+      continue;
+    }
+
+    for (header = CMSG_FIRSTHDR(&message); header != NULL;
+         header = CMSG_NXTHDR(&message, header))
+    {
+      if (!(header->cmsg_level == SOL_IP && header->cmsg_type == IP_RECVERR))
+        continue;
+      report = (struct sock_extended_err*) CMSG_DATA(header);
+      if (report->ee_origin != SO_EE_ORIGIN_ZEROCOPY || report->ee_errno)
+        continue;
+      // One report covers the sends numbered ee_info to ee_data
+      count = report->ee_data - report->ee_info + 1;
+      link->zcDone += count;
+      if (report->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+        link->zcCopied += count;
+    }
+  }
+  return 0;
+}
+
+/*********************************************************************
+ ** transportSendZerocopy
+ ** Description: Sends len bytes of data with MSG_ZEROCOPY. Falls back
+ ** to copying the rest if the kernel runs out of memory to track
+ ** pinned pages. Returns 0, or -1 with errno set.
+ ** Parameters: struct transport* link, const uint8_t* data,
+ ** size_t len, long deadline
+ *********************************************************************/
+static inline int transportSendZerocopy(struct transport* link,
+                                        const uint8_t* data, size_t len,
+                                        long deadline)
+{
+  ssize_t sent;
+
+  while (len > 0)
+  {
+    if (deadline != NO_DEADLINE && netWait(link->sockfd, POLLOUT,
+                                           deadline) < 0)
+      return -1;
+    sent = send(link->sockfd, data, len, MSG_ZEROCOPY | MSG_NOSIGNAL |
+                (deadline != NO_DEADLINE ? MSG_DONTWAIT : 0));
+    if (sent < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)
+        continue;
+      if (errno == ENOBUFS)
+        return writeFull(link->sockfd, data, len, deadline);
+      return -1;
+    }
+    link->zcSent++;  // numbered even when only part of data went
+    data += sent;
+    len -= sent;
+  }
+  return 0;
+}
+
+/*********************************************************************
+ ** transportSend
+ ** Description: Sends the count parts in order as link's profile
+ ** says. Under bulk the parts' buffers are free again once it
+ ** returns. Returns 0, or -1 with errno set.
+ ** Parameters: struct transport* link, struct iovec* parts, int count,
+ ** long deadline
+ *********************************************************************/
+static inline int transportSend(struct transport* link, struct iovec* parts,
+                                int count, long deadline)
+{
+  int index,
+      status = 0,
+      cork = 1;
+
+  if (link->profile == TRANSPORT_LATENCY)
+    return writevFull(link->sockfd, parts, count, deadline);
+
+  if (link->profile == TRANSPORT_BULK)
+    setsockopt(link->sockfd, IPPROTO_TCP, TCP_CORK, &cork, sizeof(cork));
+  for (index = 0; index < count && status == 0; index++)
+  {
+    if (link->zerocopy && parts[index].iov_len >= TRANSPORT_ZEROCOPY_MIN)
+      status = transportSendZerocopy(link, parts[index].iov_base,
+                                     parts[index].iov_len, deadline);
+    else
+      status = writeFull(link->sockfd, parts[index].iov_base,
+                         parts[index].iov_len, deadline);
+  }
+  if (link->profile != TRANSPORT_BULK)
+    return status;
+
+  // Uncorking sends the partial last segment now
+  cork = 0;
+  setsockopt(link->sockfd, IPPROTO_TCP, TCP_CORK, &cork, sizeof(cork));
+  if (status == 0)
+    status = transportReap(link, deadline);
+  return status;
+}
+
+#endif